@@ -70,6 +70,48 @@ constexpr UCHAR PAGE_PRODUCT_INFO = 0x51;
 // once every 1920 messages.
 constexpr UCHAR PAGE_BATTERY_STATUS = 0x52;
 
+// ------------------------------------
+// --- Selective Data Updates (SDU) ---
+// ------------------------------------
+
+// SDU masks are stored on the stick by number and selected per channel with
+// ConfigSelectiveDataUpdate, where 0xFF turns SDU off again. A set bit in a
+// mask byte means that bit of the payload is compared, and the stick only
+// forwards a page when a compared bit differs from the last copy of the same
+// page it forwarded.
+constexpr UCHAR SDU_CONFIG_DISABLED = 0xFF;
+constexpr UCHAR SDU_MASK_ASSET_TRACKER = 0;
+constexpr UCHAR SDU_MASK_HEART_RATE = 1;
+
+// Asset Tracker pages carry index, position, status and names in every byte.
+inline constexpr UCHAR SDU_MASK_ASSET_TRACKER_PRESET[8] = {
+    0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF
+};
+
+// HRM pages: the page number without the toggle bit, and the computed heart
+// rate. Beat event times and the beat count change with every beat.
+inline constexpr UCHAR SDU_MASK_HEART_RATE_PRESET[8] = {
+    0x7F, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xFF
+};
+
+// -----------------------
+// --- Event Buffering ---
+// -----------------------
+
+// ConfigEventBuffer lets the stick hold events and send them over USB in one
+// burst once the buffer holds a number of bytes or its oldest event reaches
+// an age, whichever comes first. A zero threshold is not used, and both zero
+// turns buffering off. Low priority events are the received data messages;
+// responses and channel events still go out at once and flush the buffer.
+constexpr UCHAR EVENT_BUFFER_LOW_PRIORITY = 0x00;
+constexpr UCHAR EVENT_BUFFER_TIME_UNIT_MS = 10;
+
+// Bytes one extended broadcast takes in the buffer: sync, length, id, channel,
+// payload, flag byte, device id, RSSI, Rx timestamp and checksum.
+constexpr USHORT EVENT_BUFFER_BYTES_PER_BROADCAST = 4 + 8 + 1 + 4 + 3 + 2 + 1;
+
 
 
 #endif //ANT_DEVICE_CONSTANTS_H
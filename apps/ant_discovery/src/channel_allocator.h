@@ -0,0 +1,179 @@
+#pragma once
+// Header-only allocator that packs paired devices onto the ANT channels left
+// over by the search channels.
+//
+// A slave channel with an inclusion list searches for any of the channel IDs
+// on the list and then tracks the first one it hears, so a shared channel
+// serves one device at a time. Devices in range are therefore given
+// dedicated channels first, and the ones out of range share lists, so they
+// are picked up again when they come back. Devices not heard lately whose
+// channel was busy with another device may still be in range; those are put
+// on lists with devices known to be out of range, so a searching channel
+// gets to look for them.
+//
+// Paired entries in ant::channels with the same channel number form one
+// shared channel. openChannels in discovery.cpp opens such a channel with a
+// wildcard device number and the members on its inclusion list.
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "channel_pool.h"
+#include "config.h"
+
+namespace ant {
+
+  // Channel IDs an inclusion list holds
+  inline constexpr uint8_t MAX_LIST_SIZE = 4;
+
+  // Devices can only share a channel if they agree on the channel config
+  // that is not part of the channel ID: profile, period and frequency.
+  inline std::tuple<uint8_t, unsigned short, uint8_t> channelGroup(const Channel& c) {
+    return {c.dType, c.period, c.rfFreq};
+  }
+
+  inline std::string channelDeviceKey(const Channel& c) {
+    return std::to_string(c.dNum) + ":" + std::to_string(c.dType) + ":" + std::to_string(c.tType);
+  }
+
+  inline bool isPairedChannel(const Channel& c) {
+    return c.dNum != 0;
+  }
+
+  // Paired device keys per channel number, for telling which channels a
+  // new packing changed
+  inline std::map<uint8_t, std::set<std::string>> pairedMembersByChannel() {
+    std::map<uint8_t, std::set<std::string>> members;
+    for (const auto& c : channels) {
+      if (isPairedChannel(c) && c.use) members[c.cNum].insert(channelDeviceKey(c));
+    }
+    return members;
+  }
+
+  // How far the current packing is from hearing every device that may be in
+  // range: devices in range that have no channel or share one with another
+  // device in range, then devices of unknown whereabouts that have no
+  // channel or share one with a device in range. Lower is better.
+  // With rotation slots the devices without a channel still get turns, so
+  // only the ones in range count, and last.
+  inline std::tuple<size_t, size_t, size_t> pairedPackingCost(const std::set<std::string>& present,
+                                                              const std::set<std::string>& absent,
+                                                              const bool rotation = false) {
+    std::map<uint8_t, size_t> inRange;
+    for (const auto& c : channels) {
+      if (isPairedChannel(c) && c.use && present.contains(channelDeviceKey(c))) inRange[c.cNum]++;
+    }
+    size_t blocked = 0, hidden = 0, rotating = 0;
+    for (const auto& c : channels) {
+      if (!isPairedChannel(c)) continue;
+      const std::string key = channelDeviceKey(c);
+      if (rotation && !c.use) {
+        if (present.contains(key)) rotating++;
+      } else if (present.contains(key)) {
+        if (!c.use || inRange[c.cNum] > 1) blocked++;
+      } else if (!absent.contains(key)) {
+        if (!c.use || inRange[c.cNum] > 0) hidden++;
+      }
+    }
+    return {blocked, hidden, rotating};
+  }
+
+  // Assigns the free and paired channel numbers in channelPool to the paired
+  // entries in ant::channels and reserves the ones it uses as paired. Every
+  // paired device gets a dedicated channel if there are enough. Otherwise the
+  // two compatible groups with the fewest devices in range, then the fewest
+  // of unknown whereabouts, then the fewest devices, are merged until the
+  // groups fit or none can be merged.
+  // Groups keep their channel number where they can, so fewer channels need
+  // reopening, and the rest are spread over the sticks. Returns the number of
+  // paired devices left without a channel, which are kept with use = false.
+  // Channel numbers in reserved are left to the rotation scheduler, which
+  // time-shares them between the devices left without a channel. Devices in
+  // range then never share a list, as a turn in a slot beats being blocked
+  // or hiding the rest of the list.
+  // Sticks without inclusion lists get a listSize of 1, so devices never share.
+  inline size_t packPairedChannels(const std::set<std::string>& present, const std::set<std::string>& absent,
+                                   const std::set<uint8_t>& reserved = {}, const uint8_t listSize = MAX_LIST_SIZE) {
+    std::set<uint8_t> numbers = channelPool.numbers(ChannelRole::Paired);
+    numbers.merge(channelPool.numbers(ChannelRole::Free));
+    for (const uint8_t n : reserved) numbers.erase(n);
+    for (const auto& c : channels) {
+      if (!isPairedChannel(c)) numbers.erase(c.cNum);
+    }
+    const size_t capacity = numbers.size();
+
+    std::vector<std::vector<size_t>> bins;
+    for (size_t i = 0; i < channels.size(); ++i) {
+      if (isPairedChannel(channels[i])) bins.push_back({i});
+    }
+
+    const auto inRange = [&](const std::vector<size_t>& bin) {
+      return static_cast<size_t>(std::count_if(bin.begin(), bin.end(), [&](const size_t i) {
+        return present.contains(channelDeviceKey(channels[i]));
+      }));
+    };
+    const auto unknown = [&](const std::vector<size_t>& bin) {
+      return static_cast<size_t>(std::count_if(bin.begin(), bin.end(), [&](const size_t i) {
+        const std::string key = channelDeviceKey(channels[i]);
+        return !present.contains(key) && !absent.contains(key);
+      }));
+    };
+
+    while (bins.size() > capacity) {
+      size_t bestA = 0, bestB = 0;
+      auto bestScore = std::make_tuple(SIZE_MAX, SIZE_MAX, SIZE_MAX);
+      for (size_t a = 0; a < bins.size(); ++a) {
+        for (size_t b = a + 1; b < bins.size(); ++b) {
+          const size_t size = bins[a].size() + bins[b].size();
+          if (size > listSize || channelGroup(channels[bins[a][0]]) != channelGroup(channels[bins[b][0]])) continue;
+          const auto score = std::make_tuple(inRange(bins[a]) + inRange(bins[b]), unknown(bins[a]) + unknown(bins[b]), size);
+          if (!reserved.empty() && std::get<0>(score) > 0) continue;
+          if (score < bestScore) {
+            bestScore = score;
+            bestA = a;
+            bestB = b;
+          }
+        }
+      }
+      if (std::get<0>(bestScore) == SIZE_MAX) break;
+      bins[bestA].insert(bins[bestA].end(), bins[bestB].begin(), bins[bestB].end());
+      bins.erase(bins.begin() + static_cast<std::ptrdiff_t>(bestB));
+    }
+
+    // Out of channels: groups with devices in range come first
+    std::stable_sort(bins.begin(), bins.end(), [&](const auto& a, const auto& b) {
+      return inRange(a) > inRange(b);
+    });
+
+    std::vector<uint8_t> assigned(bins.size(), NO_CHANNEL);
+    for (size_t k = 0; k < bins.size() && k < capacity; ++k) {
+      const uint8_t n = channels[bins[k][0]].cNum;
+      const bool same = std::all_of(bins[k].begin(), bins[k].end(), [&](const size_t i) {
+        return channels[i].cNum == n;
+      });
+      if (same && numbers.erase(n)) assigned[k] = n;
+    }
+    for (size_t k = 0; k < bins.size() && k < capacity; ++k) {
+      if (assigned[k] != NO_CHANNEL) continue;
+      assigned[k] = channelPool.pick(numbers);
+      numbers.erase(assigned[k]);
+    }
+
+    channelPool.releaseAll(ChannelRole::Paired);
+    size_t unassigned = 0;
+    for (size_t k = 0; k < bins.size(); ++k) {
+      for (const size_t i : bins[k]) {
+        channels[i].cNum = assigned[k];
+        channels[i].use = assigned[k] != NO_CHANNEL;
+        if (!channels[i].use) ++unassigned;
+        else channelPool.reserve(assigned[k], ChannelRole::Paired);
+      }
+    }
+    return unassigned;
+  }
+
+} // namespace ant
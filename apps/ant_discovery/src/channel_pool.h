@@ -0,0 +1,160 @@
+#pragma once
+// Header-only pool of the channel numbers on the stick and what each one is
+// reserved for.
+//
+// initialize in discovery.cpp sizes the pool from the channel count the
+// stick reports in its capabilities, so every channel a stick has gets used.
+// Search channels and rotation slots reserve their numbers once at startup,
+// the lowest and the highest respectively. Paired channels take the rest:
+// packPairedChannels in channel_allocator.h assigns them from the numbers
+// that are free or already paired, and a device paired later takes the
+// lowest free number. Numbers released, like that of a search channel that
+// closed after pairing its device, are handed out again.
+//
+// With several sticks the numbers are logical: each stick has a range of its
+// own, in the order the sticks were given. Numbers are taken from the stick
+// with the most free channels, so the load spreads evenly over the sticks.
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace ant {
+
+  // Channels assumed until the stick reported its capabilities
+  inline constexpr uint8_t DEFAULT_CHANNELS = 8;
+
+  inline constexpr uint8_t NO_CHANNEL = 0xFF;
+
+  inline constexpr size_t ANY_STICK = SIZE_MAX;
+
+  enum class ChannelRole : uint8_t {
+    Free,
+    Search,     // Wildcard search channel of a profile
+    Paired,     // Dedicated or shared channel of paired devices
+    Rotation,   // Time-shared by the rotation scheduler
+    Scan        // Channel 0 in continuous scan mode
+  };
+
+  inline std::string toChannelRoleString(const ChannelRole role) {
+    switch (role) {
+      case ChannelRole::Free:     return "free";
+      case ChannelRole::Search:   return "search";
+      case ChannelRole::Paired:   return "paired";
+      case ChannelRole::Rotation: return "rotation";
+      case ChannelRole::Scan:     return "scan";
+    }
+    return "unknown";
+  }
+
+  class ChannelPool {
+  public:
+    explicit ChannelPool(const uint8_t size = DEFAULT_CHANNELS) : roles(size, ChannelRole::Free), firsts{0} {}
+
+    // Frees every number and changes the channel count
+    void resize(const uint8_t size) {
+      resize(std::vector<uint8_t>{size});
+    }
+
+    // Frees every number and gives each stick its channel count, numbered
+    // from the end of the previous stick's range
+    void resize(const std::vector<uint8_t>& stickSizes) {
+      firsts.clear();
+      size_t total = 0;
+      for (const uint8_t n : stickSizes) {
+        firsts.push_back(static_cast<uint8_t>(total));
+        total += n;
+      }
+      if (firsts.empty()) firsts.push_back(0);
+      roles.assign(std::min<size_t>(total, NO_CHANNEL), ChannelRole::Free);
+    }
+
+    uint8_t size() const {
+      return static_cast<uint8_t>(roles.size());
+    }
+
+    size_t stickCount() const {
+      return firsts.size();
+    }
+
+    // First logical number of the stick
+    uint8_t firstOf(const size_t stick) const {
+      return firsts[stick];
+    }
+
+    size_t stickOf(const uint8_t number) const {
+      size_t stick = 0;
+      while (stick + 1 < firsts.size() && number >= firsts[stick + 1]) ++stick;
+      return stick;
+    }
+
+    ChannelRole role(const uint8_t number) const {
+      return number < roles.size() ? roles[number] : ChannelRole::Free;
+    }
+
+    // Takes the lowest free number, or the highest with fromTop, on the
+    // given stick or else on the stick with the most free.
+    // Returns NO_CHANNEL if none is left.
+    uint8_t acquire(const ChannelRole role, const bool fromTop = false, const size_t stick = ANY_STICK) {
+      const uint8_t number = pick(stick == ANY_STICK ? numbers(ChannelRole::Free) : numbersOn(stick, ChannelRole::Free), fromTop);
+      if (number != NO_CHANNEL) roles[number] = role;
+      return number;
+    }
+
+    // The number to take from the candidates: on the stick with the most of
+    // them, the lowest or with fromTop the highest there
+    uint8_t pick(const std::set<uint8_t>& candidates, const bool fromTop = false) const {
+      std::vector<size_t> perStick(firsts.size(), 0);
+      for (const uint8_t n : candidates) perStick[stickOf(n)]++;
+      const auto most = std::max_element(perStick.begin(), perStick.end());
+      if (*most == 0) return NO_CHANNEL;
+      const auto onStick = [&](const uint8_t n) { return stickOf(n) == static_cast<size_t>(most - perStick.begin()); };
+      if (fromTop) return *std::find_if(candidates.rbegin(), candidates.rend(), onStick);
+      return *std::find_if(candidates.begin(), candidates.end(), onStick);
+    }
+
+    // Takes the given number if it is free or already has the role
+    bool reserve(const uint8_t number, const ChannelRole role) {
+      if (number >= roles.size() || (roles[number] != ChannelRole::Free && roles[number] != role)) return false;
+      roles[number] = role;
+      return true;
+    }
+
+    void release(const uint8_t number) {
+      if (number < roles.size()) roles[number] = ChannelRole::Free;
+    }
+
+    void releaseAll(const ChannelRole role) {
+      for (auto& r : roles) {
+        if (r == role) r = ChannelRole::Free;
+      }
+    }
+
+    std::set<uint8_t> numbers(const ChannelRole role) const {
+      std::set<uint8_t> result;
+      for (size_t i = 0; i < roles.size(); ++i) {
+        if (roles[i] == role) result.insert(static_cast<uint8_t>(i));
+      }
+      return result;
+    }
+
+    std::set<uint8_t> numbersOn(const size_t stick, const ChannelRole role) const {
+      std::set<uint8_t> result = numbers(role);
+      std::erase_if(result, [&](const uint8_t n) { return stickOf(n) != stick; });
+      return result;
+    }
+
+    size_t count(const ChannelRole role) const {
+      return numbers(role).size();
+    }
+
+  private:
+    std::vector<ChannelRole> roles;
+    std::vector<uint8_t> firsts;
+  };
+
+  inline ChannelPool channelPool;
+
+} // namespace ant
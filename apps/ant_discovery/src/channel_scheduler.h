@@ -0,0 +1,50 @@
+#pragma once
+// Header-only priority rules for the rotation scheduler, which time-shares a
+// few reserved channels between the paired devices the allocator in
+// channel_allocator.h left without one.
+//
+// Every rotating device has a staleness budget: how long it may go unheard
+// before it is due a slot again. Devices that moved or raised an alert lately
+// only get a fraction of the budget, so they come round more often. Free
+// slots go to the devices furthest into their budget.
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace ant {
+
+  // Devices that changed or raised an alert this recently are urgent
+  inline constexpr int ROTATION_ACTIVITY_WINDOW_S = 60;
+
+  // Urgent devices get this fraction of the staleness budget
+  inline constexpr int ROTATION_URGENT_BUDGET_DIVISOR = 4;
+
+  struct RotationCandidate {
+    std::string key;
+    // Since the device was last heard, or a slot last searched for it in
+    // vain, whichever is later
+    std::chrono::steady_clock::duration stale{};
+    bool urgent = false;
+  };
+
+  inline std::chrono::steady_clock::duration rotationBudget(const RotationCandidate& c,
+                                                            const std::chrono::steady_clock::duration budget) {
+    return c.urgent ? budget / ROTATION_URGENT_BUDGET_DIVISOR : budget;
+  }
+
+  // How far into its budget a device is, 1.0 when it is due
+  inline double rotationPriority(const RotationCandidate& c, const std::chrono::steady_clock::duration budget) {
+    return std::chrono::duration<double>(c.stale) / std::chrono::duration<double>(rotationBudget(c, budget));
+  }
+
+  // Highest priority first; ties keep their order, which is the paired order
+  inline void sortRotationCandidates(std::vector<RotationCandidate>& candidates,
+                                     const std::chrono::steady_clock::duration budget) {
+    std::stable_sort(candidates.begin(), candidates.end(), [&](const auto& a, const auto& b) {
+      return rotationPriority(a, budget) > rotationPriority(b, budget);
+    });
+  }
+
+} // namespace ant
@@ -30,6 +30,7 @@
 #include <fstream>
 
 #include "discovery.hpp"
+#include "channel_pool.h"
 
 namespace ant {
 
@@ -77,6 +78,17 @@ namespace ant {
   // -----------------------------------------------------------------------------
   static constexpr Channel TRK_SEARCH_CH = {true, 0x01,  0x00, 0x00, 0x29, 0x00, 2048, 57, 0x03};
 
+  // -----------------------------------------------------------------------------
+  // Continuous scan mode
+  //
+  // Channel 0 with a fully wildcarded channel ID, opened with OpenRxScanMode
+  // instead of OpenChannel. The radio then listens all the time and hands us
+  // every ANT+ broadcast on 2457 MHz, each tagged with the sender's channel ID
+  // in the extended trailer. The period is not used while scanning, and the
+  // stick refuses to scan while any other channel is open.
+  // -----------------------------------------------------------------------------
+  static constexpr Channel SCAN_CH = {true, 0x00,  0x00, 0x00, 0x00, 0x00, 8192, 57, 0xFF};
+
   inline std::vector<Channel> channels = {
     /*
       HRM_SEARCH_CH,
@@ -87,8 +99,6 @@ namespace ant {
     */
   };
 
-  inline constexpr uint8_t MAX_SEARCH_CH = 2;
-
   void info(const std::string& message);
   void warn(const std::string& message);
   void fine(const std::string& message);
@@ -199,17 +209,11 @@ namespace ant {
     return field >= 9;
   }
 
-  inline uint8_t nextFreeChannelNumber() {
-    std::set<uint8_t> used;
-    for (const auto& c : ant::channels) used.insert(c.cNum);
-    for (uint8_t n = MAX_SEARCH_CH; n < 8; ++n) {
-      if (!used.contains(n)) {
-        return n;
-      }
-    }
-    return ant::channels.empty()
-      ? MAX_SEARCH_CH
-      : std::min(MAX_SEARCH_CH, static_cast<uint8_t>(ant::channels.back().cNum + 1));
+  // Reserves the lowest free channel number for a newly paired device, on
+  // the given stick if it has one; NO_CHANNEL if every channel is taken
+  inline uint8_t acquirePairedChannelNumber(const size_t stick = ANY_STICK) {
+    const uint8_t number = channelPool.acquire(ChannelRole::Paired, false, stick);
+    return number != NO_CHANNEL || stick == ANY_STICK ? number : channelPool.acquire(ChannelRole::Paired);
   }
 
   inline bool channelEqualsId(const ant::Channel& c, const uint16_t dNum, const uint8_t dType, const uint8_t tType) {
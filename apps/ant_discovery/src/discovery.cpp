@@ -8,19 +8,40 @@
 #include <set>
 #include <string>
 #include <map>
+#include <array>
+#include <unordered_map>
 #include <unordered_set>
 #include <sstream>
+#include <algorithm>
 #include <cmath>
+#include <deque>
+#include <optional>
+#include <utility>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 
 #include "ant.h"
 #include "types.h"
 #include "dsi_debug.hpp"
 #include "dsi_framer_ant.hpp"
+#include "dsi_capture_ant.hpp"
 #include "dsi_serial_generic.hpp"
+#include "dsi_serial_replay.hpp"
+#include "dsi_serial_emulator.hpp"
 
 #include "hrm_discovery.h"
 #include "asset_tracker_discovery.h"
 #include "config.h"
+#include "channel_allocator.h"
+#include "channel_pool.h"
+#include "channel_scheduler.h"
+#include "reacquire_policy.h"
 #include "mqtt.h"
 #include "logging.h"
 
@@ -43,18 +64,205 @@ namespace ant {
     static auto epsHeading = 0.1;
     static auto epsLatLng = metersToDegrees(1.0);
 
-    static DSIFramerANT *pclANT = nullptr;
-    static DSISerialGeneric *pclSerial = nullptr;
+    // One USB stick, or the emulator or replay standing in for one. Channel
+    // numbers everywhere else are logical, numbered on from one stick to the
+    // next as in channelPool, and are translated to the stick's own on the
+    // way out and back on the way in.
+    struct Stick {
+        UCHAR deviceNumber = 0;
+        DSISerial* serial = nullptr;
+        DSIFramerANT* framer = nullptr;
+        DSISerialEmulator* emulator = nullptr;
+        // The serial of a USB stick, for its receive pipeline counters
+        DSISerialGeneric* usb = nullptr;
+        // Capabilities message payload read at initialize, ucSize 0 if unknown
+        ANT_MESSAGE_ITEM capabilities{};
+        // Since the last reportSticks: messages received, copies dropped as
+        // heard stronger by another stick, and devices whose copies were kept
+        uint64_t messages = 0;
+        uint64_t duplicates = 0;
+        std::unordered_set<uint64_t> devices;
+        // Serial number read at open, so a stick plugged back in is known
+        // to be the same one
+        ULONG serialNumber = 0;
+        // Unplugged or its serial failed; its channels are restored by
+        // recoverStick once it is back. arrived is set by the hotplug
+        // notice that an ANT device was plugged in meanwhile.
+        bool lost = false;
+        bool arrived = false;
+        std::chrono::steady_clock::time_point lostAt;
+        std::chrono::steady_clock::time_point lastAttempt;
+        uint64_t recoveries = 0;
+    };
+    static std::vector<Stick> sticks;
+    static DSICaptureANT *pclCapture = nullptr;
+    static std::string capturePath;
+    static DSISerialReplay *pclReplay = nullptr;
+    static std::string replayPath;
+    static double replaySpeed = 1.0;
+    static std::chrono::steady_clock::time_point replayStarted;
+    static DSI_SERIAL_EMULATOR_FLEET emulatorFleet;
+    static bool emulate = false;
+    static bool scanMode = false;
+    static auto sduMode = SduMode::Auto;
+    static bool sduOnStick = false;
+    static bool sduOnHost = false;
+    // Last compared bytes per device, page and asset index for the host-side check
+    static std::unordered_map<uint64_t, std::array<uint8_t, 8>> lastPayloads;
+    static uint64_t dispatchedMessages = 0;
+    static uint16_t eventBufferMs = 0;
+    static uint16_t eventBufferMessages = 0;
+    static bool eventBufferOnStick = false;
+    static bool highDutyOnStick = false;
+    // Command responses get a lane of their own in the framers, ahead of
+    // channel data
+    static bool controlLane = false;
+    // Bulk IN transfers each USB stick keeps in flight, 0 for the SDK default
+    static uint8_t usbTransfers = 0;
     static std::vector<AntProfile> searchTypes;
-    static std::set<std::string> recentPageRequests;
+    static std::map<std::string, std::chrono::steady_clock::time_point> recentPageRequests;
     static std::map<std::string, std::set<uint8_t>> knownIndexes;
     static std::map<std::string, std::map<uint8_t, Device>> knownDevices;
     static std::map<std::string, std::map<uint8_t, uint16_t>> knownLatitudes;
     static std::map<std::string, std::map<uint8_t, std::chrono::steady_clock::time_point>> lastChangeTimes;
 
     static std::map<uint8_t, ChannelState> channelStates;
-    static constexpr int WATCHDOG_TIMEOUT_MS = 5000;
+
+    // Byte offsets of the option flags in the capabilities message payload
+    static constexpr size_t CAPS_STANDARD = 2;
+    static constexpr size_t CAPS_ADVANCED = 3;
+    static constexpr size_t CAPS_ADVANCED_2 = 4;
+    static constexpr size_t CAPS_ADVANCED_3 = 6;
+    // Paired devices per channel, 1 on sticks without inclusion lists
+    static uint8_t pairedListSize = MAX_LIST_SIZE;
     static constexpr int RSSI_DROP_THRESHOLD_DBM = -95;
+    static constexpr USHORT MESSAGE_BATCH_SIZE = 32;
+    static constexpr int EVENT_LOOP_TICK_MS = 250;
+    // How often a lost stick is tried again without a hotplug notice
+    static constexpr int STICK_RETRY_MS = 1000;
+    static constexpr int PAGE_REQUEST_EXPIRY_S = 600;
+    static auto lastMessageTime = std::chrono::steady_clock::now();
+
+    // Wake-ups and hold times since the last reportEventBuffer. Hold times
+    // are arrival minus Rx timestamp, in 1/32768 s relative to the first
+    // timestamped message of the period so the 2 s rollover cancels out.
+    struct EventBufferStats {
+        uint64_t wakeups = 0;
+        uint64_t messages = 0;
+        uint64_t timestamped = 0;
+        uint16_t reference = 0;
+        int64_t sum = 0;
+        int32_t min = 0;
+        int32_t max = 0;
+    };
+    static EventBufferStats bufferStats;
+
+    // Control messages drained since the last reportControlLatency, with the
+    // time each waited in the framer, in microseconds
+    struct ControlLatencyStats {
+        uint64_t events = 0;
+        uint64_t sumUs = 0;
+        uint64_t maxUs = 0;
+    };
+    static ControlLatencyStats controlStats;
+
+    // Messages from several sticks go through one queue in the order they
+    // arrived. A broadcast waits there for MERGE_WINDOW_MS, so a copy of it
+    // heard by another stick meanwhile is dropped, or takes its place if it
+    // was heard stronger. A copy has the same device and the same payload,
+    // since buffered or batched reads can bring several periods of a device
+    // within the window.
+    static constexpr int MERGE_WINDOW_MS = 20;
+    struct MergedMessage {
+        ANT_MESSAGE_ITEM item;
+        std::chrono::steady_clock::time_point due;
+        size_t stick = 0;
+        // Device the broadcast came from, if it is held for copies
+        std::optional<uint64_t> device;
+        // The 8 payload bytes of a held broadcast
+        uint64_t payload = 0;
+        int8_t rssi = INT8_MIN;
+    };
+    static std::deque<MergedMessage> mergeQueue;
+    // Sequence number of the message at the front of mergeQueue, and of the
+    // broadcast held per device and payload
+    static uint64_t mergeFront = 0;
+    static std::map<std::pair<uint64_t, uint64_t>, uint64_t> mergeHeld;
+    static uint64_t mergedMessages = 0;
+
+    // Paired devices are re-packed onto channels as they come and go, at most
+    // once per interval so a device hopping in and out of range does not keep
+    // the channels closing
+    static constexpr int REBALANCE_INTERVAL_S = 10;
+    static constexpr int PRESENCE_TIMEOUT_S = 30;
+    static bool rebalancePending = false;
+    static std::unordered_map<std::string, std::chrono::steady_clock::time_point> pairedLastSeen;
+    // When a channel searching for the device timed out without finding it
+    static std::unordered_map<std::string, std::chrono::steady_clock::time_point> pairedLastMissed;
+
+    // Broadcasts per paired device since the last reportPairedThroughput,
+    // split by whether the device was on a shared channel or a rotation slot
+    static std::map<std::string, uint64_t> dedicatedMessages;
+    static std::map<std::string, uint64_t> sharedMessages;
+    static std::map<std::string, uint64_t> rotatedMessages;
+
+    // Rotation scheduler: the top channel numbers are kept back from the
+    // allocator and time-shared between the paired devices it left without a
+    // channel, one device per slot for a time slice. Swaps are pipelined, so
+    // each costs a round trip for the close and one for the reconfiguration.
+    enum class SlotState {
+        Idle,       // Assigned and closed
+        Closing,    // Close sent, waiting for the channel closed event
+        Opening,    // Channel ID, period, frequency and open sent
+        Open
+    };
+    struct RotationSlot {
+        uint8_t cNum = 0;
+        SlotState state = SlotState::Idle;
+        Channel device{};   // Device in the slot, or about to be once it closed
+        std::chrono::steady_clock::time_point sliceStart;
+        std::chrono::steady_clock::time_point swapStart;
+        bool heard = false;
+        std::vector<ANT_COMMAND_HANDLE> pending;
+    };
+    static uint8_t rotationSlotCount = 0;
+    static auto rotationSlice = std::chrono::milliseconds(2000);
+    static auto rotationBudgetS = std::chrono::seconds(30);
+    static std::vector<RotationSlot> rotationSlots;
+    static std::chrono::steady_clock::time_point rotationStarted;
+
+    // Since the last reportRotation. Swap time runs from the close to the
+    // open response, acquisition from the open response to the first broadcast.
+    struct RotationStats {
+        uint64_t swaps = 0;
+        uint64_t acquired = 0;
+        uint64_t missed = 0;
+        uint64_t overBudget = 0;
+        double swapMs = 0;
+        double swapMsMax = 0;
+        double acquireMs = 0;
+    };
+    static RotationStats rotationStats;
+    // Worst staleness per device when it got a slot
+    static std::map<std::string, std::chrono::steady_clock::duration> rotationWorstStale;
+
+    // Reacquisition policy per device type of the paired channels. Search
+    // channels and device types without one keep the fixed behaviour.
+    static std::map<uint8_t, ReacquirePolicy> reacquirePolicies;
+    // Since start: how long dedicated paired channels searched before they
+    // heard their device again, and how many channel reopens that took,
+    // per device type
+    static std::map<uint8_t, ReacquireHistogram> reacquireHistograms;
+    static std::map<uint8_t, uint64_t> reacquireReopens;
+    // No suppression: high duty search runs the whole time a channel searches
+    static constexpr UCHAR HIGH_DUTY_SUPPRESSION_CYCLES = 0;
+
+#ifdef __linux__
+    // MQTT is serviced by the epoll event loop instead of a network thread
+    static constexpr bool MQTT_THREADED = false;
+#else
+    static constexpr bool MQTT_THREADED = true;
+#endif
 
     const std::unordered_set assetPages = {
         PAGE_NO_ASSETS,
@@ -68,6 +276,14 @@ namespace ant {
     {
         channelStates[channel].active = active;
         channelStates[channel].lastSeen = std::chrono::steady_clock::now();
+        if (!active) {
+            channelStates[channel].sdu = false;
+            channelStates[channel].lost = false;
+            channelStates[channel].dropped = false;
+            channelStates[channel].reacquiring = false;
+            channelStates[channel].listSize = 0;
+            channelStates[channel].searchSince = {};
+        }
 
         if (ext.hasRssiValue) {
             channelStates[channel].lastRssi = ext.rssi.value;
@@ -139,6 +355,122 @@ namespace ant {
         fine("Setting MQTT connection string to [" + cnn + "]");
     }
 
+    void setCapture(const std::string& path) {
+        capturePath = path;
+        fine("Setting capture file to [" + path + "]");
+    }
+
+    // Speed 0 replays as fast as the framer accepts messages
+    void setReplay(const std::string& path, const double speed) {
+        replayPath = path;
+        replaySpeed = speed;
+        fine("Setting replay file to [" + path + "]");
+    }
+
+    // Parses "trackers=N,assets=K,hrms=M,collisions=C,channels=X,seed=S,sdu=0|1,
+    // dropout=ms,dropout_every=ms,unplug=ms,replug=ms"; keys left out keep
+    // their defaults
+    bool setEmulation(const std::string& spec) {
+        DSISerialEmulator::InitFleet(&emulatorFleet);
+        std::stringstream values(spec);
+        std::string item;
+        while (std::getline(values, item, ',')) {
+            if (item.empty()) continue;
+            const auto eq = item.find('=');
+            const std::string key = item.substr(0, eq);
+            unsigned long value;
+            try {
+                value = std::stoul(eq == std::string::npos ? "" : item.substr(eq + 1));
+            } catch (const std::exception&) {
+                error("Invalid emulation setting [" + item + "]");
+                return false;
+            }
+            if (key == "trackers") emulatorFleet.usTrackers = static_cast<USHORT>(value);
+            else if (key == "assets") emulatorFleet.ucAssetsPerTracker = static_cast<UCHAR>(std::min<unsigned long>(value, DSI_SERIAL_EMULATOR_MAX_ASSETS));
+            else if (key == "hrms") emulatorFleet.usHeartRateMonitors = static_cast<USHORT>(value);
+            else if (key == "collisions") emulatorFleet.usCollisions = static_cast<USHORT>(value);
+            else if (key == "channels") emulatorFleet.ucMaxChannels = static_cast<UCHAR>(std::min<unsigned long>(value, DSI_SERIAL_EMULATOR_MAX_CHANNELS));
+            else if (key == "seed") emulatorFleet.ulSeed = static_cast<ULONG>(value);
+            else if (key == "sdu") emulatorFleet.bSelectiveDataUpdates = value ? TRUE : FALSE;
+            else if (key == "buffering") emulatorFleet.bEventBuffering = value ? TRUE : FALSE;
+            else if (key == "dropout") emulatorFleet.ulDropoutMs = static_cast<ULONG>(value);
+            else if (key == "dropout_every") emulatorFleet.ulDropoutIntervalMs = static_cast<ULONG>(value);
+            else if (key == "unplug") emulatorFleet.ulUnplugAfterMs = static_cast<ULONG>(value);
+            else if (key == "replug") emulatorFleet.ulReplugAfterMs = static_cast<ULONG>(value);
+            else {
+                error("Unknown emulation setting [" + key + "]");
+                return false;
+            }
+        }
+        emulate = true;
+        fine("Setting emulation to [" + spec + "]");
+        return true;
+    }
+
+    void setScanMode(const bool enabled) {
+        scanMode = enabled;
+        fine(std::string("Setting continuous scan mode ") + (enabled ? "on" : "off"));
+    }
+
+    void setSduMode(const SduMode mode) {
+        sduMode = mode;
+    }
+
+    void setControlLane(const bool enabled) {
+        controlLane = enabled;
+    }
+
+    void setUsbTransfers(const uint8_t transfers) {
+        usbTransfers = transfers;
+    }
+
+    void setEventBuffer(const uint16_t maxLatencyMs, const uint16_t maxMessages) {
+        eventBufferMs = maxLatencyMs;
+        eventBufferMessages = maxMessages;
+    }
+
+    void setRotation(const uint8_t slots, const uint32_t sliceMs, const uint32_t budgetS) {
+        rotationSlotCount = slots;
+        rotationSlice = std::chrono::milliseconds(sliceMs);
+        rotationBudgetS = std::chrono::seconds(budgetS);
+    }
+
+    // Parses "<policy>" for every profile, or "<profile>=<policy>,..." with
+    // profile hrm or tracker; see parseReacquirePolicy for the policies
+    bool setReacquire(const std::string& spec) {
+        reacquirePolicies.clear();
+        std::stringstream values(spec);
+        std::string item;
+        while (std::getline(values, item, ',')) {
+            if (item.empty()) continue;
+            const auto eq = item.find('=');
+            std::vector<Channel> profiles;
+            if (eq == std::string::npos) profiles = {HRM_SEARCH_CH, TRK_SEARCH_CH};
+            else if (item.substr(0, eq) == "hrm") profiles = {HRM_SEARCH_CH};
+            else if (item.substr(0, eq) == "tracker") profiles = {TRK_SEARCH_CH};
+            else {
+                error("Unknown reacquisition profile [" + item.substr(0, eq) + "]");
+                return false;
+            }
+            for (const auto& profile : profiles) {
+                ReacquirePolicy policy;
+                if (!parseReacquirePolicy(eq == std::string::npos ? item : item.substr(eq + 1), profile.period, policy)) {
+                    error("Invalid reacquisition policy [" + item + "]");
+                    return false;
+                }
+                reacquirePolicies[profile.dType] = policy;
+            }
+        }
+        fine("Setting reacquisition to [" + spec + "]");
+        return true;
+    }
+
+    const ReacquirePolicy& reacquirePolicy(const uint8_t dType) {
+        static const ReacquirePolicy fixed = fixedReacquirePolicy();
+        const auto it = reacquirePolicies.find(dType);
+        return it != reacquirePolicies.end() ? it->second : fixed;
+    }
+
     void setEpsLatLng(const double meters) {
         epsLatLng = metersToDegrees(meters);
     }
@@ -311,7 +643,7 @@ namespace ant {
             const uint8_t* trailer = &data[10];
 
             ext.hasRxTsValue = true;
-            ext.rxTs.value = parseRxTs(trailer);
+            ext.rxTs.value = parseRxTs(&trailer[offset]);
             offset += 2;
         }
 
@@ -371,6 +703,20 @@ namespace ant {
         }
     }
 
+    std::string commandName(const uint8_t mesgId) {
+        switch (mesgId) {
+            case MESG_ASSIGN_CHANNEL_ID:         return "AssignChannel";
+            case MESG_CHANNEL_ID_ID:             return "SetChannelID";
+            case MESG_CHANNEL_MESG_PERIOD_ID:    return "SetChannelPeriod";
+            case MESG_CHANNEL_RADIO_FREQ_ID:     return "SetChannelRFFrequency";
+            case MESG_CHANNEL_SEARCH_TIMEOUT_ID: return "SetChannelSearchTimeout";
+            case MESG_SET_LP_SEARCH_TIMEOUT_ID:  return "SetLowPriorityChannelSearchTimeout";
+            case MESG_PROX_SEARCH_CONFIG_ID:     return "SetProximitySearch";
+            case MESG_OPEN_CHANNEL_ID:           return "OpenChannel";
+            default:                             return "Command 0x" + toHexByte(mesgId);
+        }
+    }
+
     bool parseDevice(const uint8_t* data, const uint8_t length, Device& device){
         const uint8_t* payload = &data[1];
         const uint8_t page = payload[0];
@@ -482,50 +828,157 @@ namespace ant {
     // Control methods
     // -------------------------------------------------
 
-    bool initialize(const ULONG baud, const UCHAR ucDeviceNumber) {
+    Stick& stickOf(const uint8_t number) {
+        return sticks[channelPool.stickOf(number)];
+    }
 
-        DSIDebug::Init();
-        DSIDebug::SetDebug(true);
-        DSIDebug::SerialEnable(ucDeviceNumber, true);
+    DSIFramerANT* framerOf(const uint8_t number) {
+        return stickOf(number).framer;
+    }
 
-        info("ANT initialization started...");
+    // The stick's own number for a logical channel number
+    UCHAR localChannel(const uint8_t number) {
+        return static_cast<UCHAR>(number - channelPool.firstOf(channelPool.stickOf(number)));
+    }
+
+    // Channels on a lost stick are left alone until recoverStick reopens them
+    bool onLostStick(const uint8_t number) {
+        return stickOf(number).lost;
+    }
+
+    // Reads the stick's capabilities once. A replay takes them from the
+    // capture header instead. Returns the stick's channel count.
+    uint8_t readCapabilities(Stick& stick) {
+        ANT_MESSAGE_ITEM& capabilities = stick.capabilities;
+        capabilities = {};
+        if (pclReplay) {
+            capabilities.ucSize = pclReplay->GetCapabilities(capabilities.stANTMessage.aucData);
+        } else if (!stick.framer->SendRequest(MESG_CAPABILITIES_ID, 0, &capabilities, MESSAGE_TIMEOUT)) {
+            capabilities.ucSize = 0;
+        }
+
+        const UCHAR* caps = capabilities.stANTMessage.aucData;
+        const std::string name = "Stick " + std::to_string(stick.deviceNumber);
+        if (capabilities.ucSize < 2 || caps[0] == 0) {
+            capabilities.ucSize = 0;
+            warn("Failed to read capabilities of " + name + ", assuming " + std::to_string(DEFAULT_CHANNELS) + " channels");
+            return DEFAULT_CHANNELS;
+        }
+        info(name + " has " + std::to_string(caps[0]) + " channels and " + std::to_string(caps[1]) + " networks");
+        return caps[0];
+    }
+
+    // True if every stick reported the flag in the given options byte
+    bool hasCapability(const size_t byte, const UCHAR flag) {
+        return !sticks.empty() && std::all_of(sticks.begin(), sticks.end(), [&](const Stick& stick) {
+            return stick.capabilities.ucSize > byte && (stick.capabilities.stANTMessage.aucData[byte] & flag);
+        });
+    }
 
-        pclSerial = new DSISerialGeneric();
-        if (!pclSerial->Init(baud, ucDeviceNumber)) {
+    // True only if a stick reported its options without the flag, so
+    // features every stick has are assumed while the options are unknown
+    bool lacksCapability(const size_t byte, const UCHAR flag) {
+        return std::any_of(sticks.begin(), sticks.end(), [&](const Stick& stick) {
+            return stick.capabilities.ucSize > byte && !(stick.capabilities.stANTMessage.aucData[byte] & flag);
+        });
+    }
+
+    // Opens the stick and waits for it to start up. Each stick has its own
+    // serial receive thread feeding its framer.
+    bool openStick(Stick& stick, const ULONG baud) {
+        const UCHAR ucDeviceNumber = stick.deviceNumber;
+        DSIDebug::SerialEnable(ucDeviceNumber, true);
+
+        if (!replayPath.empty()) {
+            pclReplay = new DSISerialReplay();
+            if (!pclReplay->Init(replayPath.c_str(), replaySpeed)) {
+                error("Failed to read replay file [" + replayPath + "]");
+                return false;
+            }
+            info("Replaying " + std::to_string(pclReplay->GetStreamSize()) + " messages from [" + replayPath + "]");
+            stick.serial = pclReplay;
+        } else if (emulate) {
+            // Every emulated stick hears the same devices, each at an RSSI of its own
+            DSI_SERIAL_EMULATOR_FLEET fleet = emulatorFleet;
+            const auto index = static_cast<ULONG>(&stick - sticks.data());
+            fleet.ulSerialNumber += index;
+            fleet.ulRssiSeed = index > 0 ? fleet.ulSeed + index : 0;
+            stick.emulator = new DSISerialEmulator();
+            stick.emulator->Init(&fleet);
+            info("Emulating " + std::to_string(stick.emulator->GetFleetSize()) + " devices");
+            stick.serial = stick.emulator;
+        } else {
+            if (usbTransfers > 0) DSISerialGeneric::SetRxTransferCount(usbTransfers);
+            stick.usb = new DSISerialGeneric();
+            stick.serial = stick.usb;
+        }
+        if (!stick.serial->Init(baud, ucDeviceNumber)) {
             std::ostringstream oss;
             oss << "Failed to open USB port " << static_cast<int>(ucDeviceNumber);
             info(oss.str());
             return false;
         }
 
-        pclANT = new DSIFramerANT(pclSerial);
-        pclSerial->SetCallback(pclANT);
-        if (!pclANT->Init()) {
-            error("Framer Init failed: code " + std::to_string(pclANT->GetLastError()));
+        stick.framer = new DSIFramerANT(stick.serial);
+        stick.serial->SetCallback(stick.framer);
+        if (!stick.framer->Init()) {
+            error("Framer Init failed: code " + std::to_string(stick.framer->GetLastError()));
             return false;
         }
-        if (!pclSerial->Open()) {
+        stick.framer->SetPriorityLanes(controlLane);
+        if (!stick.serial->Open()) {
             info("Serial Open failed: USB Device [" + std::to_string(ucDeviceNumber) + "]") ;
             return false;
         }
 
-        pclANT->ResetSystem();
+        stick.serialNumber = stick.serial->GetDeviceSerialNumber();
+
+        stick.framer->ResetSystem();
         std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 
         while (true) {
-            const USHORT length = pclANT->WaitForMessage(MESSAGE_TIMEOUT);
+            const USHORT length = stick.framer->WaitForMessage(MESSAGE_TIMEOUT);
             if (length > 0 && length != DSI_FRAMER_TIMEDOUT) {
                 ANT_MESSAGE msg;
-                pclANT->GetMessage(&msg);
+                stick.framer->GetMessage(&msg);
                 std::ostringstream oss;
                 oss << "Message ID was " << static_cast<int>(msg.ucMessageID);
                 info(oss.str());
                 if (msg.ucMessageID == MESG_STARTUP_MESG_ID) break;
             }
         }
+        return true;
+    }
+
+    // Opens every stick and sizes the channel pool by their channel counts,
+    // so the sticks act as one receiver with all of their channels
+    bool initialize(const ULONG baud, const std::vector<UCHAR>& deviceNumbers) {
+
+        DSIDebug::Init();
+        DSIDebug::SetDebug(true);
+
+        info("ANT initialization started...");
+
+        if (deviceNumbers.size() > 1 && (!replayPath.empty() || !capturePath.empty())) {
+            error("Capture and replay work with a single stick");
+            return false;
+        }
+
+        sticks.assign(deviceNumbers.size(), {});
+        std::vector<uint8_t> sizes;
+        for (size_t i = 0; i < sticks.size(); ++i) {
+            sticks[i].deviceNumber = deviceNumbers[i];
+            if (!openStick(sticks[i], baud)) return false;
+            sizes.push_back(readCapabilities(sticks[i]));
+        }
+        channelPool.resize(sizes);
+        if (sticks.size() > 1) {
+            info("Receiving on " + std::to_string(sticks.size()) + " sticks with "
+                 + std::to_string(channelPool.size()) + " channels in all");
+        }
 
         if (mqttCfg.enabled) {
-            if (!mqtt.start(mqttCfg)) {
+            if (!mqtt.start(mqttCfg, MQTT_THREADED)) {
                 ant::warn("Failed to connect to MQTT broker " + mqttCfg.host);
             } else {
                 ant::info("Connected to MQTT broker " + mqttCfg.host + ":" + std::to_string(mqttCfg.port));
@@ -535,50 +988,441 @@ namespace ant {
         return true;
     }
 
-    bool openChannel(const Channel& ch) {
-        const std::string suffix = " failed for channel #" + std::to_string(ch.cNum);
-        if (!pclANT->AssignChannel(ch.cNum, ch.cType, USER_NETWORK_NUM, MESSAGE_TIMEOUT)) {
-            error("AssignChannel" + suffix);
+    // Turns off what the stick lacks before any channel is planned. Returns
+    // false if it cannot receive at all.
+    bool applyCapabilities() {
+        if (hasCapability(CAPS_STANDARD, CAPABILITIES_NO_RX_CHANNELS)) {
+            error("The stick has no receive channels");
+            return false;
+        }
+        if (scanMode && lacksCapability(CAPS_ADVANCED_2, CAPABILITIES_SCAN_MODE_ENABLED)) {
+            warn("Continuous scan mode not supported by the stick, searching on channels instead");
+            scanMode = false;
+        }
+        pairedListSize = MAX_LIST_SIZE;
+        if (lacksCapability(CAPS_ADVANCED, CAPABILITIES_SEARCH_LIST_ENABLED)) {
+            warn("Inclusion lists not supported by the stick, paired devices will not share channels");
+            pairedListSize = 1;
+        }
+        for (auto& [dType, policy] : reacquirePolicies) {
+            if (policy.lpSearchTimeout && lacksCapability(CAPS_ADVANCED, CAPABILITIES_LOW_PRIORITY_SEARCH_ENABLED)) {
+                warn("Low priority search not supported by the stick, " + describeDeviceType(dType)
+                     + " links fall back to the fixed reacquisition");
+                const uint8_t proximityBin = policy.proximityBin;
+                policy = fixedReacquirePolicy();
+                policy.proximityBin = proximityBin;
+            }
+            if (policy.proximityBin && lacksCapability(CAPS_ADVANCED_2, CAPABILITIES_PROX_SEARCH_ENABLED)) {
+                warn("Proximity search not supported by the stick, " + describeDeviceType(dType)
+                     + " devices are paired at any distance");
+                policy.proximityBin = 0;
+            }
+        }
+        return true;
+    }
+
+    ANT_CHANNEL_CONFIG toChannelConfig(const Channel& ch) {
+        ANT_CHANNEL_CONFIG cfg{};
+        cfg.ucANTChannel = ch.cNum;
+        cfg.ucChannelType = ch.cType;
+        cfg.ucNetworkNumber = USER_NETWORK_NUM;
+        cfg.usDeviceNumber = ch.dNum;
+        cfg.ucDeviceType = ch.dType;
+        cfg.ucTransmitType = ch.tType;
+        cfg.usMessagePeriod = ch.period;
+        cfg.ucRFFrequency = ch.rfFreq;
+        cfg.ucSearchTimeout = ch.searchTimeout;
+        cfg.bOpen = ch.use ? TRUE : FALSE;
+        return cfg;
+    }
+
+    // Starts recording all serial traffic to capturePath. The header carries
+    // the stick serial, its capabilities and the channel plan we are about to open.
+    bool startCapture() {
+        std::vector<ANT_CHANNEL_CONFIG> configs;
+        for (const auto& ch : channels) {
+            configs.push_back(toChannelConfig(ch));
+        }
+
+        pclCapture = new DSICaptureANT();
+        const Stick& stick = sticks.front();
+        if (!pclCapture->Open(capturePath.c_str(), stick.serial->GetDeviceSerialNumber(),
+                              stick.capabilities.stANTMessage.aucData, stick.capabilities.ucSize,
+                              configs.data(), static_cast<UCHAR>(configs.size()))) {
+            error("Failed to create capture file [" + capturePath + "]");
+            delete pclCapture;
+            pclCapture = nullptr;
             return false;
         }
+        stick.framer->SetCapture(pclCapture);
+        info("Capturing ANT traffic to [" + capturePath + "]");
+        return true;
+    }
 
-        if (!pclANT->SetChannelID(ch.cNum, ch.dNum, ch.dType, ch.tType, MESSAGE_TIMEOUT)) {
-            error("SetChannelID" + suffix);
+    void stopCapture() {
+        if (!pclCapture) return;
+        if (!sticks.empty()) sticks.front().framer->SetCapture(nullptr);
+        pclCapture->Close();
+        info("Capture closed: " + std::to_string(pclCapture->GetRecordCount()) + " records, "
+             + std::to_string(pclCapture->GetDroppedRecords()) + " dropped");
+        delete pclCapture;
+        pclCapture = nullptr;
+    }
+
+    bool loadSelectiveUpdateMasks(const Stick& stick) {
+        // The framer only reads the masks, its API just predates const
+        if (!stick.framer->SetSelectiveDataUpdateMask(SDU_MASK_ASSET_TRACKER, const_cast<UCHAR*>(SDU_MASK_ASSET_TRACKER_PRESET), MESSAGE_TIMEOUT) ||
+            !stick.framer->SetSelectiveDataUpdateMask(SDU_MASK_HEART_RATE, const_cast<UCHAR*>(SDU_MASK_HEART_RATE_PRESET), MESSAGE_TIMEOUT)) {
+            warn("Failed to set Selective Data Update masks (code 0x" + toHexByte(stick.framer->GetLastError()) + ")");
             return false;
         }
+        return true;
+    }
+
+    // Loads the per-profile SDU masks if the stick can filter unchanged pages
+    // itself. Without the capability, or if the masks do not load, unchanged
+    // pages are filtered on the host instead.
+    void setupSelectiveUpdates() {
+        sduOnStick = false;
+        sduOnHost = sduMode == SduMode::Host;
+        if (sduMode != SduMode::Auto) return;
+
+        if (!hasCapability(CAPS_ADVANCED_3, CAPABILITIES_SELECTIVE_DATA_UPDATE_ENABLED)) {
+            info("Selective Data Updates not supported by the stick, filtering unchanged pages on the host");
+            sduOnHost = true;
+            return;
+        }
+
+        for (const Stick& stick : sticks) {
+            if (!loadSelectiveUpdateMasks(stick)) {
+                warn("Filtering unchanged pages on the host");
+                sduOnHost = true;
+                return;
+            }
+        }
+
+        sduOnStick = true;
+        info("Selective Data Updates enabled on the stick");
+    }
+
+    // Selects the SDU mask for the channel's profile. Wildcard device type
+    // channels, like the scan channel, mix profiles and stay unfiltered.
+    void configureSelectiveUpdates(const Channel& ch) {
+        if (!sduOnStick) return;
 
-        if (!pclANT->SetChannelPeriod(ch.cNum, ch.period,MESSAGE_TIMEOUT)) {
-            error("SetChannelPeriod" + suffix);
+        UCHAR mask;
+        switch (ch.dType & 0x7F) {
+            case ASSET_TRACKER_DEVICE_TYPE: mask = SDU_MASK_ASSET_TRACKER; break;
+            case HRM_DEVICE_TYPE:           mask = SDU_MASK_HEART_RATE; break;
+            default: return;
+        }
+
+        DSIFramerANT* framer = framerOf(ch.cNum);
+        if (!framer->ConfigSelectiveDataUpdate(localChannel(ch.cNum), mask, MESSAGE_TIMEOUT)) {
+            warn("[CH] #" + std::to_string(ch.cNum) + ": Failed to configure Selective Data Updates (code 0x"
+                 + toHexByte(framer->GetLastError()) + ")");
+            return;
+        }
+        channelStates[ch.cNum].sdu = true;
+    }
+
+    bool configureEventBuffer(const Stick& stick) {
+        const auto size = static_cast<USHORT>(std::min<uint32_t>(
+            eventBufferMessages * static_cast<uint32_t>(EVENT_BUFFER_BYTES_PER_BROADCAST), 0xFFFF));
+        const auto time = static_cast<USHORT>((eventBufferMs + EVENT_BUFFER_TIME_UNIT_MS - 1) / EVENT_BUFFER_TIME_UNIT_MS);
+        if (!stick.framer->ConfigEventBuffer(EVENT_BUFFER_LOW_PRIORITY, size, time, MESSAGE_TIMEOUT)) {
+            warn("Failed to configure event buffering (code 0x" + toHexByte(stick.framer->GetLastError()) + ")");
             return false;
         }
+        if (!stick.framer->SetLibConfig(ANT_LIB_CONFIG_MESG_OUT_INC_DEVICE_ID | ANT_LIB_CONFIG_MESG_OUT_INC_RSSI |
+                                        ANT_LIB_CONFIG_MESG_OUT_INC_TIME_STAMP, MESSAGE_TIMEOUT)) {
+            warn("Failed to enable Rx timestamps, event buffer hold times will not be reported");
+        }
+        return true;
+    }
 
-        if (!pclANT->SetChannelRFFrequency(ch.cNum, ch.rfFreq,MESSAGE_TIMEOUT)) {
-            error("SetChannelRFFrequency" + suffix);
+    // Lets the stick hold received messages and deliver them in bursts, so the
+    // host wakes once per burst instead of once per broadcast at the cost of
+    // up to eventBufferMs of latency. Rx timestamps are turned on with it so
+    // reportEventBuffer can measure how long messages were actually held.
+    void setupEventBuffer() {
+        eventBufferOnStick = false;
+        if (eventBufferMs == 0 && eventBufferMessages == 0) return;
+
+        if (!hasCapability(CAPS_ADVANCED_3, CAPABILITIES_EVENT_BUFFERING_ENABLED)) {
+            warn("Event buffering not supported by the stick, delivering every message at once");
+            return;
+        }
+
+        for (const Stick& stick : sticks) {
+            if (!configureEventBuffer(stick)) return;
+        }
+
+        eventBufferOnStick = true;
+        info("Event buffering enabled on the stick: up to " + std::to_string(eventBufferMs) + " ms or "
+             + std::to_string(eventBufferMessages) + " messages");
+    }
+
+    bool enableHighDutySearch(const Stick& stick) {
+        if (!stick.framer->ConfigHighDutySearch(TRUE, HIGH_DUTY_SUPPRESSION_CYCLES, MESSAGE_TIMEOUT)) {
+            warn("Failed to enable high duty search (code 0x" + toHexByte(stick.framer->GetLastError()) + ")");
             return false;
         }
+        return true;
+    }
+
+    // Lets the stick search at high duty if any reacquisition policy asks
+    // for it, so low priority searches pick a device up within a few of its
+    // broadcasts
+    void setupReacquisition() {
+        highDutyOnStick = false;
+        bool highDuty = false;
+        for (const auto& [dType, policy] : reacquirePolicies) {
+            info("Reacquisition of " + describeDeviceType(dType) + " links: " + describeReacquirePolicy(policy));
+            highDuty |= policy.highDuty;
+        }
+        if (!highDuty) return;
 
-        if (!pclANT->SetNetworkKey(USER_NETWORK_NUM, USER_NETWORK_KEY, MESSAGE_TIMEOUT)) {
-            error("SetNetworkKey failed" + suffix);
+        if (!hasCapability(CAPS_ADVANCED_3, CAPABILITIES_HIGH_DUTY_SEARCH_MODE_ENABLED)) {
+            warn("High duty search not supported by the stick, searching at the normal duty");
+            return;
+        }
+        for (const Stick& stick : sticks) {
+            if (!enableHighDutySearch(stick)) return;
+        }
+        highDutyOnStick = true;
+        info("High duty search enabled on the stick");
+    }
+
+    // Host-side Selective Data Update, with --sdu host or when the stick
+    // cannot filter: true if the compared bytes of this page match the last
+    // copy seen from the same device (and asset index, for tracker pages).
+    // Pages on a search channel always go through, as pairing a device
+    // happens in their handlers.
+    bool isUnchangedPage(const UCHAR* d, const UCHAR length) {
+        if (!sduOnHost) return false;
+        if (channelPool.role(d[0]) == ChannelRole::Search) return false;
+
+        ExtendedInfo ext;
+        if (!parseExtendedInfo(d, length, ext) || !ext.hasDeviceId) return false;
+
+        const UCHAR* mask;
+        switch (ext.deviceId.dType) {
+            case ASSET_TRACKER_DEVICE_TYPE: mask = SDU_MASK_ASSET_TRACKER_PRESET; break;
+            case HRM_DEVICE_TYPE:           mask = SDU_MASK_HEART_RATE_PRESET; break;
+            default: return false;
+        }
+
+        const uint8_t* payload = &d[1];
+        const uint8_t page = payload[0] & mask[0];
+        const uint8_t index = assetPages.contains(page) ? (payload[1] & 0x1F) : 0;
+        const uint64_t key = static_cast<uint64_t>(ext.deviceId.number) << 32
+            | static_cast<uint64_t>(ext.deviceId.dType) << 24
+            | static_cast<uint64_t>(ext.deviceId.tType) << 16
+            | static_cast<uint64_t>(page) << 8
+            | index;
+
+        std::array<uint8_t, 8> compared{};
+        for (size_t i = 0; i < compared.size(); ++i) {
+            compared[i] = payload[i] & mask[i];
+        }
+
+        const auto [it, inserted] = lastPayloads.try_emplace(key, compared);
+        if (inserted || it->second != compared) {
+            it->second = compared;
             return false;
         }
+        return true;
+    }
 
-        if (!pclANT->SetChannelSearchTimeout(ch.cNum, ch.searchTimeout, MESSAGE_TIMEOUT)) {
-            error("SetChannelSearchTimeout" + suffix);
+    // Runs ConfigureChannels on every stick for its share of the configs,
+    // whose channel numbers are logical. Results and failed IDs are filled in
+    // for each config, in order.
+    void configureChannels(const std::vector<ANT_CHANNEL_CONFIG>& configs, UCHAR* results, UCHAR* failedIds) {
+        for (size_t k = 0; k < sticks.size(); ++k) {
+            std::vector<ANT_CHANNEL_CONFIG> share;
+            std::vector<size_t> indexes;
+            for (size_t i = 0; i < configs.size(); ++i) {
+                if (channelPool.stickOf(configs[i].ucANTChannel) != k) continue;
+                share.push_back(configs[i]);
+                share.back().ucANTChannel = localChannel(configs[i].ucANTChannel);
+                indexes.push_back(i);
+            }
+            if (share.empty()) continue;
+
+            std::vector<UCHAR> shareResults(share.size()), shareFailedIds(share.size());
+            sticks[k].framer->ConfigureChannels(share.data(), static_cast<UCHAR>(share.size()), MESSAGE_TIMEOUT,
+                                                shareResults.data(), shareFailedIds.data());
+            for (size_t j = 0; j < indexes.size(); ++j) {
+                results[indexes[j]] = shareResults[j];
+                failedIds[indexes[j]] = shareFailedIds[j];
+            }
+        }
+    }
+
+    // Puts the paired devices sharing a channel on its inclusion list. The
+    // channel itself was configured with a wildcard device number and
+    // transmission type, so only the list decides who it tracks.
+    bool configureSharedChannel(const Channel& ch, const std::vector<Channel>& members) {
+        DSIFramerANT* framer = framerOf(ch.cNum);
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (!framer->AddChannelID(localChannel(ch.cNum), members[i].dNum, members[i].dType, members[i].tType,
+                                      static_cast<UCHAR>(i), MESSAGE_TIMEOUT)) {
+                error("AddChannelID failed for channel #" + std::to_string(ch.cNum)
+                      + " (code 0x" + toHexByte(framer->GetLastError()) + ")");
+                return false;
+            }
+        }
+        if (!framer->ConfigList(localChannel(ch.cNum), static_cast<UCHAR>(members.size()), FALSE, MESSAGE_TIMEOUT)) {
+            error("Failed to configure the inclusion list of shared channel #" + std::to_string(ch.cNum)
+                  + " (code 0x" + toHexByte(framer->GetLastError()) + ")");
             return false;
         }
+        return true;
+    }
+
+    // Configures and opens all given channels in one pipelined batch, so the
+    // whole set costs about one round trip to the stick instead of one per command.
+    // Paired entries with the same channel number are opened as one shared
+    // channel, which only needs its inclusion list sent on top. The
+    // reacquisition policy of a paired channel may replace its search timeout
+    // and add a low priority one, and that of a search channel a proximity
+    // threshold; those channels are opened in a second pipelined batch once
+    // the extra settings are in.
+    bool openChannels(const std::vector<Channel>& entries) {
+        if (entries.empty()) return true;
+
+        std::vector<Channel> chs;
+        std::map<uint8_t, std::vector<Channel>> members;
+        for (const auto& entry : entries) {
+            if (onLostStick(entry.cNum)) continue;
+            auto& list = members[entry.cNum];
+            if (list.empty()) chs.push_back(entry);
+            list.push_back(entry);
+        }
+
+        std::vector<ANT_CHANNEL_CONFIG> configs;
+        std::vector<std::optional<uint8_t>> lpSearchTimeouts(chs.size());
+        std::vector<uint8_t> proximityBins(chs.size(), 0);
+        configs.reserve(chs.size());
+        for (size_t i = 0; i < chs.size(); ++i) {
+            Channel& ch = chs[i];
+            const ReacquirePolicy& policy = reacquirePolicy(ch.dType);
+            const bool paired = isPairedChannel(ch);
+            const bool shared = members[ch.cNum].size() > 1;
+            if (shared) {
+                ch.dNum = 0;
+                ch.tType = 0;
+            }
+            ANT_CHANNEL_CONFIG cfg = toChannelConfig(ch);
+            if (paired) {
+                if (policy.searchTimeout) cfg.ucSearchTimeout = *policy.searchTimeout;
+                lpSearchTimeouts[i] = policy.lpSearchTimeout;
+            } else {
+                proximityBins[i] = policy.proximityBin;
+            }
+            cfg.bOpen = shared || lpSearchTimeouts[i] || proximityBins[i] ? FALSE : TRUE;
+            configs.push_back(cfg);
+        }
+
+        std::vector<UCHAR> results(chs.size()), failedIds(chs.size());
+        configureChannels(configs, results.data(), failedIds.data());
+
+        std::vector<bool> opened(chs.size(), false);
+        std::vector<std::vector<ANT_COMMAND_HANDLE>> pending(chs.size());
+        std::vector<std::vector<UCHAR>> pendingIds(chs.size());
+        for (size_t i = 0; i < chs.size(); ++i) {
+            const Channel& ch = chs[i];
+            if (results[i] != RESPONSE_NO_ERROR) {
+                error(commandName(failedIds[i]) + " failed for channel #" + std::to_string(ch.cNum)
+                      + " (code 0x" + toHexByte(results[i]) + ")");
+                continue;
+            }
+            opened[i] = configs[i].bOpen;
+            if (opened[i]) continue;
+
+            const auto& list = members[ch.cNum];
+            if (list.size() > 1 && !configureSharedChannel(ch, list)) continue;
+            DSIFramerANT* framer = framerOf(ch.cNum);
+            const UCHAR local = localChannel(ch.cNum);
+            if (lpSearchTimeouts[i]) {
+                pending[i].push_back(framer->SetLowPriorityChannelSearchTimeoutAsync(local, *lpSearchTimeouts[i]));
+                pendingIds[i].push_back(MESG_SET_LP_SEARCH_TIMEOUT_ID);
+            }
+            if (proximityBins[i]) {
+                pending[i].push_back(framer->SetProximitySearchAsync(local, proximityBins[i]));
+                pendingIds[i].push_back(MESG_PROX_SEARCH_CONFIG_ID);
+            }
+            pending[i].push_back(framer->OpenChannelAsync(local));
+            pendingIds[i].push_back(MESG_OPEN_CHANNEL_ID);
+        }
+        for (size_t i = 0; i < chs.size(); ++i) {
+            if (pending[i].empty()) continue;
+            USHORT failed = MAX_USHORT;
+            const UCHAR result = framerOf(chs[i].cNum)->WaitForCommands(pending[i].data(), static_cast<USHORT>(pending[i].size()),
+                                                                        MESSAGE_TIMEOUT, &failed);
+            if (result != RESPONSE_NO_ERROR) {
+                error(commandName(failed < pendingIds[i].size() ? pendingIds[i][failed] : MESG_OPEN_CHANNEL_ID)
+                      + " failed for channel #" + std::to_string(chs[i].cNum) + " (code 0x" + toHexByte(result) + ")");
+                continue;
+            }
+            opened[i] = true;
+        }
 
-        if (!pclANT->OpenChannel(ch.cNum,MESSAGE_TIMEOUT)) {
-            error("OpenChannel" + suffix);
+        bool allOpened = true;
+        for (size_t i = 0; i < chs.size(); ++i) {
+            if (!opened[i]) {
+                allOpened = false;
+                continue;
+            }
+            const Channel& ch = chs[i];
+            const auto& list = members[ch.cNum];
+
+            std::ostringstream oss;
+            oss <<"Opened ANT Channel #" << std::to_string(ch.cNum)
+                << " | Channel Type: 0x" + toHexByte(ch.cType)
+                << " | Device #: 0x" + toHexByte(ch.dNum)
+                << " | Device Type: 0x" + toHexByte(ch.dType)
+                << " | Tx Type: 0x" + toHexByte(ch.tType);
+            if (list.size() > 1) {
+                oss << " | Inclusion list:";
+                for (const auto& m : list) oss << " 0x" << toHexByte(m.dNum);
+            }
+            info(oss.str());
+            setChannelState(ch.cNum, true, {});
+            channelStates[ch.cNum].listSize = list.size() > 1 ? static_cast<uint8_t>(list.size()) : 0;
+            configureSelectiveUpdates(ch);
+        }
+        return allOpened;
+    }
+
+    bool openChannel(const Channel& ch) {
+        return openChannels({ch});
+    }
+
+    // Assigns the first channel of a stick without opening it and puts the
+    // stick in continuous scan mode, which replaces every search and
+    // dedicated channel on it
+    bool openScanChannel(const Channel& ch) {
+        if (onLostStick(ch.cNum)) return false;
+        ANT_CHANNEL_CONFIG cfg = toChannelConfig(ch);
+        cfg.bOpen = FALSE;
+
+        UCHAR result = RESPONSE_NO_ERROR, failedId = 0;
+        configureChannels({cfg}, &result, &failedId);
+        if (result != RESPONSE_NO_ERROR) {
+            error(commandName(failedId) + " failed for scan channel #" + std::to_string(ch.cNum)
+                  + " (code 0x" + toHexByte(result) + ")");
+            return false;
+        }
+        DSIFramerANT* framer = framerOf(ch.cNum);
+        if (!framer->OpenRxScanMode(MESSAGE_TIMEOUT)) {
+            error("Failed to open continuous scan mode (code 0x" + toHexByte(framer->GetLastError()) + ")");
             return false;
         }
 
-        std::ostringstream oss;
-        oss <<"Opened ANT Channel #" << std::to_string(ch.cNum)
-            << " | Channel Type: 0x" + toHexByte(ch.cType)
-            << " | Device #: 0x" + toHexByte(ch.dNum)
-            << " | Device Type: 0x" + toHexByte(ch.dType)
-            << " | Tx Type: 0x" + toHexByte(ch.tType);
-        info(oss.str());
+        info("Opened ANT Channel #" + std::to_string(ch.cNum) + " in continuous scan mode"
+             + " | RF: " + std::to_string(ch.rfFreq));
         setChannelState(ch.cNum, true, {});
         return true;
     }
@@ -587,18 +1431,19 @@ namespace ant {
         if (!channelStates[number].active){
             return true;
         }
-        if (!pclANT) {
+        if (sticks.empty()) {
             error("Failed to close channel #"
                 + std::to_string(number)
                 + "[closeChannel] ANT framer is not initialized");
             return false;
         }
 
-        if (!pclANT->CloseChannel(number, MESSAGE_TIMEOUT)) {
+        DSIFramerANT* framer = framerOf(number);
+        if (!framer->CloseChannel(localChannel(number), MESSAGE_TIMEOUT)) {
             error("Failed to close channel #" + std::to_string(number));
             return false;
         }
-        if (!pclANT->UnAssignChannel(number, MESSAGE_TIMEOUT)) {
+        if (!framer->UnAssignChannel(localChannel(number), MESSAGE_TIMEOUT)) {
             error("Failed to unassign channel #" + std::to_string(number));
             return false;
         }
@@ -608,7 +1453,37 @@ namespace ant {
         return true;
     }
 
+    RotationSlot* findRotationSlot(const uint8_t number) {
+        const auto it = std::find_if(rotationSlots.begin(), rotationSlots.end(),
+            [&](const RotationSlot& slot){ return slot.cNum == number; });
+        return it != rotationSlots.end() ? &*it : nullptr;
+    }
+
+    bool isRotationSlot(const uint8_t number) {
+        return findRotationSlot(number) != nullptr;
+    }
+
+    std::set<uint8_t> rotationSlotNumbers() {
+        std::set<uint8_t> numbers;
+        for (const auto& slot : rotationSlots) numbers.insert(slot.cNum);
+        return numbers;
+    }
+
+    // Closes a search channel for good and hands its number back to the pool
+    bool retireSearchChannel(const uint8_t number) {
+        if (!closeChannel(number)) return false;
+        std::erase_if(channels, [&](const Channel& c){ return c.cNum == number && !isPairedChannel(c); });
+        channelPool.release(number);
+        return true;
+    }
+
     bool ensureNewChannelForDevice(const uint8_t cNum, const ExtendedInfo& ext) {
+        // The scan channel already hears every device, and a rotation slot
+        // only ever holds a paired one
+        if (scanMode || isRotationSlot(cNum)) {
+            return false;
+        }
+
         // Require valid device id in the extended trailer
         if (!ext.hasDeviceId) {
             return false;
@@ -634,8 +1509,11 @@ namespace ant {
 
         // Do not add if already exist
         if (hasChannel(ext.deviceId.number, ext.deviceId.dType, ext.deviceId.tType)) {
+            // A paired device the allocator had no channel for is back in range
+            pairedLastSeen[makeDeviceKey(ext)] = std::chrono::steady_clock::now();
+            rebalancePending = true;
             fine("[ensureNewChannelForDevice] Device 0x" + toHexByte(ext.deviceId.number) +" has dedicated channel, closing...");
-            closeChannel(searchCh.cNum);
+            retireSearchChannel(searchCh.cNum);
             return false;
         }
 
@@ -655,23 +1533,31 @@ namespace ant {
                 return false;
         }
 
-        const uint8_t newCNum = nextFreeChannelNumber();
-        if (newCNum == 0xFF || findChannelByNumber(newCNum)) {
-            warn("[ensureNewChannelForDevice] Search Channel #" + std::to_string(cNum) + ": No free ANT channels for dedicated link; keeping search only.");
+        if (channelPool.count(ChannelRole::Free) == 0) {
+            // Pair it anyway and let the allocator fit it onto a shared channel
+            info("[ensureNewChannelForDevice] Search Channel #" + std::to_string(cNum) + ": No free ANT channels for dedicated link; "
+                 + "sharing a channel with other paired devices.");
+            channels.push_back(makeDedicatedFromTemplate(0xFF, tmpl, ext));
+            knownDevices[makeDeviceKey(ext)];
+            pairedLastSeen[makeDeviceKey(ext)] = std::chrono::steady_clock::now();
+            rebalancePending = true;
             return false;
         }
-        fine("[ensureNewChannelForDevice] Search Channel #" +  std::to_string(cNum) + ": Found free channel #" + std::to_string(newCNum));
 
-        const Channel newCh = makeDedicatedFromTemplate(newCNum, tmpl, ext);
-
-        // 1) Close the search channel before opening the dedicated one
+        // 1) Close the search channel before opening the dedicated one; its
+        // number goes back to the pool, so the device may well get it
         fine("[ensureNewChannelForDevice] Search Channel #" +  std::to_string(cNum) +  ": Closing search channel to open dedicated channel...");
-        if (!closeChannel(searchCh.cNum)) {
+        if (!retireSearchChannel(searchCh.cNum)) {
             warn("[ensureNewChannelForDevice] Search Channel #" +  std::to_string(cNum) +  ": Failed to close search channel; aborting");
             return false;
         }
         fine("[ensureNewChannelForDevice] Search Channel #" +  std::to_string(cNum) +  ": Closing search channel to open dedicated channel...DONE");
 
+        // On the stick whose search channel found the device, which heard it strongest
+        const uint8_t newCNum = acquirePairedChannelNumber(channelPool.stickOf(searchCh.cNum));
+        fine("[ensureNewChannelForDevice] Search Channel #" +  std::to_string(cNum) + ": Found free channel #" + std::to_string(newCNum));
+        const Channel newCh = makeDedicatedFromTemplate(newCNum, tmpl, ext);
+
         // 2) Open new dedicated channel for
         channels.push_back(newCh); // This can reallocate; safe now because we use `searchCh` (value copy) later
         bool newChOpened = false;
@@ -683,6 +1569,7 @@ namespace ant {
                  + std::to_string(newCh.cNum) + " opened for device " + deviceId);
         } else {
             std::erase_if(channels, [&](const Channel& c){ return c.cNum == newCh.cNum; });
+            channelPool.release(newCh.cNum);
             warn("[ensureNewChannelForDevice] Search Channel #" +  std::to_string(cNum) + ": Failed to open dedicated channel. Aborting");
         }
 
@@ -700,92 +1587,673 @@ namespace ant {
         return newChOpened;
     }
 
+    bool setNetworkKey(const Stick& stick) {
+        if (!stick.framer->SetNetworkKey(USER_NETWORK_NUM, USER_NETWORK_KEY, MESSAGE_TIMEOUT)) {
+            error("SetNetworkKey failed");
+            return false;
+        }
+        return true;
+    }
+
+    bool setNetworkKey() {
+        return std::all_of(sticks.begin(), sticks.end(), [](const Stick& stick) { return setNetworkKey(stick); });
+    }
+
+    bool enableExtendedMessages(const Stick& stick) {
+        if (!stick.framer->RxExtMesgsEnable(TRUE)) {
+            error("Failed to enable extended message format mode");
+            return false;
+        }
+        return true;
+    }
+
+    bool enableExtendedMessages() {
+        return std::all_of(sticks.begin(), sticks.end(), [](const Stick& stick) { return enableExtendedMessages(stick); });
+    }
+
+    // Discovery over a single channel per stick in continuous scan mode.
+    // Devices are told apart by the channel ID in the extended trailer, so
+    // paired channels are neither opened nor needed.
+    bool startScanDiscovery() {
+        if (searchTypes.empty()) {
+            searchTypes.push_back(AntProfile::HeartRate);
+            searchTypes.push_back(AntProfile::AssetTracker);
+        }
+        for (const auto& type : searchTypes) {
+            info("Scanning for device type [" + toAntProfileString(type) + "]");
+        }
+
+        channels.clear();
+        for (size_t k = 0; k < sticks.size(); ++k) {
+            Channel ch = SCAN_CH;
+            ch.cNum = channelPool.firstOf(k);
+            channelPool.reserve(ch.cNum, ChannelRole::Scan);
+            channels.push_back(ch);
+        }
+
+        if (!capturePath.empty()) {
+            startCapture();
+        }
+
+        if (!setNetworkKey()) {
+            return false;
+        }
+
+        // The trailer carries the channel ID we demultiplex on, so it has to be
+        // on before the first scanned message arrives
+        if (!enableExtendedMessages()) {
+            return false;
+        }
+        setupEventBuffer();
+
+        // Replayed traffic starts streaming with the first channel opened
+        replayStarted = std::chrono::steady_clock::now();
+        for (const auto& ch : channels) {
+            if (!openScanChannel(ch)) {
+                return false;
+            }
+        }
+
+        fine("Starting ANT+ discovery...DONE");
+        return true;
+    }
+
+    // Takes the top channel numbers for the rotation scheduler, leaving at
+    // least one channel for the allocator
+    void reserveRotationSlots() {
+        rotationSlots.clear();
+        const int available = static_cast<int>(channelPool.count(ChannelRole::Free)) - 1;
+        const int count = std::min<int>(rotationSlotCount, std::max(available, 0));
+        if (count < rotationSlotCount) {
+            warn("Only " + std::to_string(count) + " channel(s) left for rotation slots");
+        }
+        for (int i = 0; i < count; ++i) {
+            RotationSlot slot;
+            slot.cNum = channelPool.acquire(ChannelRole::Rotation, true);
+            rotationSlots.push_back(slot);
+        }
+    }
+
+    // Assigns the rotation slots without opening them; the scheduler sets the
+    // channel ID and opens a slot once it has a device for it
+    bool setupRotationSlots() {
+        if (rotationSlots.empty()) return true;
+
+        std::vector<ANT_CHANNEL_CONFIG> configs;
+        for (const auto& slot : rotationSlots) {
+            Channel ch = TRK_SEARCH_CH;
+            ch.cNum = slot.cNum;
+            ANT_CHANNEL_CONFIG cfg = toChannelConfig(ch);
+            cfg.bOpen = FALSE;
+            configs.push_back(cfg);
+        }
+        std::vector<UCHAR> results(configs.size()), failedIds(configs.size());
+        configureChannels(configs, results.data(), failedIds.data());
+
+        std::ostringstream oss;
+        for (size_t i = 0; i < rotationSlots.size(); ++i) {
+            if (results[i] != RESPONSE_NO_ERROR) {
+                error(commandName(failedIds[i]) + " failed for rotation slot #" + std::to_string(rotationSlots[i].cNum)
+                      + " (code 0x" + toHexByte(results[i]) + ")");
+                return false;
+            }
+            oss << " #" << std::to_string(rotationSlots[i].cNum);
+        }
+        rotationStarted = std::chrono::steady_clock::now();
+        info("Rotating paired devices without a channel through channel(s)" + oss.str() + " in "
+             + std::to_string(rotationSlice.count()) + " ms slices, staleness budget "
+             + std::to_string(rotationBudgetS.count()) + " s");
+        return true;
+    }
+
     bool startDiscovery() {
         info("Starting ANT+ discovery...");
 
+        if (!applyCapabilities()) {
+            return false;
+        }
+        if (scanMode) {
+            return startScanDiscovery();
+        }
+
         loadPairedChannels();
         if (channels.empty() && searchTypes.empty()){
             searchTypes.push_back(AntProfile::HeartRate);
             searchTypes.push_back(AntProfile::AssetTracker);
         }
 
+        // Search channels take the lowest numbers, rotation slots the highest
+        // and the paired channels whatever is left. Every stick searches, so
+        // devices are found in range of any of them.
+        std::vector<Channel> searchChannels;
         for (const auto& type : searchTypes) {
+            Channel ch;
             switch (type) {
             case AntProfile::HeartRate:
-                channels.push_back(HRM_SEARCH_CH);
-                info("Active search for device type [" + toAntProfileString(type) + "]");
+                ch = HRM_SEARCH_CH;
                 break;
             case AntProfile::AssetTracker:
-                channels.push_back(TRK_SEARCH_CH);
-                info("Active search for device type [" + toAntProfileString(type) + "]");
+                ch = TRK_SEARCH_CH;
                 break;
             default:
-                break;
+                continue;
+            }
+            for (size_t k = 0; k < sticks.size(); ++k) {
+                ch.cNum = channelPool.acquire(ChannelRole::Search, false, k);
+                if (ch.cNum == NO_CHANNEL) {
+                    warn("No channel left to search for device type [" + toAntProfileString(type) + "]");
+                    continue;
+                }
+                searchChannels.push_back(ch);
+                info("Active search for device type [" + toAntProfileString(type) + "] on channel #" + std::to_string(ch.cNum));
             }
         }
+        reserveRotationSlots();
+        if (const size_t unassigned = packPairedChannels({}, {}, rotationSlotNumbers(), pairedListSize); unassigned > 0) {
+            if (rotationSlots.empty()) warn(std::to_string(unassigned) + " paired device(s) left without a channel");
+            else info(std::to_string(unassigned) + " paired device(s) left to the rotation slots");
+        }
+        channels.insert(channels.end(), searchChannels.begin(), searchChannels.end());
 
-        if (!pclANT->SetNetworkKey(USER_NETWORK_NUM, USER_NETWORK_KEY, MESSAGE_TIMEOUT)) {
-            error("SetNetworkKey failed");
+        if (!capturePath.empty()) {
+            startCapture();
+        }
+
+        if (!setNetworkKey()) {
             return false;
         }
 
         info("Opening ANT channels... (" + std::to_string(channels.size()) + ")");
+        std::vector<Channel> toOpen;
         for (const auto& ch : channels) {
             if (!ch.use) {
                 fine("Channel #" + std::to_string(ch.cNum) + " [SKIPPED]");
                 continue;
             }
-            openChannel(ch);
+            toOpen.push_back(ch);
+        }
+        setupSelectiveUpdates();
+        setupEventBuffer();
+        setupReacquisition();
+
+        // Replayed traffic starts streaming with the first channel opened
+        replayStarted = std::chrono::steady_clock::now();
+        openChannels(toOpen);
+        setupRotationSlots();
+
+        fine("Opening ANT channels...DONE");
+        if (!enableExtendedMessages()) {
+            return false;
+        }
+
+        fine("Starting ANT+ discovery...DONE");
+        return true;
+    }
+
+    bool searching = true;
+
+    // Re-packs the paired devices with the ones heard lately counted as in
+    // range, then closes and reopens only the channels whose devices changed
+    void rebalancePairedChannels(const std::chrono::steady_clock::time_point now) {
+        static std::chrono::steady_clock::time_point lastRebalance;
+        if (!rebalancePending || scanMode || now - lastRebalance < std::chrono::seconds(REBALANCE_INTERVAL_S)) return;
+        rebalancePending = false;
+        lastRebalance = now;
+
+        std::set<std::string> present, absent;
+        for (const auto& [key, seen] : pairedLastSeen) {
+            if (now - seen < std::chrono::seconds(PRESENCE_TIMEOUT_S)) present.insert(key);
+        }
+        for (const auto& [key, missed] : pairedLastMissed) {
+            const auto seen = pairedLastSeen.find(key);
+            if (now - missed < std::chrono::seconds(PRESENCE_TIMEOUT_S) &&
+                (seen == pairedLastSeen.end() || seen->second < missed)) {
+                absent.insert(key);
+            }
+        }
+
+        // Only move devices around if the packing gets strictly better, otherwise
+        // devices going quiet while blocked would keep reshuffling
+        const auto previous = channels;
+        const auto previousPool = channelPool;
+        const auto cost = pairedPackingCost(present, absent, !rotationSlots.empty());
+        const auto before = pairedMembersByChannel();
+        const size_t unassigned = packPairedChannels(present, absent, rotationSlotNumbers(), pairedListSize);
+        if (!(pairedPackingCost(present, absent, !rotationSlots.empty()) < cost)) {
+            channels = previous;
+            channelPool = previousPool;
+            return;
+        }
+        const auto after = pairedMembersByChannel();
+
+        std::set<uint8_t> changed;
+        for (const auto& [number, keys] : before) {
+            if (!after.contains(number) || after.at(number) != keys) changed.insert(number);
+        }
+        for (const auto& [number, keys] : after) {
+            if (!before.contains(number) || before.at(number) != keys) changed.insert(number);
+        }
+        if (changed.empty()) return;
+
+        std::vector<Channel> toOpen;
+        for (const uint8_t number : changed) {
+            closeChannel(number);
+        }
+        for (const auto& ch : channels) {
+            if (ch.use && isPairedChannel(ch) && changed.contains(ch.cNum)) toOpen.push_back(ch);
+        }
+        info("Rebalancing paired channels: " + std::to_string(present.size()) + " device(s) in range, "
+             + std::to_string(absent.size()) + " out of range, " + std::to_string(changed.size()) + " channel(s) changed, "
+             + std::to_string(unassigned) + " without a channel");
+        openChannels(toOpen);
+    }
+
+    // A device is urgent if it changed lately, which for a tracker mostly
+    // means an asset moved, or if any of its assets reports a problem
+    bool isUrgentDevice(const std::string& key, const std::chrono::steady_clock::time_point now) {
+        if (const auto changes = lastChangeTimes.find(key); changes != lastChangeTimes.end()) {
+            for (const auto& [index, changed] : changes->second) {
+                if (now - changed < std::chrono::seconds(ROTATION_ACTIVITY_WINDOW_S)) return true;
+            }
+        }
+        if (const auto assets = knownDevices.find(key); assets != knownDevices.end()) {
+            for (const auto& [index, device] : assets->second) {
+                if (device.lowBattery || device.gpsLost || device.commsLost ||
+                    device.situation == AssetSituation::Treed) return true;
+            }
+        }
+        return false;
+    }
+
+    // Sends the channel ID and timing of the slot's device and opens it, all
+    // pipelined; onRotationEvent picks up the responses
+    void openRotationSlot(RotationSlot& slot) {
+        const Channel& ch = slot.device;
+        DSIFramerANT* framer = framerOf(slot.cNum);
+        const UCHAR local = localChannel(slot.cNum);
+        slot.pending = {
+            framer->SetChannelIDAsync(local, ch.dNum, ch.dType, ch.tType),
+            framer->SetChannelPeriodAsync(local, ch.period),
+            framer->SetChannelRFFrequencyAsync(local, ch.rfFreq),
+            framer->SetChannelSearchTimeoutAsync(local, ch.searchTimeout),
+            framer->OpenChannelAsync(local),
+        };
+        slot.state = SlotState::Opening;
+        slot.heard = false;
+        fine("[ROTATION] Slot #" + std::to_string(slot.cNum) + ": opening for device 0x" + toHexByte(ch.dNum));
+    }
+
+    // Gives the slot to another device, or to none if next is not a paired
+    // device. An open slot is closed first, and reconfigured once the stick
+    // reports the channel closed.
+    void swapRotationSlot(RotationSlot& slot, const Channel& next, const std::chrono::steady_clock::time_point now) {
+        slot.swapStart = now;
+        slot.device = next;
+        if (slot.state == SlotState::Idle) {
+            if (isPairedChannel(next)) openRotationSlot(slot);
+            return;
+        }
+        setChannelState(slot.cNum, false, {});
+        slot.pending = {framerOf(slot.cNum)->CloseChannelAsync(localChannel(slot.cNum))};
+        slot.state = SlotState::Closing;
+    }
+
+    // Releases the slot's pipelined commands, whose responses are all in by
+    // the time the last one is. Returns the first failure, if any.
+    UCHAR releaseRotationCommands(RotationSlot& slot, UCHAR* failedId = nullptr) {
+        if (slot.pending.empty()) return RESPONSE_NO_ERROR;
+        USHORT failed = MAX_USHORT;
+        const UCHAR result = framerOf(slot.cNum)->WaitForCommands(slot.pending.data(), static_cast<USHORT>(slot.pending.size()), 0, &failed);
+        if (failedId) {
+            static constexpr UCHAR openSequence[] = {
+                MESG_CHANNEL_ID_ID, MESG_CHANNEL_MESG_PERIOD_ID, MESG_CHANNEL_RADIO_FREQ_ID,
+                MESG_CHANNEL_SEARCH_TIMEOUT_ID, MESG_OPEN_CHANNEL_ID,
+            };
+            *failedId = failed < std::size(openSequence) ? openSequence[failed] : 0;
+        }
+        slot.pending.clear();
+        return result;
+    }
+
+    // Follows a rotation slot through a swap on the responses and channel
+    // events the stick sends for it
+    void onRotationEvent(const ANT_MESSAGE& msg) {
+        RotationSlot* slot = findRotationSlot(msg.aucData[0]);
+        if (!slot) return;
+        const auto now = std::chrono::steady_clock::now();
+        const UCHAR id = msg.aucData[1];
+        const UCHAR code = msg.aucData[2];
+
+        if (id == MESG_EVENT_ID && code == EVENT_CHANNEL_CLOSED) {
+            if (slot->state == SlotState::Closing) {
+                releaseRotationCommands(*slot);
+                if (isPairedChannel(slot->device)) openRotationSlot(*slot);
+                else slot->state = SlotState::Idle;
+            } else if (slot->state == SlotState::Open) {
+                // The stick gave up searching before the slice was over
+                pairedLastMissed[channelDeviceKey(slot->device)] = now;
+                rotationStats.missed++;
+                setChannelState(slot->cNum, false, {});
+                slot->state = SlotState::Idle;
+            }
+        } else if (id == MESG_CLOSE_CHANNEL_ID && code != RESPONSE_NO_ERROR && slot->state == SlotState::Closing) {
+            // Closed by a search timeout meanwhile, so no event is coming
+            releaseRotationCommands(*slot);
+            if (isPairedChannel(slot->device)) openRotationSlot(*slot);
+            else slot->state = SlotState::Idle;
+        } else if (id == MESG_OPEN_CHANNEL_ID && slot->state == SlotState::Opening) {
+            UCHAR failedId = 0;
+            if (const UCHAR result = releaseRotationCommands(*slot, &failedId); result != RESPONSE_NO_ERROR) {
+                error(commandName(failedId) + " failed for rotation slot #" + std::to_string(slot->cNum)
+                      + " (code 0x" + toHexByte(result) + ")");
+                slot->state = SlotState::Idle;
+                return;
+            }
+            const double ms = std::chrono::duration<double, std::milli>(now - slot->swapStart).count();
+            rotationStats.swaps++;
+            rotationStats.swapMs += ms;
+            rotationStats.swapMsMax = std::max(rotationStats.swapMsMax, ms);
+            slot->state = SlotState::Open;
+            slot->sliceStart = now;
+            setChannelState(slot->cNum, true, {});
+        }
+    }
+
+    // Counts the first broadcast of a slice as the device acquired, and keeps
+    // the device from counting as stale while it is heard
+    void onRotationMessage(const uint8_t channel, const std::chrono::steady_clock::time_point now) {
+        RotationSlot* slot = findRotationSlot(channel);
+        if (!slot || slot->state != SlotState::Open) return;
+        if (!slot->heard) {
+            slot->heard = true;
+            rotationStats.acquired++;
+            rotationStats.acquireMs += std::chrono::duration<double, std::milli>(now - slot->sliceStart).count();
+        }
+        pairedLastSeen[channelDeviceKey(slot->device)] = now;
+    }
+
+    // Ends the slices that are over and hands the free slots to the rotating
+    // devices furthest into their staleness budget. A device keeps its slot
+    // when nobody else is waiting.
+    void scheduleRotation(const std::chrono::steady_clock::time_point now) {
+        if (rotationSlots.empty() || scanMode || sticks.empty()) return;
+
+        std::set<std::string> inSlots;
+        std::vector<RotationSlot*> due;
+        for (auto& slot : rotationSlots) {
+            if (onLostStick(slot.cNum)) continue;
+            const std::string key = channelDeviceKey(slot.device);
+            const bool busy = slot.state == SlotState::Closing || slot.state == SlotState::Opening;
+            if (busy && now - slot.swapStart > std::chrono::milliseconds(MESSAGE_TIMEOUT)) {
+                warn("[ROTATION] Slot #" + std::to_string(slot.cNum) + ": no response from the stick, retrying");
+                releaseRotationCommands(slot);
+                // Unknown whether the channel is open, so close it again
+                slot.state = SlotState::Open;
+                slot.sliceStart = now - rotationSlice;
+                inSlots.insert(key);
+                continue;
+            }
+            if (busy) {
+                inSlots.insert(key);
+                continue;
+            }
+            if (slot.state == SlotState::Open) {
+                // The allocator found the device a channel of its own
+                const bool placed = std::any_of(channels.begin(), channels.end(), [&](const Channel& c) {
+                    return c.use && isPairedChannel(c) && channelDeviceKey(c) == key;
+                });
+                if (!placed && now - slot.sliceStart < rotationSlice) {
+                    inSlots.insert(key);
+                    continue;
+                }
+                if (!slot.heard) {
+                    pairedLastMissed[key] = now;
+                    rotationStats.missed++;
+                }
+            }
+            due.push_back(&slot);
+        }
+        if (due.empty()) return;
+
+        std::vector<RotationCandidate> candidates;
+        std::map<std::string, Channel> byKey;
+        for (const auto& c : channels) {
+            if (!isPairedChannel(c) || c.use) continue;
+            const std::string key = channelDeviceKey(c);
+            if (inSlots.contains(key)) continue;
+            auto since = rotationStarted;
+            if (const auto seen = pairedLastSeen.find(key); seen != pairedLastSeen.end()) since = std::max(since, seen->second);
+            if (const auto missed = pairedLastMissed.find(key); missed != pairedLastMissed.end()) since = std::max(since, missed->second);
+            candidates.push_back({key, now - since, isUrgentDevice(key, now)});
+            byKey[key] = c;
+        }
+        sortRotationCandidates(candidates, rotationBudgetS);
+
+        auto next = candidates.begin();
+        for (RotationSlot* slot : due) {
+            const bool open = slot->state == SlotState::Open;
+            if (next == candidates.end()) {
+                if (open && !byKey.contains(channelDeviceKey(slot->device))) {
+                    // Nobody left to rotate, so free the channel ID for its own channel
+                    swapRotationSlot(*slot, {}, now);
+                } else if (open) {
+                    slot->sliceStart = now;
+                }
+                continue;
+            }
+            if (open && next->key == channelDeviceKey(slot->device)) {
+                slot->sliceStart = now;
+                ++next;
+                continue;
+            }
+            if (next->stale > rotationBudget(*next, rotationBudgetS)) rotationStats.overBudget++;
+            auto& worst = rotationWorstStale[next->key];
+            worst = std::max(worst, next->stale);
+            swapRotationSlot(*slot, byKey[next->key], now);
+            ++next;
+        }
+    }
+
+    // Policy of the paired devices on the channel; search channels keep the
+    // fixed one
+    const ReacquirePolicy& channelReacquirePolicy(const uint8_t cNum) {
+        for (const auto& ch : channels) {
+            if (ch.cNum == cNum && ch.use && isPairedChannel(ch)) return reacquirePolicy(ch.dType);
+        }
+        return reacquirePolicy(0);
+    }
+
+    void checkChannelWatchdogs() {
+        const auto now = std::chrono::steady_clock::now();
+        std::vector<Channel> toReopen;
+
+        for (auto& entry : channelStates) {
+
+            ChannelState& state = entry.second;
+            if (!state.active) continue;
+
+            uint8_t channel = entry.first;
+            // The scheduler ends every slice on its own
+            if (isRotationSlot(channel)) continue;
+            // A scanning stick hears whatever is in range and never loses a
+            // device, so silence there says nothing about the channel
+            if (channelPool.role(channel) == ChannelRole::Scan) continue;
+
+            // With SDU on the stick a quiet channel just means nothing changed,
+            // so only the stick's events tell us the device is gone
+            const ReacquirePolicy& policy = channelReacquirePolicy(channel);
+            const auto durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - state.lastSeen).count();
+            if (!policy.reopen && !state.lost) {
+                // The stick keeps searching on its own; the channel is only
+                // reopened once a finite low priority search timeout ran out
+                if (!state.reacquiring && (state.sdu ? state.dropped : durationMs > policy.lostAfterMs)) {
+                    warn("[WATCHDOG] Channel #" + std::to_string(channel) +
+                         (state.sdu ? " lost its device" : " unresponsive for " + std::to_string(durationMs) + "ms")
+                         + ". Searching...");
+                    state.reacquiring = true;
+                    for (const auto& ch : channels) {
+                        if (ch.cNum != channel || !ch.use || !isPairedChannel(ch)) continue;
+                        pairedLastMissed[channelDeviceKey(ch)] = now;
+                        rebalancePending = true;
+                    }
+                }
+                continue;
+            }
+            if (state.sdu ? state.lost : durationMs > policy.lostAfterMs) {
+                warn("[WATCHDOG] Channel #" + std::to_string(channel) +
+                     (state.lost ? " lost its device" : " unresponsive for " + std::to_string(durationMs) + "ms")
+                     + ". Reinitializing...");
+
+                closeChannel(channel);
+                bool found = false;
+                for (const auto& ch : channels) {
+                    if (ch.cNum != channel || !ch.use) continue;
+                    toReopen.push_back(ch);
+                    found = true;
+                    // Its channel could serve other paired devices meanwhile
+                    if (isPairedChannel(ch)) {
+                        pairedLastMissed[channelDeviceKey(ch)] = now;
+                        rebalancePending = true;
+                        reacquireReopens[ch.dType]++;
+                    }
+                }
+                if (found) {
+                    state.lastSeen = now;  // Reset
+                    state.searchSince = now;
+                }
+            }
+        }
+
+        // Re-open every expired channel in one batch
+        if (scanMode) {
+            for (const auto& ch : toReopen) openScanChannel(ch);
+        } else {
+            openChannels(toReopen);
+        }
+
+        rebalancePairedChannels(now);
+        scheduleRotation(now);
+    }
+
+    // -------------------------------------------------
+    // Stick recovery
+    // -------------------------------------------------
+
+    // Takes the channels of a stick that was unplugged or whose serial failed
+    // out of use. The serial stays open, as the notice that a device was
+    // plugged in again comes through it.
+    void markStickLost(const size_t index) {
+        Stick& stick = sticks[index];
+        if (stick.lost) return;
+        stick.lost = true;
+        stick.arrived = false;
+        stick.lostAt = stick.lastAttempt = std::chrono::steady_clock::now();
+
+        size_t down = 0;
+        for (auto& [number, state] : channelStates) {
+            if (!state.active || channelPool.stickOf(number) != index) continue;
+            setChannelState(number, false, {});
+            ++down;
+        }
+        for (auto& slot : rotationSlots) {
+            if (channelPool.stickOf(slot.cNum) != index) continue;
+            releaseRotationCommands(slot);
+            slot.state = SlotState::Idle;
+        }
+        warn("Stick " + std::to_string(stick.deviceNumber) + " lost, " + std::to_string(down)
+             + " channel(s) down until it is back");
+    }
+
+    // Sets a reset stick up the way startup left it
+    bool restoreStickSetup(const Stick& stick) {
+        if (!setNetworkKey(stick) || !enableExtendedMessages(stick)) return false;
+        if (sduOnStick && !loadSelectiveUpdateMasks(stick)) return false;
+        if (eventBufferOnStick && !configureEventBuffer(stick)) return false;
+        if (highDutyOnStick && !enableHighDutySearch(stick)) return false;
+        return true;
+    }
+
+    // Reopens a lost stick and restores its setup and channels. The stick
+    // forgot both with the power, so it is reset, which only waits for its
+    // startup message, and configured again like at startup.
+    bool recoverStick(const size_t index) {
+        Stick& stick = sticks[index];
+        stick.lastAttempt = std::chrono::steady_clock::now();
+        stick.arrived = false;
+        if (!stick.serial->Open()) {
+            fine("Stick " + std::to_string(stick.deviceNumber) + " not back yet");
+            return false;
+        }
+        if (!stick.framer->ResetSystem(MESSAGE_TIMEOUT) || !restoreStickSetup(stick)) {
+            warn("Failed to set up stick " + std::to_string(stick.deviceNumber) + " again, retrying");
+            return false;
+        }
+        stick.lost = false;
+
+        std::vector<Channel> entries;
+        for (const auto& ch : channels) {
+            if (ch.use && channelPool.stickOf(ch.cNum) == index) entries.push_back(ch);
+        }
+        if (scanMode) {
+            for (const auto& ch : entries) openScanChannel(ch);
+        } else {
+            openChannels(entries);
         }
 
-        fine("Opening ANT channels...DONE");
-        if (!pclANT->RxExtMesgsEnable(TRUE)) {
-            error("Failed to enable extended message format mode");
-            return false;
+        // The scheduler opens the slots again once they are assigned
+        std::vector<ANT_CHANNEL_CONFIG> configs;
+        for (const auto& slot : rotationSlots) {
+            if (channelPool.stickOf(slot.cNum) != index) continue;
+            Channel ch = TRK_SEARCH_CH;
+            ch.cNum = slot.cNum;
+            ANT_CHANNEL_CONFIG cfg = toChannelConfig(ch);
+            cfg.bOpen = FALSE;
+            configs.push_back(cfg);
+        }
+        std::vector<UCHAR> results(configs.size()), failedIds(configs.size());
+        configureChannels(configs, results.data(), failedIds.data());
+        for (size_t i = 0; i < configs.size(); ++i) {
+            if (results[i] == RESPONSE_NO_ERROR) continue;
+            error(commandName(failedIds[i]) + " failed for rotation slot #" + std::to_string(configs[i].ucANTChannel)
+                  + " (code 0x" + toHexByte(results[i]) + ")");
         }
 
-        fine("Starting ANT+ discovery...DONE");
+        const size_t restored = std::count_if(channelStates.begin(), channelStates.end(), [&](const auto& entry) {
+            return entry.second.active && channelPool.stickOf(entry.first) == index;
+        });
+        const auto now = std::chrono::steady_clock::now();
+        const auto downMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - stick.lostAt);
+        const auto setupMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - stick.lastAttempt);
+        stick.recoveries++;
+        info("Stick " + std::to_string(stick.deviceNumber) + " back after " + std::to_string(downMs.count()) + " ms, "
+             + std::to_string(restored) + " channel(s) restored in " + std::to_string(setupMs.count()) + " ms");
         return true;
     }
 
-    bool searching = true;
-
-    void checkChannelWatchdogs() {
-        const auto now = std::chrono::steady_clock::now();
-
-        for (auto& entry : channelStates) {
-
-            ChannelState& state = entry.second;
-            if (!state.active) continue;
-
-            uint8_t channel = entry.first;
-
-            const auto durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - state.lastSeen).count();
-            if (durationMs > WATCHDOG_TIMEOUT_MS) {
-                warn("[WATCHDOG] Channel #" + std::to_string(channel) +
-                     " unresponsive for " + std::to_string(durationMs) + "ms. Reinitializing...");
-
-                closeChannel(channel);
-                const auto it = std::find_if(channels.begin(), channels.end(), [&](const Channel& ch) {
-                    return ch.cNum == channel;
-                });
-
-                if (it != channels.end()) {
-                    openChannel(*it);
-                    state.lastSeen = now;  // Reset
-                }
-            }
+    // Tries the lost sticks again, right away once a device was plugged in
+    // and otherwise every STICK_RETRY_MS, for serials that cannot tell
+    void recoverSticks(const std::chrono::steady_clock::time_point now) {
+        for (size_t k = 0; k < sticks.size(); ++k) {
+            const Stick& stick = sticks[k];
+            if (!stick.lost) continue;
+            if (stick.arrived || now - stick.lastAttempt >= std::chrono::milliseconds(STICK_RETRY_MS)) recoverStick(k);
         }
     }
 
     void cleanup() {
         searching = false;
-        savePairedChannels();
+        // Scan mode never pairs, so leave the stored channels alone
+        if (!scanMode) {
+            savePairedChannels();
+        }
         if (mqttCfg.enabled) {
             mqtt.stop();
             ant::info("Stopped MQTT client");
         }
-        if (pclANT) {
+        const bool framersUp = !sticks.empty() && std::all_of(sticks.begin(), sticks.end(), [](const Stick& stick) {
+            return stick.framer != nullptr;
+        });
+        if (framersUp) {
             info("Closing ANT channels...");
             for (const auto& ch : channels) {
                 if (!ch.use) {
@@ -794,22 +2262,37 @@ namespace ant {
                 }
                 closeChannel(ch.cNum);
             }
+            for (const auto& slot : rotationSlots) {
+                closeChannel(slot.cNum);
+            }
             fine("Closing ANT channels...DONE");
 
             info("ANT system reset...");
-            if(!pclANT->ResetSystem()) {
-                error("Failed to reset ANT System");
-            } else {
-                fine("ANT system reset...DONE");
+            for (const Stick& stick : sticks) {
+                if (stick.lost) continue;
+                if(!stick.framer->ResetSystem()) {
+                    error("Failed to reset ANT System");
+                } else {
+                    fine("ANT system reset...DONE");
+                }
             }
         }
 
-        if (pclSerial) {
+        for (const Stick& stick : sticks) {
+            if (!stick.serial) continue;
             info("Closing USB port...");
-            pclSerial->Close();
+            stick.serial->Close();
             fine("Closing USB port...DONE");
         }
 
+        // Only once the receive threads have stopped, so none is still recording
+        stopCapture();
+
+        // Writes out the serial traces still queued for the debug writer thread
+        if (DSIDebug::GetDroppedRecords() > 0) {
+            warn("Dropped " + std::to_string(DSIDebug::GetDroppedRecords()) + " debug trace records, the log rings were full");
+        }
+        DSIDebug::Close();
     }
 
     // -------------------------------------------------
@@ -828,6 +2311,19 @@ namespace ant {
 
         if (ExtendedInfo ext; parseExtendedInfo(data, length, ext)) {
             setChannelState(channel, true, ext);
+            if (ext.hasDeviceId && findChannelByNumber(channel) && isPairedChannel(*findChannelByNumber(channel))) {
+                const std::string key = makeDeviceKey(ext);
+                pairedLastSeen[key] = channelStates[channel].lastSeen;
+                if (channelStates[channel].listSize > 0) {
+                    sharedMessages[key]++;
+                    // Tracking this device keeps the channel from the rest of its list
+                    rebalancePending = true;
+                } else {
+                    dedicatedMessages[key]++;
+                }
+            } else if (ext.hasDeviceId && isRotationSlot(channel)) {
+                rotatedMessages[makeDeviceKey(ext)]++;
+            }
             oss << " | Flags: 0x" << toHexByte(ext.flags);
             oss << " | " << formatDeviceChannelID(ext);
         } else {
@@ -1238,10 +2734,21 @@ namespace ant {
         if (recentPageRequests.contains(key)) {
             return false;
         }
-        recentPageRequests.insert(key);
+        recentPageRequests.emplace(key, std::chrono::steady_clock::now());
         return true;
     }
 
+    // Forget page requests older than PAGE_REQUEST_EXPIRY_S so they are sent again
+    void expirePageRequests(const std::chrono::steady_clock::time_point now) {
+        for (auto it = recentPageRequests.begin(); it != recentPageRequests.end();) {
+            if (now - it->second > std::chrono::seconds(PAGE_REQUEST_EXPIRY_S)) {
+                it = recentPageRequests.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
     void clearRequestCacheFor(const Device& d) {
         const std::string prefix = makeDeviceKey(d.ext) + ":";
         for (const int page : {0x10, 0x11}) {
@@ -1259,7 +2766,7 @@ namespace ant {
             oss << "[CH] #" << std::to_string(channel) << ": "
                 << "[SendBroadcastData] Data Page 0x" << toHexByte(page) << attempt;
 
-            const bool status = pclANT->SendBroadcastData(channel, data);
+            const bool status = framerOf(channel)->SendBroadcastData(localChannel(channel), data);
 
             if (status) {
                 oss << " | OK";
@@ -1267,7 +2774,7 @@ namespace ant {
                 return true;
             }
 
-            const UCHAR e = pclANT->GetLastError();
+            const UCHAR e = framerOf(channel)->GetLastError();
             oss << " | FAILED with 0x" << toHexByte(e)
                 << " (attempt " << retries+1 << " of " << maxAttempts <<")"
                 << " | " << "Raw Payload (8): " << toHex(data, 8);
@@ -1291,7 +2798,7 @@ namespace ant {
             oss << "[CH] #" << std::to_string(channel) << ": "
                 << "[SendAcknowledgedData] Data Page 0x" << toHexByte(page) << attempt;
 
-            const bool status = pclANT->SendAcknowledgedData(channel, data, MESSAGE_TIMEOUT);
+            const bool status = framerOf(channel)->SendAcknowledgedData(localChannel(channel), data, MESSAGE_TIMEOUT);
 
             if (status) {
                 oss << " | OK";
@@ -1299,7 +2806,7 @@ namespace ant {
                 return true;
             }
 
-            const UCHAR e = pclANT->GetLastError();
+            const UCHAR e = framerOf(channel)->GetLastError();
             oss << " | FAILED with 0x" << toHexByte(e)
                 << " (attempt " << retries+1 << " of " << std::to_string(maxAttempts) <<")"
                 << " | " << "Raw Payload (0): " << toHex(data, 8);
@@ -1311,7 +2818,12 @@ namespace ant {
         return false;
     }
 
+    // The stick refuses to transmit on the scan channel (INVALID_SCAN_TX_CHANNEL),
+    // so in scan mode pages arrive only as the devices send them on their own
     bool sendRequestDataPage(const uint8_t channel, uint8_t* data) {
+        if (scanMode) {
+            return false;
+        }
         return sendAcknowledgedRequestDataPage(channel, data);
     }
 
@@ -1868,7 +3380,16 @@ namespace ant {
         const UCHAR* d = msg.aucData;
         onBroadcastMessage(msg.ucMessageID, d, length);
 
-        switch (detectProfile(d)) {
+        const AntProfile profile = detectProfile(d);
+
+        // Everything on the air arrives on the scan channel; keep only the
+        // profiles asked for. Without a channel ID there is no telling
+        // devices apart, so such messages are dropped as well.
+        if (scanMode && std::find(searchTypes.begin(), searchTypes.end(), profile) == searchTypes.end()) {
+            return;
+        }
+
+        switch (profile) {
             case AntProfile::HeartRate:
                 onHeartRateMessage(d, length);
                 break;
@@ -1881,33 +3402,56 @@ namespace ant {
         }
     }
 
-    void runEventLoop() {
-        info("Starting event loop...");
-        auto lastMessageTime = std::chrono::steady_clock::now();
-        while (searching) {
-            auto now = std::chrono::steady_clock::now();
-            const USHORT length = pclANT->WaitForMessage(MESSAGE_TIMEOUT);
-
-            if (!searching) return;
-
-            if (length == DSI_FRAMER_TIMEDOUT || length == 0) {
-                const auto secondsSinceLast = std::chrono::duration_cast<std::chrono::seconds>(now - lastMessageTime).count();
-                if (secondsSinceLast > 5) {
-                    std::ostringstream oss;
-                    oss << "No ANT messages received in the last "
-                        << secondsSinceLast
-                        << " seconds";
-                    info(oss.str());
-                    lastMessageTime = now;
-                }
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
-            }
+    // Records how long a timestamped broadcast spent between the radio and the
+    // host, in the stick's 32768 Hz clock
+    void sampleHoldTime(const UCHAR* d, const UCHAR length, const std::chrono::steady_clock::time_point arrival) {
+        if (!isRxTimestampExt(d)) return;
+
+        ExtendedInfo ext;
+        if (!parseExtendedInfo(d, length, ext) || !ext.hasRxTsValue) return;
+
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(arrival.time_since_epoch()).count();
+        const auto delta = static_cast<uint16_t>(static_cast<uint16_t>(us * 32768 / 1000000) - ext.rxTs.value);
+        if (bufferStats.timestamped++ == 0) {
+            bufferStats.reference = delta;
+        }
+        const int32_t held = static_cast<int16_t>(delta - bufferStats.reference);
+        bufferStats.sum += held;
+        bufferStats.min = bufferStats.timestamped == 1 ? held : std::min(bufferStats.min, held);
+        bufferStats.max = bufferStats.timestamped == 1 ? held : std::max(bufferStats.max, held);
+    }
+
+    // Records how long a dedicated paired channel searched before it heard
+    // its device again. Devices on shared channels and in rotation slots are
+    // heard in turns, and SDU on the stick hides when the search ends, so
+    // only dedicated channels without SDU are sampled.
+    void noteLinkMessage(const UCHAR* d, const UCHAR length, const std::chrono::steady_clock::time_point now) {
+        const uint8_t channel = d[0];
+        ChannelState& state = channelStates[channel];
+        state.dropped = false;
+        state.reacquiring = false;
 
-            ANT_MESSAGE msg;
-            pclANT->GetMessage(&msg);
-            if (!searching) return;
+        const auto searchSince = std::exchange(state.searchSince, {});
+        if (searchSince == std::chrono::steady_clock::time_point{}) return;
+
+        ExtendedInfo ext;
+        if (!parseExtendedInfo(d, length, ext) || !ext.hasDeviceId) return;
+        if (!state.active || state.sdu || state.listSize > 0 || isRotationSlot(channel)) return;
+        if (const Channel* ch = findChannelByNumber(channel); !ch || !isPairedChannel(*ch)) return;
+        reacquireHistograms[ext.deviceId.dType].add(std::chrono::duration<double, std::milli>(now - searchSince).count());
+    }
 
+    // -----------------------------------------------------------------------------
+    // processMessages
+    //
+    // Handles one batch drained from a framer. Returns true if the batch held
+    // at least one broadcast data message.
+    // -----------------------------------------------------------------------------
+    bool processMessages(const ANT_MESSAGE_ITEM* batch, const USHORT count) {
+        bool broadcastSeen = false;
+        for (USHORT i = 0; i < count && searching; ++i) {
+            const ANT_MESSAGE &msg = batch[i].stANTMessage;
+            const UCHAR length = batch[i].ucSize;
             const UCHAR ucMessageID = msg.ucMessageID;
 
             if (ucMessageID == 0) {
@@ -1916,6 +3460,13 @@ namespace ant {
 
             if (ucMessageID == MESG_EVENT_ID ||
                 ucMessageID == MESG_RESPONSE_EVENT_ID) {
+                if (msg.aucData[1] == MESG_EVENT_ID && msg.aucData[2] == EVENT_RX_SEARCH_TIMEOUT) {
+                    channelStates[msg.aucData[0]].lost = true;
+                } else if (msg.aucData[1] == MESG_EVENT_ID && msg.aucData[2] == EVENT_RX_FAIL_GO_TO_SEARCH) {
+                    channelStates[msg.aucData[0]].dropped = true;
+                    channelStates[msg.aucData[0]].searchSince = std::chrono::steady_clock::now();
+                }
+                onRotationEvent(msg);
                 continue;
             }
 
@@ -1929,11 +3480,709 @@ namespace ant {
             if (ucMessageID == MESG_BROADCAST_DATA_ID ||
                 ucMessageID == MESG_EXT_BROADCAST_DATA_ID) {
 
-                lastMessageTime = now;
+                lastMessageTime = std::chrono::steady_clock::now();
+                broadcastSeen = true;
+                sampleHoldTime(msg.aucData, length, lastMessageTime);
+                onRotationMessage(msg.aucData[0], lastMessageTime);
+                noteLinkMessage(msg.aucData, length, lastMessageTime);
+
+                // A repeat still shows the channel and its device are alive
+                if (isUnchangedPage(msg.aucData, length)) {
+                    onBroadcastMessage(msg.ucMessageID, msg.aucData, length);
+                    continue;
+                }
+                dispatchedMessages++;
                 dispatchBroadcastDataMessage(msg, length);
+            }
+        }
+        return broadcastSeen;
+    }
+
+    void warnFramerError(const ANT_MESSAGE_ITEM& item) {
+        std::ostringstream oss;
+        oss << "ANT framer error (code = 0x" << toHexByte(item.stANTMessage.ucMessageID) << ")";
+        warn(oss.str());
+    }
+
+    // A stick that went away is taken out of use until it is back. The
+    // framer keeps only the last serial error, so a stick may be plugged in
+    // again before its loss was seen.
+    void onFramerError(const size_t index, const ANT_MESSAGE_ITEM& item) {
+        if (item.stANTMessage.ucMessageID != DSI_FRAMER_ANT_ESERIAL || pclReplay) {
+            warnFramerError(item);
+            return;
+        }
+        switch (item.stANTMessage.aucData[0]) {
+            case DSI_SERIAL_DEVICE_GONE:
+            case DSI_SERIAL_EREAD:
+                markStickLost(index);
+                break;
+            case DSI_SERIAL_DEVICE_ARRIVED:
+                markStickLost(index);
+                sticks[index].arrived = true;
+                recoverStick(index);
+                break;
+            default:
+                warnFramerError(item);
+        }
+    }
+
+    // The device a broadcast came from, with the RSSI it was heard at, if
+    // its trailer carries the channel ID
+    std::optional<uint64_t> broadcastDevice(const ANT_MESSAGE_ITEM& item, int8_t& rssi) {
+        const ANT_MESSAGE& msg = item.stANTMessage;
+        if (msg.ucMessageID != MESG_BROADCAST_DATA_ID && msg.ucMessageID != MESG_EXT_BROADCAST_DATA_ID) return {};
+
+        ExtendedInfo ext;
+        if (!parseExtendedInfo(msg.aucData, item.ucSize, ext) || !ext.hasDeviceId) return {};
+        rssi = ext.hasRssiValue ? ext.rssi.value : INT8_MIN;
+        return static_cast<uint64_t>(ext.deviceId.number) << 16
+            | static_cast<uint64_t>(ext.deviceId.dType) << 8
+            | ext.deviceId.tType;
+    }
+
+    // The 8 payload bytes of a broadcast, after its channel number
+    uint64_t broadcastPayload(const ANT_MESSAGE_ITEM& item) {
+        uint64_t payload = 0;
+        for (int i = 1; i <= 8; ++i) payload = payload << 8 | item.stANTMessage.aucData[i];
+        return payload;
+    }
+
+    // True if the first data byte of the message is its channel number
+    bool hasChannelNumber(const UCHAR ucMessageID) {
+        switch (ucMessageID) {
+            case MESG_EVENT_ID:
+            case MESG_RESPONSE_EVENT_ID:
+            case MESG_BROADCAST_DATA_ID:
+            case MESG_ACKNOWLEDGED_DATA_ID:
+            case MESG_EXT_BROADCAST_DATA_ID:
+            case MESG_EXT_ACKNOWLEDGED_DATA_ID:
+            case MESG_CHANNEL_ID_ID:
+            case MESG_CHANNEL_STATUS_ID:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Translates the channel numbers in messages from a stick to logical
+    // ones. Messages without a channel number are left alone.
+    void toLogicalChannels(const size_t stick, ANT_MESSAGE_ITEM* batch, const USHORT count) {
+        const uint8_t first = channelPool.firstOf(stick);
+        if (first == 0) return;
+        for (USHORT i = 0; i < count; ++i) {
+            ANT_MESSAGE& msg = batch[i].stANTMessage;
+            if (hasChannelNumber(msg.ucMessageID)) {
+                msg.aucData[0] = static_cast<UCHAR>(msg.aucData[0] + first);
+            }
+        }
+    }
+
+    // Queues messages from a stick in the merge queue. A broadcast held for
+    // the same device and payload from another stick is a copy of it, and
+    // the stronger of the two is kept.
+    void mergeMessages(const size_t stick, const ANT_MESSAGE_ITEM* batch, const USHORT count,
+                       const std::chrono::steady_clock::time_point now) {
+        for (USHORT i = 0; i < count; ++i) {
+            MergedMessage merged{batch[i], now, stick};
+            int8_t rssi = INT8_MIN;
+            if (const auto device = broadcastDevice(batch[i], rssi)) {
+                const auto key = std::make_pair(*device, broadcastPayload(batch[i]));
+                if (const auto it = mergeHeld.find(key); it != mergeHeld.end()) {
+                    MergedMessage& held = mergeQueue[it->second - mergeFront];
+                    if (held.stick != stick) {
+                        if (rssi > held.rssi) {
+                            sticks[held.stick].duplicates++;
+                            held.item = batch[i];
+                            held.stick = stick;
+                            held.rssi = rssi;
+                        } else {
+                            sticks[stick].duplicates++;
+                        }
+                        continue;
+                    }
+                }
+                merged.due = now + std::chrono::milliseconds(MERGE_WINDOW_MS);
+                merged.device = device;
+                merged.payload = key.second;
+                merged.rssi = rssi;
+                mergeHeld[key] = mergeFront + mergeQueue.size();
+            }
+            mergeQueue.push_back(merged);
+        }
+    }
+
+    // Hands the queued messages whose wait is over to processMessages, in the
+    // order they arrived. Returns true if they held a broadcast.
+    bool flushMergedMessages(const std::chrono::steady_clock::time_point now) {
+        static ANT_MESSAGE_ITEM batch[MESSAGE_BATCH_SIZE];
+        USHORT count = 0;
+        bool broadcastSeen = false;
+        while (!mergeQueue.empty() && mergeQueue.front().due <= now) {
+            const MergedMessage& merged = mergeQueue.front();
+            if (merged.device) {
+                const auto it = mergeHeld.find(std::make_pair(*merged.device, merged.payload));
+                if (it != mergeHeld.end() && it->second == mergeFront) {
+                    mergeHeld.erase(it);
+                }
+                sticks[merged.stick].devices.insert(*merged.device);
+            }
+            batch[count++] = merged.item;
+            mergeQueue.pop_front();
+            mergeFront++;
+            if (count == MESSAGE_BATCH_SIZE || mergeQueue.empty() || mergeQueue.front().due > now) {
+                broadcastSeen |= processMessages(batch, count);
+                mergedMessages += count;
+                count = 0;
+            }
+        }
+        return broadcastSeen;
+    }
+
+    // Hands the queued messages up to the last one on the channel to
+    // processMessages without waiting for copies, so a control message for
+    // the channel is not handled before data that arrived ahead of it.
+    // Returns true if they held a broadcast.
+    bool flushMergedChannel(const uint8_t channel) {
+        size_t last = mergeQueue.size();
+        for (size_t i = mergeQueue.size(); i-- > 0;) {
+            const ANT_MESSAGE& msg = mergeQueue[i].item.stANTMessage;
+            if (hasChannelNumber(msg.ucMessageID) && msg.aucData[0] == channel) {
+                last = i;
+                break;
+            }
+        }
+        if (last == mergeQueue.size()) return false;
+
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i <= last; ++i) {
+            mergeQueue[i].due = std::min(mergeQueue[i].due, now);
+        }
+        return flushMergedMessages(now);
+    }
+
+    // Milliseconds until the next queued message is due, -1 if none is queued
+    int mergeWaitMs(const std::chrono::steady_clock::time_point now) {
+        if (mergeQueue.empty()) return -1;
+        const auto wait = std::chrono::ceil<std::chrono::milliseconds>(mergeQueue.front().due - now).count();
+        return static_cast<int>(std::max<int64_t>(wait, 0));
+    }
+
+    // Adds the time the control messages of a drained batch waited in the
+    // framer to controlStats
+    void measureControlLatency(const ANT_MESSAGE_ITEM* batch, const ULLONG* queuedUs, const USHORT count) {
+        const auto nowUs = static_cast<ULLONG>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        for (USHORT i = 0; i < count; ++i) {
+            const ANT_MESSAGE& msg = batch[i].stANTMessage;
+            if (!DSIFramerANT::IsControlMessage(msg.ucMessageID, msg.aucData[1])) continue;
+            const uint64_t waitUs = nowUs > queuedUs[i] ? nowUs - queuedUs[i] : 0;
+            controlStats.events++;
+            controlStats.sumUs += waitUs;
+            controlStats.maxUs = std::max(controlStats.maxUs, waitUs);
+        }
+    }
+
+    // Takes a batch drained from a stick: straight to processMessages with a
+    // single stick, into the merge queue with more. Returns true if a
+    // broadcast was processed.
+    // With the control lane the batch starts with the stick's control
+    // messages, which have no copies to wait for and are processed at once.
+    bool receiveMessages(const size_t index, ANT_MESSAGE_ITEM* batch, const USHORT count) {
+        Stick& stick = sticks[index];
+        stick.messages += count;
+        if (sticks.size() > 1) {
+            toLogicalChannels(index, batch, count);
+            USHORT control = 0;
+            while (controlLane && control < count
+                   && DSIFramerANT::IsControlMessage(batch[control].stANTMessage.ucMessageID, batch[control].stANTMessage.aucData[1])) {
+                ++control;
+            }
+            bool broadcastSeen = false;
+            for (USHORT i = 0; i < control; ++i) {
+                const ANT_MESSAGE& msg = batch[i].stANTMessage;
+                if (hasChannelNumber(msg.ucMessageID)) broadcastSeen |= flushMergedChannel(msg.aucData[0]);
+            }
+            if (control > 0) {
+                broadcastSeen |= processMessages(batch, control);
+                mergedMessages += control;
+            }
+            mergeMessages(index, batch + control, count - control, std::chrono::steady_clock::now());
+            return broadcastSeen;
+        }
+        for (USHORT i = 0; i < count; ++i) {
+            int8_t rssi;
+            if (const auto device = broadcastDevice(batch[i], rssi)) stick.devices.insert(*device);
+        }
+        mergedMessages += count;
+        return processMessages(batch, count);
+    }
+
+    void logSilence(const std::chrono::steady_clock::time_point now) {
+        const auto secondsSinceLast = std::chrono::duration_cast<std::chrono::seconds>(now - lastMessageTime).count();
+        if (secondsSinceLast > 5) {
+            std::ostringstream oss;
+            oss << "No ANT messages received in the last "
+                << secondsSinceLast
+                << " seconds";
+            info(oss.str());
+            lastMessageTime = now;
+        }
+    }
+
+    // Reports how long control messages, like command responses and requested
+    // messages, waited in the framers before the event loop took them, and the
+    // broadcasts the framers dropped to keep their data lane from filling up.
+    // A replay reports the rest when it completes.
+    void reportControlLatency(const std::chrono::steady_clock::time_point now, const bool final = false) {
+        static auto lastReport = now;
+        const double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if ((seconds < 10 && !final) || controlStats.events == 0) return;
+
+        ULONG dropped = 0;
+        for (const Stick& stick : sticks) {
+            if (stick.framer) dropped += stick.framer->GetDroppedDataMessages();
+        }
+        std::ostringstream oss;
+        oss << "Control lane " << (controlLane ? "on" : "off") << ": " << std::fixed << std::setprecision(1)
+            << controlStats.events << " control message(s), waited "
+            << std::setprecision(2) << controlStats.sumUs / 1000.0 / controlStats.events << " ms avg, "
+            << controlStats.maxUs / 1000.0 << " ms max, " << dropped << " broadcast(s) dropped";
+        fine(oss.str());
+        lastReport = now;
+        controlStats = {};
+    }
+
+    // Ends the event loop once a replay has been delivered and every replayed
+    // message has been processed, reporting the end-to-end message rate
+    void checkReplay() {
+        if (!pclReplay || !pclReplay->IsComplete() || sticks.front().framer->GetBacklog() > 0) return;
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStarted).count();
+        const ULONG messages = pclReplay->GetReplayedMessages();
+        std::ostringstream oss;
+        oss << "Replay complete: " << messages << " messages in " << std::fixed << std::setprecision(3) << seconds
+            << "s (" << static_cast<uint64_t>(seconds > 0 ? messages / seconds : 0) << " msg/s)";
+        info(oss.str());
+        reportControlLatency(std::chrono::steady_clock::now(), true);
+        searching = false;
+    }
+
+    // Reports how many broadcasts the emulated sticks have generated, so the
+    // rate the discovery keeps up with can be compared against the load
+    void reportEmulation(const std::chrono::steady_clock::time_point now) {
+        static auto lastReport = now;
+        static ULONG lastMessages = 0;
+        static uint64_t lastDispatched = 0;
+        if (!emulate || sticks.empty() || !sticks.front().emulator) return;
+
+        const double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if (seconds < 10) return;
+
+        ULONG messages = 0;
+        ULONG backlog = 0;
+        for (const Stick& stick : sticks) {
+            messages += stick.emulator->GetGeneratedMessages();
+            backlog += stick.framer->GetBacklog();
+        }
+        std::ostringstream oss;
+        oss << "Emulated " << sticks.front().emulator->GetFleetSize() << " devices";
+        if (sticks.size() > 1) oss << " on " << sticks.size() << " sticks";
+        oss << ": " << messages << " messages ("
+            << static_cast<uint64_t>((messages - lastMessages) / seconds) << " msg/s), "
+            << static_cast<uint64_t>((dispatchedMessages - lastDispatched) / seconds) << " dispatched/s, backlog "
+            << backlog;
+        info(oss.str());
+        lastReport = now;
+        lastMessages = messages;
+        lastDispatched = dispatchedMessages;
+    }
+
+    // Reports the broadcast rate per paired device on dedicated and on shared
+    // channels, and in rotation slots. A shared channel only hears the device
+    // it is tracking and a slot the device whose turn it is, so their rates are
+    // averaged over every device on a shared channel or in a slot that was heard.
+    void reportPairedThroughput(const std::chrono::steady_clock::time_point now) {
+        static auto lastReport = now;
+        const double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if (seconds < 60 || (dedicatedMessages.empty() && sharedMessages.empty() && rotatedMessages.empty())) return;
+
+        const auto perDevice = [&](const std::map<std::string, uint64_t>& counts) {
+            uint64_t total = 0;
+            for (const auto& [key, count] : counts) total += count;
+            return counts.empty() ? 0.0 : total / seconds / counts.size();
+        };
+        std::ostringstream oss;
+        oss << "Paired throughput: " << std::fixed << std::setprecision(1)
+            << dedicatedMessages.size() << " dedicated device(s) at " << perDevice(dedicatedMessages) << " msg/s, "
+            << sharedMessages.size() << " shared device(s) at " << perDevice(sharedMessages) << " msg/s";
+        if (!rotationSlots.empty()) {
+            oss << ", " << rotatedMessages.size() << " rotated device(s) at " << perDevice(rotatedMessages) << " msg/s";
+        }
+        info(oss.str());
+        lastReport = now;
+        dedicatedMessages.clear();
+        sharedMessages.clear();
+        rotatedMessages.clear();
+    }
+
+    // Reports how long slot swaps took and how stale the rotating devices got.
+    // A device over budget waited longer than its staleness budget for a slot.
+    void reportRotation(const std::chrono::steady_clock::time_point now) {
+        static auto lastReport = now;
+        if (rotationSlots.empty() || now - lastReport < std::chrono::seconds(60)) return;
+
+        std::ostringstream oss;
+        oss << "Rotation: " << std::fixed << std::setprecision(1) << rotationStats.swaps << " swap(s)";
+        if (rotationStats.swaps > 0) {
+            oss << " in " << rotationStats.swapMs / rotationStats.swaps << " ms avg, "
+                << rotationStats.swapMsMax << " ms max";
+        }
+        if (rotationStats.acquired > 0) {
+            oss << ", acquired in " << rotationStats.acquireMs / rotationStats.acquired << " ms avg";
+        }
+        oss << ", " << rotationStats.missed << " slice(s) without a message, "
+            << rotationStats.overBudget << " slot(s) given over budget";
+        info(oss.str());
+        for (const auto& [key, worst] : rotationWorstStale) {
+            fine("Rotation: device " + key + " waited up to "
+                 + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(worst).count()) + " s for a slot");
+        }
+        lastReport = now;
+        rotationStats = {};
+        rotationWorstStale.clear();
+    }
+
+    // Reports how often the host woke up for messages and how long the stick
+    // held them. Hold times are relative to the freshest message of the
+    // period, which is delivered right away even when buffering
+    void reportEventBuffer(const std::chrono::steady_clock::time_point now) {
+        static auto lastReport = now;
+        const double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if (seconds < 10 || bufferStats.wakeups == 0) return;
+
+        std::ostringstream oss;
+        oss << "Event buffer " << (eventBufferOnStick ? "on" : "off") << ": " << std::fixed << std::setprecision(1)
+            << bufferStats.wakeups / seconds << " wake-ups/s, "
+            << static_cast<double>(bufferStats.messages) / bufferStats.wakeups << " messages per wake-up";
+        if (bufferStats.timestamped > 0) {
+            const double avg = static_cast<double>(bufferStats.sum) / bufferStats.timestamped - bufferStats.min;
+            oss << ", held " << avg * 1000 / 32768 << " ms avg, "
+                << (bufferStats.max - bufferStats.min) * 1000.0 / 32768 << " ms max";
+        }
+        if (eventBufferOnStick) info(oss.str());
+        else fine(oss.str());
+        lastReport = now;
+        bufferStats = {};
+    }
+
+    // Reports per USB stick how quickly its receive transfers went back on
+    // the endpoint once they completed, and how long the endpoint was left
+    // without any, in which the stick has to hold on to what it received.
+    // Then how many writes went out per transfer, and how often writers
+    // had to wait for the queue.
+    void reportUsb(const std::chrono::steady_clock::time_point now) {
+        static auto lastReport = now;
+        if (now - lastReport < std::chrono::seconds(10)) return;
+
+        for (const Stick& stick : sticks) {
+            USB_RX_STATS stats;
+            if (!stick.usb || !stick.usb->GetRxStats(stats)) continue;
+            std::ostringstream oss;
+            oss << "USB receive on stick " << static_cast<int>(stick.deviceNumber) << ": "
+                << stats.ulTransfersCompleted << " transfer(s), " << stats.ulTransferErrors << " error(s), resubmitted in "
+                << stats.ulTurnaroundAvgUs << " us avg, " << stats.ulTurnaroundMaxUs << " us max, endpoint idle "
+                << stats.ulIdleCount << " time(s) for " << stats.ulIdleTotalUs / 1000 << " ms in all";
+            fine(oss.str());
+        }
+        for (const Stick& stick : sticks) {
+            USB_TX_STATS stats;
+            if (!stick.usb || !stick.usb->GetTxStats(stats)) continue;
+            std::ostringstream oss;
+            oss << "USB transmit on stick " << static_cast<int>(stick.deviceNumber) << ": "
+                << stats.ulWrites << " write(s) in " << stats.ulTransfers << " transfer(s), "
+                << stats.ulTransferErrors << " error(s), queue full " << stats.ulQueueFullWaits << " time(s)";
+            fine(oss.str());
+        }
+        lastReport = now;
+    }
+
+    // Reports per stick the messages it received, the devices whose copies it
+    // kept and its copies dropped for a stronger one from another stick, and
+    // what the merged pipeline made of them. Runs with a stick more or less
+    // show what each stick adds.
+    void reportSticks(const std::chrono::steady_clock::time_point now) {
+        static auto lastReport = now;
+        const double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if (seconds < 60 || sticks.empty()) return;
+
+        std::unordered_set<uint64_t> devices;
+        uint64_t messages = 0;
+        for (size_t k = 0; k < sticks.size(); ++k) {
+            Stick& stick = sticks[k];
+            if (sticks.size() > 1) {
+                const int last = (k + 1 < sticks.size() ? channelPool.firstOf(k + 1) : channelPool.size()) - 1;
+                std::ostringstream oss;
+                oss << "Stick " << static_cast<int>(stick.deviceNumber) << " (channels #"
+                    << static_cast<int>(channelPool.firstOf(k)) << "-#" << last << "): " << std::fixed << std::setprecision(1)
+                    << stick.messages / seconds << " msg/s, " << stick.devices.size() << " device(s) heard best, "
+                    << stick.duplicates << " weaker cop(ies) dropped";
+                if (stick.recoveries) oss << ", recovered " << stick.recoveries << " time(s)";
+                if (stick.lost) oss << ", lost";
+                info(oss.str());
+            }
+            devices.insert(stick.devices.begin(), stick.devices.end());
+            messages += stick.messages;
+            stick.messages = 0;
+            stick.duplicates = 0;
+            stick.devices.clear();
+        }
+        std::ostringstream oss;
+        oss << "Receiving on " << sticks.size() << " stick(s): " << devices.size() << " device(s) tracked, "
+            << std::fixed << std::setprecision(1) << messages / seconds << " msg/s received, "
+            << mergedMessages / seconds << " msg/s after merging";
+        info(oss.str());
+        lastReport = now;
+        mergedMessages = 0;
+    }
+
+#ifdef __linux__
+
+    // -----------------------------------------------------------------------------
+    // runEventLoop (epoll)
+    //
+    // A single thread waits on every framer's event fd, a periodic timerfd that
+    // drives watchdogs, page re-requests and MQTT housekeeping, and the MQTT
+    // socket. Messages are handled as soon as a receive thread queues them,
+    // or with several sticks once their wait in the merge queue is over.
+    // -----------------------------------------------------------------------------
+
+    void drainStick(const size_t index) {
+        static ANT_MESSAGE_ITEM batch[MESSAGE_BATCH_SIZE];
+        static ULLONG queuedUs[MESSAGE_BATCH_SIZE];
+        DSIFramerANT* framer = sticks[index].framer;
+        uint64_t drained = 0;
+        // Reset the event before draining so anything queued meanwhile re-arms it
+        framer->ClearEvent();
+        while (searching) {
+            const USHORT count = framer->GetMessages(batch, MESSAGE_BATCH_SIZE, 0, queuedUs);
+            if (count == DSI_FRAMER_ERROR) {
+                onFramerError(index, batch[0]);
+                continue;
+            }
+            if (count == 0) {
+                break;
+            }
+            measureControlLatency(batch, queuedUs, count);
+            receiveMessages(index, batch, count);
+            drained += count;
+        }
+        // A whole buffered burst is drained in this one pass
+        if (drained > 0) {
+            bufferStats.wakeups++;
+            bufferStats.messages += drained;
+        }
+        checkReplay();
+    }
+
+    // Reports the reacquisition times per device type since start, with the
+    // policy they were brought back by and the channel reopens that took
+    void reportReacquisition(const std::chrono::steady_clock::time_point now) {
+        static auto lastReport = now;
+        if (now - lastReport < std::chrono::seconds(60) || reacquireHistograms.empty()) return;
+        lastReport = now;
+
+        for (const auto& [dType, histogram] : reacquireHistograms) {
+            const auto reopens = reacquireReopens.find(dType);
+            info("Reacquisition of " + describeDeviceType(dType) + " links (" + reacquirePolicy(dType).name + "): "
+                 + histogram.format() + " | " + std::to_string(reopens != reacquireReopens.end() ? reopens->second : 0)
+                 + " channel reopen(s)");
+        }
+    }
+
+    void onTick() {
+        const auto now = std::chrono::steady_clock::now();
+        recoverSticks(now);
+        checkChannelWatchdogs();
+        expirePageRequests(now);
+        if (mqttCfg.enabled) {
+            mqtt.service();
+        }
+        logSilence(now);
+        reportEmulation(now);
+        reportEventBuffer(now);
+        reportUsb(now);
+        reportControlLatency(now);
+        reportPairedThroughput(now);
+        reportRotation(now);
+        reportReacquisition(now);
+        reportSticks(now);
+        if (pclCapture) {
+            pclCapture->Flush();
+        }
+        checkReplay();
+    }
+
+    // Keeps the MQTT socket registration in step with the client, which
+    // replaces its socket on reconnect and wants EPOLLOUT only while it has
+    // queued output.
+    void syncMqttSocket(const int epfd, int& mqttFd, uint32_t& mqttEvents) {
+        const int fd = mqttCfg.enabled ? mqtt.socket() : -1;
+        epoll_event ev{};
+        ev.events = EPOLLIN | (mqtt.wantWrite() ? EPOLLOUT : 0);
+        ev.data.fd = fd;
+
+        if (fd == mqttFd && ev.events == mqttEvents) {
+            return;
+        }
+        mqttEvents = ev.events;
+
+        if (fd != mqttFd && mqttFd >= 0) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, mqttFd, nullptr);
+        }
+        if (fd >= 0) {
+            if (epoll_ctl(epfd, fd == mqttFd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) < 0 && errno == ENOENT) {
+                // Closed and reopened under the same number, so the old registration is gone
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+            }
+        }
+        mqttFd = fd;
+    }
+
+    void runEventLoop() {
+        info("Starting event loop...");
+
+        const int epfd = epoll_create1(EPOLL_CLOEXEC);
+        const int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (epfd < 0 || tfd < 0) {
+            error("Failed to create event loop: " + std::string(std::strerror(errno)));
+            return;
+        }
+
+        itimerspec tick{};
+        tick.it_interval.tv_nsec = EVENT_LOOP_TICK_MS * 1000000L;
+        tick.it_value = tick.it_interval;
+        timerfd_settime(tfd, 0, &tick, nullptr);
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = tfd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+
+        std::map<int, size_t> framers;
+        for (size_t k = 0; k < sticks.size(); ++k) {
+            const int fd = sticks[k].framer->GetEventFd();
+            if (fd < 0) {
+                error("ANT framer has no event fd");
+                continue;
+            }
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+            framers[fd] = k;
+            // Pick up anything queued before the fd was registered
+            drainStick(k);
+        }
+
+        int mqttFd = -1;
+        uint32_t mqttEvents = 0;
+        lastMessageTime = std::chrono::steady_clock::now();
+        epoll_event events[8];
+
+        while (searching) {
+            syncMqttSocket(epfd, mqttFd, mqttEvents);
+
+            const int n = epoll_wait(epfd, events, 8, mergeWaitMs(std::chrono::steady_clock::now()));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                error("epoll_wait failed: " + std::string(std::strerror(errno)));
+                break;
+            }
+
+            for (int i = 0; i < n && searching; ++i) {
+                const int fd = events[i].data.fd;
+                if (fd == tfd) {
+                    uint64_t expirations;
+                    if (read(tfd, &expirations, sizeof(expirations)) > 0) {
+                        onTick();
+                    }
+                    // Re-register the MQTT socket once per tick in case it was
+                    // closed and reopened under the same number
+                    mqttEvents = 0;
+                } else if (fd == mqttFd) {
+                    if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) mqtt.handleRead();
+                    if (events[i].events & EPOLLOUT) mqtt.handleWrite();
+                } else if (const auto it = framers.find(fd); it != framers.end()) {
+                    drainStick(it->second);
+                }
+            }
+            if (!mergeQueue.empty()) {
+                flushMergedMessages(std::chrono::steady_clock::now());
+            }
+        }
+
+        close(tfd);
+        close(epfd);
+    }
+
+#else
+
+    void runEventLoop() {
+        info("Starting event loop...");
+        static ANT_MESSAGE_ITEM batch[MESSAGE_BATCH_SIZE];
+        static ULLONG queuedUs[MESSAGE_BATCH_SIZE];
+        lastMessageTime = std::chrono::steady_clock::now();
+        while (searching) {
+            const auto now = std::chrono::steady_clock::now();
+            uint64_t received = 0;
+            bool broadcastSeen = false;
+            for (size_t k = 0; k < sticks.size(); ++k) {
+                // With several sticks none may hold up the others, so they are polled
+                const USHORT count = sticks[k].framer->GetMessages(batch, MESSAGE_BATCH_SIZE,
+                                                                   sticks.size() > 1 ? 0 : MESSAGE_TIMEOUT, queuedUs);
+                if (!searching) return;
+
+                if (count == DSI_FRAMER_ERROR) {
+                    onFramerError(k, batch[0]);
+                    continue;
+                }
+                if (count > 0) {
+                    measureControlLatency(batch, queuedUs, count);
+                    broadcastSeen |= receiveMessages(k, batch, count);
+                    received += count;
+                }
+            }
+            broadcastSeen |= flushMergedMessages(std::chrono::steady_clock::now());
+
+            expirePageRequests(now);
+
+            if (received == 0) {
+                if (sticks.size() > 1) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                if (!mergeQueue.empty()) continue;
+                logSilence(now);
+                reportEmulation(now);
+                reportEventBuffer(now);
+                reportUsb(now);
+                reportControlLatency(now);
+                reportPairedThroughput(now);
+                reportRotation(now);
+                reportReacquisition(now);
+                reportSticks(now);
+                recoverSticks(now);
+                scheduleRotation(now);
+                checkReplay();
+                continue;
+            }
+            bufferStats.wakeups++;
+            bufferStats.messages += received;
+
+            // Watchdogs only need checking once per drained batch
+            if (broadcastSeen) {
                 checkChannelWatchdogs();
             }
         }
     }
 
+#endif
+
 } // namespace ant
@@ -38,6 +38,25 @@ namespace ant {
         std::chrono::steady_clock::time_point lastSeen;
         int8_t lastRssi = 0;
         bool active = false;
+        // The stick filters unchanged pages on this channel, so silence is normal
+        bool sdu = false;
+        // The stick gave up searching for the channel's device
+        bool lost = false;
+        // The stick lost track of the channel's device and is searching again
+        bool dropped = false;
+        // The watchdog counted the device as lost and left it to the stick to find
+        bool reacquiring = false;
+        // Paired devices on the channel's inclusion list, 0 without a list
+        uint8_t listSize = 0;
+        // When the channel last went back to searching for its device, by
+        // the stick or reopened by the watchdog; zero once it is heard again
+        std::chrono::steady_clock::time_point searchSince{};
+    };
+
+    enum class SduMode {
+        Auto,   // On the stick when it has the capability, otherwise on the host
+        Host,   // On the host, after the pages have crossed USB
+        Off
     };
 
     // Enum for situation field in status byte
@@ -235,7 +254,17 @@ namespace ant {
     void setEpsLatLng(double meters);
     void setEpsHeading(double degrees);
     void setMqtt(const std::string& cnn);
-    bool initialize(ULONG baud, UCHAR ucDeviceNumber);
+    void setCapture(const std::string& path);
+    void setReplay(const std::string& path, double speed);
+    bool setEmulation(const std::string& spec);
+    void setScanMode(bool enabled);
+    void setSduMode(SduMode mode);
+    void setControlLane(bool enabled);
+    void setUsbTransfers(uint8_t transfers);
+    void setEventBuffer(uint16_t maxLatencyMs, uint16_t maxMessages);
+    void setRotation(uint8_t slots, uint32_t sliceMs, uint32_t budgetS);
+    bool setReacquire(const std::string& spec);
+    bool initialize(ULONG baud, const std::vector<UCHAR>& deviceNumbers);
     bool startDiscovery();
     void runEventLoop();
     void cleanup();
@@ -60,8 +60,11 @@ public:
     explicit MqttPublisher() = default;
     ~MqttPublisher() { stop(); }
 
-    bool start(const MqttConfig& cfg) {
+    // When threaded is false no network thread is started; the caller must
+    // poll socket() and call handleRead()/handleWrite()/service() instead.
+    bool start(const MqttConfig& cfg, const bool threaded = true) {
         cfg_ = cfg;
+        threaded_ = threaded;
         if (!cfg_.enabled) return true;
 
         mosquitto_lib_init();
@@ -91,7 +94,7 @@ public:
         }
 
         // Start internal network loop (threaded)
-        if (mosquitto_loop_start(mosq_) != MOSQ_ERR_SUCCESS){
+        if (threaded_ && mosquitto_loop_start(mosq_) != MOSQ_ERR_SUCCESS){
             ant::error("MQTT: Failed to start loop");
             return false;
         }
@@ -103,7 +106,7 @@ public:
 
     void stop() {
         if (!mosq_) return;
-        mosquitto_loop_stop(mosq_, true);
+        if (threaded_) mosquitto_loop_stop(mosq_, true);
         mosquitto_disconnect(mosq_);
         mosquitto_destroy(mosq_);
         mosq_ = nullptr;
@@ -174,11 +177,40 @@ public:
         return false;
     }
 
+    // Socket to poll when started without a network thread, -1 if not connected
+    [[nodiscard]] int socket() const { return mosq_ ? mosquitto_socket(mosq_) : -1; }
+    [[nodiscard]] bool wantWrite() const { return mosq_ && mosquitto_want_write(mosq_); }
+
+    void handleRead() {
+        if (!mosq_) return;
+        checkLoop(mosquitto_loop_read(mosq_, 1));
+    }
+
+    void handleWrite() {
+        if (!mosq_) return;
+        checkLoop(mosquitto_loop_write(mosq_, 1));
+    }
+
+    // Keepalive and reconnect housekeeping, call at least once a second
+    void service() {
+        if (!mosq_) return;
+        mosquitto_loop_misc(mosq_);
+        if (mosquitto_socket(mosq_) < 0) {
+            attemptReconnect();
+        }
+    }
+
     [[nodiscard]] const MqttConfig& config() const { return cfg_; }
     [[nodiscard]] bool isConnected() const { return connected_; }
     [[nodiscard]] int failedAttempts() const { return failed_attempts_; }
 
 private:
+    void checkLoop(const int rc) {
+        if (rc == MOSQ_ERR_NO_CONN || rc == MOSQ_ERR_CONN_LOST) {
+            attemptReconnect();
+        }
+    }
+
     void attemptReconnect() {
         const auto now = std::chrono::steady_clock::now();
         if (now - last_reconnect_attempt_ < std::chrono::milliseconds(cfg_.reconnect_delay_ms)) {
@@ -211,6 +243,7 @@ private:
 
     MqttConfig cfg_{};
     mosquitto* mosq_ = nullptr;
+    bool threaded_ = true;
     mutable int failed_attempts_ = 0;
     mutable int messages_skipped_ = 0;
     mutable bool connected_ = false;
@@ -41,34 +41,22 @@ public:
 
     // Called once to configure channel
     bool setupChannel() const {
-        // Sample setup logic for the profile channel, you can add more steps as needed.
-        if (!ant_->AssignChannel(channel_, channelType_, USER_NETWORK_NUM, MESSAGE_TIMEOUT)) {
-            ant::error("[Profile] Failed to assign channel");
-            return false;
-        }
-
-        if (!ant_->SetChannelID(channel_, 0, deviceType_, TRANSMISSION_TYPE_WILDCARD, MESSAGE_TIMEOUT)) {
-            ant::error("[Profile] Failed to set channel ID");
-            return false;
-        }
-
-        if (!ant_->SetChannelPeriod(channel_, channelPeriod_, MESSAGE_TIMEOUT)) {
-            ant::error("[Profile] Failed to set channel period");
-            return false;
-        }
-
-        if (!ant_->SetChannelRFFrequency(channel_, channelRFFrequency_, MESSAGE_TIMEOUT)) {
-            ant::error("[Profile] Failed to set channel RF frequency");
-            return false;
-        }
-
-        if (!ant_->SetChannelSearchTimeout(channel_, searchTimeout_, MESSAGE_TIMEOUT)) {
-            ant::error("[Profile] Failed to set channel search timeout");
-            return false;
-        }
-
-        if (!ant_->OpenChannel(channel_, MESSAGE_TIMEOUT)) {
-            ant::error("[Profile] Failed to open channel");
+        // All configuration commands are pipelined and confirmed as one batch.
+        ANT_CHANNEL_CONFIG cfg{};
+        cfg.ucANTChannel = channel_;
+        cfg.ucChannelType = channelType_;
+        cfg.ucNetworkNumber = USER_NETWORK_NUM;
+        cfg.usDeviceNumber = 0;
+        cfg.ucDeviceType = deviceType_;
+        cfg.ucTransmitType = TRANSMISSION_TYPE_WILDCARD;
+        cfg.usMessagePeriod = channelPeriod_;
+        cfg.ucRFFrequency = channelRFFrequency_;
+        cfg.ucSearchTimeout = searchTimeout_;
+        cfg.bOpen = TRUE;
+
+        UCHAR failedId = MAX_UCHAR;
+        if (ant_->ConfigureChannels(&cfg, 1, MESSAGE_TIMEOUT, nullptr, &failedId) != RESPONSE_NO_ERROR) {
+            ant::error("[Profile] Failed to set up channel (message 0x" + ant::toHexByte(failedId) + ")");
             return false;
         }
 
@@ -0,0 +1,144 @@
+#pragma once
+// Header-only policies for bringing lost paired links back, and the
+// histograms that show how long that took.
+//
+// The fixed policy is the original behaviour: the host watchdog closes and
+// reopens a channel that has been silent for WATCHDOG_TIMEOUT_MS, and the
+// channel searches with its own high priority search timeout. The fast
+// policy leaves the channel open and lets the stick search for the device
+// in low priority, which does not block the other channels, until it is
+// back. High duty search makes the low priority search listen more often,
+// so the device is picked up within a few of its broadcasts.
+//
+// Search timeouts are in 2.5 s units; 0xFF searches forever.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ant {
+
+  inline constexpr int WATCHDOG_TIMEOUT_MS = 5000;
+
+  // Silences shorter than this are missed broadcasts, not lost links
+  inline constexpr int REACQUIRE_GAP_MS = 1000;
+
+  // Broadcasts a device may miss before the fast policy counts its link as
+  // lost, the same number after which the stick drops back to search
+  inline constexpr int REACQUIRE_MISSED_BROADCASTS = 8;
+
+  struct ReacquirePolicy {
+    std::string name = "fixed";
+    // Silence before the link counts as lost
+    int lostAfterMs = WATCHDOG_TIMEOUT_MS;
+    // Close and reopen a lost channel from the host, instead of leaving
+    // the stick searching
+    bool reopen = true;
+    // Left at the channel's own values if not set
+    std::optional<uint8_t> searchTimeout;
+    std::optional<uint8_t> lpSearchTimeout;
+    // Proximity bin for the profile's search channel, 1 (closest) to 10,
+    // so new devices are paired nearest first; 0 for none
+    uint8_t proximityBin = 0;
+    bool highDuty = false;
+  };
+
+  inline ReacquirePolicy fixedReacquirePolicy() {
+    return {};
+  }
+
+  // period is the channel period of the profile, in 1/32768 s
+  inline ReacquirePolicy fastReacquirePolicy(const unsigned short period) {
+    ReacquirePolicy policy;
+    policy.name = "fast";
+    policy.lostAfterMs = std::max(REACQUIRE_GAP_MS, REACQUIRE_MISSED_BROADCASTS * period * 1000 / 32768);
+    policy.reopen = false;
+    policy.searchTimeout = 0;
+    policy.lpSearchTimeout = 0xFF;
+    policy.highDuty = true;
+    return policy;
+  }
+
+  // Parses "fixed" or "fast[/<lost ms>[/<low priority search timeout>[/<proximity bin>]]]"
+  inline bool parseReacquirePolicy(const std::string& spec, const unsigned short period, ReacquirePolicy& policy) {
+    std::vector<std::string> fields;
+    std::stringstream values(spec);
+    std::string field;
+    while (std::getline(values, field, '/')) fields.push_back(field);
+    if (fields.empty()) return false;
+
+    if (fields[0] == "fixed") {
+      policy = fixedReacquirePolicy();
+      return fields.size() == 1;
+    }
+    if (fields[0] != "fast" || fields.size() > 4) return false;
+
+    policy = fastReacquirePolicy(period);
+    try {
+      if (fields.size() > 1) policy.lostAfterMs = std::stoi(fields[1]);
+      if (fields.size() > 2) {
+        const unsigned long timeout = std::stoul(fields[2]);
+        if (timeout > 0xFF) return false;
+        policy.lpSearchTimeout = static_cast<uint8_t>(timeout);
+      }
+      if (fields.size() > 3) {
+        const unsigned long bin = std::stoul(fields[3]);
+        if (bin > 10) return false;
+        policy.proximityBin = static_cast<uint8_t>(bin);
+      }
+    } catch (const std::exception&) {
+      return false;
+    }
+    if (fields.size() > 1) policy.name = spec;
+    return policy.lostAfterMs > 0;
+  }
+
+  inline std::string describeReacquirePolicy(const ReacquirePolicy& policy) {
+    std::ostringstream oss;
+    oss << policy.name << ", lost after " << policy.lostAfterMs << " ms, "
+        << (policy.reopen ? "reopened by the host" : "searched for by the stick");
+    if (policy.searchTimeout) oss << ", search timeout " << static_cast<int>(*policy.searchTimeout);
+    if (policy.lpSearchTimeout) oss << ", low priority search timeout " << static_cast<int>(*policy.lpSearchTimeout);
+    if (policy.proximityBin) oss << ", proximity bin " << static_cast<int>(policy.proximityBin);
+    return oss.str();
+  }
+
+  // Times from the moment a lost link went back to search, or was last
+  // reopened, to the first broadcast heard on it. A device still out of range
+  // when the search starts adds the rest of its absence.
+  struct ReacquireHistogram {
+    static constexpr std::array<int, 7> BOUNDS_MS = {250, 500, 1000, 2000, 5000, 10000, 30000};
+    std::array<uint64_t, BOUNDS_MS.size() + 1> counts{};
+    uint64_t samples = 0;
+    double sumMs = 0;
+    double maxMs = 0;
+
+    void add(const double ms) {
+      size_t bucket = 0;
+      while (bucket < BOUNDS_MS.size() && ms >= BOUNDS_MS[bucket]) ++bucket;
+      counts[bucket]++;
+      samples++;
+      sumMs += ms;
+      if (ms > maxMs) maxMs = ms;
+    }
+
+    std::string format() const {
+      std::ostringstream oss;
+      oss << samples << " link(s), " << std::fixed << std::setprecision(1)
+          << (samples ? sumMs / samples / 1000 : 0.0) << " s avg, " << maxMs / 1000 << " s max |";
+      for (size_t i = 0; i < counts.size(); ++i) {
+        if (i < BOUNDS_MS.size()) oss << " <" << BOUNDS_MS[i] / 1000.0 << "s:";
+        else oss << " more:";
+        oss << counts[i];
+      }
+      return oss.str();
+    }
+  };
+
+} // namespace ant
@@ -13,6 +13,11 @@ typedef struct antz_context antz_context_t;
 struct antz_context_init_t {
     uint16_t usb_baud_rate = 50000;
     uint32_t usb_device_number = 0;
+    // Stick-side event buffering: received messages are delivered in one
+    // burst once the oldest is this old or this many are held. Both zero
+    // (the default) delivers every message as soon as it is received.
+    uint16_t event_buffer_ms = 0;
+    uint16_t event_buffer_messages = 0;
 };
 
 namespace antz {
@@ -21,6 +21,7 @@ namespace antz_platform
         STARTUP_MESSAGE_TIMEOUT  = 1104, ///< Timed out waiting for startup message from device.
         INVALID_STATE            = 1105, ///< Initialization called when already initialized.
         RESOURCE_ALLOCATION_FAIL = 1106, ///< Failed to allocate DSIFramerANT or DSISerialGeneric.
+        EVENT_BUFFER_UNSUPPORTED = 1107, ///< Event buffering requested but not supported or rejected by the stick.
 
         UNKNOWN                  = 1199  ///< Unknown or uncategorized error.
     };
@@ -11,6 +11,8 @@
 
 #include "dsi_framer_ant.hpp"
 #include <dsi_serial_generic.hpp>
+#include <algorithm>
+#include <map>
 #include <thread>
 #include <error/antz_error.h>
 #include <software/ANTFS/antfsmessage.h>
@@ -19,11 +21,15 @@ struct antz_hal{
     bool inited{false};
     bool running{false};
     bool destroyed{false};
+    uint32_t usb_device_number{0};
     DSIFramerANT* pclANT{nullptr};
     DSISerialGeneric* pclSerial{nullptr};
 };
 
 #define STARTUP_TIMEOUT_MS 10000L
+#define EVENT_BUFFER_TIME_UNIT_MS 10
+// Bytes one extended broadcast with device id, RSSI and timestamp takes in the stick's buffer
+#define EVENT_BUFFER_BYTES_PER_MESSAGE 23
 
 /**
  * @def ANTZ_SET_DARWIN_ERROR
@@ -41,10 +47,37 @@ struct antz_hal{
 
 namespace antz_platform {
 
-    antz_hal ctx{};
+    /// One context per stick, by USB device number, so several sticks can
+    /// be driven side by side. Map nodes keep the handed out pointers valid.
+    std::map<uint32_t, antz_hal> contexts;
+
+    /// Configures stick-side event buffering if requested. Failure is not
+    /// fatal: the stick then delivers every message as it is received.
+    void antz_hal_config_event_buffer(const antz_hal* hal, const antz_context_init_t* params) {
+        if (params->event_buffer_ms == 0 && params->event_buffer_messages == 0) return;
+
+        ANT_MESSAGE_ITEM caps{};
+        if (!hal->pclANT->SendRequest(MESG_CAPABILITIES_ID, 0, &caps, MESSAGE_TIMEOUT) || caps.ucSize < 7 ||
+            !(caps.stANTMessage.aucData[6] & CAPABILITIES_EVENT_BUFFERING_ENABLED)) {
+            ANTZ_SET_DARWIN_ERROR(antz_platform::ErrorCode::EVENT_BUFFER_UNSUPPORTED,
+                "Event buffering not supported by the ANT device");
+            return;
+        }
+
+        const auto size = static_cast<USHORT>(std::min<uint32_t>(
+            params->event_buffer_messages * static_cast<uint32_t>(EVENT_BUFFER_BYTES_PER_MESSAGE), 0xFFFF));
+        const auto time = static_cast<USHORT>(
+            (params->event_buffer_ms + EVENT_BUFFER_TIME_UNIT_MS - 1) / EVENT_BUFFER_TIME_UNIT_MS);
+        if (!hal->pclANT->ConfigEventBuffer(0x00, size, time, MESSAGE_TIMEOUT)) {
+            ANTZ_SET_DARWIN_ERROR(antz_platform::ErrorCode::EVENT_BUFFER_UNSUPPORTED,
+                "Event buffering configuration rejected by the ANT device");
+        }
+    }
     
     std::optional<antz_hal_t*> antz_hal_create(const antz_context_init_t* params) {
-        if (ctx.inited) return &ctx;
+        if (const auto it = contexts.find(params->usb_device_number); it != contexts.end() && it->second.inited) {
+            return &it->second;
+        }
 
         const auto pclSerial = new DSISerialGeneric();
         if (!pclSerial->Init(params->usb_baud_rate, params->usb_device_number)) {
@@ -105,21 +138,25 @@ namespace antz_platform {
             }
         }
 
+        antz_hal& ctx = contexts[params->usb_device_number];
+        ctx.usb_device_number = params->usb_device_number;
         ctx.pclANT = pclANT;
         ctx.pclSerial = pclSerial;
         ctx.inited = true;
+        antz_hal_config_event_buffer(&ctx, params);
 
         return &ctx;
     }
 
     /// Releases all hardware
     void antz_hal_destroy(antz_hal_t* hal){
-        if (hal == &ctx && !ctx.destroyed) {
+        const auto it = contexts.find(hal->usb_device_number);
+        if (it != contexts.end() && &it->second == hal && !hal->destroyed) {
             hal->pclSerial->Close();
             delete hal->pclANT;
             delete hal->pclSerial;
             hal->destroyed = true;
-            ctx = {};
+            contexts.erase(it);
         }
     }
 
@@ -0,0 +1,90 @@
+#!/bin/bash
+set -e
+
+# Compares the replay throughput of the default (debug) build of antz with
+# a release build, and with a profile-guided release build when --pgo is
+# given. Each binary replays the same capture at full speed RUNS times and
+# the median of the "Replay complete" rates is reported.
+#
+# Usage: bench-replay.sh [--pgo] [capture file]
+# Environment:
+#   RUNS          Replays per binary (default: 5)
+#   REPLAY_ARGS   Arguments for the runs besides the replay (default: --scan)
+
+RUNS="${RUNS:-5}"
+PLATFORM="linux"
+REPLAY_ARGS="${REPLAY_ARGS:---scan}"
+
+# Get script directory and project root
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(cd "$SCRIPT_DIR/.." && pwd)"
+ANTZ="$PROJECT_ROOT/apps/ant_discovery/bin/antz"
+BENCH_DIR="$PROJECT_ROOT/build-bench"
+
+PGO=0
+if [ "$1" == "--pgo" ]; then
+    PGO=1
+    shift
+fi
+CAPTURE="$1"
+
+mkdir -p "$BENCH_DIR"
+
+# Every build writes the same binary, so keep a copy of each
+build() {
+    local name="$1"
+    shift
+    echo "Building $name antz..."
+    cmake -S "$PROJECT_ROOT" -B "$BENCH_DIR/$name" -DANTZ_PLATFORM=$PLATFORM "$@" > /dev/null
+    cmake --build "$BENCH_DIR/$name" --target ant_discovery -j"$(nproc)" > /dev/null
+    cp "$ANTZ" "$BENCH_DIR/antz-$name"
+}
+
+build debug
+build release -DCMAKE_BUILD_TYPE=Release
+VARIANTS=(debug release)
+
+if [ -z "$CAPTURE" ]; then
+    CAPTURE="$BENCH_DIR/bench.antcap"
+    if [ ! -f "$CAPTURE" ]; then
+        "$SCRIPT_DIR/record-capture.sh" "$BENCH_DIR/antz-debug" "$CAPTURE"
+    fi
+fi
+CAPTURE="$(cd "$(dirname "$CAPTURE")" && pwd)/$(basename "$CAPTURE")"
+
+if [ $PGO -eq 1 ]; then
+    BUILD_DIR="build-bench/pgo" "$SCRIPT_DIR/build-pgo.sh" "$CAPTURE" > /dev/null
+    cp "$ANTZ" "$BENCH_DIR/antz-pgo"
+    VARIANTS+=(pgo)
+fi
+
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Prints the median msg/s of RUNS replays
+bench() {
+    local rates=()
+    for ((run = 0; run < RUNS; run++)); do
+        # shellcheck disable=SC2086
+        (cd "$WORK_DIR" && XDG_CONFIG_HOME="$WORK_DIR" "$1" -r "$CAPTURE" --speed max $REPLAY_ARGS -d 0 > bench.log 2>&1) || true
+        rates+=("$(sed -n 's/.*Replay complete: .*(\([0-9]*\) msg\/s).*/\1/p' "$WORK_DIR/bench.log")")
+        rm -f "$WORK_DIR"/Device*
+    done
+    printf '%s\n' "${rates[@]}" | sort -n | sed -n "$(( (RUNS + 1) / 2 ))p"
+}
+
+echo "Replaying $CAPTURE $RUNS times per build..."
+BASELINE=""
+for variant in "${VARIANTS[@]}"; do
+    rate="$(bench "$BENCH_DIR/antz-$variant")"
+    if [ -z "$rate" ]; then
+        echo "$variant: replay failed"
+        cat "$WORK_DIR/bench.log"
+        exit 1
+    fi
+    BASELINE="${BASELINE:-$rate}"
+    printf '%-8s %10s msg/s  %5sx\n' "$variant" "$rate" "$(awk "BEGIN { printf \"%.2f\", $rate / $BASELINE }")"
+done
+
+# Leave the default build in place
+cp "$BENCH_DIR/antz-debug" "$ANTZ"
@@ -0,0 +1,65 @@
+#!/bin/bash
+set -e
+
+# Profile-guided release build of antz.
+#
+# Builds an instrumented release binary, trains it by replaying captures at
+# full speed, then rebuilds it in the same build directory with the
+# profiles. Captures recorded from real sticks train it best; without any,
+# one is recorded from the emulator.
+#
+# Usage: build-pgo.sh [capture file...]
+# Environment:
+#   REPLAY_ARGS   Arguments for the training runs besides the replay (default: --scan)
+#   BUILD_DIR     Build directory (default: build-pgo)
+
+BUILD_DIR="${BUILD_DIR:-build-pgo}"
+PLATFORM="linux"
+REPLAY_ARGS="${REPLAY_ARGS:---scan}"
+
+# Get script directory and project root
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(cd "$SCRIPT_DIR/.." && pwd)"
+ANTZ="$PROJECT_ROOT/apps/ant_discovery/bin/antz"
+PGO_DIR="$PROJECT_ROOT/$BUILD_DIR/pgo"
+
+CAPTURES=()
+for capture in "$@"; do
+    CAPTURES+=("$(cd "$(dirname "$capture")" && pwd)/$(basename "$capture")")
+done
+
+configure() {
+    cmake -S "$PROJECT_ROOT" -B "$PROJECT_ROOT/$BUILD_DIR" \
+        -DANTZ_PLATFORM=$PLATFORM \
+        -DCMAKE_BUILD_TYPE=Release \
+        -DANTZ_PGO="$1" \
+        -DANTZ_PGO_DIR="$PGO_DIR" > /dev/null
+}
+
+echo "Building instrumented antz..."
+configure GENERATE
+cmake --build "$PROJECT_ROOT/$BUILD_DIR" --target ant_discovery -j"$(nproc)"
+
+if [ ${#CAPTURES[@]} -eq 0 ]; then
+    CAPTURES=("$PROJECT_ROOT/$BUILD_DIR/training.antcap")
+    if [ ! -f "${CAPTURES[0]}" ]; then
+        "$SCRIPT_DIR/record-capture.sh" "$ANTZ" "${CAPTURES[0]}"
+    fi
+fi
+
+# Train on the replays alone, not on whatever recorded the capture
+rm -rf "$PGO_DIR"
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+for capture in "${CAPTURES[@]}"; do
+    echo "Training on $capture..."
+    # shellcheck disable=SC2086
+    (cd "$WORK_DIR" && XDG_CONFIG_HOME="$WORK_DIR" "$ANTZ" -r "$capture" --speed max $REPLAY_ARGS -d 0 > train.log 2>&1) || true
+    grep "Replay complete" "$WORK_DIR/train.log" || { cat "$WORK_DIR/train.log"; exit 1; }
+done
+
+echo "Building optimised antz..."
+configure USE
+cmake --build "$PROJECT_ROOT/$BUILD_DIR" --target ant_discovery -j"$(nproc)"
+
+echo "Build complete! Profile-guided binary: $ANTZ"
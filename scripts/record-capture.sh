@@ -0,0 +1,29 @@
+#!/bin/bash
+set -e
+
+# Records a capture from an emulated stick in continuous scan mode, for
+# training and benchmarking on the replay backend when no capture from a
+# real stick is at hand.
+#
+# Usage: record-capture.sh <antz binary> <capture file> [seconds] [fleet]
+
+ANTZ="$1"
+CAPTURE="$2"
+SECONDS_TO_RECORD="${3:-60}"
+FLEET="${4:-trackers=50,assets=32,hrms=20,seed=1}"
+
+if [ -z "$ANTZ" ] || [ -z "$CAPTURE" ]; then
+    echo "Usage: $0 <antz binary> <capture file> [seconds] [fleet]"
+    exit 2
+fi
+
+# Keep the debug traces and paired channels of the run out of the way
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+CAPTURE="$(cd "$(dirname "$CAPTURE")" && pwd)/$(basename "$CAPTURE")"
+
+echo "Recording ${SECONDS_TO_RECORD}s of emulated traffic ($FLEET) to $CAPTURE..."
+(cd "$WORK_DIR" && XDG_CONFIG_HOME="$WORK_DIR" timeout --foreground -s INT "$SECONDS_TO_RECORD" \
+    "$ANTZ" --emulate "$FLEET" --scan -d 0 -c "$CAPTURE" > record.log 2>&1) || true
+
+grep "Capture closed" "$WORK_DIR/record.log" || { cat "$WORK_DIR/record.log"; exit 1; }
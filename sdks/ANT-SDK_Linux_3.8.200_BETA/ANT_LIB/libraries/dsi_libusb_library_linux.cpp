@@ -63,7 +63,11 @@ LibusbLibrary::LibusbLibrary() //throw(LibusbError::Enum&)
    DetachKernelDriver(NULL),
    AttachKernelDriver(NULL),
    KernelDriverActive(NULL),
-   HandleEventsTimeoutCompleted(NULL)
+   HandleEventsTimeoutCompleted(NULL),
+   HasCapability(NULL),
+   HotplugRegisterCallback(NULL),
+   HotplugDeregisterCallback(NULL),
+   GetMaxPacketSize(NULL)
 #endif
 
 {
@@ -202,6 +206,22 @@ LibusbError::Enum LibusbLibrary::LoadFunctions()
    HandleEventsTimeoutCompleted = (HandleEventsTimeoutCompleted_t)&libusb_handle_events_timeout_completed;
    if(HandleEventsTimeoutCompleted == NULL)
       bStatus = FALSE;
+
+   HasCapability = (HasCapability_t)&libusb_has_capability;
+   if(HasCapability == NULL)
+      bStatus = FALSE;
+
+   HotplugRegisterCallback = (HotplugRegisterCallback_t)&libusb_hotplug_register_callback;
+   if(HotplugRegisterCallback == NULL)
+      bStatus = FALSE;
+
+   HotplugDeregisterCallback = (HotplugDeregisterCallback_t)&libusb_hotplug_deregister_callback;
+   if(HotplugDeregisterCallback == NULL)
+      bStatus = FALSE;
+
+   GetMaxPacketSize = (GetMaxPacketSize_t)&libusb_get_max_packet_size;
+   if(GetMaxPacketSize == NULL)
+      bStatus = FALSE;
 #endif
 
    if(bStatus == FALSE)
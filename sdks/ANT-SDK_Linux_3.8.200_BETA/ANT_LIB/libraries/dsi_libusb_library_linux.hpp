@@ -93,6 +93,10 @@ class LibusbLibrary
    typedef int                                 (*AttachKernelDriver_t)(libusb_device_handle*, int);
    typedef int                                 (*KernelDriverActive_t)(libusb_device_handle*, int);
    typedef int                                 (*HandleEventsTimeoutCompleted_t)(libusb_context*, struct timeval*, int*);
+   typedef int                                 (*HasCapability_t)(uint32_t);
+   typedef int                                 (*HotplugRegisterCallback_t)(libusb_context*, libusb_hotplug_event, libusb_hotplug_flag, int, int, int, libusb_hotplug_callback_fn, void*, libusb_hotplug_callback_handle*);
+   typedef void                                (*HotplugDeregisterCallback_t)(libusb_context*, libusb_hotplug_callback_handle);
+   typedef int                                 (*GetMaxPacketSize_t)(libusb_device*, unsigned char);
 
 #endif
 
@@ -122,6 +126,10 @@ class LibusbLibrary
    AttachKernelDriver_t AttachKernelDriver;
    KernelDriverActive_t KernelDriverActive;
    HandleEventsTimeoutCompleted_t HandleEventsTimeoutCompleted;
+   HasCapability_t HasCapability;
+   HotplugRegisterCallback_t HotplugRegisterCallback;
+   HotplugDeregisterCallback_t HotplugDeregisterCallback;
+   GetMaxPacketSize_t GetMaxPacketSize;
 #endif
 
   private:
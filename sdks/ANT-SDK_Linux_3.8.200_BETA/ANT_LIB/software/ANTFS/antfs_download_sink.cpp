@@ -0,0 +1,151 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+
+Copyright (c) Dynastream Innovations Inc. 2016
+All rights reserved.
+*/
+#include "types.h"
+#include "macros.h"
+
+#include "antfs_download_sink.hpp"
+
+#include <unistd.h>
+
+#include "dsi_debug.hpp"
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+//////////////////////////////////////////////////////////////////////////////////
+
+ANTFSFileSink::ANTFSFileSink()
+{
+   pfFile = (FILE*)NULL;
+   ulSize = 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+ANTFSFileSink::~ANTFSFileSink()
+{
+   Close();
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL ANTFSFileSink::Open(const char *pcFilename_, BOOL bResume_)
+{
+   Close();
+
+   if (pcFilename_ == NULL)
+      return FALSE;
+
+   if (bResume_)
+      pfFile = FOPEN(pcFilename_, "r+b");                   // Keep what an earlier attempt downloaded.
+
+   if (pfFile == NULL)
+      pfFile = FOPEN(pcFilename_, "w+b");
+
+   if (pfFile == NULL)
+   {
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("ANTFSFileSink::Open():  Unable to open file.");
+      #endif
+      return FALSE;
+   }
+
+   if (fseek(pfFile, 0, SEEK_END) != 0)
+   {
+      Close();
+      return FALSE;
+   }
+
+   long lSize = ftell(pfFile);
+   if (lSize < 0 || (unsigned long)lSize > MAX_ULONG)
+   {
+      Close();
+      return FALSE;
+   }
+
+   ulSize = (ULONG)lSize;
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+void ANTFSFileSink::Close(void)
+{
+   if (pfFile)
+      fclose(pfFile);
+
+   pfFile = (FILE*)NULL;
+   ulSize = 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG ANTFSFileSink::GetSize(void)
+{
+   return ulSize;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG ANTFSFileSink::Read(ULONG ulOffset_, UCHAR *pucData_, ULONG ulSize_)
+{
+   if ((pfFile == NULL) || (ulOffset_ >= ulSize))
+      return 0;
+
+   if (ulSize_ > ulSize - ulOffset_)
+      ulSize_ = ulSize - ulOffset_;
+
+   if (fseek(pfFile, (long)ulOffset_, SEEK_SET) != 0)
+      return 0;
+
+   return (ULONG)fread(pucData_, 1, ulSize_, pfFile);
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL ANTFSFileSink::Write(ULONG ulOffset_, const UCHAR *pucData_, ULONG ulSize_)
+{
+   if (pfFile == NULL)
+      return FALSE;
+
+   if (fseek(pfFile, (long)ulOffset_, SEEK_SET) != 0)
+      return FALSE;
+
+   if (fwrite(pucData_, 1, ulSize_, pfFile) != ulSize_)
+   {
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("ANTFSFileSink::Write():  Write failed.");
+      #endif
+      return FALSE;
+   }
+
+   if (ulOffset_ + ulSize_ > ulSize)
+      ulSize = ulOffset_ + ulSize_;
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL ANTFSFileSink::Truncate(ULONG ulSize_)
+{
+   if (pfFile == NULL)
+      return FALSE;
+
+   if (fflush(pfFile) != 0)
+      return FALSE;
+
+   if (ftruncate(fileno(pfFile), (off_t)ulSize_) != 0)
+      return FALSE;
+
+   ulSize = ulSize_;
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL ANTFSFileSink::Flush(void)
+{
+   if (pfFile == NULL)
+      return FALSE;
+
+   return (fflush(pfFile) == 0);
+}
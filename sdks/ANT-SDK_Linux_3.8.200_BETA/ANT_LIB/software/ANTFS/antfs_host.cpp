@@ -384,6 +384,12 @@ ANTFS_RETURN ANTFSHost::Download(USHORT usFileIndex_, ULONG ulDataOffset_, ULONG
    return pclHost->Download(usFileIndex_, ulDataOffset_, ulMaxDataLength_, ulMaxBlockSize_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANTFS_RETURN ANTFSHost::DownloadToSink(USHORT usFileIndex_, ANTFSDownloadSink *pclSink_, ULONG ulMaxDataLength_, ULONG ulMaxBlockSize_)
+{
+   return pclHost->DownloadToSink(usFileIndex_, pclSink_, ulMaxDataLength_, ulMaxBlockSize_);
+}
+
 ///////////////////////////////////////////////////////////////////////
 ANTFS_RETURN ANTFSHost::Upload(USHORT usFileIndex_, ULONG ulDataOffset_, ULONG ulDataLength_, void *pvData_, BOOL bForceOffset_, ULONG ulMaxBlockSize_)
 {
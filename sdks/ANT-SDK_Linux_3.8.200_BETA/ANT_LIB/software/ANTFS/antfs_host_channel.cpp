@@ -12,6 +12,7 @@ All rights reserved.
 #include "dsi_thread.h"
 #include "dsi_timer.hpp"
 #include "dsi_convert.h"
+#include "defines.h"
 #include "crc.h"
 
 #include "antfs_host_channel.hpp"
@@ -914,6 +915,7 @@ ANTFS_RETURN ANTFSHostChannel::Download(USHORT usFileIndex_, ULONG ulDataOffset_
    ulTransferDataOffset = ulDataOffset_;
    ulTransferByteSize = ulMaxDataLength_;
    ulHostBlockSize = ulMaxBlockSize_;
+   pclDownloadSink = (ANTFSDownloadSink*)NULL;
 
    #if defined(DEBUG_FILE)
       {
@@ -936,6 +938,70 @@ ANTFS_RETURN ANTFSHostChannel::Download(USHORT usFileIndex_, ULONG ulDataOffset_
    return ANTFS_RETURN_PASS;
 }
 
+///////////////////////////////////////////////////////////////////////
+ANTFS_RETURN ANTFSHostChannel::DownloadToSink(USHORT usFileIndex_, ANTFSDownloadSink *pclSink_, ULONG ulMaxDataLength_, ULONG ulMaxBlockSize_)
+{
+   if (pclSink_ == NULL)
+      return ANTFS_RETURN_FAIL;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   if (eANTFSRequest != ANTFS_REQUEST_NONE)
+   {
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("ANTFSHostChannel::DownloadToSink():  Request Busy.");
+      #endif
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
+      return ANTFS_RETURN_BUSY;
+   }
+
+   if (eANTFSState != ANTFS_HOST_STATE_TRANSPORT)
+   {
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("ANTFSHostChannel::DownloadToSink():  Not in transport state.");
+      #endif
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
+      return ANTFS_RETURN_FAIL;
+   }
+
+   if ((usFoundANTFSManufacturerID == 1) && (usFoundANTFSDeviceType == 782))
+   {
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("ANTFSHostChannel::DownloadToSink():  Device only supports small downloads.");
+      #endif
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
+      return ANTFS_RETURN_FAIL;
+   }
+
+   bTransfer = FALSE;
+   ulTransferTotalBytesRemaining = 0;
+   ulTransferBytesInBlock = 0;
+
+   // Offsets count from the start of the file, where the sink starts
+   usTransferDataFileIndex = usFileIndex_;
+   ulTransferDataOffset = 0;
+   ulTransferByteSize = ulMaxDataLength_;
+   ulHostBlockSize = ulMaxBlockSize_;
+   pclDownloadSink = pclSink_;
+
+   #if defined(DEBUG_FILE)
+      {
+         char szString[256];
+         SNPRINTF(szString, 256, "ANTFSHostChannel::DownloadToSink():\n   usTransferDataFileIndex = %u.\n   ulResumeOffset = %lu.\n   ulTransferByteSize = %lu.",
+            usTransferDataFileIndex, pclSink_->GetSize(), ulTransferByteSize);
+         DSIDebug::ThreadWrite(szString);
+      }
+   #endif
+
+   bLargeData = TRUE;
+
+   eANTFSRequest = ANTFS_REQUEST_DOWNLOAD;
+   DSIThread_CondSignal(&stCondRequest);
+
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+   return ANTFS_RETURN_PASS;
+}
+
 ///////////////////////////////////////////////////////////////////////
 ANTFS_RETURN ANTFSHostChannel::Upload(USHORT usFileIndex_, ULONG ulDataOffset_, ULONG ulDataLength_, void *pvData_, BOOL bForceOffset_, ULONG ulMaxBlockSize_)
 {
@@ -1107,7 +1173,7 @@ BOOL ANTFSHostChannel::GetTransferData(ULONG *pulDataSize_ , void *pvData_)
    ULONG ulLength;
    int iOffset;
 
-   if ((!bTransfer) || (pucTransferBufferDynamic == NULL))
+   if ((!bTransfer) || (pucTransferBufferDynamic == NULL) || (pclDownloadSink != NULL))
    {
       #if defined(DEBUG_FILE)
          DSIDebug::ThreadWrite("ANTFSHostChannel::GetTransferData():  No valid data.");
@@ -1141,7 +1207,7 @@ BOOL ANTFSHostChannel::RecoverTransferData(ULONG *pulDataSize_ , void *pvData_)
    ULONG ulLength;
    int iOffset;
 
-   if (pucTransferBufferDynamic == NULL)
+   if ((pucTransferBufferDynamic == NULL) || (pclDownloadSink != NULL))
    {
       #if defined(DEBUG_FILE)
          DSIDebug::ThreadWrite("ANTFSHostChannel::GetTransferData():  No valid data.");
@@ -1809,6 +1875,7 @@ void ANTFSHostChannel::ANTFSThread(void)
                   #endif
 
                   eReturn = AttemptDownload();
+                  EndStream();
 
                   if (eReturn == RETURN_PASS)
                   {
@@ -2256,6 +2323,187 @@ BOOL ANTFSHostChannel::ReportDownloadProgress(void)
    return TRUE;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Stores a received data packet in the transfer buffer.  A streamed
+// download keeps only a window of the data after the 16 response bytes,
+// and a packet can wrap around its end when the download resumed at an
+// offset that is not a multiple of 8.
+void ANTFSHostChannel::StoreTransferPacket(ULONG ulIndex_, const UCHAR *pucPacket_)
+{
+   if ((pclDownloadSink == NULL) || (ulIndex_ < 16))
+   {
+      memcpy(&pucTransferBuffer[ulIndex_], pucPacket_, 8);
+      return;
+   }
+
+   for (UCHAR i = 0; i < 8; i++)
+      pucTransferBuffer[16 + ((ulIndex_ - 16 + i) % STREAM_WINDOW_SIZE)] = pucPacket_[i];
+}
+
+///////////////////////////////////////////////////////////////////////
+UCHAR ANTFSHostChannel::GetTransferByte(ULONG ulIndex_)
+{
+   if ((pclDownloadSink == NULL) || (ulIndex_ < 16))
+      return pucTransferBuffer[ulIndex_];
+
+   return pucTransferBuffer[16 + ((ulIndex_ - 16) % STREAM_WINDOW_SIZE)];
+}
+
+///////////////////////////////////////////////////////////////////////
+// Sets up the window for a streamed download and resumes it from the
+// end of the sink, seeding the CRC with the data already there.
+BOOL ANTFSHostChannel::StartStream(void)
+{
+   ULONG ulSize = pclDownloadSink->GetSize();
+   ULONG ulOffset = 0;
+
+   if (pucTransferBufferDynamic)
+      delete[] pucTransferBufferDynamic;
+
+   try
+   {
+      pucTransferBufferDynamic = new UCHAR[16 + STREAM_WINDOW_SIZE];
+
+      if (pucTransferBufferDynamic == NULL)
+         throw "Memory allocation failure!";
+   }
+   catch(...)
+   {
+      pucTransferBufferDynamic = (UCHAR*)NULL;
+      pucTransferBuffer = (UCHAR*)NULL;
+
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("ANTFSHostChannel::StartStream():  Unable to allocate memory for download.");
+      #endif
+      return FALSE;
+   }
+
+   memset(pucTransferBufferDynamic, 0x00, 16);
+   pucTransferBuffer = pucTransferBufferDynamic;
+   ulTransferBufferSize = 0;                                   // Set from the file size in each response.
+
+   usStreamCRC = 0;
+   while (ulOffset < ulSize)
+   {
+      ULONG ulRead = pclDownloadSink->Read(ulOffset, &pucTransferBufferDynamic[16], MIN(ulSize - ulOffset, STREAM_WINDOW_SIZE));
+
+      if (ulRead == 0)
+      {
+         #if defined(DEBUG_FILE)
+            DSIDebug::ThreadWrite("ANTFSHostChannel::StartStream():  Unable to read back the sink.");
+         #endif
+         return FALSE;
+      }
+
+      usStreamCRC = CRC_UpdateCRC16(usStreamCRC, &pucTransferBufferDynamic[16], ulRead);
+      ulOffset += ulRead;
+   }
+
+   ulStreamWritten = ulSize;
+   ulStreamReceived = ulSize;
+   ulStreamBlockEnd = ulSize;
+   ulStreamBlockStart = ulSize;
+   usStreamBlockCRC = usStreamCRC;
+
+   // Skip the response packets of the first burst, the window is already there
+   ulTransferArrayIndex = ulSize + 16;
+
+   #if defined(DEBUG_FILE)
+      {
+         char szString[256];
+         SNPRINTF(szString, 256, "ANTFSHostChannel::StartStream():  Resuming at %lu, CRC seed 0x%04X.", ulSize, usStreamCRC);
+         DSIDebug::ThreadWrite(szString);
+      }
+   #endif
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Hands the data received up to ulEnd_ to the sink and adds it to the
+// CRC.  Called while the burst is still coming in, so the sink is
+// written while the radio is busy.  The ANT thread stores packets in
+// the window up to ulStreamWritten, so it only moves once the data
+// is out of the window.  ulEnd_ comes from ulStreamReceived, which the
+// ANT thread moves once a packet is in the window.
+BOOL ANTFSHostChannel::WriteStream(ULONG ulEnd_)
+{
+   ULONG ulWritten = ulStreamWritten.load(std::memory_order_relaxed);
+
+   while (ulWritten < ulEnd_)
+   {
+      ULONG ulStart = ulWritten % STREAM_WINDOW_SIZE;
+      ULONG ulLength = MIN(ulEnd_ - ulWritten, STREAM_WINDOW_SIZE - ulStart);
+      UCHAR *pucData = &pucTransferBufferDynamic[16 + ulStart];
+
+      if (!pclDownloadSink->Write(ulWritten, pucData, ulLength))
+      {
+         #if defined(DEBUG_FILE)
+            DSIDebug::ThreadWrite("ANTFSHostChannel::WriteStream():  Sink write failed.");
+         #endif
+         return FALSE;
+      }
+
+      usStreamCRC = CRC_UpdateCRC16(usStreamCRC, pucData, ulLength);
+      ulWritten += ulLength;
+      ulStreamWritten.store(ulWritten, std::memory_order_release);   // The window space is free for the next packets
+   }
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Takes back the data past the last good offset, to download it again.
+BOOL ANTFSHostChannel::RewindStream(void)
+{
+   if (!pclDownloadSink->Truncate(ulStreamBlockStart))
+   {
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("ANTFSHostChannel::RewindStream():  Sink truncate failed.");
+      #endif
+      return FALSE;
+   }
+
+   ulStreamWritten = ulStreamBlockStart;
+   ulStreamReceived = ulStreamBlockStart;
+   ulStreamBlockEnd = ulStreamBlockStart;
+   usStreamCRC = usStreamBlockCRC;
+   ulTransferArrayIndex = ulStreamBlockStart + 16;
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Lets go of the sink and its window once a streamed download is over,
+// whatever its result, so the transfers after it use the transfer
+// buffer again.
+void ANTFSHostChannel::EndStream(void)
+{
+   if (pclDownloadSink == NULL)
+      return;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   pucTransferBuffer = (UCHAR*)NULL;
+   pclDownloadSink = (ANTFSDownloadSink*)NULL;
+
+   if (pucTransferBufferDynamic)
+   {
+      delete[] pucTransferBufferDynamic;
+      pucTransferBufferDynamic = (UCHAR*)NULL;
+   }
+   ulTransferBufferSize = 0;
+
+   ulStreamWritten = 0;
+   ulStreamReceived = 0;
+   ulStreamBlockEnd = 0;
+   ulStreamBlockStart = 0;
+   usStreamCRC = 0;
+   usStreamBlockCRC = 0;
+
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+}
+
 ///////////////////////////////////////////////////////////////////////
 void ANTFSHostChannel::ResetHostState(void)
 {
@@ -2328,6 +2576,14 @@ void ANTFSHostChannel::ResetHostState(void)
    ulTransferBytesInBlock = 0;
    bTransfer = FALSE;
 
+   pclDownloadSink = (ANTFSDownloadSink*)NULL;
+   ulStreamWritten = 0;
+   ulStreamReceived = 0;
+   ulStreamBlockEnd = 0;
+   ulStreamBlockStart = 0;
+   usStreamCRC = 0;
+   usStreamBlockCRC = 0;
+
    usRadioChannelID = 0;
 
    ucTransportFrequencySelection = ANTFS_AUTO_FREQUENCY_SELECTION;
@@ -3328,6 +3584,21 @@ ANTFSHostChannel::RETURN_STATUS ANTFSHostChannel::AttemptDownload(void)
       DSIDebug::ThreadWrite("ANTFSHostChannel::Download():  Starting download...");
    #endif
 
+   if (pclDownloadSink)
+   {
+      if (!StartStream())
+         return RETURN_FAIL;
+
+      if (ulTransferByteSize && (ulStreamWritten >= ulTransferByteSize))
+      {
+         #if defined(DEBUG_FILE)
+            DSIDebug::ThreadWrite("ANTFSHostChannel::Download():  Sink already holds the requested data.");
+         #endif
+         bTransfer = TRUE;
+         return RETURN_PASS;
+      }
+   }
+
    ulLastUpdateTime = DSIThread_GetSystemTime();
 
    do
@@ -3356,6 +3627,17 @@ ANTFSHostChannel::RETURN_STATUS ANTFSHostChannel::AttemptDownload(void)
             return RETURN_FAIL;
          }
 
+         if (pclDownloadSink)
+         {
+            // Keep what arrived of the block in order and request the rest
+            if (!WriteStream(MIN(ulStreamReceived.load(std::memory_order_acquire), ulStreamBlockEnd.load(std::memory_order_acquire))))
+               return RETURN_FAIL;
+
+            ulTransferArrayIndex = ulStreamWritten + 16;
+            ulStreamReceived = ulStreamWritten.load();
+            ulDataOffset = ulTransferDataOffset + ulStreamWritten;
+         }
+
          bRxError = FALSE;
 
          DSIThread_MutexLock(&stMutexCriticalSection);
@@ -3444,7 +3726,9 @@ ANTFSHostChannel::RETURN_STATUS ANTFSHostChannel::AttemptDownload(void)
             if (ucCRCReset == 0)                                        // If this is not the initial request
             {                                                           // Calculate and send a non-zero CRC value
 
-               if (pucTransferBuffer != NULL)                           // Just to make sure the transfer buffer has been created
+               if (pclDownloadSink)                                     // The CRC of a streamed download is kept as it is written
+                  usCRCCalc = usStreamCRC;
+               else if (pucTransferBuffer != NULL)                      // Just to make sure the transfer buffer has been created
                   usCRCCalc = CRC_Calc16(&pucTransferBuffer[16], ulDataOffset-ulTransferDataOffset);  //CRC_UpdateCRC16
                else
                   usCRCCalc = 0;
@@ -3516,6 +3800,9 @@ ANTFSHostChannel::RETURN_STATUS ANTFSHostChannel::AttemptDownload(void)
             return RETURN_STOP;
          }
 
+         if ((pclDownloadSink) && (!WriteStream(MIN(ulStreamReceived.load(std::memory_order_acquire), ulStreamBlockEnd.load(std::memory_order_acquire)))))
+            return RETURN_FAIL;
+
          if (bReceivedResponse)        //If a response has been received, process it.
          {
             bReceivedResponse = FALSE;  //Clear these for any potential retries
@@ -3539,6 +3826,34 @@ ANTFSHostChannel::RETURN_STATUS ANTFSHostChannel::AttemptDownload(void)
                }
                else*/ //Removed Failed CRC response check and automatic retry.  Return the response to the application and allow it to decide to retry or to skip the file.  Can also use Recover Transfer data to recover partial files as this seems to be the most way a corrupted file will fail.
 
+               if ((pclDownloadSink) &&
+                   (pucTransferBufferDynamic[DOWNLOAD_RESPONSE_OFFSET] == DOWNLOAD_RESPONSE_CRC_FAILED) &&
+                   (ulStreamWritten != ulStreamBlockStart))
+               {
+                  #if defined(DEBUG_FILE)
+                     DSIDebug::ThreadWrite("ANTFSHostChannel::Download():  CRC seed rejected, resuming from the last good offset.");
+                  #endif
+                  // The seed covered data that arrived after the last CRC check
+                  if (!RewindStream())
+                     return RETURN_FAIL;
+
+                  ulLastTransferArrayIndex = ulTransferArrayIndex;
+                  bDone = FALSE;
+                  break;
+               }
+
+               if ((pclDownloadSink) &&
+                   (pucTransferBufferDynamic[DOWNLOAD_RESPONSE_OFFSET] == DOWNLOAD_RESPONSE_REQUEST_INVALID) &&
+                   (ulStreamWritten != 0) && (ulStreamWritten == ulTransferTotalBytesRemaining))
+               {
+                  #if defined(DEBUG_FILE)
+                     DSIDebug::ThreadWrite("ANTFSHostChannel::Download():  Sink already holds the whole file.");
+                  #endif
+                  // The resume asked for the offset at the end of the file, which
+                  // some devices reject instead of sending an empty block
+                  break;
+               }
+
                if (pucTransferBufferDynamic[DOWNLOAD_RESPONSE_OFFSET] != DOWNLOAD_RESPONSE_OK)
                {
                   #if defined(DEBUG_FILE)
@@ -3556,8 +3871,48 @@ ANTFSHostChannel::RETURN_STATUS ANTFSHostChannel::AttemptDownload(void)
                return RETURN_FAIL;
             }
 
+            // Check the CRC of a streamed block as it goes to the sink
+            if ((pclDownloadSink) && ((ulStreamBlockEnd.load(std::memory_order_acquire) + 8) <= ulStreamReceived.load(std::memory_order_acquire)))
+            {
+               ULONG ulLength = ulStreamBlockEnd.load(std::memory_order_acquire);
+               ULONG ulReceived = ulStreamReceived.load(std::memory_order_acquire);
+               USHORT usReceivedCRC;
+
+               usReceivedCRC = GetTransferByte(ulReceived + 16 - 2);   //The CRC is the last 2 bytes of the last packet received
+               usReceivedCRC |= ((USHORT)GetTransferByte(ulReceived + 16 - 1) << 8);
+
+               if (!WriteStream(ulLength))
+                  return RETURN_FAIL;
+
+               if (usStreamCRC != usReceivedCRC)
+               {
+                  #if defined(DEBUG_FILE)
+                     char cBuffer[256];
+                     SNPRINTF(cBuffer, 256, "ANTFSHostChannel::Download():  Failed CRC Check. Expected %d, Got %d. Resuming at %lu.", usStreamCRC, usReceivedCRC, ulStreamBlockStart);
+                     DSIDebug::ThreadWrite(cBuffer);
+                  #endif
+                  if (!RewindStream())
+                     return RETURN_FAIL;
+
+                  if (ulStreamBlockStart == 0)
+                     ucCRCReset = 1;
+                  usCRCCalc = 0;
+                  ulLastTransferArrayIndex = ulTransferArrayIndex;
+                  bDone = FALSE;
+               }
+               else
+               {
+                  ulTransferArrayIndex = ulLength + 16;  //correct ulTransferArrayIndex in case we are downloading in odd blocks.
+                  ulStreamReceived = ulLength;
+                  ulStreamBlockStart = ulLength;
+                  usStreamBlockCRC = usStreamCRC;
+
+                  if (!pclDownloadSink->Flush())
+                     return RETURN_FAIL;
+               }
+            }
             // Check if we need to check the CRC
-            if ((bLargeData) &&
+            else if ((bLargeData) && (pclDownloadSink == NULL) &&
                 (((ulDataOffset - ulTransferDataOffset) + ulTransferBytesInBlock + 8) < ulTransferArrayIndex)) //if there is one more packet beyond the data, we will process the CRC
             {
                ULONG ulCRCLocation, ulLength;
@@ -3651,7 +4006,8 @@ ANTFSHostChannel::RETURN_STATUS ANTFSHostChannel::AttemptDownload(void)
 
    } while (!bDone);
 
-
+   if ((pclDownloadSink) && (!pclDownloadSink->Flush()))
+      return RETURN_FAIL;
 
    bTransfer = TRUE;
 
@@ -5281,8 +5637,11 @@ BOOL ANTFSHostChannel::ANTChannelEventProcess(UCHAR ucChannel_, UCHAR ucMessageC
                   if ((pucTransferBuffer[DOWNLOAD_RESPONSE_OFFSET] == DOWNLOAD_RESPONSE_OK) && ((ulReceivedDataOffset - ulTransferDataOffset) != (ulTransferArrayIndex - 16)))
                   {
                      bRxError = TRUE;
-                     ulTransferArrayIndex = 0;
-                     pucTransferBuffer = (UCHAR*) NULL;
+                     if (pclDownloadSink == NULL)     // A streamed download resumes from what reached the sink.
+                     {
+                        ulTransferArrayIndex = 0;
+                        pucTransferBuffer = (UCHAR*) NULL;
+                     }
 
                      #if defined(DEBUG_FILE)
                         DSIDebug::ThreadWrite("ANTFSHostChannel::ANTChannelEventProcess():  DL offset does not match desired DL offset.");
@@ -5290,6 +5649,24 @@ BOOL ANTFSHostChannel::ANTChannelEventProcess(UCHAR ucChannel_, UCHAR ucMessageC
                      break;
                   }
 
+                  if (pclDownloadSink)
+                  {
+                     // Every response of a streamed download sizes its block, there is no buffer to allocate.
+                     // The file size of a reject is kept too, to tell a resume at the end of the file.
+                     ulTransferTotalBytesRemaining = Convert_Bytes_To_ULONG(aucRxBuf[DOWNLOAD_RESPONSE_FILE_SIZE_OFFSET + 3 + 1],
+                               aucRxBuf[DOWNLOAD_RESPONSE_FILE_SIZE_OFFSET + 2 + 1],
+                               aucRxBuf[DOWNLOAD_RESPONSE_FILE_SIZE_OFFSET + 1 + 1],
+                               aucRxBuf[DOWNLOAD_RESPONSE_FILE_SIZE_OFFSET + 1]);
+
+                     if (ulTransferByteSize && ulTransferByteSize < ulTransferTotalBytesRemaining)
+                        ulTransferTotalBytesRemaining = ulTransferByteSize;
+
+                     if (pucTransferBuffer[DOWNLOAD_RESPONSE_OFFSET] == DOWNLOAD_RESPONSE_OK)
+                     {
+                        ulTransferBufferSize = ulTransferTotalBytesRemaining + 24 + 8 + 8;
+                        ulStreamBlockEnd.store((ulReceivedDataOffset - ulTransferDataOffset) + ulTransferBytesInBlock, std::memory_order_release);
+                     }
+                  }
 
                   if (aucRxBuf[0] & SEQUENCE_LAST_MESSAGE)
                   {
@@ -5323,9 +5700,22 @@ BOOL ANTFSHostChannel::ANTChannelEventProcess(UCHAR ucChannel_, UCHAR ucMessageC
                      #endif
                      break;
                   }
-                  memcpy(&pucTransferBuffer[ulTransferArrayIndex], &aucRxBuf[1], 8);
+
+                  if ((pclDownloadSink) && ((ulTransferArrayIndex - 16) + 8 - ulStreamWritten.load(std::memory_order_acquire) > STREAM_WINDOW_SIZE))
+                  {
+                     #if defined(DEBUG_FILE)
+                        DSIDebug::ThreadWrite("ANTFSHostChannel::ANTChannelEventProcess():  Stream window overflow");
+                     #endif
+
+                     bRxError = TRUE;      // The sink fell behind, the rest of the block is requested again.
+                     break;
+                  }
+
+                  StoreTransferPacket(ulTransferArrayIndex, &aucRxBuf[1]);
 
                   ulTransferArrayIndex += 8;
+                  if (pclDownloadSink)
+                     ulStreamReceived.store(ulTransferArrayIndex - 16, std::memory_order_release);   // Publishes the packet to the ANTFS thread
 
                   if (aucRxBuf[0] & SEQUENCE_LAST_MESSAGE)
                   {
@@ -20,6 +20,8 @@ All rights reserved.
 #include <libusb-1.0/libusb.h>
 
 #include <memory>
+#include <mutex>
+#include <time.h>
 
 using namespace std;
 
@@ -29,6 +31,7 @@ using namespace std;
 
 USBDeviceList<const USBDeviceLibusb> USBDeviceHandleLibusb::clDeviceList;
 libusb_context* USBDeviceHandleLibusb::ctx = 0;
+UCHAR USBDeviceHandleLibusb::ucRxTransferCount = USB_ANT_RX_TRANSFERS_DEFAULT;
 
 //////////////////////////////////////////////////////////////////////////////////
 // Private Definitions
@@ -38,6 +41,45 @@ const UCHAR USB_ANT_CONFIGURATION = 1;
 const UCHAR USB_ANT_INTERFACE = 0;
 const UCHAR USB_ANT_EP_IN  = 0x81;
 const UCHAR USB_ANT_EP_OUT = 0x01;
+const int USB_ANT_RX_MAX_CONSEC_ERRORS = 10;
+const int USB_ANT_HOTPLUG_VIDS = 2;
+const ULONG USB_ANT_TX_TIMEOUT_MS = 3000;               // Per bulk OUT transfer, and for Write() to find a free slot.
+
+typedef struct
+{
+   USBHotplugCallback pfCallback;                        // NULL if the slot is free.
+   void* pvParameter;
+   libusb_hotplug_callback_handle ahCallbacks[USB_ANT_HOTPLUG_VIDS];  // One libusb callback per ANT vendor ID.
+} HOTPLUG_REGISTRATION;
+
+static HOTPLUG_REGISTRATION astHotplugRegistrations[USB_ANT_HOTPLUG_CALLBACKS_MAX];
+static UCHAR ucHotplugRegistrations = 0;
+static mutex clHotplugMutex;                             // Keeps a slot from being freed while its callback runs.
+
+static DSI_THREAD_ID hHotplugThread = (DSI_THREAD_ID)NULL;  // Handles libusb events while no receive thread does.
+static const LibusbLibrary* pclHotplugLibrary = NULL;    // Loaded with the first registration, kept for the application.
+static DSI_MUTEX stHotplugThreadMutex;
+static DSI_CONDITION_VAR stEventHotplugThreadExit;
+static BOOL bStopHotplugThread = TRUE;
+
+static unsigned long long GetMonotonicUs()
+{
+   struct timespec stNow;
+   clock_gettime(CLOCK_MONOTONIC, &stNow);
+   return (unsigned long long)stNow.tv_sec * 1000000 + (unsigned long long)(stNow.tv_nsec / 1000);
+}
+
+// When the libusb event pass running on this thread reaped its first
+// transfer, 0 before that.  libusb reaps every transfer that completed
+// while it slept in one pass, so this is the earliest the completion of
+// any of them can be seen; the later ones also wait behind the
+// callbacks of those before them.
+static thread_local unsigned long long ullEventPassUs = 0;
+
+static void BeginEventPass()
+{
+   ullEventPassUs = 0;
+}
 
 BOOL LibusbDeviceMatch(const USBDeviceLibusb* const & pclDevice_)
 {
@@ -129,12 +171,14 @@ BOOL USBDeviceHandleLibusb::Open(const USBDeviceLibusb& clDevice_, USBDeviceHand
     // sending two ANT requests.
     // In the case that the USB pipe is not totally out of sync, and some responses are received,
     // we make sure we read all that data so the workaround is invisible to the app.
+    // The requests must be two separate transfers, sent before the reads start, so they bypass
+    // the coalescing writer.
     UCHAR aucReqCapabilitiesMsg[MESG_FRAME_SIZE + 2] = {0xA4, 0x02, 0x4D, 0x00, 0x54, 0xBF};
     UCHAR aucCapabilitiesMsg[MESG_MAX_SIZE];
     ULONG ulBytesWritten, ulBytesRead = 0;
 
-    pclDeviceHandle_->Write(aucReqCapabilitiesMsg, sizeof(aucReqCapabilitiesMsg), ulBytesWritten);
-    pclDeviceHandle_->Write(aucReqCapabilitiesMsg, sizeof(aucReqCapabilitiesMsg), ulBytesWritten);
+    pclDeviceHandle_->WriteSync(aucReqCapabilitiesMsg, sizeof(aucReqCapabilitiesMsg), ulBytesWritten);
+    pclDeviceHandle_->WriteSync(aucReqCapabilitiesMsg, sizeof(aucReqCapabilitiesMsg), ulBytesWritten);
     pclDeviceHandle_->Read(aucCapabilitiesMsg, sizeof(aucCapabilitiesMsg), ulBytesRead, 10);
     pclDeviceHandle_->Read(aucCapabilitiesMsg, sizeof(aucCapabilitiesMsg), ulBytesRead, 10);
 
@@ -216,6 +260,268 @@ BOOL USBDeviceHandleLibusb::TryOpen(const USBDeviceLibusb& clDevice_)
 }
 
 
+///////////////////////////////////////////////////////////////////////
+void USBDeviceHandleLibusb::SetRxTransferCount(UCHAR ucCount_)
+{
+   if(ucCount_ < 1)
+      ucCount_ = 1;
+   if(ucCount_ > USB_ANT_RX_TRANSFERS_MAX)
+      ucCount_ = USB_ANT_RX_TRANSFERS_MAX;
+
+   ucRxTransferCount = ucCount_;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL USBDeviceHandleLibusb::GetRxStats(USB_RX_STATS& stStats_) const
+{
+   ULONG ulCompleted = ulRxCompleted.load();
+
+   stStats_.ulTransfersCompleted = ulCompleted;
+   stStats_.ulTransferErrors = ulRxErrors.load();
+   stStats_.ulTurnaroundAvgUs = ulCompleted ? (ULONG)(ullTurnaroundTotalUs.load() / ulCompleted) : 0;
+   stStats_.ulTurnaroundMaxUs = ulTurnaroundMaxUs.load();
+   stStats_.ulIdleCount = ulIdleCount.load();
+   stStats_.ulIdleTotalUs = (ULONG)ullIdleTotalUs.load();
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+void USBDeviceHandleLibusb::SetWriteErrorCallback(USBWriteErrorCallback pfCallback_, void* pvParameter_)
+{
+   DSIThread_MutexLock(&stTxMutex);
+   pfTxErrorCallback = pfCallback_;
+   pvTxErrorParameter = pvParameter_;
+   DSIThread_MutexUnlock(&stTxMutex);
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL USBDeviceHandleLibusb::GetTxStats(USB_TX_STATS& stStats_) const
+{
+   stStats_.ulWrites = ulTxWrites.load();
+   stStats_.ulTransfers = ulTxTransfers.load();
+   stStats_.ulTransferErrors = ulTxErrors.load();
+   stStats_.ulQueueFullWaits = ulTxQueueFullWaits.load();
+   return TRUE;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+// Runs on whichever thread is handling libusb events.  libusb holds
+// its own callback lock here, so nothing in this path may wait for
+// libusb.
+///////////////////////////////////////////////////////////////////////
+static int LIBUSB_CALL HotplugArrived(libusb_context* /*ctx_*/, libusb_device* /*device_*/, libusb_hotplug_event /*event_*/, void* pvParameter_)
+{
+   HOTPLUG_REGISTRATION* pstRegistration = (HOTPLUG_REGISTRATION*)pvParameter_;
+
+   lock_guard<mutex> clLock(clHotplugMutex);
+   if(pstRegistration->pfCallback != NULL)
+      pstRegistration->pfCallback(pstRegistration->pvParameter);
+
+   return 0;  //Stay armed
+}
+
+///////////////////////////////////////////////////////////////////////
+// Loads the library the hotplug code uses, once.  It stays loaded for
+// the rest of the application, as the hotplug thread and the libusb
+// callbacks can outlive any one device handle.
+///////////////////////////////////////////////////////////////////////
+static BOOL LoadHotplugLibrary()
+{
+   lock_guard<mutex> clLock(clHotplugMutex);
+   if(pclHotplugLibrary != NULL)
+      return TRUE;
+
+   try
+   {
+      pclHotplugLibrary = new LibusbLibrary();
+   }
+   catch(...)
+   {
+      pclHotplugLibrary = NULL;
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Keeps libusb events flowing so arrivals are seen with every device
+// unplugged, and so with no receive thread running.
+///////////////////////////////////////////////////////////////////////
+static DSI_THREAD_RETURN HotplugThread(void* pvParameter_)
+{
+   libusb_context* pstContext = (libusb_context*)pvParameter_;
+   struct timeval tvHandleEventsTimeout;
+   tvHandleEventsTimeout.tv_sec = 0;
+   tvHandleEventsTimeout.tv_usec = 250000;  //Bounds how long stopping the thread takes
+
+   while(!bStopHotplugThread)
+   {
+      BeginEventPass();
+      pclHotplugLibrary->HandleEventsTimeoutCompleted(pstContext, &tvHandleEventsTimeout, NULL);
+   }
+
+   DSIThread_MutexLock(&stHotplugThreadMutex);
+   bStopHotplugThread = TRUE;
+   DSIThread_CondSignal(&stEventHotplugThreadExit);
+   DSIThread_MutexUnlock(&stHotplugThreadMutex);
+
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+static void StopHotplugThread()
+{
+   if(hHotplugThread == (DSI_THREAD_ID)NULL)
+      return;
+
+   DSIThread_MutexLock(&stHotplugThreadMutex);
+   if(bStopHotplugThread == FALSE)
+   {
+      bStopHotplugThread = TRUE;
+
+      if(DSIThread_CondTimedWait(&stEventHotplugThreadExit, &stHotplugThreadMutex, 3000) != DSI_THREAD_ENONE)
+      {
+         // We were unable to stop the thread normally.
+         DSIThread_DestroyThread(hHotplugThread);
+      }
+   }
+   DSIThread_MutexUnlock(&stHotplugThreadMutex);
+
+   DSIThread_ReleaseThreadID(hHotplugThread);
+   hHotplugThread = (DSI_THREAD_ID)NULL;
+
+   DSIThread_MutexDestroy(&stHotplugThreadMutex);
+   DSIThread_CondDestroy(&stEventHotplugThreadExit);
+}
+
+///////////////////////////////////////////////////////////////////////
+static BOOL StartHotplugThread(libusb_context* pstContext_)
+{
+   if(hHotplugThread != (DSI_THREAD_ID)NULL)
+      return TRUE;
+
+   if(DSIThread_MutexInit(&stHotplugThreadMutex) != DSI_THREAD_ENONE)
+      return FALSE;
+
+   if(DSIThread_CondInit(&stEventHotplugThreadExit) != DSI_THREAD_ENONE)
+   {
+      DSIThread_MutexDestroy(&stHotplugThreadMutex);
+      return FALSE;
+   }
+
+   bStopHotplugThread = FALSE;
+   hHotplugThread = DSIThread_CreateThread(&HotplugThread, pstContext_);
+   if(hHotplugThread == (DSI_THREAD_ID)NULL)
+   {
+      bStopHotplugThread = TRUE;
+      DSIThread_CondDestroy(&stEventHotplugThreadExit);
+      DSIThread_MutexDestroy(&stHotplugThreadMutex);
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Registers for arrivals of either ANT vendor ID.  The handle given
+// back is the registration slot.
+///////////////////////////////////////////////////////////////////////
+BOOL USBDeviceHandleLibusb::RegisterHotplugCallback(USBHotplugCallback pfCallback_, void* pvParameter_, int& iHandle_)
+{
+   static const int aiVids[USB_ANT_HOTPLUG_VIDS] = {USB_ANT_VID, USB_ANT_VID_TWO};
+
+   if(pfCallback_ == NULL)
+      return FALSE;
+
+   //Get a reference to library
+   if(LoadHotplugLibrary() == FALSE)
+      return FALSE;
+   const LibusbLibrary& clLibusbLibrary = *pclHotplugLibrary;
+
+   if(!clLibusbLibrary.HasCapability(LIBUSB_CAP_HAS_HOTPLUG))
+      return FALSE;
+
+   if(ctx == NULL)
+   {
+      clLibusbLibrary.Init(&ctx);
+   }
+
+   UCHAR ucSlot;
+   {
+      lock_guard<mutex> clLock(clHotplugMutex);
+      for(ucSlot = 0; ucSlot < USB_ANT_HOTPLUG_CALLBACKS_MAX; ucSlot++)
+      {
+         if(astHotplugRegistrations[ucSlot].pfCallback == NULL)
+            break;
+      }
+      if(ucSlot == USB_ANT_HOTPLUG_CALLBACKS_MAX)
+         return FALSE;
+
+      astHotplugRegistrations[ucSlot].pfCallback = pfCallback_;
+      astHotplugRegistrations[ucSlot].pvParameter = pvParameter_;
+   }
+
+   HOTPLUG_REGISTRATION& stRegistration = astHotplugRegistrations[ucSlot];
+   for(int i = 0; i < USB_ANT_HOTPLUG_VIDS; i++)
+   {
+      int ret = clLibusbLibrary.HotplugRegisterCallback(ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, (libusb_hotplug_flag)0, aiVids[i],
+                                                        LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, &HotplugArrived, &stRegistration, &stRegistration.ahCallbacks[i]);
+      if(ret != LIBUSB_SUCCESS)
+      {
+         while(i-- > 0)
+            clLibusbLibrary.HotplugDeregisterCallback(ctx, stRegistration.ahCallbacks[i]);
+
+         lock_guard<mutex> clLock(clHotplugMutex);
+         stRegistration.pfCallback = NULL;
+         return FALSE;
+      }
+   }
+
+   if(ucHotplugRegistrations++ == 0 && StartHotplugThread(ctx) == FALSE)
+   {
+      ucHotplugRegistrations--;
+      for(int i = 0; i < USB_ANT_HOTPLUG_VIDS; i++)
+         clLibusbLibrary.HotplugDeregisterCallback(ctx, stRegistration.ahCallbacks[i]);
+
+      lock_guard<mutex> clLock(clHotplugMutex);
+      stRegistration.pfCallback = NULL;
+      return FALSE;
+   }
+
+   iHandle_ = ucSlot;
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Once this returns the callback is not running and will not be
+// called again.
+///////////////////////////////////////////////////////////////////////
+void USBDeviceHandleLibusb::DeregisterHotplugCallback(int iHandle_)
+{
+   if(iHandle_ < 0 || iHandle_ >= USB_ANT_HOTPLUG_CALLBACKS_MAX)
+      return;
+
+   HOTPLUG_REGISTRATION& stRegistration = astHotplugRegistrations[iHandle_];
+   {
+      // Cleared first: libusb may be inside HotplugArrived holding its
+      // callback lock, which its deregister call below waits for.
+      lock_guard<mutex> clLock(clHotplugMutex);
+      if(stRegistration.pfCallback == NULL)
+         return;
+      stRegistration.pfCallback = NULL;
+   }
+
+   // Loaded by the registration
+   for(int i = 0; i < USB_ANT_HOTPLUG_VIDS; i++)
+      pclHotplugLibrary->HotplugDeregisterCallback(ctx, stRegistration.ahCallbacks[i]);
+
+   if(--ucHotplugRegistrations == 0)
+      StopHotplugThread();
+}
+
+
 ///////////////////////////////////////////////////////////////////////
 // Constructor
 ///////////////////////////////////////////////////////////////////////
@@ -231,6 +537,35 @@ try
    bStopReceiveThread = TRUE;
    device_handle = NULL;
 
+   ucRxTransfers = ucRxTransferCount;
+   for(UCHAR i = 0; i < USB_ANT_RX_TRANSFERS_MAX; i++)
+   {
+      astRxTransfers[i].pclOwner = this;
+      astRxTransfers[i].pstTransfer = NULL;
+   }
+   iRxInFlight = 0;
+   iConsecIoErrors = 0;
+   ullIdleSinceUs = 0;
+   ulRxCompleted = 0;
+   ulRxErrors = 0;
+   ullTurnaroundTotalUs = 0;
+   ulTurnaroundMaxUs = 0;
+   ulIdleCount = 0;
+   ullIdleTotalUs = 0;
+
+   hTransmitThread = (DSI_THREAD_ID)NULL;
+   bStopTransmitThread = TRUE;
+   ucTxHead = 0;
+   ucTxCount = 0;
+   usTxPacketSize = USB_ANT_TX_SLOT_SIZE;
+   bTxBusy = FALSE;
+   pfTxErrorCallback = NULL;
+   pvTxErrorParameter = NULL;
+   ulTxWrites = 0;
+   ulTxTransfers = 0;
+   ulTxErrors = 0;
+   ulTxQueueFullWaits = 0;
+
    if(ctx == NULL)
    {
       clLibusbLibrary.Init(&ctx);
@@ -319,6 +654,12 @@ BOOL USBDeviceHandleLibusb::POpen()
       return FALSE;
    }
 
+   if(StartTransmitThread() == FALSE)
+   {
+      PClose();
+      return FALSE;
+   }
+
    return TRUE;
 }
 
@@ -328,6 +669,7 @@ BOOL USBDeviceHandleLibusb::POpen()
 ///////////////////////////////////////////////////////////////////////
 void USBDeviceHandleLibusb::PClose(BOOL bReset_)
 {
+   StopTransmitThread();  //Sends what is still queued, like a reset, while the device is there
 
    bDeviceGone = TRUE;
 
@@ -387,50 +729,134 @@ static void LIBUSB_CALL Callback(struct libusb_transfer *transfer)
     *completed = 1;
 }
 ///////////////////////////////////////////////////////////////////////
-// Writes usSize_ bytes to USB, returns TRUE if successful.
+// Queues ulSize_ bytes for the writer thread, returns NONE if they
+// were queued.  The bytes are queued all together or not at all, so a
+// failed write never leaves part of an ANT frame to go out.
 ///////////////////////////////////////////////////////////////////////
-//!!Return true if we wrote half the bytes successfully?
 USBError::Enum USBDeviceHandleLibusb::Write(void* pvData_, ULONG ulSize_, ULONG& ulBytesWritten_)
 {
-    #if defined(DEBUG_FILE) && defined(_DEBUG)
-    BOOL bTxDebug = DSIDebug::ThreadInit("ao_libusb_transmit");
-    DSIDebug::ThreadEnable(TRUE);
-    #endif
-
     if(bDeviceGone)
         return USBError::DEVICE_GONE;
 
     if(pvData_ == NULL)
         return USBError::INVALID_PARAM;
 
-    int iRet = 0;
-    int iCompleted = 0;
-    struct libusb_transfer *asyncTransfer;
-    struct timeval tvHandleEventsTimeout;
-    tvHandleEventsTimeout.tv_sec = 3;
-    tvHandleEventsTimeout.tv_usec = 0;
+    const ULONG ulSlots = (ulSize_ + USB_ANT_TX_SLOT_SIZE - 1) / USB_ANT_TX_SLOT_SIZE;
+    if(ulSlots > USB_ANT_TX_QUEUE_SIZE)
+        return USBError::INVALID_PARAM;
+
+    const UCHAR* pucData = (const UCHAR*)pvData_;
+    USBError::Enum eResult = USBError::NONE;
+    ULONG ulQueued = 0;
 
-    asyncTransfer = clLibusbLibrary.AllocTransfer(0);
-    clLibusbLibrary.FillBulkTransfer(asyncTransfer, device_handle, USB_ANT_EP_OUT, (UCHAR*)pvData_, (int)ulSize_, Callback, &iCompleted, 3000);
-    asyncTransfer->type = LIBUSB_TRANSFER_TYPE_BULK;
-    iRet = clLibusbLibrary.SubmitTransfer(asyncTransfer);
-    if(iRet < 0)
+    DSIThread_MutexLock(&stTxMutex);
+
+    // Wait for room for the whole write before queueing any of it
+    while(eResult == USBError::NONE && (ULONG)(USB_ANT_TX_QUEUE_SIZE - ucTxCount) < ulSlots)
     {
-        clLibusbLibrary.FreeTransfer(asyncTransfer);
-        return USBError::FAILED;
+        if(bStopTransmitThread)
+        {
+            eResult = bDeviceGone ? USBError::DEVICE_GONE : USBError::FAILED;
+            break;
+        }
+
+        ulTxQueueFullWaits++;
+        if(DSIThread_CondTimedWait(&stCondTxSpace, &stTxMutex, USB_ANT_TX_TIMEOUT_MS) != DSI_THREAD_ENONE)
+            eResult = USBError::FAILED;
     }
 
-    while(!iCompleted)
-        clLibusbLibrary.HandleEventsTimeoutCompleted(NULL, &tvHandleEventsTimeout, &iCompleted);
+    if(eResult == USBError::NONE && bStopTransmitThread)
+        eResult = bDeviceGone ? USBError::DEVICE_GONE : USBError::FAILED;
+
+    while(eResult == USBError::NONE && ulQueued < ulSize_)
+    {
+        TxSlot& stSlot = astTxQueue[(ucTxHead + ucTxCount) % USB_ANT_TX_QUEUE_SIZE];
+        ULONG ulChunk = ulSize_ - ulQueued;
+        if(ulChunk > USB_ANT_TX_SLOT_SIZE)
+            ulChunk = USB_ANT_TX_SLOT_SIZE;
+
+        memcpy(stSlot.aucData, &pucData[ulQueued], ulChunk);
+        stSlot.ucSize = (UCHAR)ulChunk;
+        ulQueued += ulChunk;
+        ucTxCount++;
+    }
 
-    if(asyncTransfer->status != LIBUSB_TRANSFER_COMPLETED)
+    if(ulQueued > 0)
     {
+        ulTxWrites++;
+        DSIThread_CondSignal(&stCondTxQueued);
+    }
+
+    DSIThread_MutexUnlock(&stTxMutex);
+
+    ulBytesWritten_ = ulQueued;
+    return eResult;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Sends the bytes in a bulk OUT transfer of their own, once everything
+// queued before them has gone out, and waits for it to complete.
+// Write() calls made meanwhile wait, so nothing goes out in between.
+///////////////////////////////////////////////////////////////////////
+USBError::Enum USBDeviceHandleLibusb::WriteSync(void* pvData_, ULONG ulSize_, ULONG& ulBytesWritten_)
+{
+    ulBytesWritten_ = 0;
+
+    if(bDeviceGone)
+        return USBError::DEVICE_GONE;
+
+    if(pvData_ == NULL || ulSize_ > USB_ANT_TX_TRANSFER_MAX)
+        return USBError::INVALID_PARAM;
+
+    struct libusb_transfer* pstTransfer = clLibusbLibrary.AllocTransfer(0);
+    if(pstTransfer == NULL)
         return USBError::FAILED;
+
+    USBError::Enum eResult = USBError::NONE;
+
+    DSIThread_MutexLock(&stTxMutex);
+
+    while(eResult == USBError::NONE && (ucTxCount > 0 || bTxBusy))
+    {
+        if(bStopTransmitThread)
+            eResult = bDeviceGone ? USBError::DEVICE_GONE : USBError::FAILED;
+        else if(DSIThread_CondTimedWait(&stCondTxSpace, &stTxMutex, USB_ANT_TX_TIMEOUT_MS) != DSI_THREAD_ENONE)
+            eResult = USBError::FAILED;
     }
 
-    ulBytesWritten_ = asyncTransfer->actual_length;
+    if(eResult == USBError::NONE)
+    {
+        struct timeval tvHandleEventsTimeout;
+        tvHandleEventsTimeout.tv_sec = 1;
+        tvHandleEventsTimeout.tv_usec = 0;
+
+        int iCompleted = 0;
+        clLibusbLibrary.FillBulkTransfer(pstTransfer, device_handle, USB_ANT_EP_OUT, (UCHAR*)pvData_, (int)ulSize_, Callback, &iCompleted, USB_ANT_TX_TIMEOUT_MS);
+        pstTransfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+        if(clLibusbLibrary.SubmitTransfer(pstTransfer) == 0)
+        {
+            while(!iCompleted)
+            {
+                BeginEventPass();
+                clLibusbLibrary.HandleEventsTimeoutCompleted(ctx, &tvHandleEventsTimeout, &iCompleted);
+            }
+        }
 
-    return USBError::NONE;
+        if(iCompleted && pstTransfer->status == LIBUSB_TRANSFER_COMPLETED)
+            ulBytesWritten_ = (ULONG)pstTransfer->actual_length;
+        else
+            eResult = USBError::FAILED;
+
+        ulTxWrites++;
+        ulTxTransfers++;
+        if(eResult != USBError::NONE)
+            ulTxErrors++;
+    }
+
+    DSIThread_MutexUnlock(&stTxMutex);
+
+    clLibusbLibrary.FreeTransfer(pstTransfer);
+    return eResult;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -443,6 +869,102 @@ USBError::Enum USBDeviceHandleLibusb::Read(void* pvData_, ULONG ulSize_, ULONG&
     return USBError::NONE;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Submits one receive transfer and tracks how long the endpoint was
+// left without any transfer queued.
+///////////////////////////////////////////////////////////////////////
+BOOL USBDeviceHandleLibusb::SubmitRxTransfer(RxTransfer* pstRx_)
+{
+    if(clLibusbLibrary.SubmitTransfer(pstRx_->pstTransfer) < 0)
+        return FALSE;
+
+    if(iRxInFlight.fetch_add(1) == 0)
+    {
+        unsigned long long ullIdleSince = ullIdleSinceUs.exchange(0);
+        if(ullIdleSince != 0)
+            ullIdleTotalUs.fetch_add(GetMonotonicUs() - ullIdleSince);
+    }
+
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Runs on whichever thread is handling libusb events.  Hands the data
+// to the rx queue and puts the transfer straight back on the endpoint.
+///////////////////////////////////////////////////////////////////////
+void USBDeviceHandleLibusb::RxTransferComplete(RxTransfer* pstRx_)
+{
+    unsigned long long ullCompletedUs = GetMonotonicUs();
+    struct libusb_transfer* pstTransfer = pstRx_->pstTransfer;
+    BOOL bResubmit = FALSE;
+
+    if(ullEventPassUs == 0)
+        ullEventPassUs = ullCompletedUs;
+    else
+        ullCompletedUs = ullEventPassUs;  //Reaped in the same pass as an earlier transfer, and completed by the time that one was
+
+    if(iRxInFlight.fetch_sub(1) == 1)
+    {
+        ulIdleCount++;
+        ullIdleSinceUs = ullCompletedUs;
+    }
+
+    switch(pstTransfer->status)
+    {
+        case LIBUSB_TRANSFER_COMPLETED:
+            clRxQueue.PushArray(pstRx_->aucData, pstTransfer->actual_length);
+            iConsecIoErrors = 0;
+            bResubmit = TRUE;
+            break;
+
+        case LIBUSB_TRANSFER_CANCELLED:
+            break;
+
+        default:
+            ulRxErrors++;
+            if(iConsecIoErrors.fetch_add(1) + 1 < USB_ANT_RX_MAX_CONSEC_ERRORS)
+                bResubmit = TRUE;
+            #if defined(_DEBUG) && defined(DEBUG_FILE)
+            {
+                char acMesg[255];
+                SNPRINTF(acMesg, 255, "RxTransferComplete(): Transfer Unsuccessful - Error %d", pstTransfer->status);
+                DSIDebug::ThreadWrite(acMesg);
+            }
+            #endif
+            break;
+    }
+
+    if(!bResubmit || bStopReceiveThread)
+        return;
+
+    BOOL bHadData = (pstTransfer->status == LIBUSB_TRANSFER_COMPLETED);  //Read before resubmitting, the transfer belongs to libusb again after that
+
+    if(SubmitRxTransfer(pstRx_) == FALSE)
+        return;
+
+    if(bHadData)
+    {
+        ULONG ulTurnaroundUs = (ULONG)(GetMonotonicUs() - ullCompletedUs);
+        ULONG ulMax = ulTurnaroundMaxUs.load();
+
+        ulRxCompleted++;
+        ullTurnaroundTotalUs.fetch_add(ulTurnaroundUs);
+        while(ulTurnaroundUs > ulMax && !ulTurnaroundMaxUs.compare_exchange_weak(ulMax, ulTurnaroundUs)) {}
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+void LIBUSB_CALL USBDeviceHandleLibusb::RxCallback(struct libusb_transfer* pstTransfer_)
+{
+    RxTransfer* pstRx = (RxTransfer*)pstTransfer_->user_data;
+    pstRx->pclOwner->RxTransferComplete(pstRx);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Keeps ucRxTransfers bulk IN transfers in flight and runs the libusb
+// event loop until the handle is closed or the endpoint stops
+// accepting transfers.
+///////////////////////////////////////////////////////////////////////
 void USBDeviceHandleLibusb::ReceiveThread()
 {
     #if defined(DEBUG_FILE)
@@ -450,91 +972,63 @@ void USBDeviceHandleLibusb::ReceiveThread()
     DSIDebug::ThreadEnable(TRUE);
     #endif
 
-    int iRet = 0;
-    int iConsecIoErrors = 0;
-    int iCompleted = 0;
-    BOOL bSubmitTransfer = TRUE;
-    BOOL bReallocTransfer = TRUE;
-    UCHAR aucData[4096];
-    struct libusb_transfer *asyncTransfer;
     struct timeval tvHandleEventsTimeout;
     tvHandleEventsTimeout.tv_sec = 1;
     tvHandleEventsTimeout.tv_usec = 0;
 
-    while(!bStopReceiveThread)
+    iConsecIoErrors = 0;
+    ullIdleSinceUs = 0;
+
+    for(UCHAR i = 0; i < ucRxTransfers; i++)
     {
-        if(bSubmitTransfer)
-        {
-            bSubmitTransfer = FALSE;
-            if(bReallocTransfer)
-            {
-                asyncTransfer = clLibusbLibrary.AllocTransfer(0);
-                clLibusbLibrary.FillBulkTransfer(asyncTransfer, device_handle, USB_ANT_EP_IN, aucData, sizeof(aucData), Callback, &iCompleted, 0);
-                asyncTransfer->type = LIBUSB_TRANSFER_TYPE_BULK;
-                bReallocTransfer = FALSE;
-            }
-            iRet = clLibusbLibrary.SubmitTransfer(asyncTransfer);
-            iCompleted = 0;
-            if(iRet < 0)
-            {
-                clLibusbLibrary.FreeTransfer(asyncTransfer);
-                bStopReceiveThread = TRUE;
-                return;
-            }
-        }
+        RxTransfer* pstRx = &astRxTransfers[i];
+        pstRx->pstTransfer = clLibusbLibrary.AllocTransfer(0);
+        if(pstRx->pstTransfer == NULL)
+            break;
+
+        clLibusbLibrary.FillBulkTransfer(pstRx->pstTransfer, device_handle, USB_ANT_EP_IN, pstRx->aucData, sizeof(pstRx->aucData), &USBDeviceHandleLibusb::RxCallback, pstRx, 0);
+        pstRx->pstTransfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+        SubmitRxTransfer(pstRx);
+    }
 
-        clLibusbLibrary.HandleEventsTimeoutCompleted(NULL, &tvHandleEventsTimeout, &iCompleted);
+    #if defined(_DEBUG) && defined(DEBUG_FILE)
+    if(bRxDebug)
+    {
+        char acMesg[255];
+        SNPRINTF(acMesg, 255, "ReceiveThread(): %d Transfers In Flight", iRxInFlight.load());
+        DSIDebug::ThreadWrite(acMesg);
+    }
+    #endif
 
-        if(iCompleted)
-        {
-            switch(asyncTransfer->status)
-            {
-                case LIBUSB_TRANSFER_COMPLETED:
-                    clRxQueue.PushArray(aucData, asyncTransfer->actual_length);
-                    bSubmitTransfer = TRUE;
-                    iConsecIoErrors = 0;
-                    #if defined(_DEBUG) && defined(DEBUG_FILE)
-                    if(bRxDebug)
-                    {
-                        char acMesg[255];
-                        SNPRINTF(acMesg, 255, "ReceiveThread(): %d Bytes Read From USB", asyncTransfer->actual_length);
-                        DSIDebug::ThreadWrite(acMesg);
-                    }
-                    #endif
-                    break;
-                default:
-                    clLibusbLibrary.FreeTransfer(asyncTransfer);
-                    if(iConsecIoErrors == 10)
-                    {
-                        bStopReceiveThread = TRUE;
-                        break;
-                    }
-                    iConsecIoErrors++;
-                    bReallocTransfer = TRUE;
-                    bSubmitTransfer = TRUE;
-                    #if defined(_DEBUG) && defined(DEBUG_FILE)
-                    if(bRxDebug)
-                    {
-                        char acMesg2[255];
-                        SNPRINTF(acMesg2, 255, "ReceiveThread(): Transfer Unsuccessful - Error %d", asyncTransfer->status);
-                        DSIDebug::ThreadWrite(acMesg2);
-                    }
-                    #endif
-                    break;
-            }
-        }
+    while(!bStopReceiveThread && iRxInFlight > 0)
+    {
+        BeginEventPass();
+        clLibusbLibrary.HandleEventsTimeoutCompleted(ctx, &tvHandleEventsTimeout, NULL);
+    }
+
+    for(UCHAR i = 0; i < ucRxTransfers; i++)
+    {
+        if(astRxTransfers[i].pstTransfer != NULL)
+            clLibusbLibrary.CancelTransfer(astRxTransfers[i].pstTransfer);  //Fails harmlessly if the transfer is not in flight
     }
 
-    if(!iCompleted)
+    while(iRxInFlight > 0)
     {
-        clLibusbLibrary.CancelTransfer(asyncTransfer);
-        while(!iCompleted)
-            clLibusbLibrary.HandleEventsTimeoutCompleted(NULL, &tvHandleEventsTimeout, &iCompleted);
-        clLibusbLibrary.FreeTransfer(asyncTransfer);
-        asyncTransfer = NULL;
+        BeginEventPass();
+        clLibusbLibrary.HandleEventsTimeoutCompleted(ctx, &tvHandleEventsTimeout, NULL);
+    }
+
+    for(UCHAR i = 0; i < ucRxTransfers; i++)
+    {
+        if(astRxTransfers[i].pstTransfer != NULL)
+        {
+            clLibusbLibrary.FreeTransfer(astRxTransfers[i].pstTransfer);
+            astRxTransfers[i].pstTransfer = NULL;
+        }
     }
 
     bDeviceGone = TRUE;  //The read loop is dead, since we can't get any info, the device might as well be gone
+    clRxQueue.Notify();  //Wake a blocked Read() so the loss is reported now rather than at its timeout
 
     DSIThread_MutexLock(&stMutexCriticalSection);
     bStopReceiveThread = TRUE;
@@ -551,4 +1045,183 @@ DSI_THREAD_RETURN USBDeviceHandleLibusb::ProcessThread(void* pvParameter_)
     return 0;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Sizes the coalescing budget from the OUT endpoint and starts the
+// writer thread.
+///////////////////////////////////////////////////////////////////////
+BOOL USBDeviceHandleLibusb::StartTransmitThread()
+{
+    int iPacketSize = clLibusbLibrary.GetMaxPacketSize(&clDevice.GetRawDevice(), USB_ANT_EP_OUT);
+    if(iPacketSize < USB_ANT_TX_SLOT_SIZE)
+        iPacketSize = USB_ANT_TX_SLOT_SIZE;  //Also when the endpoint could not be read
+    if(iPacketSize > USB_ANT_TX_TRANSFER_MAX)
+        iPacketSize = USB_ANT_TX_TRANSFER_MAX;
+    usTxPacketSize = (USHORT)iPacketSize;
+
+    ucTxHead = 0;
+    ucTxCount = 0;
+    bTxBusy = FALSE;
+
+    if(DSIThread_MutexInit(&stTxMutex) != DSI_THREAD_ENONE)
+        return FALSE;
+
+    if(DSIThread_CondInit(&stCondTxQueued) != DSI_THREAD_ENONE)
+    {
+        DSIThread_MutexDestroy(&stTxMutex);
+        return FALSE;
+    }
+
+    if(DSIThread_CondInit(&stCondTxSpace) != DSI_THREAD_ENONE)
+    {
+        DSIThread_CondDestroy(&stCondTxQueued);
+        DSIThread_MutexDestroy(&stTxMutex);
+        return FALSE;
+    }
+
+    if(DSIThread_CondInit(&stEventTransmitThreadExit) != DSI_THREAD_ENONE)
+    {
+        DSIThread_CondDestroy(&stCondTxSpace);
+        DSIThread_CondDestroy(&stCondTxQueued);
+        DSIThread_MutexDestroy(&stTxMutex);
+        return FALSE;
+    }
+
+    bStopTransmitThread = FALSE;
+    hTransmitThread = DSIThread_CreateThread(&USBDeviceHandleLibusb::ProcessTransmitThread, this);
+    if(hTransmitThread == (DSI_THREAD_ID)NULL)
+    {
+        bStopTransmitThread = TRUE;
+        DSIThread_CondDestroy(&stEventTransmitThreadExit);
+        DSIThread_CondDestroy(&stCondTxSpace);
+        DSIThread_CondDestroy(&stCondTxQueued);
+        DSIThread_MutexDestroy(&stTxMutex);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Lets the writer thread send what is queued and waits for it to end.
+///////////////////////////////////////////////////////////////////////
+void USBDeviceHandleLibusb::StopTransmitThread()
+{
+    if(hTransmitThread == (DSI_THREAD_ID)NULL)
+        return;
+
+    DSIThread_MutexLock(&stTxMutex);
+    if(bStopTransmitThread == FALSE)
+    {
+        bStopTransmitThread = TRUE;
+        DSIThread_CondSignal(&stCondTxQueued);
+
+        if(DSIThread_CondTimedWait(&stEventTransmitThreadExit, &stTxMutex, USB_ANT_TX_TIMEOUT_MS) != DSI_THREAD_ENONE)
+        {
+            // We were unable to stop the thread normally.
+            DSIThread_DestroyThread(hTransmitThread);
+        }
+    }
+    DSIThread_MutexUnlock(&stTxMutex);
+
+    DSIThread_ReleaseThreadID(hTransmitThread);
+    hTransmitThread = (DSI_THREAD_ID)NULL;
+
+    DSIThread_CondDestroy(&stEventTransmitThreadExit);
+    DSIThread_CondDestroy(&stCondTxSpace);
+    DSIThread_CondDestroy(&stCondTxQueued);
+    DSIThread_MutexDestroy(&stTxMutex);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Sends the queued writes, one bulk OUT transfer at a time.  Whatever
+// was queued while a transfer was out goes in the next one, whole
+// writes up to usTxPacketSize bytes, so a burst of commands costs a
+// round trip per packet instead of per command.  Once stopped it
+// sends what is left before it ends, unless the device is gone.
+///////////////////////////////////////////////////////////////////////
+void USBDeviceHandleLibusb::TransmitThread()
+{
+    UCHAR aucTransfer[USB_ANT_TX_TRANSFER_MAX];
+    struct timeval tvHandleEventsTimeout;
+    tvHandleEventsTimeout.tv_sec = 1;
+    tvHandleEventsTimeout.tv_usec = 0;
+
+    struct libusb_transfer* pstTransfer = clLibusbLibrary.AllocTransfer(0);
+
+    DSIThread_MutexLock(&stTxMutex);
+    while(pstTransfer != NULL)
+    {
+        while(ucTxCount == 0 && bStopTransmitThread == FALSE)
+            DSIThread_CondTimedWait(&stCondTxQueued, &stTxMutex, DSI_THREAD_INFINITE);
+
+        if(ucTxCount == 0 || bDeviceGone)
+            break;
+
+        int iSize = 0;
+        while(ucTxCount > 0)
+        {
+            const TxSlot& stSlot = astTxQueue[ucTxHead];
+            if(iSize > 0 && iSize + stSlot.ucSize > usTxPacketSize)
+                break;
+
+            memcpy(&aucTransfer[iSize], stSlot.aucData, stSlot.ucSize);
+            iSize += stSlot.ucSize;
+            ucTxHead = (UCHAR)((ucTxHead + 1) % USB_ANT_TX_QUEUE_SIZE);
+            ucTxCount--;
+        }
+        bTxBusy = TRUE;
+        DSIThread_CondBroadcast(&stCondTxSpace);
+        DSIThread_MutexUnlock(&stTxMutex);
+
+        int iCompleted = 0;
+        BOOL bSent = FALSE;
+        clLibusbLibrary.FillBulkTransfer(pstTransfer, device_handle, USB_ANT_EP_OUT, aucTransfer, iSize, Callback, &iCompleted, USB_ANT_TX_TIMEOUT_MS);
+        pstTransfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+        if(clLibusbLibrary.SubmitTransfer(pstTransfer) == 0)
+        {
+            while(!iCompleted)
+            {
+                BeginEventPass();
+                clLibusbLibrary.HandleEventsTimeoutCompleted(ctx, &tvHandleEventsTimeout, &iCompleted);
+            }
+            bSent = (pstTransfer->status == LIBUSB_TRANSFER_COMPLETED);
+        }
+
+        ulTxTransfers++;
+        if(!bSent)
+            ulTxErrors++;
+
+        DSIThread_MutexLock(&stTxMutex);
+        bTxBusy = FALSE;
+        DSIThread_CondBroadcast(&stCondTxSpace);  //Also wakes WriteSync() waiting for the writer to be done
+        if(!bSent && pfTxErrorCallback != NULL)
+        {
+            USBWriteErrorCallback pfCallback = pfTxErrorCallback;
+            void* pvParameter = pvTxErrorParameter;
+
+            DSIThread_MutexUnlock(&stTxMutex);  //The callback may write
+            pfCallback(pvParameter);
+            DSIThread_MutexLock(&stTxMutex);
+        }
+    }
+
+    // Writers waiting for a slot fail rather than wait out their timeout
+    bStopTransmitThread = TRUE;
+    DSIThread_CondBroadcast(&stCondTxSpace);
+    DSIThread_CondSignal(&stEventTransmitThreadExit);
+    DSIThread_MutexUnlock(&stTxMutex);
+
+    if(pstTransfer != NULL)
+        clLibusbLibrary.FreeTransfer(pstTransfer);
+}
+
+///////////////////////////////////////////////////////////////////////
+DSI_THREAD_RETURN USBDeviceHandleLibusb::ProcessTransmitThread(void* pvParameter_)
+{
+    USBDeviceHandleLibusb* This = reinterpret_cast<USBDeviceHandleLibusb*>(pvParameter_);
+    This->TransmitThread();
+
+    return 0;
+}
+
 #endif //defined(DSI_TYPES_LINUX)
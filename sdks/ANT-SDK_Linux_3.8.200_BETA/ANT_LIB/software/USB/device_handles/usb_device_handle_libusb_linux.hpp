@@ -22,6 +22,7 @@ All rights reserved.
 
 #include <deque>
 #include <list>
+#include <atomic>
 
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -30,6 +31,14 @@ All rights reserved.
 
 typedef USBDeviceList<const USBDeviceLibusb*> USBDeviceListLibusb;
 
+#define USB_ANT_RX_TRANSFERS_DEFAULT   ((UCHAR) 4)       // Bulk IN transfers kept in flight per device.
+#define USB_ANT_RX_TRANSFERS_MAX       ((UCHAR) 8)
+#define USB_ANT_RX_BUFFER_SIZE         4096
+#define USB_ANT_HOTPLUG_CALLBACKS_MAX  ((UCHAR) 8)       // Hotplug callbacks registered at once.
+#define USB_ANT_TX_QUEUE_SIZE          ((UCHAR) 64)      // Writes waiting for the writer thread.
+#define USB_ANT_TX_SLOT_SIZE           64                // Bytes per queued write, longer writes take several slots.  Fits any framed ANT message.
+#define USB_ANT_TX_TRANSFER_MAX        512               // Largest bulk OUT packet the writer coalesces up to.
+
 /*
 //for internal use only!
 struct SerialData
@@ -57,7 +66,7 @@ class USBDeviceHandleLibusb : public USBDeviceHandle
 
    LibusbLibrary clLibusbLibrary;
    //std::deque<SerialData*> clOverflowQueue;  //used if the user does not specify a big enough array
-   TSQueue<UCHAR> clRxQueue;
+   TSByteQueue clRxQueue;                                // Bytes received from the IN endpoint, drained by Read().
 
    const USBDeviceLibusb clDevice;
    libusb_device_handle* device_handle;
@@ -70,10 +79,70 @@ class USBDeviceHandleLibusb : public USBDeviceHandle
 
    BOOL bDeviceGone;
 
+   // Receive transfer pool.  Transfers are resubmitted straight from the
+   // completion callback; the receive thread only runs the libusb event loop.
+   struct RxTransfer
+   {
+      USBDeviceHandleLibusb* pclOwner;
+      struct libusb_transfer* pstTransfer;
+      UCHAR aucData[USB_ANT_RX_BUFFER_SIZE];
+   };
+   RxTransfer astRxTransfers[USB_ANT_RX_TRANSFERS_MAX];
+   UCHAR ucRxTransfers;                                  // Number of transfers in the pool for this handle.
+   std::atomic<int> iRxInFlight;
+   std::atomic<int> iConsecIoErrors;
+   std::atomic<unsigned long long> ullIdleSinceUs;       // When the endpoint last went idle, 0 if not idle.
+
+   std::atomic<ULONG> ulRxCompleted;
+   std::atomic<ULONG> ulRxErrors;
+   std::atomic<unsigned long long> ullTurnaroundTotalUs;
+   std::atomic<ULONG> ulTurnaroundMaxUs;
+   std::atomic<ULONG> ulIdleCount;
+   std::atomic<unsigned long long> ullIdleTotalUs;
+
+   // Writer thread.  Write() queues the bytes and returns; the writer
+   // sends everything queued up while its last transfer was out in one
+   // bulk OUT transfer of up to one endpoint packet.  The queue is a
+   // single FIFO, so writes go out in order, on every channel.
+   struct TxSlot
+   {
+      UCHAR aucData[USB_ANT_TX_SLOT_SIZE];
+      UCHAR ucSize;
+   };
+   TxSlot astTxQueue[USB_ANT_TX_QUEUE_SIZE];
+   UCHAR ucTxHead;                                       // Oldest queued slot, guarded by stTxMutex like ucTxCount.
+   UCHAR ucTxCount;
+   USHORT usTxPacketSize;                                // Coalescing budget, the OUT endpoint's max packet size.
+   BOOL bTxBusy;                                         // The writer has a transfer out.
+   USBWriteErrorCallback pfTxErrorCallback;              // Told about failed transfers, NULL for nobody.
+   void* pvTxErrorParameter;
+
+   DSI_THREAD_ID hTransmitThread;
+   DSI_MUTEX stTxMutex;
+   DSI_CONDITION_VAR stCondTxQueued;                     // Wakes the writer for queued bytes or shutdown.
+   DSI_CONDITION_VAR stCondTxSpace;                      // Wakes Write() once the writer freed slots, WriteSync() once it is idle.
+   DSI_CONDITION_VAR stEventTransmitThreadExit;
+   BOOL bStopTransmitThread;
+
+   std::atomic<ULONG> ulTxWrites;
+   std::atomic<ULONG> ulTxTransfers;
+   std::atomic<ULONG> ulTxErrors;
+   std::atomic<ULONG> ulTxQueueFullWaits;
+
+   static UCHAR ucRxTransferCount;
+
    BOOL POpen();
    void PClose(BOOL bReset_ = FALSE);
    void ReceiveThread();
+   BOOL SubmitRxTransfer(RxTransfer* pstRx_);
+   void RxTransferComplete(RxTransfer* pstRx_);
+   static void LIBUSB_CALL RxCallback(struct libusb_transfer* pstTransfer_);
    static DSI_THREAD_RETURN ProcessThread(void* pvParameter_);
+   USBError::Enum WriteSync(void* pvData_, ULONG ulSize_, ULONG& ulBytesWritten_);
+   BOOL StartTransmitThread();
+   void StopTransmitThread();
+   void TransmitThread();
+   static DSI_THREAD_RETURN ProcessTransmitThread(void* pvParameter_);
 
    static USBDeviceList<const USBDeviceLibusb> clDeviceList;  //This holds only instances of USBDeviceLibusb (unless someone manually makes their own)
    static libusb_context* ctx;
@@ -88,9 +157,56 @@ class USBDeviceHandleLibusb : public USBDeviceHandle
    static BOOL Close(USBDeviceHandleLibusb*& pclDeviceHandle_, BOOL bReset_ = FALSE);
    static BOOL TryOpen(const USBDeviceLibusb& clDevice_);
 
+   static void SetRxTransferCount(UCHAR ucCount_);
+   /////////////////////////////////////////////////////////////////
+   // Sets how many bulk IN transfers are kept in flight by handles
+   // opened after this call.  Clamped to 1..USB_ANT_RX_TRANSFERS_MAX.
+   // Defaults to USB_ANT_RX_TRANSFERS_DEFAULT.
+   /////////////////////////////////////////////////////////////////
+
+   static BOOL RegisterHotplugCallback(USBHotplugCallback pfCallback_, void* pvParameter_, int& iHandle_);
+   /////////////////////////////////////////////////////////////////
+   // As per USBDeviceHandle::RegisterHotplugCallback().  Arrivals
+   // are picked up by a libusb event thread of their own, which runs
+   // while any callback is registered, so they are reported even
+   // when no device is open.  Returns FALSE if libusb was built
+   // without hotplug support.
+   /////////////////////////////////////////////////////////////////
+
+   static void DeregisterHotplugCallback(int iHandle_);
+
+   BOOL GetRxStats(USB_RX_STATS& stStats_) const;
+   /////////////////////////////////////////////////////////////////
+   // As per USBDeviceHandle::GetRxStats().  A transfer counts as
+   // completed from the start of the libusb event pass that reaped
+   // it, so its turnaround includes waiting behind the callbacks of
+   // transfers reaped before it.
+   /////////////////////////////////////////////////////////////////
+
+   void SetWriteErrorCallback(USBWriteErrorCallback pfCallback_, void* pvParameter_);
+   /////////////////////////////////////////////////////////////////
+   // As per USBDeviceHandle::SetWriteErrorCallback().  Called on
+   // the writer thread once per failed transfer, which may hold
+   // several writes.
+   /////////////////////////////////////////////////////////////////
+
+   BOOL GetTxStats(USB_TX_STATS& stStats_) const;
+   /////////////////////////////////////////////////////////////////
+   // As per USBDeviceHandle::GetTxStats().  WriteSync() transfers
+   // count as one write each.
+   /////////////////////////////////////////////////////////////////
+
    //USBDeviceHandle Base Class//
 
    USBError::Enum Write(void* pvData_, ULONG ulSize_, ULONG& ulBytesWritten_);
+   /////////////////////////////////////////////////////////////////
+   // Queues the bytes for the writer thread and returns without
+   // waiting for the transfer; blocks only while the queue has no
+   // room for all of them.  Nothing is queued if it fails.
+   // A transfer that fails later is reported to the write error
+   // callback.
+   /////////////////////////////////////////////////////////////////
+
    USBError::Enum Read(void* pvData_, ULONG ulSize_, ULONG& ulBytesRead_, ULONG ulWaitTime_);
 
    const USBDevice& GetDevice() { return clDevice; }
@@ -187,6 +187,21 @@ BOOL USBDeviceHandle::Close(USBDeviceHandle*& pclDeviceHandle_, BOOL bReset_)
    return bSuccess;
 }
 
+BOOL USBDeviceHandle::RegisterHotplugCallback(USBHotplugCallback pfCallback_, void* pvParameter_, int& iHandle_)
+{
+   return USBDeviceHandleLibusb::RegisterHotplugCallback(pfCallback_, pvParameter_, iHandle_);
+}
+
+void USBDeviceHandle::DeregisterHotplugCallback(int iHandle_)
+{
+   USBDeviceHandleLibusb::DeregisterHotplugCallback(iHandle_);
+}
+
+void USBDeviceHandle::SetRxTransferCount(UCHAR ucCount_)
+{
+   USBDeviceHandleLibusb::SetRxTransferCount(ucCount_);
+}
+
 
 
 #endif //defined(DSI_TYPES_LINUX)
@@ -349,5 +349,19 @@ BOOL USBDeviceHandle::Close(USBDeviceHandle*& pclDeviceHandle_, BOOL bReset_)
    return bSuccess;
 }
 
+BOOL USBDeviceHandle::RegisterHotplugCallback(USBHotplugCallback /*pfCallback_*/, void* /*pvParameter_*/, int& /*iHandle_*/)
+{
+   return FALSE;  //Callers fall back to polling
+}
+
+void USBDeviceHandle::DeregisterHotplugCallback(int /*iHandle_*/)
+{
+}
+
+void USBDeviceHandle::SetRxTransferCount(UCHAR /*ucCount_*/)
+{
+   //One read is kept in flight on this platform
+}
+
 
 #endif //defined(DSI_TYPES_MACINTOSH)
@@ -0,0 +1,157 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+*/
+
+#if !defined(DSI_CAPTURE_ANT_HPP)
+#define DSI_CAPTURE_ANT_HPP
+
+#include "types.h"
+#include "antmessage.h"
+#include "dsi_thread.h"
+#include "dsi_framer_ant.hpp"
+
+#include <stdio.h>
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Definitions
+//////////////////////////////////////////////////////////////////////////////////
+
+// Capture file layout, all fields little endian:
+//
+//    ANT_CAPTURE_FILE_HEADER                      64 bytes
+//    ANT_CAPTURE_CHANNEL x ucChannelCount         16 bytes each
+//    { ANT_CAPTURE_RECORD, payload, padding }     repeated until end of file
+//
+// Every record starts on an 8 byte boundary so the file can be mapped and
+// walked in place.  The payload is the message body that follows the
+// message ID on the wire; sync, length and checksum are not stored.
+
+#define ANT_CAPTURE_MAGIC              "ANTZCAP"            // Including the terminating zero, fills aucMagic.
+#define ANT_CAPTURE_VERSION            ((USHORT) 1)
+
+#define ANT_CAPTURE_DIR_RX             ((UCHAR) 0x00)       // Received from the device.
+#define ANT_CAPTURE_DIR_TX             ((UCHAR) 0x01)       // Written to the device.
+
+#define ANT_CAPTURE_RECORD_ALIGN       ((ULONG) 8)
+#define ANT_CAPTURE_RECORD_SIZE(len)   ((ULONG)((sizeof(ANT_CAPTURE_RECORD) + (len) + ANT_CAPTURE_RECORD_ALIGN - 1) & ~(ANT_CAPTURE_RECORD_ALIGN - 1)))
+
+#define DSI_CAPTURE_ANT_BUFFER_SIZE    ((ULONG) 65536)      // Default write buffer size.
+
+typedef struct
+{
+   UCHAR aucMagic[8];
+   USHORT usVersion;
+   USHORT usHeaderSize;                                     // Offset of the first record.
+   ULONG ulSerialNumber;                                    // USB stick serial number, 0 if unknown.
+   ULLONG ullStartTimeNs;                                   // Monotonic clock when the capture was opened.
+   ULLONG ullWallClockUs;                                   // Unix time when the capture was opened.
+   UCHAR aucCapabilities[MESG_CAPABILITIES_SIZE];           // Payload of the capabilities message.
+   UCHAR ucCapabilitiesSize;                                // Valid bytes in aucCapabilities, 0 if unknown.
+   UCHAR ucChannelCount;                                    // Number of ANT_CAPTURE_CHANNEL entries that follow.
+   UCHAR aucReserved[22];
+} ANT_CAPTURE_FILE_HEADER;
+
+typedef struct
+{
+   UCHAR ucANTChannel;
+   UCHAR ucChannelType;
+   UCHAR ucNetworkNumber;
+   UCHAR ucDeviceType;
+   USHORT usDeviceNumber;
+   UCHAR ucTransmitType;
+   UCHAR ucRFFrequency;
+   USHORT usMessagePeriod;
+   UCHAR ucSearchTimeout;
+   UCHAR ucOpen;
+   UCHAR aucReserved[4];
+} ANT_CAPTURE_CHANNEL;
+
+typedef struct
+{
+   ULLONG ullTimestampNs;                                   // Monotonic clock, same base as ullStartTimeNs.
+   UCHAR ucDirection;                                       // ANT_CAPTURE_DIR_RX or ANT_CAPTURE_DIR_TX.
+   UCHAR ucMessageID;
+   UCHAR ucLength;                                          // Payload bytes following this record header.
+   UCHAR ucReserved;
+   ULONG ulSequence;                                        // Record number, starting at 0.
+} ANT_CAPTURE_RECORD;
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Class Prototypes
+//////////////////////////////////////////////////////////////////////////////////
+
+class DSICaptureANT
+{
+   private:
+
+      DSI_MUTEX stMutexCriticalSection;                     // Records come from both the receive and the application thread.
+      FILE *pfFile;
+      UCHAR *pucBuffer;
+      ULONG ulBufferSize;
+      ULONG ulBufferUsed;
+      ULONG ulSequence;
+      ULONG ulDroppedRecords;
+
+      BOOL FlushBuffer(void);
+
+   public:
+
+      DSICaptureANT(ULONG ulBufferSize_ = DSI_CAPTURE_ANT_BUFFER_SIZE);
+      ~DSICaptureANT();
+
+      BOOL Open(const char *pcFileName_, ULONG ulSerialNumber_, const UCHAR *pucCapabilities_, UCHAR ucCapabilitiesSize_, const ANT_CHANNEL_CONFIG *pastChannels_, UCHAR ucChannelCount_);
+      /////////////////////////////////////////////////////////////////
+      // Creates the capture file and writes its header.
+      // Parameters:
+      //    *pcFileName_:     Path of the capture file.  An existing
+      //                      file is replaced.
+      //    ulSerialNumber_:  Serial number of the stick, or 0.
+      //    *pucCapabilities_: Capabilities message payload, or NULL.
+      //    ucCapabilitiesSize_: Number of bytes in pucCapabilities_.
+      //    *pastChannels_:   Channel configuration at capture start,
+      //                      or NULL.
+      //    ucChannelCount_:  Number of entries in pastChannels_.
+      // Returns TRUE if successful.
+      /////////////////////////////////////////////////////////////////
+
+      void Close(void);
+      /////////////////////////////////////////////////////////////////
+      // Flushes any buffered records and closes the file.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL IsOpen(void);
+
+      void Record(UCHAR ucDirection_, UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_);
+      /////////////////////////////////////////////////////////////////
+      // Appends one message to the capture.  Records are buffered and
+      // written out when the buffer fills or on Flush().
+      // Parameters:
+      //    ucDirection_:     ANT_CAPTURE_DIR_RX or ANT_CAPTURE_DIR_TX.
+      //    ucMessageID_:     The message ID.
+      //    *pucData_:        The message body following the ID.
+      //    ucLength_:        Number of bytes in pucData_.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL Flush(void);
+      /////////////////////////////////////////////////////////////////
+      // Writes buffered records to the file.
+      // Returns FALSE if the write failed.
+      /////////////////////////////////////////////////////////////////
+
+      ULONG GetRecordCount(void);
+      ULONG GetDroppedRecords(void);
+      /////////////////////////////////////////////////////////////////
+      // Records lost because the file could not be written.
+      /////////////////////////////////////////////////////////////////
+
+      static ULLONG GetTimestamp(void);
+      /////////////////////////////////////////////////////////////////
+      // Returns the monotonic clock used for record timestamps, in ns.
+      /////////////////////////////////////////////////////////////////
+};
+
+#endif // !defined(DSI_CAPTURE_ANT_HPP)
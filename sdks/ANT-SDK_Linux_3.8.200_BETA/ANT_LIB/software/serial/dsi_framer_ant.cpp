@@ -13,8 +13,15 @@ All rights reserved.
 #include "checksum.h"
 #include "dsi_thread.h"
 #include "dsi_framer_ant.hpp"
+#include "dsi_capture_ant.hpp"
 
 #include <string.h>
+#include <chrono>
+
+#if defined(DSI_TYPES_LINUX)
+   #include <sys/eventfd.h>
+   #include <unistd.h>
+#endif
 
 #define WAIT_TO_FEED_TRANSFER
 #include "dsi_debug.hpp"
@@ -41,9 +48,10 @@ All rights reserved.
 //////////////////////////////////////////////////////////////////////////////////
 
 ///////////////////////////////////////////////////////////////////////
-DSIFramerANT::DSIFramerANT()
+DSIFramerANT::DSIFramerANT() : clControlQueue(DSI_FRAMER_ANT_CONTROL_QUEUE_SIZE), clMessageQueue(DSI_FRAMER_ANT_MESSAGE_QUEUE_SIZE)
 {
    bInitOkay = TRUE;
+   bPriorityLanes = FALSE;
    bClosing = FALSE;
    pbCancel = (volatile BOOL*)NULL;
    bSplitAdvancedBursts = FALSE;
@@ -57,14 +65,22 @@ DSIFramerANT::DSIFramerANT()
    if (DSIThread_MutexInit(&stMutexResponseRequest) != DSI_THREAD_ENONE)
       bInitOkay = FALSE;
 
-   pclResponseListStart = (ANTMessageResponse*)NULL;
+   InitResponseTable();
+   pclCapture = (DSICaptureANT*)NULL;
+
+#if defined(DSI_TYPES_LINUX)
+   iEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+   iEventFd = -1;
+#endif
 
    Init((DSISerial*)NULL);
 }
 
-DSIFramerANT::DSIFramerANT(DSISerial *pclSerial_) : DSIFramer(pclSerial_)
+DSIFramerANT::DSIFramerANT(DSISerial *pclSerial_, ULONG ulMessageQueueSize_) : DSIFramer(pclSerial_), clControlQueue(DSI_FRAMER_ANT_CONTROL_QUEUE_SIZE), clMessageQueue(ulMessageQueueSize_)
 {
    bInitOkay = TRUE;
+   bPriorityLanes = FALSE;
    bClosing = FALSE;
    pbCancel = (volatile BOOL*)NULL;
    bSplitAdvancedBursts = FALSE;
@@ -78,13 +94,25 @@ DSIFramerANT::DSIFramerANT(DSISerial *pclSerial_) : DSIFramer(pclSerial_)
    if (DSIThread_MutexInit(&stMutexResponseRequest) != DSI_THREAD_ENONE)
       bInitOkay = FALSE;
 
-   pclResponseListStart = (ANTMessageResponse*)NULL;
+   InitResponseTable();
+   pclCapture = (DSICaptureANT*)NULL;
+
+#if defined(DSI_TYPES_LINUX)
+   iEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+   iEventFd = -1;
+#endif
 
    Init(pclSerial_);
 }
 ///////////////////////////////////////////////////////////////////////
 DSIFramerANT::~DSIFramerANT()
 {
+   delete[] pclResponsePool;
+#if defined(DSI_TYPES_LINUX)
+   if (iEventFd >= 0)
+      close(iEventFd);
+#endif
    DSIThread_CondDestroy(&stCondMessageReady);
    DSIThread_MutexDestroy(&stMutexCriticalSection);
    DSIThread_MutexDestroy(&stMutexResponseRequest);
@@ -112,8 +140,9 @@ volatile BOOL* DSIFramerANT::GetCancelParameter()
 BOOL DSIFramerANT::Init(DSISerial *pclSerial_)
 {
    ucRxIndex = 0;
-   usMessageHead = 0;
-   usMessageTail = 0;
+   clControlQueue.Clear();
+   clMessageQueue.Clear();
+   ulDroppedData = 0;
    ucError = 0;
 
    if (pclSerial_ != NULL)
@@ -155,6 +184,10 @@ BOOL DSIFramerANT::WriteMessage(void *pvData_, USHORT usMessageSize_)
 
    if (pclSerial->WriteBytes(aucTxFifo, ucTotalSize))
    {
+      DSICaptureANT *pclTap = pclCapture;
+      if (pclTap != NULL)
+         pclTap->Record(ANT_CAPTURE_DIR_TX, aucTxFifo[MESG_ID_OFFSET], &aucTxFifo[MESG_DATA_OFFSET], (UCHAR)usMessageSize_);
+
       #if defined(SERIAL_DEBUG)
          if (aucTxFifo[MESG_ID_OFFSET] == 0x46)
             memset(&aucTxFifo[MESG_DATA_OFFSET+1],0x00,8);
@@ -175,33 +208,9 @@ BOOL DSIFramerANT::WriteMessage(void *pvData_, USHORT usMessageSize_)
 ///////////////////////////////////////////////////////////////////////
 USHORT DSIFramerANT::WaitForMessage(ULONG ulMilliseconds_)
 {
-   USHORT usMessageSize;
-
-   DSIThread_MutexLock(&stMutexCriticalSection);
-
-   usMessageSize = GetMessageSize();
-
-   if ((usMessageSize == DSI_FRAMER_TIMEDOUT) && (ulMilliseconds_ != 0))
-   {
-      UCHAR ucStatus = DSIThread_CondTimedWait(&stCondMessageReady, &stMutexCriticalSection, ulMilliseconds_);
-      if(ucStatus == DSI_THREAD_ENONE)
-      {
-         usMessageSize = GetMessageSize();
-      }
-      else if(ucStatus == DSI_THREAD_ETIMEDOUT)
-      {
-        usMessageSize = DSI_FRAMER_TIMEDOUT;
-      }
-      else //CondWait() failed
-      {
-        ucError = (UCHAR)(DSI_FRAMER_ERROR & 0xFF); //Set ucError so we can distinguish from a normal error if this ever occurs
-        usMessageSize = DSI_FRAMER_ERROR;
-      }
-   }
-
-   DSIThread_MutexUnlock(&stMutexCriticalSection);
+   WaitForQueue(ulMilliseconds_);
 
-   return usMessageSize;
+   return GetMessageSize();
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -209,10 +218,10 @@ USHORT DSIFramerANT::GetMessage(void *pvData_, USHORT usSize_)
 {
    USHORT usRetVal;
 
-   DSIThread_MutexLock(&stMutexCriticalSection);
-
    if (ucError)
    {
+      DSIThread_MutexLock(&stMutexCriticalSection);
+
       ((ANT_MESSAGE *) pvData_)->ucMessageID = ucError;
 
       if (ucError == DSI_FRAMER_ANT_ESERIAL)
@@ -220,13 +229,20 @@ USHORT DSIFramerANT::GetMessage(void *pvData_, USHORT usSize_)
 
       ucError = 0;
       usRetVal = DSI_FRAMER_ERROR;
+
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
    }
    else
    {
-      if ((usMessageHead - usMessageTail) != 0)
+      BOOL bControl;
+      ANT_QUEUED_MESSAGE *pstQueued = FrontMessage(bControl);  // The lanes are single-consumer, so no lock is needed here.
+
+      if (pstQueued != NULL)
       {
+         const ANT_MESSAGE_ITEM *pstItem = &pstQueued->stItem;
+
          // Determine the number of bytes to copy.
-         usRetVal = astMessageBuffer[usMessageTail].ucSize; // The reported number of bytes in the queue.
+         usRetVal = pstItem->ucSize;                        // The reported number of bytes in the queue.
 
          if (usSize_ != 0)
             usRetVal = MIN(usRetVal, usSize_);              // If the usSize_ parameter is non-zero, limit the number of bytes copied from the queue to usSize_.
@@ -238,11 +254,11 @@ USHORT DSIFramerANT::GetMessage(void *pvData_, USHORT usSize_)
          }
          else
          {
-            ((ANT_MESSAGE *) pvData_)->ucMessageID = astMessageBuffer[usMessageTail].stANTMessage.ucMessageID;
-            memcpy(((ANT_MESSAGE *) pvData_)->aucData, astMessageBuffer[usMessageTail].stANTMessage.aucData, usRetVal);
+            ((ANT_MESSAGE *) pvData_)->ucMessageID = pstItem->stANTMessage.ucMessageID;
+            memcpy(((ANT_MESSAGE *) pvData_)->aucData, pstItem->stANTMessage.aucData, usRetVal);
          }
 
-         usMessageTail++;                                   // Rollover of usMessageTail happens automagically because our buffer size is MAX_USHORT + 1.
+         PopMessage(bControl);
       }
       else
       {
@@ -250,11 +266,97 @@ USHORT DSIFramerANT::GetMessage(void *pvData_, USHORT usSize_)
       }
    }
 
-   DSIThread_MutexUnlock(&stMutexCriticalSection);
-
    return usRetVal;
 }
 
+///////////////////////////////////////////////////////////////////////
+USHORT DSIFramerANT::GetMessages(ANT_MESSAGE_ITEM *pastMessages_, USHORT usMaxMessages_, ULONG ulMilliseconds_, ULLONG *paullQueuedUs_)
+{
+   if (usMaxMessages_ == 0)
+      return 0;
+
+   WaitForQueue(ulMilliseconds_);
+
+   if (ucError)
+   {
+      pastMessages_[0].ucSize = 0;
+      GetMessage(&pastMessages_[0].stANTMessage);
+      return DSI_FRAMER_ERROR;
+   }
+
+   if (usMaxMessages_ > DSI_FRAMER_TIMEDOUT - 1)
+      usMaxMessages_ = DSI_FRAMER_TIMEDOUT - 1;             // Keep the count clear of the status codes.
+
+   USHORT usCount = 0;
+   BOOL bControl;
+   ANT_QUEUED_MESSAGE *pstQueued;
+   while (usCount < usMaxMessages_ && (pstQueued = FrontMessage(bControl)) != NULL)
+   {
+      pastMessages_[usCount] = pstQueued->stItem;
+      if (paullQueuedUs_ != NULL)
+         paullQueuedUs_[usCount] = pstQueued->ullQueuedUs;
+      PopMessage(bControl);
+      usCount++;
+   }
+
+   return usCount;
+}
+
+///////////////////////////////////////////////////////////////////////
+int DSIFramerANT::GetEventFd() const
+{
+   return iEventFd;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSIFramerANT::ClearEvent()
+{
+#if defined(DSI_TYPES_LINUX)
+   eventfd_t ullCount;
+   if (iEventFd >= 0)
+      eventfd_read(iEventFd, &ullCount);                    // Non-blocking, so this only resets the counter.
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSIFramerANT::SetCapture(DSICaptureANT *pclCapture_)
+{
+   pclCapture = pclCapture_;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSIFramerANT::SetPriorityLanes(BOOL bEnable_)
+{
+   bPriorityLanes = bEnable_;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSIFramerANT::GetDroppedDataMessages(void)
+{
+   return ulDroppedData;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSIFramerANT::IsControlMessage(UCHAR ucMessageID_, UCHAR ucEventID_)
+{
+   switch (ucMessageID_)
+   {
+      case MESG_BROADCAST_DATA_ID:
+      case MESG_ACKNOWLEDGED_DATA_ID:
+      case MESG_BURST_DATA_ID:
+      case MESG_EXT_BROADCAST_DATA_ID:
+      case MESG_EXT_ACKNOWLEDGED_DATA_ID:
+      case MESG_EXT_BURST_DATA_ID:
+      case MESG_ADV_BURST_DATA_ID:
+         return FALSE;
+      case MESG_RESPONSE_EVENT_ID:
+         // Channel events stay in order with the channel's data
+         return (ucEventID_ != MESG_EVENT_ID);
+      default:
+         return TRUE;
+   }
+}
+
 ///////////////////////////////////////////////////////////////////////
 #define MESG_CHANNEL_OFFSET                  0
 #define MESG_EVENT_ID_OFFSET                 1
@@ -290,74 +392,118 @@ UCHAR DSIFramerANT::GetChannelNumber(ANT_MESSAGE* pstMessage)
 ///////////////////////////////////////////////////////////////////////
 void DSIFramerANT::ProcessByte(UCHAR ucByte_)
 {
+   ProcessBytes(&ucByte_, 1);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Frames a whole received chunk under a single lock.  Every complete
+// message found in the chunk is queued, and waiters are woken once at
+// the end rather than once per message.
+///////////////////////////////////////////////////////////////////////
+void DSIFramerANT::ProcessBytes(const UCHAR *pucBytes_, ULONG ulSize_)
+{
+   BOOL bSignal = FALSE;
+   ULONG ulIndex = 0;
+
    DSIThread_MutexLock(&stMutexCriticalSection);
 
-   if (ucRxIndex == 0)                                      // If we are looking for the start of a message.
+   while (ulIndex < ulSize_)
    {
-      if (ucByte_ == MESG_TX_SYNC)                          // If it is a valid first byte.
+      if (ucRxIndex == 0)                                   // If we are looking for the start of a message.
       {
-         aucRxFifo[ucRxIndex++] = ucByte_;                  // Save it.
-         ucCheckSum = ucByte_;                              // Initialize the checksum.
+         const UCHAR *pucSync = (const UCHAR*)memchr(&pucBytes_[ulIndex], MESG_TX_SYNC, ulSize_ - ulIndex);
+         if (pucSync == NULL)                               // No sync byte left in this chunk, drop the rest.
+            break;
+
+         ulIndex = (ULONG)(pucSync - pucBytes_) + 1;
+         aucRxFifo[ucRxIndex++] = MESG_TX_SYNC;             // Save it.
+         ucCheckSum = MESG_TX_SYNC;                         // Initialize the checksum.
          ucRxSize = 2;                                      // We have to init high so we can read enough bytes to determine real length
       }
-   }
-   else if (ucRxIndex == 1)                                 // Determine RX message size.
-   {
-      aucRxFifo[ucRxIndex++] = ucByte_;                     // Save it.
-      ucRxSize = ucByte_ + (MESG_FRAME_SIZE - MESG_SYNC_SIZE);  // We just got the length.
-      ucCheckSum ^= ucByte_;                                // Calculate checksum.
-
-      if ((USHORT)ucRxSize > RX_FIFO_SIZE)                          // If our buffer can't handle this message, turf it.
+      else if (ucRxIndex == 1)                              // Determine RX message size.
       {
-         #if defined(SERIAL_DEBUG)
-            DSIDebug::SerialWrite(pclSerial->GetDeviceNumber(), "ERROR: size > RX_FIFO_SIZE", aucRxFifo, ucRxIndex);
-         #endif
-         if (ucByte_ == MESG_TX_SYNC)
-         {
-            aucRxFifo[0] = ucByte_;                         // Save the byte.
-            ucCheckSum = ucByte_;                           // Initialize the checksum.
-            ucRxSize = 2;                                   // We have to init high so we can read enough bytes to determine real length
-            ucRxIndex = 1;                                  // Set the Rx Index for the next iteration.
-         }
-         else
+         UCHAR ucByte = pucBytes_[ulIndex++];
+         aucRxFifo[ucRxIndex++] = ucByte;                   // Save it.
+         ucRxSize = ucByte + (MESG_FRAME_SIZE - MESG_SYNC_SIZE);  // We just got the length.
+         ucCheckSum ^= ucByte;                              // Calculate checksum.
+
+         if ((USHORT)ucRxSize > RX_FIFO_SIZE)                       // If our buffer can't handle this message, turf it.
          {
-            ucRxIndex = 0;                                  // Invalid size, so restart.
+            #if defined(SERIAL_DEBUG)
+               DSIDebug::SerialWrite(pclSerial->GetDeviceNumber(), "ERROR: size > RX_FIFO_SIZE", aucRxFifo, ucRxIndex);
+            #endif
+            if (ucByte == MESG_TX_SYNC)
+            {
+               aucRxFifo[0] = ucByte;                       // Save the byte.
+               ucCheckSum = ucByte;                         // Initialize the checksum.
+               ucRxSize = 2;                                // We have to init high so we can read enough bytes to determine real length
+               ucRxIndex = 1;                               // Set the Rx Index for the next iteration.
+            }
+            else
+            {
+               ucRxIndex = 0;                               // Invalid size, so restart.
+            }
          }
-
       }
-   }
-   else
-   {
-      aucRxFifo[ucRxIndex] = ucByte_;                       // Save the byte.
-      ucCheckSum ^= ucByte_;                                // Calculate checksum.
-
-      if (ucRxIndex >= ucRxSize)                            // If we have received the whole message.
+      else
       {
-         if (ucCheckSum == 0)                               // The CRC passed.
+         // Copy as much of the remaining message as this chunk holds.
+         ULONG ulNeeded = (ucRxIndex < ucRxSize) ? (ULONG)(ucRxSize - ucRxIndex) + 1 : 1;
+         ULONG ulCopy = (ulNeeded < ulSize_ - ulIndex) ? ulNeeded : ulSize_ - ulIndex;
+
+         memcpy(&aucRxFifo[ucRxIndex], &pucBytes_[ulIndex], ulCopy);
+         for (ULONG i = 0; i < ulCopy; i++)
+            ucCheckSum ^= pucBytes_[ulIndex + i];           // Calculate checksum.
+         ulIndex += ulCopy;
+         ucRxIndex = (UCHAR)(ucRxIndex + ulCopy - 1);       // Index of the last byte saved.
+
+         if (ucRxIndex >= ucRxSize)                         // If we have received the whole message.
          {
-            ProcessMessage();                               // Process the ANT message.
+            if (ucCheckSum == 0)                            // The CRC passed.
+            {
+               DSICaptureANT *pclTap = pclCapture;
+               if (pclTap != NULL)                          // Record before ProcessMessage() recodes anything.
+                  pclTap->Record(ANT_CAPTURE_DIR_RX, aucRxFifo[MESG_ID_OFFSET], &aucRxFifo[MESG_DATA_OFFSET], aucRxFifo[MESG_SIZE_OFFSET]);
+
+               ProcessMessage();                            // Process the ANT message.
+            }
+            else
+            {
+               // Set a serial error for the bad crc.
+               ucSerialError = DSI_FRAMER_ANT_CRC_ERROR;
+               ucError = DSI_FRAMER_ANT_ESERIAL;
+               #if defined(SERIAL_DEBUG)
+                  DSIDebug::SerialWrite(pclSerial->GetDeviceNumber(), "Bad CRC",aucRxFifo,ucRxIndex);
+               #endif
+            }
+            bSignal = TRUE;
+            ucRxIndex = 0;                                  // Reset the index.
          }
          else
          {
-            // Set a serial error for the bad crc.
-            ucSerialError = DSI_FRAMER_ANT_CRC_ERROR;
-            ucError = DSI_FRAMER_ANT_ESERIAL;
-            DSIThread_CondSignal(&stCondMessageReady);
-            #if defined(SERIAL_DEBUG)
-               DSIDebug::SerialWrite(pclSerial->GetDeviceNumber(), "Bad CRC",aucRxFifo,ucRxIndex);
-            #endif
+            ucRxIndex++;
          }
-         ucRxIndex = 0;                                     // Reset the index.
-      }
-      else
-      {
-         ucRxIndex++;
       }
    }
 
+   if (bSignal)
+   {
+      DSIThread_CondSignal(&stCondMessageReady);
+   #if defined(DSI_TYPES_LINUX)
+      if (iEventFd >= 0)
+         eventfd_write(iEventFd, 1);
+   #endif
+   }
+
    DSIThread_MutexUnlock(&stMutexCriticalSection);
 }
 
+///////////////////////////////////////////////////////////////////////
+ULONG DSIFramerANT::GetBacklog(void)
+{
+   return clControlQueue.GetSize() + clMessageQueue.GetSize();
+}
+
 ///////////////////////////////////////////////////////////////////////
 void DSIFramerANT::Error(UCHAR ucError_)
 {
@@ -367,6 +513,10 @@ void DSIFramerANT::Error(UCHAR ucError_)
    ucError = DSI_FRAMER_ANT_ESERIAL;
 
    DSIThread_CondSignal(&stCondMessageReady);
+#if defined(DSI_TYPES_LINUX)
+   if (iEventFd >= 0)
+      eventfd_write(iEventFd, 1);
+#endif
 
    DSIThread_MutexUnlock(&stMutexCriticalSection);
 }
@@ -383,6 +533,18 @@ BOOL DSIFramerANT::SetNetworkKey(UCHAR ucNetworkNumber_, UCHAR *pucKey_, ULONG u
    return SendCommand(&stMessage, MESG_NETWORK_KEY_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::SetNetworkKeyAsync(UCHAR ucNetworkNumber_, UCHAR *pucKey_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_NETWORK_KEY_ID;
+   stMessage.aucData[0] = ucNetworkNumber_;
+   memcpy(&stMessage.aucData[1], pucKey_, 8);
+
+   return SendCommandAsync(&stMessage, MESG_NETWORK_KEY_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::UnAssignChannel(UCHAR ucANTChannel_, ULONG ulResponseTime_)
 {
@@ -394,6 +556,17 @@ BOOL DSIFramerANT::UnAssignChannel(UCHAR ucANTChannel_, ULONG ulResponseTime_)
    return SendCommand(&stMessage, MESG_UNASSIGN_CHANNEL_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::UnAssignChannelAsync(UCHAR ucANTChannel_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_UNASSIGN_CHANNEL_ID;
+   stMessage.aucData[0] = ucANTChannel_;
+
+   return SendCommandAsync(&stMessage, MESG_UNASSIGN_CHANNEL_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::AssignChannel(UCHAR ucANTChannel_, UCHAR ucChannelType_, UCHAR ucNetworkNumber_, ULONG ulResponseTime_)
 {
@@ -407,6 +580,19 @@ BOOL DSIFramerANT::AssignChannel(UCHAR ucANTChannel_, UCHAR ucChannelType_, UCHA
    return SendCommand(&stMessage, MESG_ASSIGN_CHANNEL_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::AssignChannelAsync(UCHAR ucANTChannel_, UCHAR ucChannelType_, UCHAR ucNetworkNumber_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_ASSIGN_CHANNEL_ID;
+   stMessage.aucData[0] = ucANTChannel_;
+   stMessage.aucData[1] = ucChannelType_;
+   stMessage.aucData[2] = ucNetworkNumber_;
+
+   return SendCommandAsync(&stMessage, MESG_ASSIGN_CHANNEL_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::AssignChannelExt(UCHAR ucANTChannel_, UCHAR* pucChannelType_, UCHAR ucSize_, UCHAR ucNetworkNumber_, ULONG ulResponseTime_)
 {
@@ -442,6 +628,21 @@ BOOL DSIFramerANT::SetChannelID(UCHAR ucANTChannel_, USHORT usDeviceNumber_, UCH
    return SendCommand(&stMessage, MESG_CHANNEL_ID_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::SetChannelIDAsync(UCHAR ucANTChannel_, USHORT usDeviceNumber_, UCHAR ucDeviceType_, UCHAR ucTransmitType_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_CHANNEL_ID_ID;
+   stMessage.aucData[0] = ucANTChannel_;
+   stMessage.aucData[1] = (UCHAR)(usDeviceNumber_ & 0xFF);
+   stMessage.aucData[2] = (UCHAR)((usDeviceNumber_ >>8) & 0xFF);
+   stMessage.aucData[3] = ucDeviceType_;
+   stMessage.aucData[4] = ucTransmitType_;
+
+   return SendCommandAsync(&stMessage, MESG_CHANNEL_ID_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::SetChannelPeriod(UCHAR ucANTChannel_, USHORT usMessagePeriod_, ULONG ulResponseTime_)
 {
@@ -455,6 +656,19 @@ BOOL DSIFramerANT::SetChannelPeriod(UCHAR ucANTChannel_, USHORT usMessagePeriod_
    return SendCommand(&stMessage, MESG_CHANNEL_MESG_PERIOD_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::SetChannelPeriodAsync(UCHAR ucANTChannel_, USHORT usMessagePeriod_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_CHANNEL_MESG_PERIOD_ID;
+   stMessage.aucData[0] = ucANTChannel_;
+   stMessage.aucData[1] = (UCHAR)(usMessagePeriod_ & 0xFF);
+   stMessage.aucData[2] = (UCHAR)((usMessagePeriod_ >>8) & 0xFF);
+
+   return SendCommandAsync(&stMessage, MESG_CHANNEL_MESG_PERIOD_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::SetFastSearch(UCHAR ucANTChannel_, ULONG ulResponseTime_)
 {
@@ -483,6 +697,18 @@ BOOL DSIFramerANT::SetLowPriorityChannelSearchTimeout(UCHAR ucANTChannel_, UCHAR
    return SendCommand(&stMessage, MESG_SET_LP_SEARCH_TIMEOUT_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::SetLowPriorityChannelSearchTimeoutAsync(UCHAR ucANTChannel_, UCHAR ucSearchTimeout_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_SET_LP_SEARCH_TIMEOUT_ID;
+   stMessage.aucData[0] = ucANTChannel_;
+   stMessage.aucData[1] = ucSearchTimeout_;
+
+   return SendCommandAsync(&stMessage, MESG_SET_LP_SEARCH_TIMEOUT_SIZE);
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::SetChannelSearchTimeout(UCHAR ucANTChannel_, UCHAR ucSearchTimeout_, ULONG ulResponseTime_)
@@ -496,6 +722,18 @@ BOOL DSIFramerANT::SetChannelSearchTimeout(UCHAR ucANTChannel_, UCHAR ucSearchTi
    return SendCommand(&stMessage, MESG_CHANNEL_SEARCH_TIMEOUT_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::SetChannelSearchTimeoutAsync(UCHAR ucANTChannel_, UCHAR ucSearchTimeout_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_CHANNEL_SEARCH_TIMEOUT_ID;
+   stMessage.aucData[0] = ucANTChannel_;
+   stMessage.aucData[1] = ucSearchTimeout_;
+
+   return SendCommandAsync(&stMessage, MESG_CHANNEL_SEARCH_TIMEOUT_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::SetChannelRFFrequency(UCHAR ucANTChannel_, UCHAR ucRFFrequency_, ULONG ulResponseTime_)
 {
@@ -508,6 +746,18 @@ BOOL DSIFramerANT::SetChannelRFFrequency(UCHAR ucANTChannel_, UCHAR ucRFFrequenc
    return SendCommand(&stMessage, MESG_CHANNEL_RADIO_FREQ_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::SetChannelRFFrequencyAsync(UCHAR ucANTChannel_, UCHAR ucRFFrequency_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_CHANNEL_RADIO_FREQ_ID;
+   stMessage.aucData[0] = ucANTChannel_;
+   stMessage.aucData[1] = ucRFFrequency_;
+
+   return SendCommandAsync(&stMessage, MESG_CHANNEL_RADIO_FREQ_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::CrystalEnable(ULONG ulResponseTime_)
 {
@@ -544,6 +794,18 @@ BOOL DSIFramerANT::SetProximitySearch(UCHAR ucANTChannel_, UCHAR ucSearchThresho
    return SendCommand(&stMessage, MESG_PROX_SEARCH_CONFIG_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::SetProximitySearchAsync(UCHAR ucANTChannel_, UCHAR ucSearchThreshold_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_PROX_SEARCH_CONFIG_ID;
+   stMessage.aucData[0]  = ucANTChannel_;
+   stMessage.aucData[1]  = ucSearchThreshold_;
+
+   return SendCommandAsync(&stMessage, MESG_PROX_SEARCH_CONFIG_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::ConfigEventBuffer(UCHAR ucConfig_, USHORT usSize_, USHORT usTime_, ULONG ulResponseTime_)
 {
@@ -1284,7 +1546,7 @@ BOOL DSIFramerANT::ResetSystem(ULONG ulResponseTime_)
    // If we are going to be waiting for a response setup the Response object
    if (ulResponseTime_ != 0)
    {
-      pclCommandResponse = new ANTMessageResponse();
+      pclCommandResponse = AcquireResponse();
       pclCommandResponse->Attach(MESG_STARTUP_MESG_ID, (UCHAR*)NULL, 0, this);
    }
 
@@ -1297,7 +1559,7 @@ BOOL DSIFramerANT::ResetSystem(ULONG ulResponseTime_)
 
       if(pclCommandResponse != NULL)
       {
-         delete pclCommandResponse;
+         ReleaseResponse(pclCommandResponse);
          pclCommandResponse = (ANTMessageResponse*)NULL;
       }
 
@@ -1321,11 +1583,11 @@ BOOL DSIFramerANT::ResetSystem(ULONG ulResponseTime_)
          DSIDebug::ThreadWrite("Framer->ResetSystem():  Timeout.");
       #endif
 
-      delete pclCommandResponse;
+      ReleaseResponse(pclCommandResponse);
       return FALSE;
    }
 
-   delete pclCommandResponse;
+   ReleaseResponse(pclCommandResponse);
    return TRUE;
 }
 
@@ -1340,6 +1602,17 @@ BOOL DSIFramerANT::OpenChannel(UCHAR ucANTChannel_, ULONG ulResponseTime_)
    return SendCommand(&stMessage, MESG_OPEN_CHANNEL_SIZE, ulResponseTime_);
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::OpenChannelAsync(UCHAR ucANTChannel_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_OPEN_CHANNEL_ID;
+   stMessage.aucData[0]  = ucANTChannel_;
+
+   return SendCommandAsync(&stMessage, MESG_OPEN_CHANNEL_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::SetRSSISearchThreshold(UCHAR ucANTChannel_, UCHAR ucSearchThreshold_, ULONG ulResponseTime_)
 {
@@ -1371,7 +1644,7 @@ BOOL DSIFramerANT::CloseChannel(UCHAR ucANTChannel_, ULONG ulResponseTime_)
       aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_EVENT_ID;
       aucDesiredData[ANT_DATA_EVENT_CODE_OFFSET] = EVENT_CHANNEL_CLOSED;
 
-      pclEventResponse = new ANTMessageResponse();
+      pclEventResponse = AcquireResponse();
       pclEventResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, sizeof(aucDesiredData), this);
    }
 
@@ -1387,11 +1660,22 @@ BOOL DSIFramerANT::CloseChannel(UCHAR ucANTChannel_, ULONG ulResponseTime_)
    }
 
    pclEventResponse->Remove();                                               //detach from list
-   delete pclEventResponse;
+   ReleaseResponse(pclEventResponse);
 
    return bReturn;
 }
 
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::CloseChannelAsync(UCHAR ucANTChannel_)
+{
+   ANT_MESSAGE stMessage;
+
+   stMessage.ucMessageID = MESG_CLOSE_CHANNEL_ID;
+   stMessage.aucData[0]  = ucANTChannel_;
+
+   return SendCommandAsync(&stMessage, MESG_CLOSE_CHANNEL_SIZE);
+}
+
 ///////////////////////////////////////////////////////////////////////
 BOOL DSIFramerANT::SendBroadcastData(UCHAR ucANTChannel_, UCHAR *pucData_)
 {
@@ -1481,20 +1765,20 @@ ANTFRAMER_RETURN DSIFramerANT::SetupAckDataTransfer(UCHAR ucMessageID_, UCHAR uc
      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_EVENT_ID;
      aucDesiredData[ANT_DATA_EVENT_CODE_OFFSET] = EVENT_TRANSFER_TX_COMPLETED;
 
-     pclPassResponse = new ANTMessageResponse();
+     pclPassResponse = AcquireResponse();
      pclPassResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, sizeof(aucDesiredData), this);
 
      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = ucANTChannel_;   //Setup response to catch tx fail
      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_EVENT_ID;
      aucDesiredData[ANT_DATA_EVENT_CODE_OFFSET] = EVENT_TRANSFER_TX_FAILED;
 
-     pclFailResponse = new ANTMessageResponse();
+     pclFailResponse = AcquireResponse();
      pclFailResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, sizeof(aucDesiredData), this, pclPassResponse->pstCondResponseReady);
 
      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = ucANTChannel_;   //Setup response to catch any errors like transfer in progress.
      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = ucMessageID_;
 
-     pclErrorResponse = new ANTMessageResponse();
+     pclErrorResponse = AcquireResponse();
      pclErrorResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, 2, this, pclPassResponse->pstCondResponseReady);
    }
 
@@ -1536,9 +1820,9 @@ ANTFRAMER_RETURN DSIFramerANT::SetupAckDataTransfer(UCHAR ucMessageID_, UCHAR uc
 
    DSIThread_MutexUnlock(&stMutexResponseRequest);
 
-   delete pclPassResponse;
-   delete pclFailResponse;
-   delete pclErrorResponse;
+   ReleaseResponse(pclPassResponse);
+   ReleaseResponse(pclFailResponse);
+   ReleaseResponse(pclErrorResponse);
 
    return eReturn;
 }
@@ -1578,20 +1862,20 @@ ANTFRAMER_RETURN DSIFramerANT::SetupBurstDataTransfer(UCHAR ucMessageID_, UCHAR
    aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_EVENT_ID;
    aucDesiredData[ANT_DATA_EVENT_CODE_OFFSET] = EVENT_TRANSFER_TX_COMPLETED;
 
-   pclPassResponse = new ANTMessageResponse();
+   pclPassResponse = AcquireResponse();
    pclPassResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, sizeof(aucDesiredData), this);
 
    aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = ucANTChannel_; //Setup response to catch tx fail
    aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_EVENT_ID;
    aucDesiredData[ANT_DATA_EVENT_CODE_OFFSET] = EVENT_TRANSFER_TX_FAILED;
 
-   pclFailResponse = new ANTMessageResponse();
+   pclFailResponse = AcquireResponse();
    pclFailResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, sizeof(aucDesiredData), this, pclPassResponse->pstCondResponseReady);
 
    aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = ucANTChannel_; //Setup response to catch any errors like transfer in progress.
    aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = ucMessageID_;
 
-   pclErrorResponse = new ANTMessageResponse();
+   pclErrorResponse = AcquireResponse();
    pclErrorResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, 2, this, pclPassResponse->pstCondResponseReady);
 
    //getting error Rx will also effectively lose the transfer, but only on an AP1
@@ -1674,9 +1958,9 @@ ANTFRAMER_RETURN DSIFramerANT::SetupBurstDataTransfer(UCHAR ucMessageID_, UCHAR
 
    DSIThread_MutexUnlock(&stMutexResponseRequest);
 
-   delete pclPassResponse;
-   delete pclFailResponse;
-   delete pclErrorResponse;
+   ReleaseResponse(pclPassResponse);
+   ReleaseResponse(pclFailResponse);
+   ReleaseResponse(pclErrorResponse);
    delete[] stMessage;
 
    //Always return true with no timeout, so nobody relies on this return value
@@ -1772,30 +2056,30 @@ ANTFRAMER_RETURN DSIFramerANT::SendANTFSTransfer(UCHAR ucANTChannel_, UCHAR* puc
      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_EVENT_ID;
      aucDesiredData[ANT_DATA_EVENT_CODE_OFFSET] = EVENT_TRANSFER_TX_COMPLETED;
 
-     pclPassResponse = new ANTMessageResponse();
+     pclPassResponse = AcquireResponse();
      pclPassResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, sizeof(aucDesiredData), this);
 
      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = ucANTChannel_;   //Setup response to catch tx fail
      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_EVENT_ID;
      aucDesiredData[ANT_DATA_EVENT_CODE_OFFSET] = EVENT_TRANSFER_TX_FAILED;
 
-     pclFailResponse = new ANTMessageResponse();
+     pclFailResponse = AcquireResponse();
      pclFailResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, sizeof(aucDesiredData), this, pclPassResponse->pstCondResponseReady);
 
      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = ucANTChannel_;   //Setup response to catch any errors like transfer in progress.
      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_BURST_DATA_ID;
 
-     pclErrorResponse = new ANTMessageResponse();
+     pclErrorResponse = AcquireResponse();
      pclErrorResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, 2, this, pclPassResponse->pstCondResponseReady);
 
      //getting error Rx will also effectively lose the transfer, but only on an AP1
 #if defined(WAIT_TO_FEED_TRANSFER)
      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = ucANTChannel_;   //Setup response to catch only broadcast/acknowledged messages for this channel
 
-     pclBroadcastResponse = new ANTMessageResponse();
+     pclBroadcastResponse = AcquireResponse();
      pclBroadcastResponse->Attach(MESG_BROADCAST_DATA_ID, aucDesiredData, 1, this, pclPassResponse->pstCondResponseReady);
 
-     pclAcknowledgeResponse = new ANTMessageResponse();
+     pclAcknowledgeResponse = AcquireResponse();
      pclAcknowledgeResponse->Attach(MESG_ACKNOWLEDGED_DATA_ID, aucDesiredData, 1, this, pclPassResponse->pstCondResponseReady);
 #endif
    }
@@ -1955,12 +2239,12 @@ ANTFRAMER_RETURN DSIFramerANT::SendANTFSTransfer(UCHAR ucANTChannel_, UCHAR* puc
 
       DSIThread_MutexUnlock(&stMutexResponseRequest);
 
-      delete pclPassResponse;
-      delete pclFailResponse;
-      delete pclErrorResponse;
+      ReleaseResponse(pclPassResponse);
+      ReleaseResponse(pclFailResponse);
+      ReleaseResponse(pclErrorResponse);
    #if defined(WAIT_TO_FEED_TRANSFER)
-      delete pclBroadcastResponse;
-      delete pclAcknowledgeResponse;
+      ReleaseResponse(pclBroadcastResponse);
+      ReleaseResponse(pclAcknowledgeResponse);
    #endif
    }
 
@@ -2015,20 +2299,20 @@ ANTFRAMER_RETURN DSIFramerANT::SendANTFSClientTransfer(UCHAR ucANTChannel_, ANTF
      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_EVENT_ID;
      aucDesiredData[ANT_DATA_EVENT_CODE_OFFSET] = EVENT_TRANSFER_TX_COMPLETED;
 
-     pclPassResponse = new ANTMessageResponse();
+     pclPassResponse = AcquireResponse();
      pclPassResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, sizeof(aucDesiredData), this);
 
      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = ucANTChannel_;   //Setup response to catch tx fail
      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_EVENT_ID;
      aucDesiredData[ANT_DATA_EVENT_CODE_OFFSET] = EVENT_TRANSFER_TX_FAILED;
 
-     pclFailResponse = new ANTMessageResponse();
+     pclFailResponse = AcquireResponse();
      pclFailResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, sizeof(aucDesiredData), this, pclPassResponse->pstCondResponseReady);
 
      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = ucANTChannel_;   //Setup response to catch any errors like transfer in progress.
      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = MESG_BURST_DATA_ID;
 
-     pclErrorResponse = new ANTMessageResponse();
+     pclErrorResponse = AcquireResponse();
      pclErrorResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, 2, this, pclPassResponse->pstCondResponseReady);
    }
 
@@ -2150,9 +2434,9 @@ ANTFRAMER_RETURN DSIFramerANT::SendANTFSClientTransfer(UCHAR ucANTChannel_, ANTF
 
       DSIThread_MutexUnlock(&stMutexResponseRequest);
 
-      delete pclPassResponse;
-      delete pclFailResponse;
-      delete pclErrorResponse;
+      ReleaseResponse(pclPassResponse);
+      ReleaseResponse(pclFailResponse);
+      ReleaseResponse(pclErrorResponse);
    }
 
    return eReturn;
@@ -2169,21 +2453,96 @@ USHORT DSIFramerANT::GetMessageSize(void)
 {
    USHORT usRetVal;
 
+   BOOL bControl;
+   ANT_QUEUED_MESSAGE *pstQueued;
+
    if (ucError)
       usRetVal = DSI_FRAMER_ERROR;
-   else if ((usMessageHead - usMessageTail) != 0)
-      usRetVal = astMessageBuffer[usMessageTail].ucSize;
+   else if ((pstQueued = FrontMessage(bControl)) != NULL)
+      usRetVal = pstQueued->stItem.ucSize;
    else
       usRetVal = DSI_FRAMER_TIMEDOUT;
 
    return usRetVal;
 }
 
+///////////////////////////////////////////////////////////////////////
+// The lane a received message is queued on.
+///////////////////////////////////////////////////////////////////////
+SPSCQueue<ANT_QUEUED_MESSAGE>& DSIFramerANT::GetLane(UCHAR ucMessageID_, UCHAR ucEventID_)
+{
+   if (bPriorityLanes && IsControlMessage(ucMessageID_, ucEventID_))
+      return clControlQueue;
+
+   return clMessageQueue;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Applies the overflow policy of the message's lane when it is full.
+// Only broadcasts, which repeat every channel period, are dropped.
+///////////////////////////////////////////////////////////////////////
+void DSIFramerANT::QueueOverflow(UCHAR ucMessageID_)
+{
+   if (bPriorityLanes && (ucMessageID_ == MESG_BROADCAST_DATA_ID || ucMessageID_ == MESG_EXT_BROADCAST_DATA_ID))
+      ulDroppedData++;
+   else
+      ucError = DSI_FRAMER_ANT_EQUEUE_OVERFLOW;
+}
+
+///////////////////////////////////////////////////////////////////////
+// The oldest message of the control lane, or else of the data lane.
+// bControl_ tells PopMessage() which lane it came from, as a control
+// message may arrive in between.
+///////////////////////////////////////////////////////////////////////
+ANT_QUEUED_MESSAGE* DSIFramerANT::FrontMessage(BOOL &bControl_)
+{
+   ANT_QUEUED_MESSAGE *pstQueued = clControlQueue.Front();
+   bControl_ = (pstQueued != NULL);
+
+   if (pstQueued == NULL)
+      pstQueued = clMessageQueue.Front();
+
+   return pstQueued;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSIFramerANT::PopMessage(BOOL bControl_)
+{
+   if (bControl_)
+      clControlQueue.Pop();
+   else
+      clMessageQueue.Pop();
+}
+
+///////////////////////////////////////////////////////////////////////
+// Blocks until a message or an error is pending, or until
+// ulMilliseconds_ has passed.  The receive thread only publishes to the
+// queue while holding stMutexCriticalSection, so checking again under
+// the lock before waiting cannot miss a wake-up.
+///////////////////////////////////////////////////////////////////////
+void DSIFramerANT::WaitForQueue(ULONG ulMilliseconds_)
+{
+   if ((ulMilliseconds_ == 0) || ucError || GetBacklog() != 0)
+      return;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   if (!ucError && GetBacklog() == 0)
+   {
+      UCHAR ucStatus = DSIThread_CondTimedWait(&stCondMessageReady, &stMutexCriticalSection, ulMilliseconds_);
+      if ((ucStatus != DSI_THREAD_ENONE) && (ucStatus != DSI_THREAD_ETIMEDOUT)) //CondWait() failed
+         ucError = (UCHAR)(DSI_FRAMER_ERROR & 0xFF);        //Set ucError so we can distinguish from a normal error if this ever occurs
+   }
+
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+}
+
 ///////////////////////////////////////////////////////////////////////
 void DSIFramerANT::ProcessMessage(void)
 {
    UCHAR ucMessageID = aucRxFifo[MESG_ID_OFFSET];
    UCHAR ucSize = aucRxFifo[MESG_SIZE_OFFSET];                    // Set size as reported by message.
+   ULLONG ullQueuedUs = (ULLONG)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 
    CheckResponseList();
 
@@ -2222,43 +2581,49 @@ void DSIFramerANT::ProcessMessage(void)
          if((aucRxFifo[MESG_DATA_OFFSET] & SEQUENCE_LAST_MESSAGE) != 0 && (i+1)*8 == ucSize - 1) //If the last packet.
             ucPrevSequenceNum |= SEQUENCE_LAST_MESSAGE;
          // Add message to the queue.
-         if ((USHORT)(usMessageHead - usMessageTail) < (USHORT)(sizeof(astMessageBuffer) / sizeof(ANT_MESSAGE_ITEM) - 1))
+         SPSCQueue<ANT_QUEUED_MESSAGE> &clLane = GetLane(MESG_BURST_DATA_ID, 0);
+         ANT_QUEUED_MESSAGE *pstQueued = clLane.Reserve();
+         if (pstQueued != NULL)
          {
-            astMessageBuffer[usMessageHead].ucSize = 9;
-            astMessageBuffer[usMessageHead].stANTMessage.ucMessageID = MESG_BURST_DATA_ID;
-            astMessageBuffer[usMessageHead].stANTMessage.aucData[0] = ucPrevSequenceNum | (aucRxFifo[MESG_DATA_OFFSET] & CHANNEL_NUMBER_MASK);
-            memcpy(astMessageBuffer[usMessageHead].stANTMessage.aucData + 1, &aucRxFifo[MESG_DATA_OFFSET + 1 + i*8], 8);
-            usMessageHead++;                                   // Rollover of usMessageHead happens automagically because our buffer size is MAX_USHORT + 1.
+            ANT_MESSAGE_ITEM *pstItem = &pstQueued->stItem;
+            pstQueued->ullQueuedUs = ullQueuedUs;
+            pstItem->ucSize = 9;
+            pstItem->stANTMessage.ucMessageID = MESG_BURST_DATA_ID;
+            pstItem->stANTMessage.aucData[0] = ucPrevSequenceNum | (aucRxFifo[MESG_DATA_OFFSET] & CHANNEL_NUMBER_MASK);
+            memcpy(pstItem->stANTMessage.aucData + 1, &aucRxFifo[MESG_DATA_OFFSET + 1 + i*8], 8);
+            #if defined(SERIAL_DEBUG)
+               DSIDebug::SerialWrite(pclSerial->GetDeviceNumber(), "Simulated Rx", pstItem->stANTMessage.aucData, pstItem->ucSize);
+            #endif
+            clLane.Commit();
          }
          else
          {
-            ucError = DSI_FRAMER_ANT_EQUEUE_OVERFLOW;
+            QueueOverflow(MESG_BURST_DATA_ID);
          }
-
-         DSIThread_CondSignal(&stCondMessageReady);
-
-         #if defined(SERIAL_DEBUG)
-            DSIDebug::SerialWrite(pclSerial->GetDeviceNumber(), "Simulated Rx", astMessageBuffer[usMessageHead-1].stANTMessage.aucData, astMessageBuffer[usMessageHead-1].ucSize);
-         #endif
       }
    }
    else
    {
       // Add message to the queue.
-      if ((USHORT)(usMessageHead - usMessageTail) < (USHORT)(sizeof(astMessageBuffer) / sizeof(ANT_MESSAGE_ITEM) - 1))
+      SPSCQueue<ANT_QUEUED_MESSAGE> &clLane = GetLane(ucMessageID, aucRxFifo[MESG_DATA_OFFSET + 1]);
+      ANT_QUEUED_MESSAGE *pstQueued = clLane.Reserve();
+      if (ucSize > MESG_MAX_SIZE_VALUE)                     // Would overrun the queue slot, so drop it.
       {
-         astMessageBuffer[usMessageHead].ucSize = ucSize;
-         astMessageBuffer[usMessageHead].stANTMessage.ucMessageID = ucMessageID;
-         memcpy(astMessageBuffer[usMessageHead].stANTMessage.aucData, &aucRxFifo[MESG_DATA_OFFSET], ucSize);
-         usMessageHead++;                                   // Rollover of usMessageHead happens automagically because our buffer size is MAX_USHORT + 1.
+         ucError = DSI_FRAMER_ANT_EINVALID_SIZE;
+      }
+      else if (pstQueued != NULL)
+      {
+         pstQueued->ullQueuedUs = ullQueuedUs;
+         pstQueued->stItem.ucSize = ucSize;
+         pstQueued->stItem.stANTMessage.ucMessageID = ucMessageID;
+         memcpy(pstQueued->stItem.stANTMessage.aucData, &aucRxFifo[MESG_DATA_OFFSET], ucSize);
+         clLane.Commit();
       }
       else
       {
-         ucError = DSI_FRAMER_ANT_EQUEUE_OVERFLOW;
+         QueueOverflow(ucMessageID);
       }
 
-      DSIThread_CondSignal(&stCondMessageReady);
-
       #if defined(SERIAL_DEBUG)
          DSIDebug::SerialWrite(pclSerial->GetDeviceNumber(), "Rx", aucRxFifo, ucSize + 4);
       #endif
@@ -2266,129 +2631,330 @@ void DSIFramerANT::ProcessMessage(void)
 }
 
 ///////////////////////////////////////////////////////////////////////
-void DSIFramerANT::CheckResponseList(void)
+void DSIFramerANT::InitResponseTable(void)
 {
-   ANTMessageResponse *pclResponseList;
-   BOOL bMatch;
+   for (UCHAR i = 0; i < DSI_FRAMER_ANT_RESPONSE_BUCKETS; i++)
+   {
+      apclResponseTable[i] = (ANTMessageResponse*)NULL;
+      ausResponsesPending[i] = 0;
+   }
+
+   // The waiters' condition variables are initialised once here and reused.
+   pclResponsePool = new ANTMessageResponse[DSI_FRAMER_ANT_RESPONSE_POOL_SIZE];
+   pclResponseFreeList = (ANTMessageResponse*)NULL;
+   for (UCHAR i = 0; i < DSI_FRAMER_ANT_RESPONSE_POOL_SIZE; i++)
+   {
+      pclResponsePool[i].bPooled = TRUE;
+      pclResponsePool[i].pclNext = pclResponseFreeList;
+      pclResponseFreeList = &pclResponsePool[i];
+   }
+}
+
+///////////////////////////////////////////////////////////////////////
+UCHAR DSIFramerANT::GetResponseBucket(UCHAR ucMessageID_, UCHAR ucChannel_)
+{
+   return (UCHAR)((ucMessageID_ * 31 + ucChannel_) & (DSI_FRAMER_ANT_RESPONSE_BUCKETS - 1));
+}
+
+///////////////////////////////////////////////////////////////////////
+ANTMessageResponse* DSIFramerANT::AcquireResponse(void)
+{
+   ANTMessageResponse *pclResponse;
 
    DSIThread_MutexLock(&stMutexResponseRequest);
+   pclResponse = pclResponseFreeList;
+   if (pclResponse != NULL)
+      pclResponseFreeList = pclResponse->pclNext;
+   DSIThread_MutexUnlock(&stMutexResponseRequest);
+
+   if (pclResponse == NULL)
+      return new ANTMessageResponse();                      // Pool exhausted, released with delete.
+
+   pclResponse->pclNext = (ANTMessageResponse*)NULL;
+   pclResponse->bResponseReady = FALSE;
+   pclResponse->pstCondResponseReady = &pclResponse->stCondResponseReady;
+   return pclResponse;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSIFramerANT::ReleaseResponse(ANTMessageResponse *pclResponse_)
+{
+   if (pclResponse_ == NULL)
+      return;
+
+   pclResponse_->Remove();
+
+   if (pclResponse_->bPooled == FALSE)
+   {
+      delete pclResponse_;
+      return;
+   }
+
+   DSIThread_MutexLock(&stMutexResponseRequest);
+   pclResponse_->pclNext = pclResponseFreeList;
+   pclResponseFreeList = pclResponse_;
+   DSIThread_MutexUnlock(&stMutexResponseRequest);
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSIFramerANT::CheckResponseList(void)
+{
+   UCHAR ucMessageID = aucRxFifo[MESG_ID_OFFSET];
+   UCHAR aucBuckets[2];
+   UCHAR ucBuckets = 0;
+
+   aucBuckets[ucBuckets++] = GetResponseBucket(ucMessageID, aucRxFifo[MESG_DATA_OFFSET]);
+   if (GetResponseBucket(ucMessageID, DSI_FRAMER_ANT_RESPONSE_ANY) != aucBuckets[0])
+      aucBuckets[ucBuckets++] = GetResponseBucket(ucMessageID, DSI_FRAMER_ANT_RESPONSE_ANY);
+
+   // Fast path: nobody can be waiting for this message, which is the normal case for broadcast data.
+   if ((ausResponsesPending[aucBuckets[0]] == 0) && ((ucBuckets == 1) || (ausResponsesPending[aucBuckets[1]] == 0)))
+      return;
 
-   pclResponseList = pclResponseListStart;
+   DSIThread_MutexLock(&stMutexResponseRequest);
 
-   while (pclResponseList != NULL)
+   for (UCHAR ucBucket = 0; ucBucket < ucBuckets; ucBucket++)
    {
-      bMatch = TRUE;
+      ANTMessageResponse *pclResponseList = apclResponseTable[aucBuckets[ucBucket]];
 
-      if (pclResponseList->bResponseReady == FALSE && pclResponseList->stMessageItem.stANTMessage.ucMessageID == aucRxFifo[MESG_ID_OFFSET])
+      while (pclResponseList != NULL)
       {
-         for(int i=0; i < pclResponseList->ucBytesToMatch; i++)
+         BOOL bMatch;
+
+         if (pclResponseList->bResponseReady == FALSE && pclResponseList->stMessageItem.stANTMessage.ucMessageID == ucMessageID)
+            bMatch = (memcmp(pclResponseList->stMessageItem.stANTMessage.aucData, &aucRxFifo[MESG_DATA_OFFSET], pclResponseList->ucBytesToMatch) == 0);
+         else
+            bMatch = FALSE;                                                                  // Mesg ID did not match
+
+         if (bMatch)
          {
-            if (pclResponseList->stMessageItem.stANTMessage.aucData[i] != aucRxFifo[MESG_DATA_OFFSET + i])
-            {
-               bMatch = FALSE;                                                             // Data byte did not match
-            }
+           int i = pclResponseList->ucBytesToMatch;
+           pclResponseList->stMessageItem.ucSize = aucRxFifo[MESG_SIZE_OFFSET];
+           memcpy(&(pclResponseList->stMessageItem.stANTMessage.aucData[i]), &(aucRxFifo[MESG_DATA_OFFSET + i]), MESG_MAX_SIZE_VALUE - i);   // Copy the rest of the message
+
+           pclResponseList->bResponseReady = TRUE;
+           DSIThread_CondSignal(pclResponseList->pstCondResponseReady);
          }
+
+         pclResponseList = pclResponseList->pclNext;
       }
-      else
+   }
+
+   DSIThread_MutexUnlock(&stMutexResponseRequest);
+}
+
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSIFramerANT::SendCommand(ANT_MESSAGE *pstANTMessage_, USHORT usMessageSize_, ULONG ulResponseTime_)
+{
+   UCHAR ucResult;
+
+   // Return immediately if we aren't waiting for the response.
+   if (ulResponseTime_ == 0)
+   {
+      if (!WriteMessage(pstANTMessage_, usMessageSize_))
       {
-         bMatch = FALSE;                                                                     // Mesg ID did not match
+         #if defined(DEBUG_FILE)
+            DSIDebug::ThreadWrite("Framer->SendCommand():  WriteMessage Failed.");
+         #endif
+         return FALSE;
       }
+      return TRUE;
+   }
 
-      if (bMatch)
-      {
-        int i = pclResponseList->ucBytesToMatch;
-        pclResponseList->stMessageItem.ucSize = aucRxFifo[MESG_SIZE_OFFSET];
-        memcpy(&(pclResponseList->stMessageItem.stANTMessage.aucData[i]), &(aucRxFifo[MESG_DATA_OFFSET + i]), MESG_MAX_SIZE_VALUE - i);   // Copy the rest of the message
+   ucResult = WaitForCommand(SendCommandAsync(pstANTMessage_, usMessageSize_), ulResponseTime_);
 
-        pclResponseList->bResponseReady = TRUE;
-        DSIThread_CondSignal(pclResponseList->pstCondResponseReady);
-      }
+   #if defined(DEBUG_FILE)
+      if (ucResult == DSI_FRAMER_ANT_COMMAND_EWRITE)
+         DSIDebug::ThreadWrite("Framer->SendCommand():  WriteMessage Failed.");
+      else if (ucResult == DSI_FRAMER_ANT_COMMAND_ETIMEOUT)
+         DSIDebug::ThreadWrite("Framer->SendCommand():  Timeout.");
+      else if (ucResult != RESPONSE_NO_ERROR)
+         DSIDebug::ThreadWrite("Framer->SendCommand():  Response != RESPONSE_NO_ERROR.");
+   #endif
 
-      pclResponseList = pclResponseList->pclNext;
+   return (ucResult == RESPONSE_NO_ERROR);
+}
+
+///////////////////////////////////////////////////////////////////////
+ANT_COMMAND_HANDLE DSIFramerANT::SendCommandAsync(ANT_MESSAGE *pstANTMessage_, USHORT usMessageSize_)
+{
+   ANTMessageResponse *pclCommandResponse;
+   UCHAR aucDesiredData[2];
+   UCHAR bytesToMatch = 2;
+
+   aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = pstANTMessage_->aucData[ANT_DATA_CHANNEL_NUM_OFFSET];
+   aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = pstANTMessage_->ucMessageID;
+
+   //Script dump success can be determined by looking for the script cmd 0x04 dump complete code
+   if(pstANTMessage_->ucMessageID == MESG_SCRIPT_CMD_ID && pstANTMessage_->aucData[ANT_DATA_EVENT_ID_OFFSET] == SCRIPT_CMD_DUMP)
+   {
+      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = SCRIPT_CMD_END_DUMP;
+      bytesToMatch = 1; //The second byte is the number of commands returned, which we can't guess so only match the first byte
    }
+   else if(pstANTMessage_->ucMessageID == MESG_SCRIPT_DATA_ID)
+   {
+      //The first byte of script write is the id of the message being written, not the channel, and it is not overwritten but it is returned with the burst mask, so we need to ensure that is what we are looking for
+      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] &= 0x1F;
+   }
+
+   // Attach before writing so a fast response can't be missed.
+   pclCommandResponse = AcquireResponse();
+   pclCommandResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, bytesToMatch, this);
+
+   if (!WriteMessage(pstANTMessage_, usMessageSize_))
+   {
+      ReleaseResponse(pclCommandResponse);
+      return (ANT_COMMAND_HANDLE)NULL;
+   }
+
+   return pclCommandResponse;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSIFramerANT::IsCommandComplete(ANT_COMMAND_HANDLE hCommand_)
+{
+   BOOL bComplete;
 
+   if (hCommand_ == NULL)
+      return TRUE;
+
+   DSIThread_MutexLock(&stMutexResponseRequest);
+   bComplete = hCommand_->bResponseReady;
    DSIThread_MutexUnlock(&stMutexResponseRequest);
+
+   return bComplete;
 }
 
+///////////////////////////////////////////////////////////////////////
+UCHAR DSIFramerANT::WaitForCommand(ANT_COMMAND_HANDLE hCommand_, ULONG ulResponseTime_)
+{
+   return WaitForCommands(&hCommand_, 1, ulResponseTime_);
+}
 
 ///////////////////////////////////////////////////////////////////////
-BOOL DSIFramerANT::SendCommand(ANT_MESSAGE *pstANTMessage_, USHORT usMessageSize_, ULONG ulResponseTime_)
+UCHAR DSIFramerANT::WaitForCommands(ANT_COMMAND_HANDLE *pahCommands_, USHORT usCount_, ULONG ulResponseTime_, USHORT *pusFailedIndex_)
 {
-   ANTMessageResponse *pclCommandResponse = (ANTMessageResponse*)NULL;
+   UCHAR ucResult = RESPONSE_NO_ERROR;
+   USHORT usFailedIndex = MAX_USHORT;
+   ULONG ulStartTime = DSIThread_GetSystemTime();
 
-   // If we are going to be waiting for a response setup the Response object
-   if (ulResponseTime_ != 0)
+   for (USHORT i = 0; i < usCount_; i++)
    {
-      UCHAR aucDesiredData[2];
-      UCHAR bytesToMatch = 2;
-
-      aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = pstANTMessage_->aucData[ANT_DATA_CHANNEL_NUM_OFFSET];
-      aucDesiredData[ANT_DATA_EVENT_ID_OFFSET] = pstANTMessage_->ucMessageID;
+      ANTMessageResponse *pclCommandResponse = pahCommands_[i];
+      UCHAR ucCommandResult;
 
-      //Script dump success can be determined by looking for the script cmd 0x04 dump complete code
-      if(pstANTMessage_->ucMessageID == MESG_SCRIPT_CMD_ID && pstANTMessage_->aucData[ANT_DATA_EVENT_ID_OFFSET] == SCRIPT_CMD_DUMP)
+      if (pclCommandResponse == NULL)
       {
-         aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] = SCRIPT_CMD_END_DUMP;
-         bytesToMatch = 1; //The second byte is the number of commands returned, which we can't guess so only match the first byte
+         ucCommandResult = DSI_FRAMER_ANT_COMMAND_EWRITE;
       }
-      else if(pstANTMessage_->ucMessageID == MESG_SCRIPT_DATA_ID)
+      else
       {
-         //The first byte of script write is the id of the message being written, not the channel, and it is not overwritten but it is returned with the burst mask, so we need to ensure that is what we are looking for
-         aucDesiredData[ANT_DATA_CHANNEL_NUM_OFFSET] &= 0x1F;
-      }
+         // The batch shares one deadline; the responses arrive back to back so
+         // later waits are normally already satisfied.
+         for (;;)
+         {
+            ULONG ulElapsed = DSIThread_GetSystemTime() - ulStartTime;
 
-      pclCommandResponse = new ANTMessageResponse();
-      pclCommandResponse->Attach(MESG_RESPONSE_EVENT_ID, aucDesiredData, bytesToMatch, this);
-   }
+            if (pclCommandResponse->WaitForResponse(ulElapsed < ulResponseTime_ ? ulResponseTime_ - ulElapsed : 0))
+               break;
 
-   // Write the command message.
-   if (!WriteMessage(pstANTMessage_, usMessageSize_))
-   {
-      #if defined(DEBUG_FILE)
-         DSIDebug::ThreadWrite("Framer->SendCommand():  WriteMessage Failed.");
-      #endif
+            if ((DSIThread_GetSystemTime() - ulStartTime) >= ulResponseTime_)
+               break;
+         }
 
-      if(pclCommandResponse != NULL)
-      {
-         delete pclCommandResponse;
-         pclCommandResponse = (ANTMessageResponse*)NULL;
+         pclCommandResponse->Remove();                                                  //detach from list
+
+         if (pclCommandResponse->bResponseReady == FALSE)
+            ucCommandResult = DSI_FRAMER_ANT_COMMAND_ETIMEOUT;
+         else
+            ucCommandResult = pclCommandResponse->stMessageItem.stANTMessage.aucData[ANT_DATA_EVENT_CODE_OFFSET];
+
+         ReleaseResponse(pclCommandResponse);
+         pahCommands_[i] = (ANT_COMMAND_HANDLE)NULL;
       }
 
-      return FALSE;
+      if ((ucCommandResult != RESPONSE_NO_ERROR) && (usFailedIndex == MAX_USHORT))
+      {
+         ucResult = ucCommandResult;
+         usFailedIndex = i;
+      }
    }
 
-   // Return immediately if we aren't waiting for the response.
-   if (ulResponseTime_ == 0)
-      return TRUE;
+   if (pusFailedIndex_ != NULL)
+      *pusFailedIndex_ = usFailedIndex;
 
-   // Wait for the response.
-   pclCommandResponse->WaitForResponse(ulResponseTime_);
+   return ucResult;
+}
 
-   pclCommandResponse->Remove();                                               //detach from list
+///////////////////////////////////////////////////////////////////////
+UCHAR DSIFramerANT::ConfigureChannels(const ANT_CHANNEL_CONFIG *pastConfigs_, UCHAR ucCount_, ULONG ulResponseTime_, UCHAR *paucResults_, UCHAR *paucFailedMesgIDs_)
+{
+   const USHORT usPerChannel = 6;                          // Assign, ID, period, frequency, search timeout, open
 
-   // We haven't received a response in the allotted time.
-   //if (pclCommandResponse->stMessageItem.ucSize == 0)
-   if (pclCommandResponse->bResponseReady == FALSE)
+   ANT_COMMAND_HANDLE *pahCommands;
+   UCHAR *paucMesgIDs;
+   USHORT usCount = 0;
+   UCHAR ucResult = RESPONSE_NO_ERROR;
+   ULONG ulStartTime;
+
+   if ((pastConfigs_ == NULL) || (ucCount_ == 0))
+      return RESPONSE_NO_ERROR;
+
+   pahCommands = new ANT_COMMAND_HANDLE[ucCount_ * usPerChannel];
+   paucMesgIDs = new UCHAR[ucCount_ * usPerChannel];
+
+   // Issue everything first; the device answers each command in order.
+   for (UCHAR ucConfig = 0; ucConfig < ucCount_; ucConfig++)
    {
-      delete pclCommandResponse;
-      #if defined(DEBUG_FILE)
-         DSIDebug::ThreadWrite("Framer->SendCommand():  Timeout.");
-      #endif
-      return FALSE;
+      const ANT_CHANNEL_CONFIG *pstConfig = &pastConfigs_[ucConfig];
+      UCHAR ucChannel = pstConfig->ucANTChannel;
+
+      usCount = ucConfig * usPerChannel;
+
+      paucMesgIDs[usCount] = MESG_ASSIGN_CHANNEL_ID;
+      pahCommands[usCount++] = AssignChannelAsync(ucChannel, pstConfig->ucChannelType, pstConfig->ucNetworkNumber);
+
+      paucMesgIDs[usCount] = MESG_CHANNEL_ID_ID;
+      pahCommands[usCount++] = SetChannelIDAsync(ucChannel, pstConfig->usDeviceNumber, pstConfig->ucDeviceType, pstConfig->ucTransmitType);
+
+      paucMesgIDs[usCount] = MESG_CHANNEL_MESG_PERIOD_ID;
+      pahCommands[usCount++] = SetChannelPeriodAsync(ucChannel, pstConfig->usMessagePeriod);
+
+      paucMesgIDs[usCount] = MESG_CHANNEL_RADIO_FREQ_ID;
+      pahCommands[usCount++] = SetChannelRFFrequencyAsync(ucChannel, pstConfig->ucRFFrequency);
+
+      paucMesgIDs[usCount] = MESG_CHANNEL_SEARCH_TIMEOUT_ID;
+      pahCommands[usCount++] = SetChannelSearchTimeoutAsync(ucChannel, pstConfig->ucSearchTimeout);
+
+      paucMesgIDs[usCount] = MESG_OPEN_CHANNEL_ID;
+      pahCommands[usCount++] = pstConfig->bOpen ? OpenChannelAsync(ucChannel) : (ANT_COMMAND_HANDLE)NULL;
    }
 
-   // Check the response.
-   if (pclCommandResponse->stMessageItem.stANTMessage.aucData[ANT_DATA_EVENT_CODE_OFFSET] != RESPONSE_NO_ERROR)
+   // Collect the results per channel, all against one deadline.
+   ulStartTime = DSIThread_GetSystemTime();
+   for (UCHAR ucConfig = 0; ucConfig < ucCount_; ucConfig++)
    {
-      delete pclCommandResponse;
-      #if defined(DEBUG_FILE)
-         DSIDebug::ThreadWrite("Framer->SendCommand():  Response != RESPONSE_NO_ERROR.");
-      #endif
-      return FALSE;
+      ULONG ulElapsed = DSIThread_GetSystemTime() - ulStartTime;
+      USHORT usCommands = pastConfigs_[ucConfig].bOpen ? usPerChannel : (USHORT)(usPerChannel - 1);
+      USHORT usFailedIndex;
+      UCHAR ucChannelResult;
+
+      ucChannelResult = WaitForCommands(&pahCommands[ucConfig * usPerChannel], usCommands, ulElapsed < ulResponseTime_ ? ulResponseTime_ - ulElapsed : 0, &usFailedIndex);
+
+      if (paucResults_ != NULL)
+         paucResults_[ucConfig] = ucChannelResult;
+      if (paucFailedMesgIDs_ != NULL)
+         paucFailedMesgIDs_[ucConfig] = (usFailedIndex != MAX_USHORT) ? paucMesgIDs[ucConfig * usPerChannel + usFailedIndex] : MAX_UCHAR;
+
+      if (ucResult == RESPONSE_NO_ERROR)
+         ucResult = ucChannelResult;
    }
 
-   delete pclCommandResponse;
-   return TRUE;
+   delete[] paucMesgIDs;
+   delete[] pahCommands;
+
+   return ucResult;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -2405,7 +2971,7 @@ BOOL DSIFramerANT::SendRequest(UCHAR ucRequestedMesgID_, UCHAR ucANTChannel_ , A
    // If we are going to be waiting for a response setup the Response object
    if ((ulResponseTime_ != 0) && (pstANTResponse_ != NULL))
    {
-      pclRequestResponse = new ANTMessageResponse();
+      pclRequestResponse = AcquireResponse();
      pclRequestResponse->Attach(ucRequestedMesgID_, (UCHAR*)NULL, 0, this);
    }
 
@@ -2414,7 +2980,7 @@ BOOL DSIFramerANT::SendRequest(UCHAR ucRequestedMesgID_, UCHAR ucANTChannel_ , A
    {
       if(pclRequestResponse != NULL)
       {
-         delete pclRequestResponse;
+         ReleaseResponse(pclRequestResponse);
          pclRequestResponse = (ANTMessageResponse*)NULL;
       }
       return FALSE;
@@ -2432,7 +2998,7 @@ BOOL DSIFramerANT::SendRequest(UCHAR ucRequestedMesgID_, UCHAR ucANTChannel_ , A
    // We haven't received a response in the allotted time.
    if (pclRequestResponse->bResponseReady == FALSE)
    {
-      delete pclRequestResponse;
+      ReleaseResponse(pclRequestResponse);
       return FALSE;
    }
 
@@ -2441,7 +3007,7 @@ BOOL DSIFramerANT::SendRequest(UCHAR ucRequestedMesgID_, UCHAR ucANTChannel_ , A
    pstANTResponse_->stANTMessage.ucMessageID = pclRequestResponse->stMessageItem.stANTMessage.ucMessageID;
    memcpy (pstANTResponse_->stANTMessage.aucData, pclRequestResponse->stMessageItem.stANTMessage.aucData, pclRequestResponse->stMessageItem.ucSize);
 
-   delete pclRequestResponse;
+   ReleaseResponse(pclRequestResponse);
    return TRUE;
 }
 
@@ -2462,7 +3028,7 @@ BOOL DSIFramerANT::SendUserNvmRequest(UCHAR ucRequestedMesgID_, UCHAR ucANTChann
    // If we are going to be waiting for a response setup the Response object
    if ((ulResponseTime_ != 0) && (pstANTResponse_ != NULL))
    {
-      pclRequestResponse = new ANTMessageResponse();
+      pclRequestResponse = AcquireResponse();
       pclRequestResponse->Attach(ucRequestedMesgID_, (UCHAR*)NULL, 0, this);
    }
 
@@ -2471,7 +3037,7 @@ BOOL DSIFramerANT::SendUserNvmRequest(UCHAR ucRequestedMesgID_, UCHAR ucANTChann
    {
       if(pclRequestResponse != NULL)
       {
-         delete pclRequestResponse;
+         ReleaseResponse(pclRequestResponse);
          pclRequestResponse = (ANTMessageResponse*)NULL;
       }
       return FALSE;
@@ -2489,7 +3055,7 @@ BOOL DSIFramerANT::SendUserNvmRequest(UCHAR ucRequestedMesgID_, UCHAR ucANTChann
    // We haven't received a response in the allotted time.
    if (pclRequestResponse->bResponseReady == FALSE)
    {
-      delete pclRequestResponse;
+      ReleaseResponse(pclRequestResponse);
       return FALSE;
    }
 
@@ -2498,7 +3064,7 @@ BOOL DSIFramerANT::SendUserNvmRequest(UCHAR ucRequestedMesgID_, UCHAR ucANTChann
    pstANTResponse_->stANTMessage.ucMessageID = pclRequestResponse->stMessageItem.stANTMessage.ucMessageID;
    memcpy (pstANTResponse_->stANTMessage.aucData, pclRequestResponse->stMessageItem.stANTMessage.aucData, pclRequestResponse->stMessageItem.ucSize);
 
-   delete pclRequestResponse;
+   ReleaseResponse(pclRequestResponse);
    return TRUE;
 }
 
@@ -2578,6 +3144,9 @@ ANTMessageResponse::ANTMessageResponse()
 {
    pstCondResponseReady = &stCondResponseReady;
    bResponseReady = FALSE;
+   bAttached = FALSE;
+   bPooled = FALSE;
+   ucBucket = 0;
    pclNext = (ANTMessageResponse*)NULL;
    pclFramer = (DSIFramerANT*)NULL;
    if (DSIThread_CondInit(pstCondResponseReady) != DSI_THREAD_ENONE)                       //Init the wait object
@@ -2594,8 +3163,6 @@ ANTMessageResponse::~ANTMessageResponse()
 ///////////////////////////////////////////////////////////////////////
 BOOL ANTMessageResponse::Attach(UCHAR ucMessageID_, UCHAR *pucData_, UCHAR ucBytesToMatch_, DSIFramerANT * pclFramer_, DSI_CONDITION_VAR *pstCondResponseReady_)
 {
-   ANTMessageResponse *pclResponse;
-
    bResponseReady = FALSE;                                                                 //Init ResponseReady
    stMessageItem.stANTMessage.ucMessageID = ucMessageID_;                                  //Set mesg ID to look for
    ucBytesToMatch = ucBytesToMatch_;                                                       //Set number of data bytes to match
@@ -2613,23 +3180,15 @@ BOOL ANTMessageResponse::Attach(UCHAR ucMessageID_, UCHAR *pucData_, UCHAR ucByt
    if (pclFramer == NULL)
       return FALSE;
 
+   // Waiters that match on the message ID alone go in the catch-all slot for that ID.
+   ucBucket = DSIFramerANT::GetResponseBucket(ucMessageID_, (ucBytesToMatch_ > 0) ? pucData_[0] : DSI_FRAMER_ANT_RESPONSE_ANY);
+
    DSIThread_MutexLock(&(pclFramer->stMutexResponseRequest));                              // Lock the mutex and begin list manipulation
 
-   pclResponse = pclFramer->pclResponseListStart;
-
-   if (pclFramer->pclResponseListStart == NULL)                                            // Check if the list is empty
-   {
-      pclFramer->pclResponseListStart = this;                                              // Add this reponse object to the list
-   }
-   else
-   {
-      pclResponse = pclFramer->pclResponseListStart;                                       // If the list is not empty, walk through the list
-     while (pclResponse->pclNext != NULL)
-      {
-         pclResponse = pclResponse->pclNext;
-      }
-     pclResponse->pclNext = this;                                                          // Add ourself to the end of the list
-   }
+   pclNext = pclFramer->apclResponseTable[ucBucket];                                       // Add ourself to the front of the bucket
+   pclFramer->apclResponseTable[ucBucket] = this;
+   pclFramer->ausResponsesPending[ucBucket]++;
+   bAttached = TRUE;
 
    DSIThread_MutexUnlock(&(pclFramer->stMutexResponseRequest));                            // Unlock mutex when we're done
 
@@ -2647,21 +3206,23 @@ void ANTMessageResponse::Remove()
 
    DSIThread_MutexLock(&(pclFramer->stMutexResponseRequest));                              // Lock the mutex and begin list manipulation
 
-   ppclResponse = &(pclFramer->pclResponseListStart);                                      // Set the ppointer to point to pclResponseListStart
-
-   while (*ppclResponse != NULL)                                                           // While the pclNext is not NULL
+   if (bAttached)
    {
-      if (*ppclResponse == this)                                                           // Check if pclNext is pointing to us
-     {
-        *ppclResponse = pclNext;                                                       // Remove this object from the List by changing the pointer to point to the element behind us
+      ppclResponse = &(pclFramer->apclResponseTable[ucBucket]);
 
-       if (pclNext == NULL)                                                              // If we are at the end of the list, then break because we are done.
-           break;
-     }
-     else
-     {
-        ppclResponse = &((*ppclResponse)->pclNext);                                       // Advance the ppointer to point to the pclNext element of the next object in the list
-     }
+      while (*ppclResponse != NULL)
+      {
+         if (*ppclResponse == this)
+         {
+            *ppclResponse = pclNext;                                                       // Unlink by pointing the previous element past us
+            break;
+         }
+         ppclResponse = &((*ppclResponse)->pclNext);
+      }
+
+      pclNext = (ANTMessageResponse*)NULL;
+      pclFramer->ausResponsesPending[ucBucket]--;
+      bAttached = FALSE;
    }
 
    DSIThread_MutexUnlock(&(pclFramer->stMutexResponseRequest));                            // Unlock mutex when we're done
@@ -66,7 +66,7 @@ BOOL DSIFramerANT::SendFSCommand(FS_MESSAGE *pstFSMessage_, USHORT usMessageSize
       aucDesiredData[OFFSET_RESPONSE_COMMAND_ID_LOW] = pstFSMessage_->ucCommandID;
       aucDesiredData[OFFSET_RESPONSE_COMMAND_ID_HIGH] = pstFSMessage_->ucMessageID;
 
-      pclCommandResponse = new ANTMessageResponse();
+      pclCommandResponse = AcquireResponse();
       pclCommandResponse->Attach((UCHAR)((MESG_EXT_RESPONSE_ID >> 8) & 0xFF), aucDesiredData, bytesToMatch, this);
    }
 
@@ -79,7 +79,7 @@ BOOL DSIFramerANT::SendFSCommand(FS_MESSAGE *pstFSMessage_, USHORT usMessageSize
 
       if(pclCommandResponse != NULL)
       {
-         delete pclCommandResponse;
+         ReleaseResponse(pclCommandResponse);
          pclCommandResponse = (ANTMessageResponse*)NULL;
       }
 
@@ -99,7 +99,7 @@ BOOL DSIFramerANT::SendFSCommand(FS_MESSAGE *pstFSMessage_, USHORT usMessageSize
    //if (pclCommandResponse->stMessageItem.ucSize == 0)
    if (pclCommandResponse->bResponseReady == FALSE)
    {
-      delete pclCommandResponse;
+      ReleaseResponse(pclCommandResponse);
       #if defined(SERIAL_DEBUG)
       DSIDebug::ThreadWrite("Framer->SendCommand():  Timeout.");
       #endif
@@ -109,7 +109,7 @@ BOOL DSIFramerANT::SendFSCommand(FS_MESSAGE *pstFSMessage_, USHORT usMessageSize
    // Check the response.
    if (pclCommandResponse->stMessageItem.stANTMessage.aucData[OFFSET_RESPONSE_FSRESPONSE] != FS_NO_ERROR_RESPONSE)
    {
-      delete pclCommandResponse;
+      ReleaseResponse(pclCommandResponse);
       #if defined(DEBUG_FILE)
          DSIDebug::ThreadWrite("Framer->SendFSCommand():  Response != RESPONSE_NO_ERROR.");
       #endif
@@ -118,7 +118,7 @@ BOOL DSIFramerANT::SendFSCommand(FS_MESSAGE *pstFSMessage_, USHORT usMessageSize
 
    *pucFSResponse = pclCommandResponse->stMessageItem.stANTMessage.aucData[OFFSET_RESPONSE_FSRESPONSE];                         //Save the FSResponse
 
-   delete pclCommandResponse;
+   ReleaseResponse(pclCommandResponse);
    return TRUE;
 }
 
@@ -130,7 +130,7 @@ BOOL DSIFramerANT::SendFSRequest(UCHAR MesgSize, ANT_MESSAGE_ITEM *pstANTRespons
    // If we are going to be waiting for a response setup the Response object
    if ((ulResponseTime_ != 0) && (pstANTResponse_ != NULL))
    {
-      pclRequestResponse = new ANTMessageResponse();
+      pclRequestResponse = AcquireResponse();
       pclRequestResponse->Attach(MESG_EXT_ID_2, (UCHAR*)NULL, 0, this);
    }
 
@@ -139,7 +139,7 @@ BOOL DSIFramerANT::SendFSRequest(UCHAR MesgSize, ANT_MESSAGE_ITEM *pstANTRespons
    {
       if(pclRequestResponse != NULL)
       {
-         delete pclRequestResponse;
+         ReleaseResponse(pclRequestResponse);
          pclRequestResponse = (ANTMessageResponse*)NULL;
       }
       return FALSE;
@@ -157,7 +157,7 @@ BOOL DSIFramerANT::SendFSRequest(UCHAR MesgSize, ANT_MESSAGE_ITEM *pstANTRespons
    // We haven't received a response in the allotted time.
    if (pclRequestResponse->bResponseReady == FALSE)
    {
-      delete pclRequestResponse;
+      ReleaseResponse(pclRequestResponse);
       return FALSE;
    }
 
@@ -166,7 +166,7 @@ BOOL DSIFramerANT::SendFSRequest(UCHAR MesgSize, ANT_MESSAGE_ITEM *pstANTRespons
    pstANTResponse_->stANTMessage.ucMessageID = pclRequestResponse->stMessageItem.stANTMessage.ucMessageID;
    memcpy (pstANTResponse_->stANTMessage.aucData, pclRequestResponse->stMessageItem.stANTMessage.aucData, pclRequestResponse->stMessageItem.ucSize);
 
-   delete pclRequestResponse;
+   ReleaseResponse(pclRequestResponse);
    return TRUE;
 }
 
@@ -22,6 +22,7 @@ All rights reserved.
 #define DSI_SERIAL_DEVICE_GONE      ((UCHAR) 0x01)
 #define DSI_SERIAL_EWRITE           ((UCHAR) 0x02)
 #define DSI_SERIAL_EREAD            ((UCHAR) 0x03)
+#define DSI_SERIAL_DEVICE_ARRIVED   ((UCHAR) 0x04)          // Not an error: a device was plugged in while ours was lost, so reopening it may work.
 #define DSI_SERIAL_EOTHER           ((UCHAR) 0xFF)
 
 
@@ -0,0 +1,1583 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+*/
+
+#include "types.h"
+#include "defines.h"
+#include "macros.h"
+#include "antmessage.h"
+#include "antdefines.h"
+#include "dsi_thread.h"
+#include "dsi_serial_emulator.hpp"
+#include "dsi_serial_frames.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <queue>
+#include <vector>
+#include <functional>
+
+#include "dsi_debug.hpp"
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Private Definitions
+//////////////////////////////////////////////////////////////////////////////////
+
+#define EMULATOR_TRACKER_DEVICE_TYPE   ((UCHAR) 0x29)
+#define EMULATOR_TRACKER_TRANSMIT_TYPE ((UCHAR) 0x05)
+#define EMULATOR_TRACKER_PERIOD        ((USHORT) 2048)      // 16 Hz
+#define EMULATOR_HRM_DEVICE_TYPE       ((UCHAR) 0x78)
+#define EMULATOR_HRM_TRANSMIT_TYPE     ((UCHAR) 0x01)
+#define EMULATOR_HRM_PERIOD            ((USHORT) 8070)      // 4.06 Hz
+#define EMULATOR_RF_FREQUENCY          ((UCHAR) 57)         // 2457 MHz, ANT+
+
+#define EMULATOR_PAGE_LOCATION_1       ((UCHAR) 0x01)
+#define EMULATOR_PAGE_LOCATION_2       ((UCHAR) 0x02)
+#define EMULATOR_PAGE_NO_ASSETS        ((UCHAR) 0x03)
+#define EMULATOR_PAGE_IDENTIFICATION_1 ((UCHAR) 0x10)
+#define EMULATOR_PAGE_IDENTIFICATION_2 ((UCHAR) 0x11)
+#define EMULATOR_PAGE_REQUEST          ((UCHAR) 0x46)       // Common page 70
+#define EMULATOR_PAGE_MANUFACTURER     ((UCHAR) 0x50)       // Common page 80
+#define EMULATOR_PAGE_PRODUCT          ((UCHAR) 0x51)       // Common page 81
+#define EMULATOR_PAGE_BATTERY          ((UCHAR) 0x52)       // Common page 82
+#define EMULATOR_PAGE_HRM              ((UCHAR) 0x04)
+#define EMULATOR_REQUEST_PAGE_SET      ((UCHAR) 0x04)       // Page 70 command type asking for a set of pages.
+#define EMULATOR_NO_ASSET              ((UCHAR) 0xFF)
+#define EMULATOR_SITUATION_MOVING      ((UCHAR) 1)          // Situation in bits 5-7 of the location page 1 status.
+
+#define EMULATOR_IDENT_INTERVAL        ((USHORT) 8)         // Location cycles between unsolicited identification pages.
+#define EMULATOR_COMMON_INTERVAL       ((ULONG) 1920)       // Messages between unsolicited common pages.
+#define EMULATOR_MAX_REQUESTED_TX      ((UCHAR) 4)          // Cap on page 70 "transmit N times".
+
+#define EMULATOR_CENTER_LATITUDE       ((DOUBLE) 60.0)      // Fleet positions are scattered around this point.
+#define EMULATOR_CENTER_LONGITUDE      ((DOUBLE) 10.5)
+#define EMULATOR_SEMICIRCLES_PER_DEG   ((DOUBLE) 2147483648.0 / 180.0)
+
+#define EMULATOR_RSSI_THRESHOLD        ((SCHAR) -96)
+#define EMULATOR_RSSI_JITTER           ((ULONG) 3)          // dBm either side of the device's base RSSI.
+#define EMULATOR_EXT_MESG_FLAGS        ((UCHAR)(ANT_LIB_CONFIG_MESG_OUT_INC_DEVICE_ID | ANT_LIB_CONFIG_MESG_OUT_INC_RSSI | ANT_LIB_CONFIG_MESG_OUT_INC_TIME_STAMP))
+
+#define EMULATOR_ID_LIST_SIZE          ((UCHAR) 4)          // Channel IDs an inclusion/exclusion list can hold.
+
+#define EMULATOR_SDU_MASKS             ((UCHAR) 8)          // Selective Data Update masks the stick can hold.
+#define EMULATOR_SDU_DISABLED          ((UCHAR) 0xFF)
+#define EMULATOR_SDU_HISTORY_SIZE      ((ULONG) 256 * 9)    // Per page: a seen flag and the last forwarded payload.
+
+#define EMULATOR_EVENT_BUFFER_ALL      ((UCHAR) 0x01)       // Buffer config: all events, not only low priority ones.
+#define EMULATOR_EVENT_BUFFER_TIME_NS  ((ULLONG) 10000000ULL)    // One event buffer time unit, 10 ms.
+
+#define EMULATOR_SEARCH_TIMEOUT_NS     ((ULLONG) 2500000000ULL)  // One search timeout count, 2.5 s.
+#define EMULATOR_RX_FAILS_TO_SEARCH    ((ULLONG) 8)         // Missed broadcasts before a tracking channel drops to search.
+#define EMULATOR_PROXIMITY_BIN_DBM     ((SLONG) 5)          // Each proximity bin reaches this much further out...
+#define EMULATOR_PROXIMITY_BASE_DBM    ((SLONG) -35)        // ...than bin 1, which only hears devices above this RSSI.
+#define EMULATOR_STALL_NS              ((ULLONG) 1000000000ULL)  // Devices further behind than this skip ahead instead of bursting.
+
+typedef struct
+{
+   SLONG slLatitude;                                        // Semicircles
+   SLONG slLongitude;
+   USHORT usDistance;                                       // Metres from the tracker
+   UCHAR ucBearing;                                         // Binary radians
+   UCHAR ucStatus;                                          // Situation in bits 5-7
+   UCHAR ucColor;
+   char acName[11];                                         // Identification pages 1 and 2 carry five characters each.
+} EMULATOR_ASSET;
+
+typedef struct
+{
+   USHORT usDeviceNumber;
+   UCHAR ucDeviceType;
+   UCHAR ucTransmitType;
+   UCHAR ucRFFrequency;
+   SCHAR scRssi;
+   ULLONG ullPeriodNs;
+   ULLONG ullPhaseNs;                                       // Offset of the first broadcast after Open().
+   ULONG ulMessages;                                        // Broadcasts sent, delivered or not.
+
+   std::vector<EMULATOR_ASSET> clAssets;                    // Trackers only.
+   std::deque<USHORT> clRequested;                          // Requested pages, page << 8 | asset.
+   USHORT usSlot;                                           // Position in the tracker's page cycle.
+   USHORT usCycle;
+
+   UCHAR ucHeartRate;                                       // Heart rate monitors only.
+   ULLONG ullTime1024;                                      // Device clock, 1/1024 s.
+   ULLONG ullNextBeat1024;
+   USHORT usLastBeat1024;
+   USHORT usPreviousBeat1024;
+   UCHAR ucBeatCount;
+} EMULATOR_DEVICE;
+
+typedef struct
+{
+   UCHAR ucStatus;                                          // STATUS_*_CHANNEL
+   UCHAR ucChannelType;
+   UCHAR ucNetworkNumber;
+   USHORT usDeviceNumber;                                   // Configured channel ID, 0 fields are wildcards.
+   UCHAR ucDeviceType;
+   UCHAR ucTransmitType;
+   USHORT usMessagePeriod;
+   UCHAR ucRFFrequency;
+   UCHAR ucSearchTimeout;
+   UCHAR ucLPSearchTimeout;
+   UCHAR ucProximityBin;                                    // 0 if the search has no proximity threshold.
+   USHORT usTrackedNumber;                                  // Channel ID of the device being tracked.
+   UCHAR ucTrackedType;
+   UCHAR ucTrackedTransmitType;
+   ULLONG ullSearchDeadlineNs;                              // 0 if the search never times out.
+   ULLONG ullLastRxNs;                                      // Last broadcast received while tracking.
+   USHORT ausListNumber[EMULATOR_ID_LIST_SIZE];             // Inclusion/exclusion list, 0 fields are wildcards.
+   UCHAR aucListType[EMULATOR_ID_LIST_SIZE];
+   UCHAR aucListTransmitType[EMULATOR_ID_LIST_SIZE];
+   UCHAR ucListSize;                                        // 0 if the channel has no list.
+   BOOL bListExclude;
+} EMULATOR_CHANNEL;
+
+typedef std::pair<ULLONG, ULONG> EMULATOR_EVENT;           // Due time, device index.
+
+struct DSISerialEmulator::EMULATOR_STATE
+{
+   std::vector<EMULATOR_DEVICE> clDevices;
+   std::priority_queue<EMULATOR_EVENT, std::vector<EMULATOR_EVENT>, std::greater<EMULATOR_EVENT> > clSchedule;
+   EMULATOR_CHANNEL astChannels[DSI_SERIAL_EMULATOR_MAX_CHANNELS];
+   std::vector<UCHAR> clPendingBytes;                       // Responses and events waiting for the emulator thread.
+   std::vector<UCHAR> clBroadcasts;                         // Broadcasts framed for the next chunk.
+   BOOL bExtMesgsEnabled;
+   BOOL bRxScanMode;                                        // Channel 0 is in continuous scan mode.
+   UCHAR ucLibConfig;
+   UCHAR aaucSduMasks[EMULATOR_SDU_MASKS][8];
+   UCHAR aucSduConfig[DSI_SERIAL_EMULATOR_MAX_CHANNELS];    // Mask number per channel, EMULATOR_SDU_DISABLED if off.
+   std::vector<UCHAR> aclSduHistory[DSI_SERIAL_EMULATOR_MAX_CHANNELS];
+   UCHAR ucEventBufferConfig;
+   USHORT usEventBufferSize;                                // Bytes held before a flush, 0 for no limit.
+   USHORT usEventBufferTime;                                // 10 ms units held before a flush, 0 for no limit.
+   ULLONG ullBufferedSinceNs;                               // When the oldest held broadcast was generated, 0 if none.
+   ULLONG ullUnplugNs;                                      // When the stick is pulled out, 0 for never.
+   ULLONG ullReplugNs;                                      // When it is plugged back in, 0 for never.
+   ULONG ulRandom;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Private Function Prototypes
+//////////////////////////////////////////////////////////////////////////////////
+
+static ULONG NextRandom(ULONG *pulState_);
+static void BuildTrackerPage(EMULATOR_DEVICE &stDevice_, UCHAR *pucPayload_, ULONG *pulRandom_);
+static void BuildHeartRatePage(EMULATOR_DEVICE &stDevice_, UCHAR *pucPayload_, ULONG *pulRandom_);
+static void BuildCommonPage(const EMULATOR_DEVICE &stDevice_, UCHAR ucPage_, UCHAR *pucPayload_);
+static BOOL MatchesChannelID(const EMULATOR_CHANNEL &stChannel_, const EMULATOR_DEVICE &stDevice_);
+static ULLONG SearchDeadline(const EMULATOR_CHANNEL &stChannel_, ULLONG ullNow_);
+static BOOL IsInRange(const DSI_SERIAL_EMULATOR_FLEET &stFleet_, const EMULATOR_DEVICE &stDevice_, ULLONG ullNow_);
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Methods
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////
+DSISerialEmulator::DSISerialEmulator()
+{
+   hEmulatorThread = (DSI_THREAD_ID)NULL;
+   bStopEmulatorThread = TRUE;
+
+   InitFleet(&stFleet);
+   ucDeviceNumber = 0;
+   ulGeneratedMessages = 0;
+
+   pstState = new EMULATOR_STATE;
+   pstState->ulRandom = stFleet.ulSeed;
+   pstState->ullUnplugNs = 0;
+   pstState->ullReplugNs = 0;
+   ResetChannels();
+}
+
+///////////////////////////////////////////////////////////////////////
+// Destructor
+///////////////////////////////////////////////////////////////////////
+DSISerialEmulator::~DSISerialEmulator()
+{
+   Close();
+   delete pstState;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::InitFleet(DSI_SERIAL_EMULATOR_FLEET *pstFleet_)
+{
+   memset(pstFleet_, 0, sizeof(DSI_SERIAL_EMULATOR_FLEET));
+   pstFleet_->usTrackers = 4;
+   pstFleet_->ucAssetsPerTracker = 8;
+   pstFleet_->usHeartRateMonitors = 4;
+   pstFleet_->usCollisions = 0;
+   pstFleet_->ucMaxChannels = 8;
+   pstFleet_->scRssiMin = -90;
+   pstFleet_->scRssiMax = -40;
+   pstFleet_->ucExtFlags = ANT_LIB_CONFIG_MESG_OUT_INC_DEVICE_ID | ANT_LIB_CONFIG_MESG_OUT_INC_RSSI;
+   pstFleet_->bSelectiveDataUpdates = TRUE;
+   pstFleet_->bEventBuffering = TRUE;
+   pstFleet_->ulDropoutIntervalMs = 60000;
+   pstFleet_->ulSerialNumber = 0x00EE0001;
+   pstFleet_->ulSeed = 1;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialEmulator::Init(const DSI_SERIAL_EMULATOR_FLEET *pstFleet_)
+{
+   Close();
+
+   if (pstFleet_ == NULL)
+      InitFleet(&stFleet);
+   else
+      stFleet = *pstFleet_;
+
+   if (stFleet.ucMaxChannels == 0 || stFleet.ucMaxChannels > DSI_SERIAL_EMULATOR_MAX_CHANNELS)
+      stFleet.ucMaxChannels = DSI_SERIAL_EMULATOR_MAX_CHANNELS;
+   if (stFleet.ucAssetsPerTracker > DSI_SERIAL_EMULATOR_MAX_ASSETS)
+      stFleet.ucAssetsPerTracker = DSI_SERIAL_EMULATOR_MAX_ASSETS;
+   if (stFleet.scRssiMin > stFleet.scRssiMax)
+   {
+      SCHAR scTemp = stFleet.scRssiMin;
+      stFleet.scRssiMin = stFleet.scRssiMax;
+      stFleet.scRssiMax = scTemp;
+   }
+   if (stFleet.ulSeed == 0)
+      stFleet.ulSeed = 1;                                   // xorshift never leaves zero.
+
+   CreateFleet();
+   ResetChannels();
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSISerialEmulator::GetFleetSize(void)
+{
+   return (ULONG)pstState->clDevices.size();
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSISerialEmulator::GetGeneratedMessages(void)
+{
+   return ulGeneratedMessages;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialEmulator::AutoInit()
+{
+   return Init((ULONG)0, (UCHAR)0);
+}
+
+///////////////////////////////////////////////////////////////////////
+// The baud rate has no meaning for an emulated stick; the device
+// number is only reported back through GetDeviceNumber().  Creates the
+// default fleet if Init() was not called with one.
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialEmulator::Init(ULONG /*ulBaud_*/, UCHAR ucDeviceNumber_)
+{
+   ucDeviceNumber = ucDeviceNumber_;
+
+   if (pstState->clDevices.empty() && (stFleet.usTrackers + stFleet.usHeartRateMonitors > 0))
+      CreateFleet();
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSISerialEmulator::GetDeviceSerialNumber()
+{
+   return stFleet.ulSerialNumber;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Powers up the emulated stick and starts the emulator thread.
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialEmulator::Open()
+{
+   ULLONG ullNow = SerialFrames_GetTimestamp();
+
+   if (IsUnplugged(ullNow))
+      return FALSE;                                         // Nothing to open until it is plugged back in.
+
+   Close();
+
+   if (pclCallback == NULL)
+      return FALSE;
+
+   pstState->ullUnplugNs = 0;
+   pstState->ullReplugNs = 0;
+   if (stFleet.ulUnplugAfterMs != 0)
+   {
+      pstState->ullUnplugNs = ullNow + (ULLONG)stFleet.ulUnplugAfterMs * 1000000;
+      if (stFleet.ulReplugAfterMs != 0)
+         pstState->ullReplugNs = pstState->ullUnplugNs + (ULLONG)stFleet.ulReplugAfterMs * 1000000;
+   }
+
+   ResetChannels();
+   pstState->clPendingBytes.clear();
+   pstState->clBroadcasts.clear();
+   ulGeneratedMessages = 0;
+
+   // Phases count from whole periods of the monotonic clock, so emulators
+   // with the same seed broadcast at the same instants.
+   pstState->clSchedule = std::priority_queue<EMULATOR_EVENT, std::vector<EMULATOR_EVENT>, std::greater<EMULATOR_EVENT> >();
+   for (ULONG i = 0; i < pstState->clDevices.size(); i++)
+   {
+      const EMULATOR_DEVICE &stDevice = pstState->clDevices[i];
+      ULLONG ullFirst = ullNow - ullNow % stDevice.ullPeriodNs + stDevice.ullPhaseNs;
+
+      if (ullFirst < ullNow)
+         ullFirst += stDevice.ullPeriodNs;
+      pstState->clSchedule.push(EMULATOR_EVENT(ullFirst, i));
+   }
+
+   if (DSIThread_MutexInit(&stMutexCriticalSection) != DSI_THREAD_ENONE)
+      return FALSE;
+
+   if (DSIThread_CondInit(&stCondEmulator) != DSI_THREAD_ENONE)
+   {
+      DSIThread_MutexDestroy(&stMutexCriticalSection);
+      return FALSE;
+   }
+
+   if (DSIThread_CondInit(&stEventEmulatorThreadExit) != DSI_THREAD_ENONE)
+   {
+      DSIThread_CondDestroy(&stCondEmulator);
+      DSIThread_MutexDestroy(&stMutexCriticalSection);
+      return FALSE;
+   }
+
+   bStopEmulatorThread = FALSE;
+   hEmulatorThread = DSIThread_CreateThread(&DSISerialEmulator::ProcessThread, this);
+   if (hEmulatorThread == (DSI_THREAD_ID)NULL)
+   {
+      bStopEmulatorThread = TRUE;
+      DSIThread_CondDestroy(&stEventEmulatorThreadExit);
+      DSIThread_CondDestroy(&stCondEmulator);
+      DSIThread_MutexDestroy(&stMutexCriticalSection);
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Stops the emulator thread.  The fleet is kept, so a reopened stick
+// hears the same devices.
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::Close(BOOL /*bReset_*/)
+{
+   if (hEmulatorThread == (DSI_THREAD_ID)NULL)
+      return;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+   if (bStopEmulatorThread == FALSE)
+   {
+      bStopEmulatorThread = TRUE;
+      DSIThread_CondSignal(&stCondEmulator);
+
+      if (DSIThread_CondTimedWait(&stEventEmulatorThreadExit, &stMutexCriticalSection, 3000) != DSI_THREAD_ENONE)
+      {
+         // We were unable to stop the thread normally.
+         DSIThread_DestroyThread(hEmulatorThread);
+      }
+   }
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+   DSIThread_ReleaseThreadID(hEmulatorThread);
+   hEmulatorThread = (DSI_THREAD_ID)NULL;
+
+   DSIThread_CondDestroy(&stEventEmulatorThreadExit);
+   DSIThread_CondDestroy(&stCondEmulator);
+   DSIThread_MutexDestroy(&stMutexCriticalSection);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Parses the framed messages written by the framer and acts on them
+// as the stick would.
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialEmulator::WriteBytes(void *pvData_, USHORT usSize_)
+{
+   const UCHAR *pucBytes = (const UCHAR*)pvData_;
+   USHORT usIndex = 0;
+
+   if ((hEmulatorThread == (DSI_THREAD_ID)NULL) || (pvData_ == NULL) || IsUnplugged(SerialFrames_GetTimestamp()))
+      return FALSE;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   while ((USHORT)(usIndex + MESG_FRAME_SIZE) <= usSize_)
+   {
+      UCHAR ucLength;
+
+      if (pucBytes[usIndex] != MESG_TX_SYNC)
+      {
+         usIndex++;                                         // Skip the zero padding between messages.
+         continue;
+      }
+
+      ucLength = pucBytes[usIndex + MESG_SIZE_OFFSET];
+      if ((USHORT)(usIndex + ucLength + MESG_FRAME_SIZE) > usSize_)
+         break;
+
+      HandleCommand(pucBytes[usIndex + MESG_ID_OFFSET], &pucBytes[usIndex + MESG_DATA_OFFSET], ucLength);
+      usIndex += ucLength + MESG_FRAME_SIZE;
+   }
+
+   DSIThread_CondSignal(&stCondEmulator);
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+UCHAR DSISerialEmulator::GetDeviceNumber()
+{
+   return ucDeviceNumber;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Private Methods
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+// Creates the trackers, the heart rate monitors, and the collisions,
+// which copy the channel ID of a random earlier device but have their
+// own position, timing and RSSI.
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::CreateFleet(void)
+{
+   static const char *apcNames[] = { "Bamse", "Luna", "Rex", "Tass", "Fido", "Bella", "Rocky", "Zorro" };
+   std::vector<UCHAR> clUsed(65536 / 8, 0);                 // Device numbers handed out so far.
+   ULONG ulDevices = (ULONG)stFleet.usTrackers + stFleet.usHeartRateMonitors;
+   ULONG *pulRandom = &pstState->ulRandom;
+   ULONG ulRssiRandom = stFleet.ulRssiSeed;
+
+   pstState->ulRandom = stFleet.ulSeed;
+   pstState->clDevices.clear();
+   pstState->clDevices.reserve(ulDevices + stFleet.usCollisions);
+
+   for (ULONG i = 0; i < ulDevices + stFleet.usCollisions; i++)
+   {
+      EMULATOR_DEVICE stDevice;
+      BOOL bTracker;
+
+      stDevice.ucRFFrequency = EMULATOR_RF_FREQUENCY;
+      stDevice.scRssi = (SCHAR)(stFleet.scRssiMin + (SCHAR)(NextRandom(pulRandom) % (ULONG)(stFleet.scRssiMax - stFleet.scRssiMin + 1)));
+      if (ulRssiRandom != 0)
+         stDevice.scRssi = (SCHAR)(stFleet.scRssiMin + (SCHAR)(NextRandom(&ulRssiRandom) % (ULONG)(stFleet.scRssiMax - stFleet.scRssiMin + 1)));
+      stDevice.ulMessages = 0;
+      stDevice.usSlot = 0;
+      stDevice.usCycle = 0;
+      stDevice.ucHeartRate = (UCHAR)(60 + NextRandom(pulRandom) % 60);
+      stDevice.ullTime1024 = 0;
+      stDevice.ullNextBeat1024 = 0;
+      stDevice.usLastBeat1024 = 0;
+      stDevice.usPreviousBeat1024 = 0;
+      stDevice.ucBeatCount = 0;
+
+      if (i < ulDevices)
+      {
+         USHORT usNumber;
+
+         do
+         {
+            usNumber = (USHORT)(1 + NextRandom(pulRandom) % 65535);
+         } while (clUsed[usNumber >> 3] & (1 << (usNumber & 7)));
+         clUsed[usNumber >> 3] |= (UCHAR)(1 << (usNumber & 7));
+
+         bTracker = (i < stFleet.usTrackers);
+         stDevice.usDeviceNumber = usNumber;
+         stDevice.ucDeviceType = bTracker ? EMULATOR_TRACKER_DEVICE_TYPE : EMULATOR_HRM_DEVICE_TYPE;
+         stDevice.ucTransmitType = bTracker ? EMULATOR_TRACKER_TRANSMIT_TYPE : EMULATOR_HRM_TRANSMIT_TYPE;
+      }
+      else if (ulDevices > 0)
+      {
+         const EMULATOR_DEVICE &stOriginal = pstState->clDevices[NextRandom(pulRandom) % ulDevices];
+
+         stDevice.usDeviceNumber = stOriginal.usDeviceNumber;
+         stDevice.ucDeviceType = stOriginal.ucDeviceType;
+         stDevice.ucTransmitType = stOriginal.ucTransmitType;
+         bTracker = (stDevice.ucDeviceType == EMULATOR_TRACKER_DEVICE_TYPE);
+      }
+      else
+      {
+         break;
+      }
+
+      // Crystals drift, so give every device a slightly different period.
+      stDevice.ullPeriodNs = (ULLONG)((bTracker ? EMULATOR_TRACKER_PERIOD : EMULATOR_HRM_PERIOD) * 1000000000ULL / 32768);
+      stDevice.ullPeriodNs = stDevice.ullPeriodNs * (1000000 - 500 + NextRandom(pulRandom) % 1001) / 1000000;
+      stDevice.ullPhaseNs = NextRandom(pulRandom) % stDevice.ullPeriodNs;
+
+      if (bTracker)
+      {
+         DOUBLE dLatitude = EMULATOR_CENTER_LATITUDE + ((SLONG)(NextRandom(pulRandom) % 10001) - 5000) / 100000.0;
+         DOUBLE dLongitude = EMULATOR_CENTER_LONGITUDE + ((SLONG)(NextRandom(pulRandom) % 10001) - 5000) / 100000.0;
+
+         stDevice.clAssets.resize(stFleet.ucAssetsPerTracker);
+         for (UCHAR j = 0; j < stFleet.ucAssetsPerTracker; j++)
+         {
+            EMULATOR_ASSET &stAsset = stDevice.clAssets[j];
+
+            stAsset.slLatitude = (SLONG)((dLatitude + ((SLONG)(NextRandom(pulRandom) % 2001) - 1000) / 100000.0) * EMULATOR_SEMICIRCLES_PER_DEG);
+            stAsset.slLongitude = (SLONG)((dLongitude + ((SLONG)(NextRandom(pulRandom) % 2001) - 1000) / 100000.0) * EMULATOR_SEMICIRCLES_PER_DEG);
+            stAsset.usDistance = (USHORT)(NextRandom(pulRandom) % 2000);
+            stAsset.ucBearing = (UCHAR)NextRandom(pulRandom);
+            stAsset.ucStatus = (UCHAR)((NextRandom(pulRandom) % 4) << 5);
+            stAsset.ucColor = (UCHAR)(NextRandom(pulRandom) % 16);
+            SNPRINTF(stAsset.acName, sizeof(stAsset.acName), "%s%u", apcNames[(i + j) % (sizeof(apcNames) / sizeof(apcNames[0]))], (unsigned int)(i * DSI_SERIAL_EMULATOR_MAX_ASSETS + j));
+         }
+      }
+
+      pstState->clDevices.push_back(stDevice);
+   }
+
+   #if defined(DEBUG_FILE)
+   {
+      char acMesg[128];
+      SNPRINTF(acMesg, sizeof(acMesg), "Emulator->CreateFleet(): %lu devices, %u collisions.", (unsigned long)pstState->clDevices.size(), (unsigned int)stFleet.usCollisions);
+      DSIDebug::ThreadWrite(acMesg);
+   }
+   #endif
+}
+
+///////////////////////////////////////////////////////////////////////
+// Puts every channel back in the power-up state.
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::ResetChannels(void)
+{
+   memset(pstState->astChannels, 0, sizeof(pstState->astChannels));
+   pstState->bExtMesgsEnabled = FALSE;
+   pstState->bRxScanMode = FALSE;
+   pstState->ucLibConfig = 0;
+   memset(pstState->aaucSduMasks, 0, sizeof(pstState->aaucSduMasks));
+   memset(pstState->aucSduConfig, EMULATOR_SDU_DISABLED, sizeof(pstState->aucSduConfig));
+   for (UCHAR i = 0; i < DSI_SERIAL_EMULATOR_MAX_CHANNELS; i++)
+      pstState->aclSduHistory[i].clear();
+   pstState->ucEventBufferConfig = 0;
+   pstState->usEventBufferSize = 0;
+   pstState->usEventBufferTime = 0;
+   pstState->ullBufferedSinceNs = 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Must be called with stMutexCriticalSection held.
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::HandleCommand(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_)
+{
+   UCHAR ucChannel = (ucLength_ > 0) ? pucData_[0] : 0;
+   EMULATOR_CHANNEL *pstChannel = (ucChannel < stFleet.ucMaxChannels) ? &pstState->astChannels[ucChannel] : (EMULATOR_CHANNEL*)NULL;
+   UCHAR ucCode = RESPONSE_NO_ERROR;
+
+   switch (ucMessageID_)
+   {
+      case MESG_SYSTEM_RESET_ID:
+      {
+         UCHAR ucStartup = RESET_CMD;
+         ResetChannels();
+         QueueMessage(MESG_STARTUP_MESG_ID, &ucStartup, MESG_STARTUP_MESG_SIZE);
+         return;
+      }
+
+      case MESG_REQUEST_ID:
+         if (ucLength_ >= 2)
+            HandleRequest(ucChannel, pucData_[1]);
+         return;
+
+      case MESG_BROADCAST_DATA_ID:
+         if ((ucChannel == 0) && pstState->bRxScanMode)
+            QueueResponse(ucChannel, ucMessageID_, INVALID_SCAN_TX_CHANNEL);
+         return;                                            // A slave's broadcast goes out with the next reply; nothing to report.
+
+      case MESG_ACKNOWLEDGED_DATA_ID:
+      case MESG_BURST_DATA_ID:
+         HandleAcknowledged(ucMessageID_, pucData_, ucLength_);
+         return;
+
+      case MESG_NETWORK_KEY_ID:
+         if (ucChannel >= 8)
+            ucCode = INVALID_MESSAGE;
+         break;
+
+      case MESG_RX_EXT_MESGS_ENABLE_ID:
+         pstState->bExtMesgsEnabled = (ucLength_ >= 2) && (pucData_[1] != 0);
+         break;
+
+      case MESG_ANTLIB_CONFIG_ID:
+         pstState->ucLibConfig = (ucLength_ >= 2) ? pucData_[1] : 0;
+         break;
+
+      case MESG_ASSIGN_CHANNEL_ID:
+         if (pstChannel == NULL || ucLength_ < 3)
+         {
+            ucCode = INVALID_MESSAGE;
+         }
+         else if (pstChannel->ucStatus != STATUS_UNASSIGNED_CHANNEL)
+         {
+            ucCode = CHANNEL_IN_WRONG_STATE;
+         }
+         else
+         {
+            memset(pstChannel, 0, sizeof(EMULATOR_CHANNEL));
+            pstState->aucSduConfig[ucChannel] = EMULATOR_SDU_DISABLED;
+            pstChannel->ucStatus = STATUS_ASSIGNED_CHANNEL;
+            pstChannel->ucChannelType = pucData_[1];
+            pstChannel->ucNetworkNumber = pucData_[2];
+            pstChannel->usMessagePeriod = 8192;             // Power-up defaults.
+            pstChannel->ucRFFrequency = 66;
+            pstChannel->ucSearchTimeout = 10;
+            pstChannel->ucLPSearchTimeout = 2;
+         }
+         break;
+
+      case MESG_UNASSIGN_CHANNEL_ID:
+         if (pstChannel == NULL)
+            ucCode = INVALID_MESSAGE;
+         else if (pstChannel->ucStatus != STATUS_ASSIGNED_CHANNEL)
+            ucCode = CHANNEL_IN_WRONG_STATE;
+         else
+            pstChannel->ucStatus = STATUS_UNASSIGNED_CHANNEL;
+         break;
+
+      case MESG_CHANNEL_ID_ID:
+      case MESG_CHANNEL_MESG_PERIOD_ID:
+      case MESG_CHANNEL_SEARCH_TIMEOUT_ID:
+      case MESG_SET_LP_SEARCH_TIMEOUT_ID:
+      case MESG_CHANNEL_RADIO_FREQ_ID:
+         if (pstChannel == NULL || ucLength_ < 2)
+         {
+            ucCode = INVALID_MESSAGE;
+         }
+         else if (pstChannel->ucStatus == STATUS_UNASSIGNED_CHANNEL)
+         {
+            ucCode = CHANNEL_IN_WRONG_STATE;
+         }
+         else if (ucMessageID_ == MESG_CHANNEL_ID_ID)
+         {
+            if (ucLength_ < MESG_CHANNEL_ID_SIZE)
+            {
+               ucCode = INVALID_MESSAGE;
+               break;
+            }
+            pstChannel->usDeviceNumber = (USHORT)(pucData_[1] | (pucData_[2] << 8));
+            pstChannel->ucDeviceType = pucData_[3];
+            pstChannel->ucTransmitType = pucData_[4];
+         }
+         else if (ucMessageID_ == MESG_CHANNEL_MESG_PERIOD_ID)
+         {
+            pstChannel->usMessagePeriod = (ucLength_ >= 3) ? (USHORT)(pucData_[1] | (pucData_[2] << 8)) : pucData_[1];
+         }
+         else if (ucMessageID_ == MESG_CHANNEL_SEARCH_TIMEOUT_ID)
+         {
+            pstChannel->ucSearchTimeout = pucData_[1];
+         }
+         else if (ucMessageID_ == MESG_SET_LP_SEARCH_TIMEOUT_ID)
+         {
+            pstChannel->ucLPSearchTimeout = pucData_[1];
+         }
+         else
+         {
+            pstChannel->ucRFFrequency = pucData_[1];
+         }
+         break;
+
+      case MESG_OPEN_CHANNEL_ID:
+         if (pstChannel == NULL)
+         {
+            ucCode = INVALID_MESSAGE;
+         }
+         else if ((pstChannel->ucStatus != STATUS_ASSIGNED_CHANNEL) || pstState->bRxScanMode)
+         {
+            ucCode = CHANNEL_IN_WRONG_STATE;
+         }
+         else
+         {
+            pstChannel->ucStatus = STATUS_SEARCHING_CHANNEL;
+            pstChannel->ullSearchDeadlineNs = SearchDeadline(*pstChannel, SerialFrames_GetTimestamp());
+            pstState->aclSduHistory[ucChannel].clear();
+         }
+         break;
+
+      case MESG_PROX_SEARCH_CONFIG_ID:
+         if (pstChannel == NULL || ucLength_ < MESG_PROX_SEARCH_CONFIG_SIZE || pucData_[1] > 10)
+            ucCode = INVALID_MESSAGE;
+         else if (pstChannel->ucStatus == STATUS_UNASSIGNED_CHANNEL)
+            ucCode = CHANNEL_IN_WRONG_STATE;
+         else
+            pstChannel->ucProximityBin = pucData_[1];
+         break;
+
+      case MESG_SDU_SET_MASK_ID:
+         if (!stFleet.bSelectiveDataUpdates || (ucLength_ < 1 + 8) || (ucChannel >= EMULATOR_SDU_MASKS))
+            ucCode = INVALID_MESSAGE;
+         else
+            memcpy(pstState->aaucSduMasks[ucChannel], &pucData_[1], 8);
+         break;
+
+      case MESG_SDU_CONFIG_ID:
+         if (!stFleet.bSelectiveDataUpdates || (pstChannel == NULL) || (ucLength_ < 2) ||
+             ((pucData_[1] != EMULATOR_SDU_DISABLED) && (pucData_[1] >= EMULATOR_SDU_MASKS)))
+         {
+            ucCode = INVALID_MESSAGE;
+         }
+         else
+         {
+            pstState->aucSduConfig[ucChannel] = pucData_[1];
+            pstState->aclSduHistory[ucChannel].clear();
+         }
+         break;
+
+      case MESG_ID_LIST_ADD_ID:
+         if ((pstChannel == NULL) || (ucLength_ < MESG_ID_LIST_ADD_SIZE) || (pucData_[5] >= EMULATOR_ID_LIST_SIZE))
+         {
+            ucCode = INVALID_MESSAGE;
+         }
+         else if (pstChannel->ucStatus != STATUS_ASSIGNED_CHANNEL)
+         {
+            ucCode = CHANNEL_IN_WRONG_STATE;
+         }
+         else
+         {
+            pstChannel->ausListNumber[pucData_[5]] = (USHORT)(pucData_[1] | (pucData_[2] << 8));
+            pstChannel->aucListType[pucData_[5]] = pucData_[3];
+            pstChannel->aucListTransmitType[pucData_[5]] = pucData_[4];
+         }
+         break;
+
+      case MESG_ID_LIST_CONFIG_ID:
+         if ((pstChannel == NULL) || (ucLength_ < MESG_ID_LIST_CONFIG_SIZE) || (pucData_[1] > EMULATOR_ID_LIST_SIZE))
+         {
+            ucCode = INVALID_MESSAGE;
+         }
+         else if (pstChannel->ucStatus != STATUS_ASSIGNED_CHANNEL)
+         {
+            ucCode = CHANNEL_IN_WRONG_STATE;
+         }
+         else
+         {
+            pstChannel->ucListSize = pucData_[1];
+            pstChannel->bListExclude = (pucData_[2] != 0);
+         }
+         break;
+
+      case MESG_EVENT_BUFFERING_CONFIG_ID:
+         if (!stFleet.bEventBuffering || (ucLength_ < MESG_EVENT_BUFFERING_CONFIG_SIZE) || (pucData_[1] > EMULATOR_EVENT_BUFFER_ALL))
+         {
+            ucCode = INVALID_MESSAGE;
+         }
+         else
+         {
+            // Only broadcasts are ever buffered, so both configs behave the same.
+            pstState->ucEventBufferConfig = pucData_[1];
+            pstState->usEventBufferSize = (USHORT)(pucData_[2] | (pucData_[3] << 8));
+            pstState->usEventBufferTime = (USHORT)(pucData_[4] | (pucData_[5] << 8));
+         }
+         break;
+
+      case MESG_OPEN_RX_SCAN_ID:
+         // Scan mode takes over the whole radio, so channel 0 must be the
+         // only channel assigned and nothing may be open.
+         ucChannel = 0;
+         pstChannel = &pstState->astChannels[0];
+         if (pstChannel->ucStatus != STATUS_ASSIGNED_CHANNEL)
+         {
+            ucCode = CHANNEL_IN_WRONG_STATE;
+            break;
+         }
+         for (UCHAR i = 1; i < stFleet.ucMaxChannels; i++)
+         {
+            if (pstState->astChannels[i].ucStatus >= STATUS_SEARCHING_CHANNEL)
+               ucCode = CLOSE_ALL_CHANNELS;
+         }
+         if (ucCode == RESPONSE_NO_ERROR)
+         {
+            pstChannel->ucStatus = STATUS_SEARCHING_CHANNEL;
+            pstChannel->ullSearchDeadlineNs = 0;            // Scanning never times out.
+            pstState->bRxScanMode = TRUE;
+         }
+         break;
+
+      case MESG_CLOSE_CHANNEL_ID:
+         if (pstChannel == NULL)
+         {
+            ucCode = INVALID_MESSAGE;
+         }
+         else if (pstChannel->ucStatus < STATUS_SEARCHING_CHANNEL)
+         {
+            ucCode = CHANNEL_IN_WRONG_STATE;
+         }
+         else
+         {
+            pstChannel->ucStatus = STATUS_ASSIGNED_CHANNEL;
+            if (ucChannel == 0)
+               pstState->bRxScanMode = FALSE;
+            QueueResponse(ucChannel, ucMessageID_, RESPONSE_NO_ERROR);
+            QueueResponse(ucChannel, MESG_EVENT_ID, EVENT_CHANNEL_CLOSED);
+            return;
+         }
+         break;
+
+      default:
+         break;                                             // Anything else is accepted without effect.
+   }
+
+   QueueResponse(ucChannel, ucMessageID_, ucCode);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Must be called with stMutexCriticalSection held.
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::HandleRequest(UCHAR ucChannel_, UCHAR ucRequestedID_)
+{
+   UCHAR aucData[MESG_MAX_SIZE_VALUE];
+   const EMULATOR_CHANNEL *pstChannel = (ucChannel_ < stFleet.ucMaxChannels) ? &pstState->astChannels[ucChannel_] : (const EMULATOR_CHANNEL*)NULL;
+
+   memset(aucData, 0, sizeof(aucData));
+
+   switch (ucRequestedID_)
+   {
+      case MESG_CAPABILITIES_ID:
+         aucData[0] = stFleet.ucMaxChannels;
+         aucData[1] = 8;                                    // Networks
+         aucData[2] = 0x00;                                 // Standard options: everything supported.
+         aucData[3] = 0xBA;                                 // Advanced options, search lists included
+         aucData[4] = 0x36;                                 // Advanced options 2
+         aucData[6] = (stFleet.bSelectiveDataUpdates ? CAPABILITIES_SELECTIVE_DATA_UPDATE_ENABLED : 0)    // Advanced options 3
+                    | (stFleet.bEventBuffering ? CAPABILITIES_EVENT_BUFFERING_ENABLED : 0)
+                    | CAPABILITIES_HIGH_DUTY_SEARCH_MODE_ENABLED;
+         QueueMessage(MESG_CAPABILITIES_ID, aucData, MESG_CAPABILITIES_SIZE);
+         return;
+
+      case MESG_GET_SERIAL_NUM_ID:
+         aucData[0] = (UCHAR)(stFleet.ulSerialNumber);
+         aucData[1] = (UCHAR)(stFleet.ulSerialNumber >> 8);
+         aucData[2] = (UCHAR)(stFleet.ulSerialNumber >> 16);
+         aucData[3] = (UCHAR)(stFleet.ulSerialNumber >> 24);
+         QueueMessage(MESG_GET_SERIAL_NUM_ID, aucData, MESG_GET_SERIAL_NUM_SIZE);
+         return;
+
+      case MESG_VERSION_ID:
+         memcpy(aucData, "EMU1.00B00", 11);
+         QueueMessage(MESG_VERSION_ID, aucData, 11);
+         return;
+
+      case MESG_CHANNEL_STATUS_ID:
+         if (pstChannel == NULL)
+            break;
+         aucData[0] = ucChannel_;
+         aucData[1] = (UCHAR)((pstChannel->ucChannelType & 0xF0) | ((pstChannel->ucNetworkNumber & 0x03) << 2) | pstChannel->ucStatus);
+         QueueMessage(MESG_CHANNEL_STATUS_ID, aucData, MESG_CHANNEL_STATUS_SIZE);
+         return;
+
+      case MESG_CHANNEL_ID_ID:
+      {
+         BOOL bTracking;
+
+         if (pstChannel == NULL)
+            break;
+         bTracking = (pstChannel->ucStatus == STATUS_TRACKING_CHANNEL);
+         aucData[0] = ucChannel_;
+         aucData[1] = (UCHAR)(bTracking ? pstChannel->usTrackedNumber : pstChannel->usDeviceNumber);
+         aucData[2] = (UCHAR)((bTracking ? pstChannel->usTrackedNumber : pstChannel->usDeviceNumber) >> 8);
+         aucData[3] = bTracking ? pstChannel->ucTrackedType : pstChannel->ucDeviceType;
+         aucData[4] = bTracking ? pstChannel->ucTrackedTransmitType : pstChannel->ucTransmitType;
+         QueueMessage(MESG_CHANNEL_ID_ID, aucData, MESG_CHANNEL_ID_SIZE);
+         return;
+      }
+
+      default:
+         break;
+   }
+
+   QueueResponse(ucChannel_, MESG_REQUEST_ID, INVALID_MESSAGE);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Delivers acknowledged data to the tracked device(s) and reports the
+// outcome.  Page 70 requests queue the requested pages on every device
+// sharing the channel ID.  Must be called with stMutexCriticalSection
+// held.
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::HandleAcknowledged(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_)
+{
+   UCHAR ucChannel = (ucLength_ > 0) ? (pucData_[0] & CHANNEL_NUMBER_MASK) : 0;
+   const EMULATOR_CHANNEL *pstChannel;
+   const UCHAR *pucPayload = &pucData_[1];
+
+   if ((ucLength_ < 1 + 8) || (ucChannel >= stFleet.ucMaxChannels))
+   {
+      QueueResponse(ucChannel, ucMessageID_, INVALID_MESSAGE);
+      return;
+   }
+
+   if ((ucMessageID_ == MESG_BURST_DATA_ID) && !(pucData_[0] & SEQUENCE_LAST_MESSAGE))
+      return;                                               // The result comes with the last packet.
+
+   pstChannel = &pstState->astChannels[ucChannel];
+   if ((ucChannel == 0) && pstState->bRxScanMode)
+   {
+      QueueResponse(ucChannel, ucMessageID_, INVALID_SCAN_TX_CHANNEL);
+      return;
+   }
+
+   if (pstChannel->ucStatus < STATUS_SEARCHING_CHANNEL)
+   {
+      QueueResponse(ucChannel, ucMessageID_, CHANNEL_NOT_OPENED);
+      return;
+   }
+
+   if (pstChannel->ucStatus != STATUS_TRACKING_CHANNEL)
+   {
+      QueueResponse(ucChannel, MESG_EVENT_ID, EVENT_TRANSFER_TX_FAILED);
+      return;
+   }
+
+   if ((ucMessageID_ == MESG_ACKNOWLEDGED_DATA_ID) && (pucPayload[0] == EMULATOR_PAGE_REQUEST))
+   {
+      UCHAR ucTimes = pucPayload[5] & 0x7F;
+      UCHAR ucPage = pucPayload[6];
+      BOOL bPageSet = (pucPayload[7] == EMULATOR_REQUEST_PAGE_SET);
+
+      if (ucTimes == 0 || ucTimes > EMULATOR_MAX_REQUESTED_TX)
+         ucTimes = (ucTimes == 0) ? 1 : EMULATOR_MAX_REQUESTED_TX;
+
+      for (ULONG i = 0; i < pstState->clDevices.size(); i++)
+      {
+         EMULATOR_DEVICE &stDevice = pstState->clDevices[i];
+
+         if ((stDevice.usDeviceNumber != pstChannel->usTrackedNumber) || (stDevice.ucDeviceType != pstChannel->ucTrackedType) || (stDevice.ucTransmitType != pstChannel->ucTrackedTransmitType))
+            continue;
+
+         for (UCHAR t = 0; t < ucTimes; t++)
+         {
+            if ((ucPage >= EMULATOR_PAGE_MANUFACTURER) && (ucPage <= EMULATOR_PAGE_BATTERY))
+            {
+               stDevice.clRequested.push_back((USHORT)((ucPage << 8) | EMULATOR_NO_ASSET));
+               continue;
+            }
+
+            if (stDevice.ucDeviceType != EMULATOR_TRACKER_DEVICE_TYPE)
+               continue;
+
+            for (UCHAR a = 0; a < stDevice.clAssets.size(); a++)
+            {
+               stDevice.clRequested.push_back((USHORT)((ucPage << 8) | a));
+               if (bPageSet && (ucPage == EMULATOR_PAGE_IDENTIFICATION_1))
+                  stDevice.clRequested.push_back((USHORT)((EMULATOR_PAGE_IDENTIFICATION_2 << 8) | a));
+               else if (bPageSet && (ucPage == EMULATOR_PAGE_LOCATION_1))
+                  stDevice.clRequested.push_back((USHORT)((EMULATOR_PAGE_LOCATION_2 << 8) | a));
+            }
+         }
+      }
+   }
+
+   QueueResponse(ucChannel, MESG_EVENT_ID, EVENT_TRANSFER_TX_COMPLETED);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Queues a channel response or channel event.
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::QueueResponse(UCHAR ucChannel_, UCHAR ucMessageID_, UCHAR ucCode_)
+{
+   UCHAR aucResponse[MESG_RESPONSE_EVENT_SIZE];
+
+   aucResponse[0] = ucChannel_;
+   aucResponse[1] = ucMessageID_;
+   aucResponse[2] = ucCode_;
+   QueueMessage(MESG_RESPONSE_EVENT_ID, aucResponse, MESG_RESPONSE_EVENT_SIZE);
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::QueueMessage(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_)
+{
+   SerialFrames_Append(pstState->clPendingBytes, ucMessageID_, pucData_, ucLength_);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Sends one broadcast from a device and frames it for every open
+// channel that hears it.  A searching channel locks on to the first
+// matching device in range, and drops back to search once it has
+// missed enough broadcasts from the device it tracks.  Returns when
+// the device transmits next.  Must be called with
+// stMutexCriticalSection held.
+///////////////////////////////////////////////////////////////////////
+ULLONG DSISerialEmulator::Transmit(ULONG ulDevice_, ULLONG ullNow_)
+{
+   EMULATOR_DEVICE &stDevice = pstState->clDevices[ulDevice_];
+   UCHAR aucPayload[8];
+   UCHAR aucMessage[MESG_MAX_SIZE_VALUE];
+   UCHAR ucFlags;
+   UCHAR ucLength;
+   BOOL bInRange = IsInRange(stFleet, stDevice, ullNow_);
+
+   if (stDevice.ucDeviceType == EMULATOR_TRACKER_DEVICE_TYPE)
+      BuildTrackerPage(stDevice, aucPayload, &pstState->ulRandom);
+   else
+      BuildHeartRatePage(stDevice, aucPayload, &pstState->ulRandom);
+   stDevice.ulMessages++;
+
+   ucFlags = pstState->ucLibConfig & EMULATOR_EXT_MESG_FLAGS;
+   if ((ucFlags == 0) && pstState->bExtMesgsEnabled)
+      ucFlags = stFleet.ucExtFlags & EMULATOR_EXT_MESG_FLAGS;
+
+   for (UCHAR i = 0; i < stFleet.ucMaxChannels; i++)
+   {
+      EMULATOR_CHANNEL &stChannel = pstState->astChannels[i];
+
+      if ((stChannel.ucStatus < STATUS_SEARCHING_CHANNEL) || (stChannel.ucChannelType & PARAMETER_TX_NOT_RX) || (stChannel.ucRFFrequency != stDevice.ucRFFrequency))
+         continue;
+
+      if ((i == 0) && pstState->bRxScanMode)
+      {
+         // A scanning channel hears every matching device and never locks.
+         if (!bInRange || !MatchesChannelID(stChannel, stDevice))
+            continue;
+      }
+      else if (stChannel.ucStatus == STATUS_TRACKING_CHANNEL)
+      {
+         if ((stChannel.usTrackedNumber != stDevice.usDeviceNumber) || (stChannel.ucTrackedType != stDevice.ucDeviceType) || (stChannel.ucTrackedTransmitType != stDevice.ucTransmitType))
+            continue;
+
+         if (!bInRange)
+         {
+            if (ullNow_ - stChannel.ullLastRxNs >= EMULATOR_RX_FAILS_TO_SEARCH * stDevice.ullPeriodNs)
+            {
+               stChannel.ucStatus = STATUS_SEARCHING_CHANNEL;
+               stChannel.ullSearchDeadlineNs = SearchDeadline(stChannel, ullNow_);
+               QueueResponse(i, MESG_EVENT_ID, EVENT_RX_FAIL_GO_TO_SEARCH);
+            }
+            continue;
+         }
+      }
+      else
+      {
+         if (!bInRange || !MatchesChannelID(stChannel, stDevice))
+            continue;
+         if ((stChannel.ucProximityBin != 0) && (stDevice.scRssi < EMULATOR_PROXIMITY_BASE_DBM - EMULATOR_PROXIMITY_BIN_DBM * (stChannel.ucProximityBin - 1)))
+            continue;
+
+         stChannel.ucStatus = STATUS_TRACKING_CHANNEL;
+         stChannel.usTrackedNumber = stDevice.usDeviceNumber;
+         stChannel.ucTrackedType = stDevice.ucDeviceType;
+         stChannel.ucTrackedTransmitType = stDevice.ucTransmitType;
+         stChannel.ullSearchDeadlineNs = 0;
+         stChannel.ucProximityBin = 0;                      // The threshold only applies to the first acquisition.
+      }
+      stChannel.ullLastRxNs = ullNow_;
+
+      if (pstState->aucSduConfig[i] != EMULATOR_SDU_DISABLED)
+      {
+         // Forward the page only if a masked bit differs from the last
+         // copy of the same page forwarded on this channel.
+         const UCHAR *pucMask = pstState->aaucSduMasks[pstState->aucSduConfig[i]];
+         std::vector<UCHAR> &clHistory = pstState->aclSduHistory[i];
+         UCHAR *pucLast;
+         BOOL bChanged;
+
+         if (clHistory.empty())
+            clHistory.resize(EMULATOR_SDU_HISTORY_SIZE, 0);
+
+         pucLast = &clHistory[(aucPayload[0] & pucMask[0]) * 9];
+         bChanged = (pucLast[0] == 0);
+         for (UCHAR j = 0; j < 8; j++)
+         {
+            if ((pucLast[1 + j] & pucMask[j]) != (aucPayload[j] & pucMask[j]))
+               bChanged = TRUE;
+         }
+
+         if (!bChanged)
+            continue;
+
+         pucLast[0] = 1;
+         memcpy(&pucLast[1], aucPayload, sizeof(aucPayload));
+      }
+
+      aucMessage[0] = i;
+      memcpy(&aucMessage[1], aucPayload, sizeof(aucPayload));
+      ucLength = 1 + sizeof(aucPayload);
+
+      if (ucFlags)
+      {
+         aucMessage[ucLength++] = ucFlags;
+
+         if (ucFlags & ANT_LIB_CONFIG_MESG_OUT_INC_DEVICE_ID)
+         {
+            aucMessage[ucLength++] = (UCHAR)stDevice.usDeviceNumber;
+            aucMessage[ucLength++] = (UCHAR)(stDevice.usDeviceNumber >> 8);
+            aucMessage[ucLength++] = stDevice.ucDeviceType;
+            aucMessage[ucLength++] = stDevice.ucTransmitType;
+         }
+
+         if (ucFlags & ANT_LIB_CONFIG_MESG_OUT_INC_RSSI)
+         {
+            SLONG slRssi = stDevice.scRssi + (SLONG)(NextRandom(&pstState->ulRandom) % (2 * EMULATOR_RSSI_JITTER + 1)) - (SLONG)EMULATOR_RSSI_JITTER;
+
+            aucMessage[ucLength++] = 0x20;                  // Measurement type: dBm
+            aucMessage[ucLength++] = (UCHAR)(SCHAR)slRssi;
+            aucMessage[ucLength++] = (UCHAR)EMULATOR_RSSI_THRESHOLD;
+         }
+
+         if (ucFlags & ANT_LIB_CONFIG_MESG_OUT_INC_TIME_STAMP)
+         {
+            USHORT usTicks = (USHORT)((ullNow_ / 1000) * 32768 / 1000000);   // 32768 Hz rollover counter
+
+            aucMessage[ucLength++] = (UCHAR)usTicks;
+            aucMessage[ucLength++] = (UCHAR)(usTicks >> 8);
+         }
+      }
+
+      SerialFrames_Append(pstState->clBroadcasts, MESG_BROADCAST_DATA_ID, aucMessage, ucLength);
+      ulGeneratedMessages++;
+   }
+
+   return ullNow_ + stDevice.ullPeriodNs;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Closes searching channels whose search has timed out.  Returns the
+// earliest deadline still pending, or 0.  Must be called with
+// stMutexCriticalSection held.
+///////////////////////////////////////////////////////////////////////
+ULLONG DSISerialEmulator::CheckSearchTimeouts(ULLONG ullNow_)
+{
+   ULLONG ullNextDeadline = 0;
+
+   for (UCHAR i = 0; i < stFleet.ucMaxChannels; i++)
+   {
+      EMULATOR_CHANNEL &stChannel = pstState->astChannels[i];
+
+      if ((stChannel.ucStatus != STATUS_SEARCHING_CHANNEL) || (stChannel.ullSearchDeadlineNs == 0))
+         continue;
+
+      if (stChannel.ullSearchDeadlineNs <= ullNow_)
+      {
+         stChannel.ucStatus = STATUS_ASSIGNED_CHANNEL;
+         stChannel.ullSearchDeadlineNs = 0;
+         QueueResponse(i, MESG_EVENT_ID, EVENT_RX_SEARCH_TIMEOUT);
+         QueueResponse(i, MESG_EVENT_ID, EVENT_CHANNEL_CLOSED);
+      }
+      else if ((ullNextDeadline == 0) || (stChannel.ullSearchDeadlineNs < ullNextDeadline))
+      {
+         ullNextDeadline = stChannel.ullSearchDeadlineNs;
+      }
+   }
+
+   return ullNextDeadline;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Decides whether the framed broadcasts stay in the event buffer.
+// Returns FALSE once they should be delivered, TRUE to keep holding
+// them, with *pullFlushNs_ set to when the time threshold runs out,
+// or 0 if only the size threshold applies.  Must be called with
+// stMutexCriticalSection held.
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialEmulator::HoldBroadcasts(ULLONG ullNow_, ULLONG *pullFlushNs_)
+{
+   ULONG ulSize = pstState->usEventBufferSize;
+
+   *pullFlushNs_ = 0;
+   if (pstState->clBroadcasts.empty() || ((pstState->usEventBufferSize == 0) && (pstState->usEventBufferTime == 0)))
+      return FALSE;
+
+   if (pstState->ullBufferedSinceNs == 0)
+      pstState->ullBufferedSinceNs = ullNow_;
+
+   // Broadcasts stop being generated at this size anyway.
+   if ((ulSize == 0) || (ulSize > DSI_SERIAL_EMULATOR_CHUNK_SIZE - MESG_MAX_SIZE_VALUE))
+      ulSize = DSI_SERIAL_EMULATOR_CHUNK_SIZE - MESG_MAX_SIZE_VALUE;
+
+   if (pstState->clBroadcasts.size() < ulSize)
+   {
+      if (pstState->usEventBufferTime == 0)
+         return TRUE;
+
+      *pullFlushNs_ = pstState->ullBufferedSinceNs + pstState->usEventBufferTime * EMULATOR_EVENT_BUFFER_TIME_NS;
+      if (*pullFlushNs_ > ullNow_)
+         return TRUE;
+      *pullFlushNs_ = 0;
+   }
+
+   pstState->ullBufferedSinceNs = 0;
+   return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// The unplug and replug times are only set by Open(), so this needs no
+// lock.
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialEmulator::IsUnplugged(ULLONG ullNow_)
+{
+   return (pstState->ullUnplugNs != 0) && (ullNow_ >= pstState->ullUnplugNs) &&
+          ((pstState->ullReplugNs == 0) || (ullNow_ < pstState->ullReplugNs));
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSISerialEmulator::EmulatorThread(void)
+{
+   std::vector<UCHAR> clBytes;
+   UCHAR ucPlugEvent = DSI_SERIAL_ENONE;                    // Last of DSI_SERIAL_DEVICE_GONE or _ARRIVED reported.
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   while (!bStopEmulatorThread)
+   {
+      ULLONG ullNow = SerialFrames_GetTimestamp();
+      ULLONG ullWake;
+      ULLONG ullFlush = 0;
+
+      if ((pstState->ullUnplugNs != 0) && (ullNow >= pstState->ullUnplugNs))
+      {
+         // Pulled out: nothing more is sent until the next Open().
+         UCHAR ucEvent = IsUnplugged(ullNow) ? DSI_SERIAL_DEVICE_GONE : DSI_SERIAL_DEVICE_ARRIVED;
+
+         if (ucEvent != ucPlugEvent)
+         {
+            ucPlugEvent = ucEvent;
+            pstState->clPendingBytes.clear();
+            pstState->clBroadcasts.clear();
+
+            DSIThread_MutexUnlock(&stMutexCriticalSection);
+            pclCallback->Error(ucEvent);
+            DSIThread_MutexLock(&stMutexCriticalSection);
+            continue;
+         }
+
+         if ((ucEvent == DSI_SERIAL_DEVICE_GONE) && (pstState->ullReplugNs != 0))
+            DSIThread_CondTimedWait(&stCondEmulator, &stMutexCriticalSection, (ULONG)((pstState->ullReplugNs - ullNow + 999999) / 1000000));
+         else
+            DSIThread_CondTimedWait(&stCondEmulator, &stMutexCriticalSection, DSI_THREAD_INFINITE);
+         continue;
+      }
+
+      ullWake = CheckSearchTimeouts(ullNow);
+
+      // Responses and events go first so a command's response is never
+      // stuck behind a chunk of broadcasts.
+      if (pstState->clPendingBytes.empty())
+      {
+         while (!pstState->clSchedule.empty() && (pstState->clSchedule.top().first <= ullNow) && (pstState->clBroadcasts.size() < DSI_SERIAL_EMULATOR_CHUNK_SIZE - MESG_MAX_SIZE_VALUE))
+         {
+            EMULATOR_EVENT stEvent = pstState->clSchedule.top();
+            ULLONG ullNext;
+
+            pstState->clSchedule.pop();
+            ullNext = Transmit(stEvent.second, stEvent.first);
+            if (ullNext + EMULATOR_STALL_NS < ullNow)
+               ullNext = ullNow;                            // We were held up; skip ahead rather than burst.
+            pstState->clSchedule.push(EMULATOR_EVENT(ullNext, stEvent.second));
+         }
+         if (!HoldBroadcasts(ullNow, &ullFlush))
+            clBytes.swap(pstState->clBroadcasts);
+      }
+      else
+      {
+         // Anything the stick sends flushes the event buffer with it.
+         clBytes.swap(pstState->clPendingBytes);
+         clBytes.insert(clBytes.end(), pstState->clBroadcasts.begin(), pstState->clBroadcasts.end());
+         pstState->clBroadcasts.clear();
+         pstState->ullBufferedSinceNs = 0;
+      }
+
+      if (!clBytes.empty())
+      {
+         DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+         for (ULONG i = 0; i < clBytes.size(); i += DSI_SERIAL_EMULATOR_CHUNK_SIZE)
+            pclCallback->ProcessBytes(&clBytes[i], ((ULONG)clBytes.size() - i < DSI_SERIAL_EMULATOR_CHUNK_SIZE) ? (ULONG)clBytes.size() - i : DSI_SERIAL_EMULATOR_CHUNK_SIZE);
+         clBytes.clear();
+
+         DSIThread_MutexLock(&stMutexCriticalSection);
+         continue;
+      }
+
+      if (!pstState->clSchedule.empty() && ((ullWake == 0) || (pstState->clSchedule.top().first < ullWake)))
+         ullWake = pstState->clSchedule.top().first;
+      if ((ullFlush != 0) && ((ullWake == 0) || (ullFlush < ullWake)))
+         ullWake = ullFlush;
+      if ((pstState->ullUnplugNs != 0) && ((ullWake == 0) || (pstState->ullUnplugNs < ullWake)))
+         ullWake = pstState->ullUnplugNs;
+
+      if (ullWake == 0)
+         DSIThread_CondTimedWait(&stCondEmulator, &stMutexCriticalSection, DSI_THREAD_INFINITE);
+      else if (ullWake > ullNow)
+         DSIThread_CondTimedWait(&stCondEmulator, &stMutexCriticalSection, (ULONG)((ullWake - ullNow + 999999) / 1000000));
+   }
+
+   bStopEmulatorThread = TRUE;
+   DSIThread_CondSignal(&stEventEmulatorThreadExit);       // Set an event to alert the main process that the emulator thread is finished and can be closed.
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+}
+
+///////////////////////////////////////////////////////////////////////
+DSI_THREAD_RETURN DSISerialEmulator::ProcessThread(void *pvParameter_)
+{
+   DSISerialEmulator *This = (DSISerialEmulator*)pvParameter_;
+   This->EmulatorThread();
+   return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Private Functions
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+// xorshift32; the fleet only needs to look random and be repeatable.
+///////////////////////////////////////////////////////////////////////
+static ULONG NextRandom(ULONG *pulState_)
+{
+   ULONG ulX = *pulState_;
+
+   ulX ^= ulX << 13;
+   ulX ^= ulX >> 17;
+   ulX ^= ulX << 5;
+   *pulState_ = ulX;
+   return ulX;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Zero fields in the channel ID are wildcards; the pairing bit of the
+// device type is ignored.
+///////////////////////////////////////////////////////////////////////
+static BOOL MatchesChannelID(const EMULATOR_CHANNEL &stChannel_, const EMULATOR_DEVICE &stDevice_)
+{
+   BOOL bListed = FALSE;
+
+   if ((stChannel_.usDeviceNumber != 0) && (stChannel_.usDeviceNumber != stDevice_.usDeviceNumber))
+      return FALSE;
+   if (((stChannel_.ucDeviceType & 0x7F) != 0) && ((stChannel_.ucDeviceType & 0x7F) != stDevice_.ucDeviceType))
+      return FALSE;
+   if ((stChannel_.ucTransmitType != 0) && (stChannel_.ucTransmitType != stDevice_.ucTransmitType))
+      return FALSE;
+   if (stChannel_.ucListSize == 0)
+      return TRUE;
+
+   for (UCHAR i = 0; (i < stChannel_.ucListSize) && !bListed; i++)
+   {
+      bListed = ((stChannel_.ausListNumber[i] == 0) || (stChannel_.ausListNumber[i] == stDevice_.usDeviceNumber)) &&
+                (((stChannel_.aucListType[i] & 0x7F) == 0) || ((stChannel_.aucListType[i] & 0x7F) == stDevice_.ucDeviceType)) &&
+                ((stChannel_.aucListTransmitType[i] == 0) || (stChannel_.aucListTransmitType[i] == stDevice_.ucTransmitType));
+   }
+   return stChannel_.bListExclude ? !bListed : bListed;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Whether a device is within reach of the stick.  With dropouts
+// configured, every device is out of range for a while once per
+// interval, at an offset derived from its device number.
+///////////////////////////////////////////////////////////////////////
+static BOOL IsInRange(const DSI_SERIAL_EMULATOR_FLEET &stFleet_, const EMULATOR_DEVICE &stDevice_, ULLONG ullNow_)
+{
+   ULLONG ullIntervalNs = (ULLONG)stFleet_.ulDropoutIntervalMs * 1000000;
+   ULLONG ullOffsetNs;
+
+   if ((stFleet_.ulDropoutMs == 0) || (ullIntervalNs == 0))
+      return TRUE;
+
+   ullOffsetNs = ((ULLONG)stDevice_.usDeviceNumber * 40503 * 1000000) % ullIntervalNs;
+   return ((ullNow_ + ullOffsetNs) % ullIntervalNs) >= (ULLONG)stFleet_.ulDropoutMs * 1000000;
+}
+
+///////////////////////////////////////////////////////////////////////
+// High priority search first, then low priority; a search timeout of
+// 0xFF on either never ends.  Returns 0 if the search never times out.
+///////////////////////////////////////////////////////////////////////
+static ULLONG SearchDeadline(const EMULATOR_CHANNEL &stChannel_, ULLONG ullNow_)
+{
+   if ((stChannel_.ucSearchTimeout == 0xFF) || (stChannel_.ucLPSearchTimeout == 0xFF))
+      return 0;
+
+   return ullNow_ + 1 + ((ULLONG)stChannel_.ucSearchTimeout + stChannel_.ucLPSearchTimeout) * EMULATOR_SEARCH_TIMEOUT_NS;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Requested pages go first.  Otherwise the tracker cycles location
+// pages 1 and 2 through its assets, adds identification pages 1 and 2
+// every EMULATOR_IDENT_INTERVAL cycles, and common pages 80 and 81
+// every EMULATOR_COMMON_INTERVAL messages.  Assets move a little after
+// each location page 2.
+///////////////////////////////////////////////////////////////////////
+static void BuildTrackerPage(EMULATOR_DEVICE &stDevice_, UCHAR *pucPayload_, ULONG *pulRandom_)
+{
+   UCHAR ucAssets = (UCHAR)stDevice_.clAssets.size();
+   UCHAR ucPage;
+   UCHAR ucAsset = EMULATOR_NO_ASSET;
+
+   memset(pucPayload_, 0xFF, 8);
+
+   if (!stDevice_.clRequested.empty())
+   {
+      ucPage = (UCHAR)(stDevice_.clRequested.front() >> 8);
+      ucAsset = (UCHAR)stDevice_.clRequested.front();
+      stDevice_.clRequested.pop_front();
+   }
+   else if ((stDevice_.ulMessages % EMULATOR_COMMON_INTERVAL) >= EMULATOR_COMMON_INTERVAL - 2)
+   {
+      ucPage = ((stDevice_.ulMessages % EMULATOR_COMMON_INTERVAL) == EMULATOR_COMMON_INTERVAL - 2) ? EMULATOR_PAGE_MANUFACTURER : EMULATOR_PAGE_PRODUCT;
+   }
+   else if (ucAssets == 0)
+   {
+      ucPage = EMULATOR_PAGE_NO_ASSETS;
+   }
+   else
+   {
+      USHORT usLocationSlots = (USHORT)(2 * ucAssets);
+      USHORT usSlots = (USHORT)(usLocationSlots + (((stDevice_.usCycle % EMULATOR_IDENT_INTERVAL) == 0) ? 2 * ucAssets : 0));
+
+      if (stDevice_.usSlot < usLocationSlots)
+      {
+         ucAsset = (UCHAR)(stDevice_.usSlot / 2);
+         ucPage = (stDevice_.usSlot & 1) ? EMULATOR_PAGE_LOCATION_2 : EMULATOR_PAGE_LOCATION_1;
+      }
+      else
+      {
+         ucAsset = (UCHAR)((stDevice_.usSlot - usLocationSlots) / 2);
+         ucPage = (stDevice_.usSlot & 1) ? EMULATOR_PAGE_IDENTIFICATION_2 : EMULATOR_PAGE_IDENTIFICATION_1;
+      }
+
+      if (++stDevice_.usSlot >= usSlots)
+      {
+         stDevice_.usSlot = 0;
+         stDevice_.usCycle++;
+      }
+   }
+
+   if ((ucPage >= EMULATOR_PAGE_MANUFACTURER) || (ucPage == EMULATOR_PAGE_NO_ASSETS) || (ucAsset >= ucAssets))
+   {
+      if (ucPage == EMULATOR_PAGE_NO_ASSETS || ucPage < EMULATOR_PAGE_MANUFACTURER)
+      {
+         pucPayload_[0] = EMULATOR_PAGE_NO_ASSETS;
+         return;
+      }
+      BuildCommonPage(stDevice_, ucPage, pucPayload_);
+      return;
+   }
+
+   EMULATOR_ASSET &stAsset = stDevice_.clAssets[ucAsset];
+   pucPayload_[0] = ucPage;
+   pucPayload_[1] = ucAsset;
+
+   switch (ucPage)
+   {
+      case EMULATOR_PAGE_LOCATION_1:
+         pucPayload_[2] = (UCHAR)stAsset.usDistance;
+         pucPayload_[3] = (UCHAR)(stAsset.usDistance >> 8);
+         pucPayload_[4] = stAsset.ucBearing;
+         pucPayload_[5] = stAsset.ucStatus;
+         pucPayload_[6] = (UCHAR)stAsset.slLatitude;
+         pucPayload_[7] = (UCHAR)(stAsset.slLatitude >> 8);
+         break;
+
+      case EMULATOR_PAGE_LOCATION_2:
+         pucPayload_[2] = (UCHAR)(stAsset.slLatitude >> 16);
+         pucPayload_[3] = (UCHAR)(stAsset.slLatitude >> 24);
+         pucPayload_[4] = (UCHAR)stAsset.slLongitude;
+         pucPayload_[5] = (UCHAR)(stAsset.slLongitude >> 8);
+         pucPayload_[6] = (UCHAR)(stAsset.slLongitude >> 16);
+         pucPayload_[7] = (UCHAR)(stAsset.slLongitude >> 24);
+
+         // Moving assets cover roughly five metres per update; the rest
+         // stay put and repeat the same pages.  Now and then the
+         // situation changes.
+         if ((stAsset.ucStatus >> 5) == EMULATOR_SITUATION_MOVING)
+         {
+            stAsset.slLatitude += (SLONG)(NextRandom(pulRandom_) % 1001) - 500;
+            stAsset.slLongitude += (SLONG)(NextRandom(pulRandom_) % 1001) - 500;
+            stAsset.usDistance = (USHORT)((stAsset.usDistance + NextRandom(pulRandom_) % 11 + 2000 - 5) % 2000);
+            stAsset.ucBearing = (UCHAR)(stAsset.ucBearing + (NextRandom(pulRandom_) % 9) - 4);
+         }
+         if ((NextRandom(pulRandom_) % 64) == 0)
+            stAsset.ucStatus = (UCHAR)((stAsset.ucStatus & 0x1F) | ((NextRandom(pulRandom_) % 4) << 5));
+         break;
+
+      case EMULATOR_PAGE_IDENTIFICATION_1:
+         pucPayload_[2] = stAsset.ucColor;
+         memcpy(&pucPayload_[3], &stAsset.acName[0], 5);
+         break;
+
+      default:                                              // EMULATOR_PAGE_IDENTIFICATION_2
+         pucPayload_[2] = 0x01;                             // Asset type: dog collar
+         memcpy(&pucPayload_[3], &stAsset.acName[5], 5);
+         break;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////
+// Heart rate page 4, with the page toggle bit flipping every four
+// messages and a heart rate that wanders between 60 and 190 bpm.
+///////////////////////////////////////////////////////////////////////
+static void BuildHeartRatePage(EMULATOR_DEVICE &stDevice_, UCHAR *pucPayload_, ULONG *pulRandom_)
+{
+   stDevice_.ullTime1024 += EMULATOR_HRM_PERIOD / 32;      // Period in 1/1024 s.
+   while (stDevice_.ullNextBeat1024 <= stDevice_.ullTime1024)
+   {
+      stDevice_.usPreviousBeat1024 = stDevice_.usLastBeat1024;
+      stDevice_.usLastBeat1024 = (USHORT)stDevice_.ullNextBeat1024;
+      stDevice_.ucBeatCount++;
+      stDevice_.ullNextBeat1024 += 60 * 1024 / stDevice_.ucHeartRate;
+   }
+
+   if ((stDevice_.ulMessages % 16) == 0)
+   {
+      SLONG slRate = (SLONG)stDevice_.ucHeartRate + (SLONG)(NextRandom(pulRandom_) % 7) - 3;
+      stDevice_.ucHeartRate = (UCHAR)((slRate < 60) ? 60 : ((slRate > 190) ? 190 : slRate));
+   }
+
+   if ((stDevice_.ulMessages % EMULATOR_COMMON_INTERVAL) == EMULATOR_COMMON_INTERVAL - 1)
+   {
+      BuildCommonPage(stDevice_, EMULATOR_PAGE_BATTERY, pucPayload_);
+      return;
+   }
+
+   pucPayload_[0] = (UCHAR)(EMULATOR_PAGE_HRM | ((stDevice_.ulMessages & 0x04) ? 0x80 : 0x00));
+   pucPayload_[1] = 0xFF;
+   pucPayload_[2] = (UCHAR)stDevice_.usPreviousBeat1024;
+   pucPayload_[3] = (UCHAR)(stDevice_.usPreviousBeat1024 >> 8);
+   pucPayload_[4] = (UCHAR)stDevice_.usLastBeat1024;
+   pucPayload_[5] = (UCHAR)(stDevice_.usLastBeat1024 >> 8);
+   pucPayload_[6] = stDevice_.ucBeatCount;
+   pucPayload_[7] = stDevice_.ucHeartRate;
+}
+
+///////////////////////////////////////////////////////////////////////
+static void BuildCommonPage(const EMULATOR_DEVICE &stDevice_, UCHAR ucPage_, UCHAR *pucPayload_)
+{
+   ULONG ulSerial = 0x00EE0000 | stDevice_.usDeviceNumber;
+   ULONG ulUptime = (ULONG)(stDevice_.ulMessages * stDevice_.ullPeriodNs / 2000000000ULL);   // 2 s units
+
+   memset(pucPayload_, 0xFF, 8);
+   pucPayload_[0] = ucPage_;
+
+   switch (ucPage_)
+   {
+      case EMULATOR_PAGE_MANUFACTURER:
+         pucPayload_[3] = 1;                                // Hardware revision
+         pucPayload_[4] = 0xFF;                             // Manufacturer: development
+         pucPayload_[5] = 0x00;
+         pucPayload_[6] = stDevice_.ucDeviceType;           // Model number
+         pucPayload_[7] = 0x00;
+         break;
+
+      case EMULATOR_PAGE_PRODUCT:
+         pucPayload_[3] = 10;                               // Software revision
+         pucPayload_[4] = (UCHAR)ulSerial;
+         pucPayload_[5] = (UCHAR)(ulSerial >> 8);
+         pucPayload_[6] = (UCHAR)(ulSerial >> 16);
+         pucPayload_[7] = (UCHAR)(ulSerial >> 24);
+         break;
+
+      default:                                              // EMULATOR_PAGE_BATTERY
+         pucPayload_[3] = (UCHAR)ulUptime;
+         pucPayload_[4] = (UCHAR)(ulUptime >> 8);
+         pucPayload_[5] = (UCHAR)(ulUptime >> 16);
+         pucPayload_[6] = 0x00;                             // Fractional voltage
+         pucPayload_[7] = 0x23;                             // Good, 3 V
+         break;
+   }
+}
@@ -0,0 +1,38 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+*/
+
+#include "types.h"
+#include "antmessage.h"
+#include "checksum.h"
+#include "dsi_serial_frames.hpp"
+
+#include <string.h>
+#include <chrono>
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Functions
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+void SerialFrames_Append(std::vector<UCHAR> &clBytes_, UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_)
+{
+   ULONG ulStart = (ULONG)clBytes_.size();
+
+   clBytes_.resize(ulStart + ucLength_ + MESG_FRAME_SIZE);
+   clBytes_[ulStart] = MESG_TX_SYNC;
+   clBytes_[ulStart + MESG_SIZE_OFFSET] = ucLength_;
+   clBytes_[ulStart + MESG_ID_OFFSET] = ucMessageID_;
+   if (ucLength_ > 0)
+      memcpy(&clBytes_[ulStart + MESG_DATA_OFFSET], pucData_, ucLength_);
+   clBytes_[ulStart + MESG_HEADER_SIZE + ucLength_] = CheckSum_Calc8(&clBytes_[ulStart], MESG_HEADER_SIZE + ucLength_);
+}
+
+///////////////////////////////////////////////////////////////////////
+ULLONG SerialFrames_GetTimestamp(void)
+{
+   return (ULLONG)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
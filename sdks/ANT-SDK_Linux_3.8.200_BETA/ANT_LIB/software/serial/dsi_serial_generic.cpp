@@ -49,6 +49,9 @@ DSISerialGeneric::DSISerialGeneric()
    bStopReceiveThread = TRUE;
    ucDeviceNumber = 0xFF;
    ulBaud = 0;
+   ulOpenedSerialNumber = 0;
+   iHotplugHandle = -1;
+   bDeviceLost = FALSE;
 
    return;
 }
@@ -58,6 +61,10 @@ DSISerialGeneric::DSISerialGeneric()
 ///////////////////////////////////////////////////////////////////////
 DSISerialGeneric::~DSISerialGeneric()
 {
+   if(iHotplugHandle >= 0)
+      USBDeviceHandle::DeregisterHotplugCallback(iHotplugHandle);
+   iHotplugHandle = -1;
+
    Close();
 
    if (pclDevice)
@@ -136,6 +143,7 @@ BOOL DSISerialGeneric::Init(ULONG ulBaud_, UCHAR ucDeviceNumber_)
 
    ulBaud = ulBaud_;
    ucDeviceNumber = ucDeviceNumber_;
+   ulOpenedSerialNumber = 0;
 
    return TRUE;
 }
@@ -240,16 +248,31 @@ BOOL DSISerialGeneric::Open(void)
    if (pclCallback == NULL)
       return FALSE;
 
+   if(iHotplugHandle < 0 && USBDeviceHandle::RegisterHotplugCallback(&DSISerialGeneric::HotplugArrived, this, iHotplugHandle) == FALSE)
+      iHotplugHandle = -1;  //The caller has to poll Open() to find the stick again
+
 
    //If the user specified a device number instead of a USBDevice instance, then grab it from the list
    const USBDevice* pclTempDevice = pclDevice;
    if(pclDevice == NULL)
    {
       const USBDeviceList<const USBDevice*> clDeviceList = USBDeviceHandle::GetAllDevices();
-      if(clDeviceList.GetSize() <= ucDeviceNumber)
-         return FALSE;
+      if(ulOpenedSerialNumber != 0)
+      {
+         // Device numbers shift as sticks come and go, the serial number does not
+         for(ULONG i = 0; i < clDeviceList.GetSize(); i++)
+         {
+            if(clDeviceList[i]->GetSerialNumber() == ulOpenedSerialNumber)
+               pclTempDevice = clDeviceList[i];
+         }
+      }
+      else if(clDeviceList.GetSize() > ucDeviceNumber)
+      {
+         pclTempDevice = clDeviceList[ucDeviceNumber];
+      }
 
-      pclTempDevice = clDeviceList[ucDeviceNumber];
+      if(pclTempDevice == NULL)
+         return FALSE;
    }
 
    if(USBDeviceHandle::Open(*pclTempDevice, pclDeviceHandle, ulBaud) == FALSE)
@@ -259,6 +282,11 @@ BOOL DSISerialGeneric::Open(void)
       return FALSE;
    }
 
+   pclDeviceHandle->SetWriteErrorCallback(&DSISerialGeneric::WriteFailed, this);
+
+   ulOpenedSerialNumber = pclDeviceHandle->GetDevice().GetSerialNumber();
+   bDeviceLost = FALSE;
+
 
    if(DSIThread_MutexInit(&stMutexCriticalSection) != DSI_THREAD_ENONE)
    {
@@ -354,6 +382,30 @@ UCHAR DSISerialGeneric::GetDeviceNumber()
    return ucDeviceNumber;
 }
 
+///////////////////////////////////////////////////////////////////////
+void DSISerialGeneric::SetRxTransferCount(UCHAR ucCount_)
+{
+   USBDeviceHandle::SetRxTransferCount(ucCount_);
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialGeneric::GetRxStats(USB_RX_STATS& stStats_)
+{
+   if(pclDeviceHandle == NULL)
+      return FALSE;
+
+   return pclDeviceHandle->GetRxStats(stStats_);
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialGeneric::GetTxStats(USB_TX_STATS& stStats_)
+{
+   if(pclDeviceHandle == NULL)
+      return FALSE;
+
+   return pclDeviceHandle->GetTxStats(stStats_);
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Private Methods
 //////////////////////////////////////////////////////////////////////////////////
@@ -371,11 +423,11 @@ void DSISerialGeneric::ReceiveThread(void)
       switch(eStatus)
       {
          case USBError::NONE:
-            for(ULONG i=0; i<ulRxBytesRead; i++)
-               pclCallback->ProcessByte(aucData[i]);
+            pclCallback->ProcessBytes(aucData, ulRxBytesRead);
             break;
 
          case USBError::DEVICE_GONE:
+            bDeviceLost = TRUE;
             pclCallback->Error(DSI_SERIAL_DEVICE_GONE);
             bStopReceiveThread = TRUE;
             break;
@@ -384,6 +436,7 @@ void DSISerialGeneric::ReceiveThread(void)
             break;
 
          default:
+            bDeviceLost = TRUE;
             pclCallback->Error(DSI_SERIAL_EREAD);
             bStopReceiveThread = TRUE;
             break;
@@ -404,6 +457,29 @@ DSI_THREAD_RETURN DSISerialGeneric::ProcessThread(void* pvParameter_)
    return 0;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Called on the handle's writer thread when bytes an earlier
+// WriteBytes() queued could not be sent.
+///////////////////////////////////////////////////////////////////////
+void DSISerialGeneric::WriteFailed(void* pvParameter_)
+{
+   DSISerialGeneric* This = (DSISerialGeneric*)pvParameter_;
+   if(This->pclCallback != NULL)
+      This->pclCallback->Error(DSI_SERIAL_EWRITE);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Called on the USB event thread for any ANT device plugged in.  Only
+// tells the callback; the stick is reopened from its own thread, and
+// Open() then checks it is the same one.
+///////////////////////////////////////////////////////////////////////
+void DSISerialGeneric::HotplugArrived(void* pvParameter_)
+{
+   DSISerialGeneric* This = (DSISerialGeneric*)pvParameter_;
+   if(This->bDeviceLost && This->pclCallback != NULL)
+      This->pclCallback->Error(DSI_SERIAL_DEVICE_ARRIVED);
+}
+
 
 //NOTE: The USBReset was originally added due to issues in the USB1 (two processor) usb stick that would occasionally have synch issues requiring a reset
 // to remedy. It appears this reset is of no use for USB2s, and in fact is documented in device_handle_libusb PClose() as potentially causing errors with usb2s.
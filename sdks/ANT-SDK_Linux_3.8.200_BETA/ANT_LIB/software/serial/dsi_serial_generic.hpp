@@ -38,11 +38,17 @@ class DSISerialGeneric : public DSISerial
       UCHAR ucDeviceNumber;
       ULONG ulBaud;
 
+      ULONG ulOpenedSerialNumber;                           // Serial number of the stick last opened, 0 if none.
+      int iHotplugHandle;                                   // Hotplug registration, -1 if there is none.
+      BOOL bDeviceLost;                                     // The receive thread stopped on a lost device.
+
       static time_t lastUsbResetTime;
 
       // Private Member Functions
       void ReceiveThread();
       static DSI_THREAD_RETURN ProcessThread(void *pvParameter_);
+      static void HotplugArrived(void *pvParameter_);
+      static void WriteFailed(void *pvParameter_);
 
    public:
       DSISerialGeneric();
@@ -54,11 +60,38 @@ class DSISerialGeneric : public DSISerial
       void USBReset();
       UCHAR GetNumberOfDevices();
 
+      static void SetRxTransferCount(UCHAR ucCount_);
+      /////////////////////////////////////////////////////////////////
+      // As per USBDeviceHandle::SetRxTransferCount().  Applies to
+      // sticks opened after the call.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL GetRxStats(USB_RX_STATS& stStats_);
+      /////////////////////////////////////////////////////////////////
+      // Copies the receive pipeline counters of the open stick.
+      // Returns FALSE if no stick is open or its handle keeps none.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL GetTxStats(USB_TX_STATS& stStats_);
+      /////////////////////////////////////////////////////////////////
+      // Copies the transmit counters of the open stick.
+      // Returns FALSE if no stick is open or its handle keeps none.
+      /////////////////////////////////////////////////////////////////
+
       // Methods inherited from the base class:
       BOOL AutoInit();
       ULONG GetDeviceSerialNumber();
 
       BOOL Open();
+      /////////////////////////////////////////////////////////////////
+      // As per DSISerial::Open().  Once a stick has been opened by
+      // device number, later calls open the stick with the same serial
+      // number, wherever it enumerates after being plugged back in.
+      // While the stick is lost, the callback is given
+      // DSI_SERIAL_DEVICE_ARRIVED each time an ANT device is plugged
+      // in, if the platform reports hotplug events.
+      /////////////////////////////////////////////////////////////////
+
       void Close(BOOL bReset = FALSE);
       BOOL WriteBytes(void *pvData_, USHORT usSize_);
       UCHAR GetDeviceNumber();
@@ -322,8 +322,7 @@ void DSISerialLibusb::ReceiveThread()
       switch(eStatus)
       {
          case USBError::NONE:
-            for(ULONG i=0; i<ulRxBytesRead; i++)
-                pclCallback->ProcessByte(aucData[i]);
+            pclCallback->ProcessBytes(aucData, ulRxBytesRead);
             break;
 
          case USBError::DEVICE_GONE:
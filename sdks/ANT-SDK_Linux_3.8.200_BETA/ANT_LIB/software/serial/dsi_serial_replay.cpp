@@ -0,0 +1,767 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+*/
+
+#include "types.h"
+#include "defines.h"
+#include "macros.h"
+#include "antmessage.h"
+#include "antdefines.h"
+#include "checksum.h"
+#include "dsi_thread.h"
+#include "dsi_serial_replay.hpp"
+#include "dsi_serial_frames.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <deque>
+#include <vector>
+
+#include "dsi_debug.hpp"
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Private Definitions
+//////////////////////////////////////////////////////////////////////////////////
+
+#define REPLAY_NONE                    MAX_ULONG
+
+typedef struct
+{
+   ULONG ulOffset;                                          // Record offset in the capture.
+   ULLONG ullTimestampNs;
+} REPLAY_RECORD;
+
+struct DSISerialReplay::REPLAY_INDEX
+{
+   std::vector<REPLAY_RECORD> clStream;                     // Spontaneous received traffic, in order.
+   std::vector<std::vector<ULONG> > clAnswers;              // Recorded replies, per recorded command.
+   std::map<ULONG, std::deque<ULONG> > clRecordedCommands;  // Command key -> recorded commands, in order.
+   std::map<ULONG, std::deque<ULONG> > clCommands;          // Command key -> recorded commands not yet answered.
+   std::map<ULONG, ULONG> clLastCommand;                    // Command key -> last recorded command, reused once the queue runs dry.
+   std::vector<UCHAR> clPendingBytes;                       // Replies waiting for the replay thread.
+};
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Methods
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////
+DSISerialReplay::DSISerialReplay()
+{
+   hReplayThread = (DSI_THREAD_ID)NULL;
+   bStopReplayThread = TRUE;
+
+   pstIndex = new REPLAY_INDEX;
+
+   pucCapture = (UCHAR*)NULL;
+   ulCaptureSize = 0;
+   pstHeader = (const ANT_CAPTURE_FILE_HEADER*)NULL;
+
+   ullOpenTimestampNs = 0;
+   ullStreamBaseNs = 0;
+   ullStartNs = 0;
+   ulStreamIndex = 0;
+   bLoop = FALSE;
+   bComplete = FALSE;
+   dSpeed = 1.0;
+   ucDeviceNumber = 0;
+   ulReplayedMessages = 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Destructor
+///////////////////////////////////////////////////////////////////////
+DSISerialReplay::~DSISerialReplay()
+{
+   Close();
+   FreeCapture();
+   delete pstIndex;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialReplay::Init(const char *pcFileName_, DOUBLE dSpeed_, BOOL bLoop_)
+{
+   Close();
+   FreeCapture();
+
+   if (dSpeed_ < 0)
+      dSpeed_ = DSI_SERIAL_REPLAY_SPEED_MAX;
+
+   dSpeed = dSpeed_;
+   bLoop = bLoop_;
+
+   if (!LoadCapture(pcFileName_))
+      return FALSE;
+
+   IndexCapture();
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialReplay::IsComplete(void)
+{
+   return bComplete;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSISerialReplay::GetReplayedMessages(void)
+{
+   return ulReplayedMessages;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSISerialReplay::GetStreamSize(void)
+{
+   return (ULONG)pstIndex->clStream.size();
+}
+
+///////////////////////////////////////////////////////////////////////
+UCHAR DSISerialReplay::GetCapabilities(UCHAR *pucCapabilities_)
+{
+   UCHAR ucSize;
+
+   if ((pstHeader == NULL) || (pucCapabilities_ == NULL))
+      return 0;
+
+   ucSize = pstHeader->ucCapabilitiesSize;
+   if (ucSize > MESG_CAPABILITIES_SIZE)
+      ucSize = MESG_CAPABILITIES_SIZE;
+   memcpy(pucCapabilities_, pstHeader->aucCapabilities, ucSize);
+   return ucSize;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialReplay::AutoInit()
+{
+   return Init((ULONG)0, (UCHAR)0);
+}
+
+///////////////////////////////////////////////////////////////////////
+// The baud rate has no meaning for a replay; the device number is
+// only reported back through GetDeviceNumber().
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialReplay::Init(ULONG /*ulBaud_*/, UCHAR ucDeviceNumber_)
+{
+   ucDeviceNumber = ucDeviceNumber_;
+   return (pucCapture != NULL);
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSISerialReplay::GetDeviceSerialNumber()
+{
+   if (pstHeader == NULL)
+      return 0;
+
+   return pstHeader->ulSerialNumber;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Starts the replay thread.  Nothing is streamed until the
+// application opens a channel.
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialReplay::Open()
+{
+   Close();
+
+   if ((pclCallback == NULL) || (pucCapture == NULL))
+      return FALSE;
+
+   pstIndex->clCommands = pstIndex->clRecordedCommands;
+   pstIndex->clPendingBytes.clear();
+   ullStreamBaseNs = ullOpenTimestampNs;
+   ullStartNs = 0;
+   ulStreamIndex = 0;
+   bComplete = FALSE;
+   ulReplayedMessages = 0;
+
+   if (DSIThread_MutexInit(&stMutexCriticalSection) != DSI_THREAD_ENONE)
+      return FALSE;
+
+   if (DSIThread_CondInit(&stCondReplay) != DSI_THREAD_ENONE)
+   {
+      DSIThread_MutexDestroy(&stMutexCriticalSection);
+      return FALSE;
+   }
+
+   if (DSIThread_CondInit(&stEventReplayThreadExit) != DSI_THREAD_ENONE)
+   {
+      DSIThread_CondDestroy(&stCondReplay);
+      DSIThread_MutexDestroy(&stMutexCriticalSection);
+      return FALSE;
+   }
+
+   bStopReplayThread = FALSE;
+   hReplayThread = DSIThread_CreateThread(&DSISerialReplay::ProcessThread, this);
+   if (hReplayThread == (DSI_THREAD_ID)NULL)
+   {
+      bStopReplayThread = TRUE;
+      DSIThread_CondDestroy(&stEventReplayThreadExit);
+      DSIThread_CondDestroy(&stCondReplay);
+      DSIThread_MutexDestroy(&stMutexCriticalSection);
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Stops the replay thread.  The loaded capture is kept so the
+// replay can be opened again.
+///////////////////////////////////////////////////////////////////////
+void DSISerialReplay::Close(BOOL /*bReset_*/)
+{
+   if (hReplayThread == (DSI_THREAD_ID)NULL)
+      return;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+   if (bStopReplayThread == FALSE)
+   {
+      bStopReplayThread = TRUE;
+      DSIThread_CondSignal(&stCondReplay);
+
+      if (DSIThread_CondTimedWait(&stEventReplayThreadExit, &stMutexCriticalSection, 3000) != DSI_THREAD_ENONE)
+      {
+         // We were unable to stop the thread normally.
+         DSIThread_DestroyThread(hReplayThread);
+      }
+   }
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+   DSIThread_ReleaseThreadID(hReplayThread);
+   hReplayThread = (DSI_THREAD_ID)NULL;
+
+   DSIThread_CondDestroy(&stEventReplayThreadExit);
+   DSIThread_CondDestroy(&stCondReplay);
+   DSIThread_MutexDestroy(&stMutexCriticalSection);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Parses the framed messages written by the framer and queues the
+// recorded answers for the replay thread.
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialReplay::WriteBytes(void *pvData_, USHORT usSize_)
+{
+   const UCHAR *pucBytes = (const UCHAR*)pvData_;
+   USHORT usIndex = 0;
+
+   if ((hReplayThread == (DSI_THREAD_ID)NULL) || (pvData_ == NULL))
+      return FALSE;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   while ((USHORT)(usIndex + MESG_FRAME_SIZE) <= usSize_)
+   {
+      UCHAR ucLength;
+      UCHAR ucMessageID;
+
+      if (pucBytes[usIndex] != MESG_TX_SYNC)
+      {
+         usIndex++;                                         // Skip the zero padding between messages.
+         continue;
+      }
+
+      ucLength = pucBytes[usIndex + MESG_SIZE_OFFSET];
+      if ((USHORT)(usIndex + ucLength + MESG_FRAME_SIZE) > usSize_)
+         break;
+
+      ucMessageID = pucBytes[usIndex + MESG_ID_OFFSET];
+      AnswerCommand(ucMessageID, &pucBytes[usIndex + MESG_DATA_OFFSET], ucLength);
+
+      if (((ucMessageID == MESG_OPEN_CHANNEL_ID) || (ucMessageID == MESG_OPEN_RX_SCAN_ID)) && (ullStartNs == 0))
+         ullStartNs = DSICaptureANT::GetTimestamp();
+
+      usIndex += ucLength + MESG_FRAME_SIZE;
+   }
+
+   DSIThread_CondSignal(&stCondReplay);
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+UCHAR DSISerialReplay::GetDeviceNumber()
+{
+   return ucDeviceNumber;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Private Methods
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialReplay::LoadCapture(const char *pcFileName_)
+{
+   FILE *pfFile;
+   long lSize;
+
+   pfFile = fopen(pcFileName_, "rb");
+   if (pfFile == NULL)
+   {
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("Replay->LoadCapture(): Could not open capture file.");
+      #endif
+      return FALSE;
+   }
+
+   fseek(pfFile, 0, SEEK_END);
+   lSize = ftell(pfFile);
+   fseek(pfFile, 0, SEEK_SET);
+
+   if (lSize < (long)sizeof(ANT_CAPTURE_FILE_HEADER))
+   {
+      fclose(pfFile);
+      return FALSE;
+   }
+
+   pucCapture = new UCHAR[lSize];
+   ulCaptureSize = (ULONG)lSize;
+
+   if (fread(pucCapture, 1, ulCaptureSize, pfFile) != ulCaptureSize)
+   {
+      fclose(pfFile);
+      FreeCapture();
+      return FALSE;
+   }
+   fclose(pfFile);
+
+   pstHeader = (const ANT_CAPTURE_FILE_HEADER*)pucCapture;
+   if ((memcmp(pstHeader->aucMagic, ANT_CAPTURE_MAGIC, sizeof(pstHeader->aucMagic)) != 0) ||
+       (pstHeader->usVersion != ANT_CAPTURE_VERSION) ||
+       (pstHeader->usHeaderSize < sizeof(ANT_CAPTURE_FILE_HEADER)) ||
+       (pstHeader->usHeaderSize > ulCaptureSize))
+   {
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("Replay->LoadCapture(): Not a capture file.");
+      #endif
+      FreeCapture();
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Splits the capture into replies to recorded commands and the
+// spontaneous stream.  A received message is a reply if it is
+// the channel response to an outstanding command, the transfer
+// result of an outstanding acknowledged or burst message, the
+// channel closed event after a close, the startup message after a
+// reset, or the message asked for by an outstanding request.
+///////////////////////////////////////////////////////////////////////
+void DSISerialReplay::IndexCapture(void)
+{
+   std::vector<ULONG> clTxRecords;                          // Offsets of recorded commands.
+   std::map<UCHAR, std::deque<ULONG> > clAwaitingResponse;  // Message ID -> commands waiting for a channel response.
+   std::map<UCHAR, std::deque<ULONG> > clAwaitingRequest;   // Requested message ID -> outstanding requests.
+   ULONG aulAwaitingTransfer[CHANNEL_NUMBER_MASK + 1];
+   ULONG aulAwaitingClose[CHANNEL_NUMBER_MASK + 1];
+   ULONG ulAwaitingReset = REPLAY_NONE;
+   ULONG ulOffset = pstHeader->usHeaderSize;
+
+   for (UCHAR i = 0; i <= CHANNEL_NUMBER_MASK; i++)
+   {
+      aulAwaitingTransfer[i] = REPLAY_NONE;
+      aulAwaitingClose[i] = REPLAY_NONE;
+   }
+
+   while (ulOffset + sizeof(ANT_CAPTURE_RECORD) <= ulCaptureSize)
+   {
+      const ANT_CAPTURE_RECORD *pstRecord = (const ANT_CAPTURE_RECORD*)&pucCapture[ulOffset];
+      const UCHAR *pucData = (const UCHAR*)(pstRecord + 1);
+      ULONG ulReply = REPLAY_NONE;
+
+      if (ulOffset + sizeof(ANT_CAPTURE_RECORD) + pstRecord->ucLength > ulCaptureSize)
+         break;                                             // Truncated by a crash during capture.
+
+      if (pstRecord->ucDirection == ANT_CAPTURE_DIR_TX)
+      {
+         ULONG ulCommand = (ULONG)clTxRecords.size();
+         UCHAR ucChannel = (pstRecord->ucLength > 0) ? (pucData[0] & CHANNEL_NUMBER_MASK) : 0;
+         ULONG ulKey = GetCommandKey(pstRecord->ucMessageID, pucData, pstRecord->ucLength);
+
+         clTxRecords.push_back(ulOffset);
+         pstIndex->clAnswers.push_back(std::vector<ULONG>());
+         pstIndex->clRecordedCommands[ulKey].push_back(ulCommand);
+         pstIndex->clLastCommand[ulKey] = ulCommand;
+
+         switch (pstRecord->ucMessageID)
+         {
+            case MESG_SYSTEM_RESET_ID:
+               ulAwaitingReset = ulCommand;
+               break;
+
+            case MESG_REQUEST_ID:
+               if (pstRecord->ucLength >= 2)
+                  clAwaitingRequest[pucData[1]].push_back(ulCommand);
+               break;
+
+            case MESG_BROADCAST_DATA_ID:
+               break;
+
+            case MESG_ACKNOWLEDGED_DATA_ID:
+            case MESG_BURST_DATA_ID:
+               aulAwaitingTransfer[ucChannel] = ulCommand;
+               break;
+
+            case MESG_CLOSE_CHANNEL_ID:
+               aulAwaitingClose[ucChannel] = ulCommand;
+               clAwaitingResponse[pstRecord->ucMessageID].push_back(ulCommand);
+               break;
+
+            default:
+               clAwaitingResponse[pstRecord->ucMessageID].push_back(ulCommand);
+               break;
+         }
+      }
+      else if ((pstRecord->ucMessageID == MESG_RESPONSE_EVENT_ID) && (pstRecord->ucLength >= MESG_RESPONSE_EVENT_SIZE))
+      {
+         UCHAR ucChannel = pucData[0] & CHANNEL_NUMBER_MASK;
+
+         if (pucData[1] == MESG_EVENT_ID)
+         {
+            if (((pucData[2] == EVENT_TRANSFER_TX_COMPLETED) || (pucData[2] == EVENT_TRANSFER_TX_FAILED)) && (aulAwaitingTransfer[ucChannel] != REPLAY_NONE))
+            {
+               ulReply = aulAwaitingTransfer[ucChannel];
+               aulAwaitingTransfer[ucChannel] = REPLAY_NONE;
+            }
+            else if ((pucData[2] == EVENT_CHANNEL_CLOSED) && (aulAwaitingClose[ucChannel] != REPLAY_NONE))
+            {
+               ulReply = aulAwaitingClose[ucChannel];
+               aulAwaitingClose[ucChannel] = REPLAY_NONE;
+            }
+         }
+         else
+         {
+            std::map<UCHAR, std::deque<ULONG> >::iterator clIt = clAwaitingResponse.find(pucData[1]);
+
+            if ((clIt != clAwaitingResponse.end()) && !clIt->second.empty())
+            {
+               // Prefer the command on the same channel; responses to
+               // network commands carry the network number instead.
+               std::deque<ULONG>::iterator clMatch = clIt->second.begin();
+               for (std::deque<ULONG>::iterator clCommand = clIt->second.begin(); clCommand != clIt->second.end(); ++clCommand)
+               {
+                  const ANT_CAPTURE_RECORD *pstCommand = (const ANT_CAPTURE_RECORD*)&pucCapture[clTxRecords[*clCommand]];
+                  if ((pstCommand->ucLength > 0) && (((const UCHAR*)(pstCommand + 1))[0] == pucData[0]))
+                  {
+                     clMatch = clCommand;
+                     break;
+                  }
+               }
+
+               ulReply = *clMatch;
+               clIt->second.erase(clMatch);
+            }
+         }
+      }
+      else if ((pstRecord->ucMessageID == MESG_STARTUP_MESG_ID) && (ulAwaitingReset != REPLAY_NONE))
+      {
+         ulReply = ulAwaitingReset;
+         ulAwaitingReset = REPLAY_NONE;
+      }
+      else
+      {
+         std::map<UCHAR, std::deque<ULONG> >::iterator clIt = clAwaitingRequest.find(pstRecord->ucMessageID);
+
+         if ((clIt != clAwaitingRequest.end()) && !clIt->second.empty())
+         {
+            ulReply = clIt->second.front();
+            clIt->second.pop_front();
+         }
+      }
+
+      if (pstRecord->ucDirection != ANT_CAPTURE_DIR_TX)
+      {
+         if (ulReply != REPLAY_NONE)
+         {
+            pstIndex->clAnswers[ulReply].push_back(ulOffset);
+         }
+         else
+         {
+            REPLAY_RECORD stRecord;
+            stRecord.ulOffset = ulOffset;
+            stRecord.ullTimestampNs = pstRecord->ullTimestampNs;
+            pstIndex->clStream.push_back(stRecord);
+         }
+      }
+
+      ulOffset += ANT_CAPTURE_RECORD_SIZE(pstRecord->ucLength);
+   }
+
+   // Streaming starts when the application opens its first channel,
+   // which lines up with the first channel opened in the capture.
+   ullOpenTimestampNs = pstIndex->clStream.empty() ? 0 : pstIndex->clStream[0].ullTimestampNs;
+   for (ULONG i = 0; i < clTxRecords.size(); i++)
+   {
+      const ANT_CAPTURE_RECORD *pstCommand = (const ANT_CAPTURE_RECORD*)&pucCapture[clTxRecords[i]];
+      if ((pstCommand->ucMessageID == MESG_OPEN_CHANNEL_ID) || (pstCommand->ucMessageID == MESG_OPEN_RX_SCAN_ID))
+      {
+         ullOpenTimestampNs = pstCommand->ullTimestampNs;
+         break;
+      }
+   }
+
+   #if defined(DEBUG_FILE)
+   {
+      char acMesg[128];
+      SNPRINTF(acMesg, sizeof(acMesg), "Replay->IndexCapture(): %lu commands, %lu streamed messages.", (unsigned long)clTxRecords.size(), (unsigned long)pstIndex->clStream.size());
+      DSIDebug::ThreadWrite(acMesg);
+   }
+   #endif
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSISerialReplay::FreeCapture(void)
+{
+   delete[] pucCapture;
+   pucCapture = (UCHAR*)NULL;
+   ulCaptureSize = 0;
+   pstHeader = (const ANT_CAPTURE_FILE_HEADER*)NULL;
+
+   pstIndex->clStream.clear();
+   pstIndex->clAnswers.clear();
+   pstIndex->clRecordedCommands.clear();
+   pstIndex->clCommands.clear();
+   pstIndex->clLastCommand.clear();
+   ullOpenTimestampNs = 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Commands are matched on message ID and channel, and requests also
+// on the requested message ID.
+///////////////////////////////////////////////////////////////////////
+ULONG DSISerialReplay::GetCommandKey(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_)
+{
+   ULONG ulKey = (ULONG)ucMessageID_ << 16;
+
+   if (ucMessageID_ == MESG_SYSTEM_RESET_ID)
+      return ulKey;
+
+   if (ucLength_ > 0)
+   {
+      if ((ucMessageID_ == MESG_ACKNOWLEDGED_DATA_ID) || (ucMessageID_ == MESG_BURST_DATA_ID))
+         ulKey |= (ULONG)(pucData_[0] & CHANNEL_NUMBER_MASK) << 8;
+      else
+         ulKey |= (ULONG)pucData_[0] << 8;
+   }
+
+   if ((ucMessageID_ == MESG_REQUEST_ID) && (ucLength_ >= 2))
+      ulKey |= pucData_[1];
+
+   return ulKey;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Queues the recorded answers to one command, or a plausible answer
+// if the command was never recorded.  Must be called with
+// stMutexCriticalSection held.
+///////////////////////////////////////////////////////////////////////
+void DSISerialReplay::AnswerCommand(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_)
+{
+   ULONG ulKey = GetCommandKey(ucMessageID_, pucData_, ucLength_);
+   ULONG ulCommand = REPLAY_NONE;
+   std::map<ULONG, std::deque<ULONG> >::iterator clIt = pstIndex->clCommands.find(ulKey);
+   UCHAR ucChannel = (ucLength_ > 0) ? pucData_[0] : 0;
+   UCHAR aucEvent[MESG_RESPONSE_EVENT_SIZE];
+
+   if ((clIt != pstIndex->clCommands.end()) && !clIt->second.empty())
+   {
+      ulCommand = clIt->second.front();
+      clIt->second.pop_front();
+   }
+   else
+   {
+      std::map<ULONG, ULONG>::iterator clLast = pstIndex->clLastCommand.find(ulKey);
+      if (clLast != pstIndex->clLastCommand.end())
+         ulCommand = clLast->second;                        // Reopened channels and repeated requests get the last answer again.
+   }
+
+   if ((ulCommand != REPLAY_NONE) && !pstIndex->clAnswers[ulCommand].empty())
+   {
+      for (ULONG i = 0; i < pstIndex->clAnswers[ulCommand].size(); i++)
+      {
+         const ANT_CAPTURE_RECORD *pstRecord = (const ANT_CAPTURE_RECORD*)&pucCapture[pstIndex->clAnswers[ulCommand][i]];
+         SerialFrames_Append(pstIndex->clPendingBytes, pstRecord->ucMessageID, (const UCHAR*)(pstRecord + 1), pstRecord->ucLength);
+      }
+      return;
+   }
+
+   switch (ucMessageID_)
+   {
+      case MESG_SYSTEM_RESET_ID:
+         aucEvent[0] = RESET_CMD;
+         SerialFrames_Append(pstIndex->clPendingBytes, MESG_STARTUP_MESG_ID, aucEvent, MESG_STARTUP_MESG_SIZE);
+         break;
+
+      case MESG_REQUEST_ID:
+      case MESG_BROADCAST_DATA_ID:
+         break;                                             // Nothing to say without a recording.
+
+      case MESG_ACKNOWLEDGED_DATA_ID:
+      case MESG_BURST_DATA_ID:
+         if ((ucMessageID_ == MESG_BURST_DATA_ID) && !(ucChannel & SEQUENCE_LAST_MESSAGE))
+            break;
+         aucEvent[0] = ucChannel & CHANNEL_NUMBER_MASK;
+         aucEvent[1] = MESG_EVENT_ID;
+         aucEvent[2] = EVENT_TRANSFER_TX_COMPLETED;
+         SerialFrames_Append(pstIndex->clPendingBytes, MESG_RESPONSE_EVENT_ID, aucEvent, MESG_RESPONSE_EVENT_SIZE);
+         break;
+
+      default:
+         aucEvent[0] = ucChannel;
+         aucEvent[1] = ucMessageID_;
+         aucEvent[2] = RESPONSE_NO_ERROR;
+         SerialFrames_Append(pstIndex->clPendingBytes, MESG_RESPONSE_EVENT_ID, aucEvent, MESG_RESPONSE_EVENT_SIZE);
+
+         if (ucMessageID_ == MESG_CLOSE_CHANNEL_ID)
+         {
+            aucEvent[1] = MESG_EVENT_ID;
+            aucEvent[2] = EVENT_CHANNEL_CLOSED;
+            SerialFrames_Append(pstIndex->clPendingBytes, MESG_RESPONSE_EVENT_ID, aucEvent, MESG_RESPONSE_EVENT_SIZE);
+         }
+         break;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////
+// Frames every streamed record that is due at ullNow_ into
+// pucChunk_, up to DSI_SERIAL_REPLAY_CHUNK_SIZE bytes.  Returns the
+// number of bytes written and, if nothing more is due, when the next
+// record is.  Only called from the replay thread.
+///////////////////////////////////////////////////////////////////////
+ULONG DSISerialReplay::FillStreamChunk(UCHAR *pucChunk_, ULLONG ullNow_, ULLONG *pullNextDue_)
+{
+   ULONG ulSize = 0;
+   ULONG ulMessages = 0;
+
+   *pullNextDue_ = 0;
+
+   while (ulStreamIndex < pstIndex->clStream.size())
+   {
+      const REPLAY_RECORD &stRecord = pstIndex->clStream[ulStreamIndex];
+      const ANT_CAPTURE_RECORD *pstRecord = (const ANT_CAPTURE_RECORD*)&pucCapture[stRecord.ulOffset];
+      const UCHAR *pucData = (const UCHAR*)(pstRecord + 1);
+      ULONG ulFrameSize = pstRecord->ucLength + MESG_FRAME_SIZE;
+
+      if (dSpeed != DSI_SERIAL_REPLAY_SPEED_MAX)
+      {
+         ULLONG ullOffset = (stRecord.ullTimestampNs > ullStreamBaseNs) ? (stRecord.ullTimestampNs - ullStreamBaseNs) : 0;
+         ULLONG ullDue = ullStartNs + (ULLONG)(ullOffset / dSpeed);
+
+         if (ullDue > ullNow_)
+         {
+            *pullNextDue_ = ullDue;
+            break;
+         }
+      }
+
+      if (ulSize + ulFrameSize > DSI_SERIAL_REPLAY_CHUNK_SIZE)
+         break;
+
+      pucChunk_[ulSize] = MESG_TX_SYNC;
+      pucChunk_[ulSize + MESG_SIZE_OFFSET] = pstRecord->ucLength;
+      pucChunk_[ulSize + MESG_ID_OFFSET] = pstRecord->ucMessageID;
+      memcpy(&pucChunk_[ulSize + MESG_DATA_OFFSET], pucData, pstRecord->ucLength);
+      pucChunk_[ulSize + MESG_HEADER_SIZE + pstRecord->ucLength] = CheckSum_Calc8(&pucChunk_[ulSize], MESG_HEADER_SIZE + pstRecord->ucLength);
+
+      ulSize += ulFrameSize;
+      ulMessages++;
+      ulStreamIndex++;
+   }
+
+   ulReplayedMessages += ulMessages;
+
+   if (ulStreamIndex >= pstIndex->clStream.size())
+   {
+      if (bLoop && !pstIndex->clStream.empty())
+      {
+         ulStreamIndex = 0;
+         ullStreamBaseNs = pstIndex->clStream[0].ullTimestampNs;
+         ullStartNs = ullNow_;
+      }
+      else
+      {
+         bComplete = TRUE;
+      }
+   }
+
+   return ulSize;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSISerialReplay::ReplayThread(void)
+{
+   UCHAR aucChunk[DSI_SERIAL_REPLAY_CHUNK_SIZE];
+   std::vector<UCHAR> clReplies;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   while (!bStopReplayThread)
+   {
+      ULLONG ullNow;
+      ULLONG ullNextDue;
+      ULONG ulSize;
+
+      // Answers to commands go first so a command's response is never
+      // stuck behind a backlog of streamed traffic.
+      if (!pstIndex->clPendingBytes.empty())
+      {
+         clReplies.swap(pstIndex->clPendingBytes);
+         DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+         for (ULONG i = 0; i < clReplies.size(); i += DSI_SERIAL_REPLAY_CHUNK_SIZE)
+            pclCallback->ProcessBytes(&clReplies[i], ((ULONG)clReplies.size() - i < DSI_SERIAL_REPLAY_CHUNK_SIZE) ? (ULONG)clReplies.size() - i : DSI_SERIAL_REPLAY_CHUNK_SIZE);
+         clReplies.clear();
+
+         DSIThread_MutexLock(&stMutexCriticalSection);
+         continue;
+      }
+
+      if ((ullStartNs == 0) || bComplete)
+      {
+         DSIThread_CondTimedWait(&stCondReplay, &stMutexCriticalSection, DSI_THREAD_INFINITE);
+         continue;
+      }
+
+      if ((dSpeed == DSI_SERIAL_REPLAY_SPEED_MAX) && (pclCallback->GetBacklog() > DSI_SERIAL_REPLAY_MAX_BACKLOG))
+      {
+         DSIThread_CondTimedWait(&stCondReplay, &stMutexCriticalSection, 1);
+         continue;
+      }
+
+      ullNow = DSICaptureANT::GetTimestamp();
+      ulSize = FillStreamChunk(aucChunk, ullNow, &ullNextDue);
+
+      if (ulSize > 0)
+      {
+         DSIThread_MutexUnlock(&stMutexCriticalSection);
+         pclCallback->ProcessBytes(aucChunk, ulSize);
+         DSIThread_MutexLock(&stMutexCriticalSection);
+      }
+      else if (ullNextDue > ullNow)
+      {
+         DSIThread_CondTimedWait(&stCondReplay, &stMutexCriticalSection, (ULONG)((ullNextDue - ullNow + 999999) / 1000000));
+      }
+   }
+
+   bStopReplayThread = TRUE;
+   DSIThread_CondSignal(&stEventReplayThreadExit);         // Set an event to alert the main process that the replay thread is finished and can be closed.
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+}
+
+///////////////////////////////////////////////////////////////////////
+DSI_THREAD_RETURN DSISerialReplay::ProcessThread(void *pvParameter_)
+{
+   DSISerialReplay *This = (DSISerialReplay*)pvParameter_;
+   This->ReplayThread();
+   return 0;
+}
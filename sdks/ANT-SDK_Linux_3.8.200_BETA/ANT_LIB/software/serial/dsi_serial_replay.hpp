@@ -0,0 +1,135 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+*/
+
+#if !defined(DSI_SERIAL_REPLAY_HPP)
+#define DSI_SERIAL_REPLAY_HPP
+
+#include "types.h"
+#include "dsi_thread.h"
+#include "dsi_serial.hpp"
+#include "dsi_capture_ant.hpp"
+
+#include <atomic>
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Definitions
+//////////////////////////////////////////////////////////////////////////////////
+
+#define DSI_SERIAL_REPLAY_SPEED_MAX    ((DOUBLE) 0)         // Deliver recorded traffic as fast as the framer takes it.
+#define DSI_SERIAL_REPLAY_CHUNK_SIZE   ((ULONG) 4096)       // Bytes handed to the callback at once, one USB transfer's worth.
+#define DSI_SERIAL_REPLAY_MAX_BACKLOG  ((ULONG) 512)        // Messages the callback may hold before a max speed replay waits.
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Class Prototypes
+//////////////////////////////////////////////////////////////////////////////////
+
+// Plays a capture written by DSICaptureANT back through a DSISerialCallback,
+// standing in for a USB stick.
+//
+// Received traffic that answers a recorded command (responses, request
+// replies, the startup message, transfer and close events) is held back and
+// only sent when the application writes the matching command.  Commands that
+// were never recorded get a synthesised RESPONSE_NO_ERROR.  Everything else
+// is streamed with its recorded timing, scaled by the replay speed, starting
+// when the application first opens a channel.
+class DSISerialReplay : public DSISerial
+{
+   private:
+
+      struct REPLAY_INDEX;
+
+      DSI_THREAD_ID hReplayThread;
+      DSI_MUTEX stMutexCriticalSection;
+      DSI_CONDITION_VAR stCondReplay;                       // Wakes the replay thread for responses or shutdown.
+      DSI_CONDITION_VAR stEventReplayThreadExit;
+      BOOL bStopReplayThread;
+
+      UCHAR *pucCapture;                                    // Whole capture file.
+      ULONG ulCaptureSize;
+      const ANT_CAPTURE_FILE_HEADER *pstHeader;
+
+      // The containers live in the .cpp so the layout of this class does
+      // not depend on the standard library debug mode the SDK is built with.
+      REPLAY_INDEX *pstIndex;
+
+      ULLONG ullOpenTimestampNs;                            // Capture time the first channel was opened.
+      ULLONG ullStreamBaseNs;                               // Capture time that maps to the start of streaming.
+      ULLONG ullStartNs;                                    // Local time streaming started, 0 if not started.
+      ULONG ulStreamIndex;
+      BOOL bLoop;
+      std::atomic<BOOL> bComplete;
+      DOUBLE dSpeed;
+      UCHAR ucDeviceNumber;
+
+      std::atomic<ULONG> ulReplayedMessages;
+
+      BOOL LoadCapture(const char *pcFileName_);
+      void IndexCapture(void);
+      void FreeCapture(void);
+      static ULONG GetCommandKey(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_);
+      void AnswerCommand(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_);
+      ULONG FillStreamChunk(UCHAR *pucChunk_, ULLONG ullNow_, ULLONG *pullNextDue_);
+
+      void ReplayThread(void);
+      static DSI_THREAD_RETURN ProcessThread(void *pvParameter_);
+
+   public:
+
+      DSISerialReplay();
+      ~DSISerialReplay();
+
+      BOOL Init(const char *pcFileName_, DOUBLE dSpeed_ = 1.0, BOOL bLoop_ = FALSE);
+      /////////////////////////////////////////////////////////////////
+      // Loads a capture for replay.
+      // Parameters:
+      //    *pcFileName_:     Capture file written by DSICaptureANT.
+      //    dSpeed_:          1.0 for the recorded timing, N for N
+      //                      times faster, DSI_SERIAL_REPLAY_SPEED_MAX
+      //                      to deliver as fast as possible.
+      //    bLoop_:           Restart the stream when it runs out.
+      // Returns TRUE if the capture could be read.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL IsComplete(void);
+      /////////////////////////////////////////////////////////////////
+      // Returns TRUE once every streamed record has been delivered.
+      // Never TRUE when looping.
+      /////////////////////////////////////////////////////////////////
+
+      ULONG GetReplayedMessages(void);
+      /////////////////////////////////////////////////////////////////
+      // Number of streamed messages delivered so far.
+      /////////////////////////////////////////////////////////////////
+
+      ULONG GetStreamSize(void);
+      /////////////////////////////////////////////////////////////////
+      // Number of messages in one pass over the stream.
+      /////////////////////////////////////////////////////////////////
+
+      UCHAR GetCapabilities(UCHAR *pucCapabilities_);
+      /////////////////////////////////////////////////////////////////
+      // Copies the capabilities of the captured stick from the
+      // capture header.
+      // Parameters:
+      //    *pucCapabilities_: Buffer of MESG_CAPABILITIES_SIZE bytes.
+      // Returns the number of bytes copied, 0 if the capture did not
+      // record them.
+      /////////////////////////////////////////////////////////////////
+
+      // Methods inherited from the base class:
+      BOOL AutoInit();
+      BOOL Init(ULONG ulBaud_, UCHAR ucDeviceNumber_);
+      ULONG GetDeviceSerialNumber();
+
+      BOOL Open();
+      void Close(BOOL bReset = FALSE);
+      BOOL WriteBytes(void *pvData_, USHORT usSize_);
+      UCHAR GetDeviceNumber();
+};
+
+#endif // !defined(DSI_SERIAL_REPLAY_HPP)
@@ -45,6 +45,14 @@ class DSIDebug
    static BOOL SetDirectory(const char* pcDirectory_ = "");
    static void SetDebug(BOOL bDebugOn_);
 
+   ///////////////////////////////////////////
+   // Note: writes are queued on a ring per thread and
+   // written out by a background thread; a write that
+   // finds its ring full is dropped, never waited on.
+   // Returns the number dropped since the start.
+   ///////////////////////////////////////////
+   static ULONG GetDroppedRecords();
+
  private:
    static BOOL bInitialized;
 };
@@ -110,8 +110,26 @@ UCHAR DSIThread_MutexUnlock(DSI_MUTEX *pstMutex_)
 ///////////////////////////////////////////////////////////////////////
 UCHAR DSIThread_CondInit(DSI_CONDITION_VAR *pstConditionVariable_)
 {
+#if defined(DSI_TYPES_MACINTOSH)
    if (pthread_cond_init(pstConditionVariable_, (const pthread_condattr_t *) NULL) != 0)
       return DSI_THREAD_EOTHER;
+#else
+   // Timed waits are on CLOCK_MONOTONIC, so setting the wall clock, like
+   // NTP does on boards without an RTC, does not stretch or cut them short.
+   pthread_condattr_t stAttributes;
+   UCHAR ucReturn = DSI_THREAD_ENONE;
+
+   if (pthread_condattr_init(&stAttributes) != 0)
+      return DSI_THREAD_EOTHER;
+
+   if (pthread_condattr_setclock(&stAttributes, CLOCK_MONOTONIC) != 0 ||
+       pthread_cond_init(pstConditionVariable_, &stAttributes) != 0)
+      ucReturn = DSI_THREAD_EOTHER;
+
+   pthread_condattr_destroy(&stAttributes);
+   if (ucReturn != DSI_THREAD_ENONE)
+      return ucReturn;
+#endif
 
    return DSI_THREAD_ENONE;
 }
@@ -151,7 +169,7 @@ UCHAR DSIThread_CondTimedWait(DSI_CONDITION_VAR *pstConditionVariable_, DSI_MUTE
       // Now add our time..
       ullNanoseconds += stTimeValue.tv_usec * 1000 + (unsigned long long) stTimeValue.tv_sec * 1000000000;
 #else
-      if (clock_gettime(CLOCK_REALTIME, &stTimeSpec) != 0)
+      if (clock_gettime(CLOCK_MONOTONIC, &stTimeSpec) != 0)   // The clock DSIThread_CondInit() set
          return DSI_THREAD_EOTHER;
 
       // Now add our time..
@@ -279,7 +297,7 @@ ULONG DSIThread_GetSystemTime(void)
    ulReturn = (stTimeValue.tv_usec / 1000) +  (stTimeValue.tv_sec * 1000);
 #else
    struct timespec stTimeSpec;
-   if (clock_gettime(CLOCK_REALTIME, &stTimeSpec) != 0)
+   if (clock_gettime(CLOCK_MONOTONIC, &stTimeSpec) != 0)
       return DSI_THREAD_EOTHER;
 
       // Now convert our time..
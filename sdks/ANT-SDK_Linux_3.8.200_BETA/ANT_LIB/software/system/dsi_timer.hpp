@@ -11,6 +11,7 @@ All rights reserved.
 
 #include "types.h"
 #include "dsi_thread.h"
+#include "dsi_timer_wheel.hpp"
 
 //////////////////////////////////////////////////////////////////////////////////
 // Public Definitions
@@ -20,21 +21,14 @@ All rights reserved.
 // Public Class Prototypes
 //////////////////////////////////////////////////////////////////////////////////
 
+// Calls a function after an interval, once or recurring.  The calls are
+// made from the thread of the process-wide DSITimerWheel, which every
+// timer shares.
 class DSITimer
 {
    private:
-      DSI_THREAD_RETURN (*fnTimerFunc)(void *);
-      void *pvTimerFuncParameter;
-      BOOL bClosing;
-      DSI_MUTEX stMutexCriticalSection;
-      DSI_CONDITION_VAR stCondTimerWait;
-      DSI_CONDITION_VAR stCondTimerThreadExit;
-      DSI_THREAD_ID hTimerThread;
-      BOOL bRecurring;
-      ULONG ulInterval;
-
-      static DSI_THREAD_RETURN TimerThreadStart(void *pvParameter_);
-      void TimerThread(void);
+      DSI_TIMER_WHEEL_ENTRY stEntry;
+      BOOL bAdded;
 
    public:
 
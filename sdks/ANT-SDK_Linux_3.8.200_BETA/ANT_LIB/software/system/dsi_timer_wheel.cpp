@@ -0,0 +1,440 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+
+Copyright (c) Dynastream Innovations Inc. 2016
+All rights reserved.
+*/
+#include "types.h"
+#include "dsi_timer_wheel.hpp"
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Private Definitions
+//////////////////////////////////////////////////////////////////////////////////
+
+#define NO_TICK         ((ULLONG) -1)
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Class Functions
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+DSITimerWheel::DSITimerWheel()
+{
+   UCHAR ucLevel;
+   UCHAR ucSlot;
+
+   for (ucLevel = 0; ucLevel < DSI_TIMER_WHEEL_LEVELS; ucLevel++)
+   {
+      for (ucSlot = 0; ucSlot < DSI_TIMER_WHEEL_SLOTS; ucSlot++)
+         apstSlots[ucLevel][ucSlot] = (DSI_TIMER_WHEEL_ENTRY*)NULL;
+   }
+
+   pstExpired = (DSI_TIMER_WHEEL_ENTRY*)NULL;
+   pstRunning = (DSI_TIMER_WHEEL_ENTRY*)NULL;
+   bRunningRemoved = FALSE;
+   ullWheelMs = GetTimeMs();
+   ulTimers = 0;
+
+   hWheelThread = (DSI_THREAD_ID)NULL;
+   iTimerFd = -1;
+   iWakeFd = -1;
+   bInitialized = FALSE;
+
+   if (DSIThread_MutexInit(&stMutexCriticalSection) != DSI_THREAD_ENONE)
+      return;
+
+   if (DSIThread_CondInit(&stCondCallbackDone) != DSI_THREAD_ENONE)
+   {
+      DSIThread_MutexDestroy(&stMutexCriticalSection);
+      return;
+   }
+
+   bInitialized = TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+DSITimerWheel* DSITimerWheel::GetInstance(void)
+{
+   // Never deleted, so timers owned by static objects can still be
+   // removed while the process exits.
+   static DSITimerWheel *pclWheel = new DSITimerWheel();
+
+   return pclWheel;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULLONG DSITimerWheel::GetTimeMs(void)
+{
+   struct timespec stTimeSpec;
+
+   if (clock_gettime(CLOCK_MONOTONIC, &stTimeSpec) != 0)
+      return 0;
+
+   return (ULLONG)stTimeSpec.tv_sec * 1000 + (ULLONG)(stTimeSpec.tv_nsec / 1000000);
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSITimerWheel::Add(DSI_TIMER_WHEEL_ENTRY *pstEntry_)
+{
+   if (!bInitialized || pstEntry_ == NULL || pstEntry_->fnCallback == NULL)
+      return FALSE;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   if (!hWheelThread && Start() == FALSE)
+   {
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
+      return FALSE;
+   }
+
+   // Nothing was due while the wheel was empty, so skip the ticks
+   // rather than step through them.
+   if (ulTimers == 0 && pstRunning == NULL)
+      ullWheelMs = GetTimeMs();
+
+   pstEntry_->ullExpiresMs = GetTimeMs() + pstEntry_->ulIntervalMs;
+   pstEntry_->bFired = FALSE;
+   Insert(pstEntry_);
+   ulTimers++;
+   Wake();
+
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSITimerWheel::Remove(DSI_TIMER_WHEEL_ENTRY *pstEntry_)
+{
+   if (!bInitialized || pstEntry_ == NULL)
+      return;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   if (pstEntry_->ppstPrev != NULL)
+   {
+      Unlink(pstEntry_);
+      ulTimers--;
+   }
+   else if (pstEntry_ == pstRunning && !bRunningRemoved)
+   {
+      bRunningRemoved = TRUE;
+      ulTimers--;
+   }
+
+   if (pstEntry_ == pstRunning && !DSIThread_CompareThreads(DSIThread_GetCurrentThreadIDNum(), hWheelThreadIDNum))
+   {
+      while (pstEntry_ == pstRunning)
+         DSIThread_CondTimedWait(&stCondCallbackDone, &stMutexCriticalSection, DSI_THREAD_INFINITE);
+   }
+
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSITimerWheel::GetTimerCount(void)
+{
+   ULONG ulCount;
+
+   if (!bInitialized)
+      return 0;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+   ulCount = ulTimers;
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+   return ulCount;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Private Class Functions
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+// Creates the fds and the wheel thread.  Called with the lock held.
+///////////////////////////////////////////////////////////////////////
+BOOL DSITimerWheel::Start(void)
+{
+   iTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   iWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+   if (iTimerFd >= 0 && iWakeFd >= 0)
+      hWheelThread = DSIThread_CreateThread(&DSITimerWheel::WheelThreadStart, this);
+
+   if (!hWheelThread)
+   {
+      if (iTimerFd >= 0)
+         close(iTimerFd);
+      if (iWakeFd >= 0)
+         close(iWakeFd);
+      iTimerFd = -1;
+      iWakeFd = -1;
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Puts a timer in the slot its deadline falls in: the lowest level
+// whose span from the current tick reaches it.
+///////////////////////////////////////////////////////////////////////
+void DSITimerWheel::Insert(DSI_TIMER_WHEEL_ENTRY *pstEntry_)
+{
+   ULLONG ullExpires = pstEntry_->ullExpiresMs;
+   UCHAR ucLevel;
+   UCHAR ucSlot;
+
+   if (ullExpires < ullWheelMs)
+      ullExpires = ullWheelMs;                              // Overdue, so the next tick.
+
+   for (ucLevel = 0; ucLevel < DSI_TIMER_WHEEL_LEVELS - 1; ucLevel++)
+   {
+      if (ullExpires - ullWheelMs < (1ULL << (DSI_TIMER_WHEEL_SLOT_BITS * (ucLevel + 1))))
+         break;
+   }
+
+   if (ullExpires - ullWheelMs >= (1ULL << (DSI_TIMER_WHEEL_SLOT_BITS * DSI_TIMER_WHEEL_LEVELS)))
+      ullExpires = ullWheelMs + (1ULL << (DSI_TIMER_WHEEL_SLOT_BITS * DSI_TIMER_WHEEL_LEVELS)) - 1;   // Parked in the top level until it fits.
+
+   ucSlot = (UCHAR)((ullExpires >> (DSI_TIMER_WHEEL_SLOT_BITS * ucLevel)) & DSI_TIMER_WHEEL_SLOT_MASK);
+
+   pstEntry_->pstNext = apstSlots[ucLevel][ucSlot];
+   if (pstEntry_->pstNext != NULL)
+      pstEntry_->pstNext->ppstPrev = &pstEntry_->pstNext;
+   pstEntry_->ppstPrev = &apstSlots[ucLevel][ucSlot];
+   apstSlots[ucLevel][ucSlot] = pstEntry_;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSITimerWheel::Unlink(DSI_TIMER_WHEEL_ENTRY *pstEntry_)
+{
+   *pstEntry_->ppstPrev = pstEntry_->pstNext;
+   if (pstEntry_->pstNext != NULL)
+      pstEntry_->pstNext->ppstPrev = pstEntry_->ppstPrev;
+
+   pstEntry_->pstNext = (DSI_TIMER_WHEEL_ENTRY*)NULL;
+   pstEntry_->ppstPrev = (DSI_TIMER_WHEEL_ENTRY**)NULL;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Moves the timers of a slot down to the levels their deadlines now
+// fall in.
+///////////////////////////////////////////////////////////////////////
+void DSITimerWheel::Cascade(UCHAR ucLevel_, UCHAR ucSlot_)
+{
+   DSI_TIMER_WHEEL_ENTRY *pstList = apstSlots[ucLevel_][ucSlot_];
+   DSI_TIMER_WHEEL_ENTRY *pstEntry;
+
+   // Detached first, as a parked timer may go back to the same level
+   apstSlots[ucLevel_][ucSlot_] = (DSI_TIMER_WHEEL_ENTRY*)NULL;
+   if (pstList != NULL)
+      pstList->ppstPrev = &pstList;
+
+   while ((pstEntry = pstList) != NULL)
+   {
+      Unlink(pstEntry);
+      Insert(pstEntry);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////
+// Processes the ticks up to ullNowMs_ and runs the callbacks due in
+// them.  Called with the lock held, which is released around each
+// callback.
+///////////////////////////////////////////////////////////////////////
+void DSITimerWheel::Advance(ULLONG ullNowMs_)
+{
+   DSI_TIMER_WHEEL_ENTRY *pstEntry;
+   UCHAR ucSlot;
+   UCHAR ucLevel;
+
+   if (ulTimers == 0)
+   {
+      ullWheelMs = ullNowMs_ + 1;
+      return;
+   }
+
+   while (ullWheelMs <= ullNowMs_)
+   {
+      ucSlot = (UCHAR)(ullWheelMs & DSI_TIMER_WHEEL_SLOT_MASK);
+
+      // Level 0 wrapped, so the slot of each level above whose turn it
+      // is moves down, until a level that did not wrap itself.
+      if (ucSlot == 0)
+      {
+         for (ucLevel = 1; ucLevel < DSI_TIMER_WHEEL_LEVELS; ucLevel++)
+         {
+            UCHAR ucUpper = (UCHAR)((ullWheelMs >> (DSI_TIMER_WHEEL_SLOT_BITS * ucLevel)) & DSI_TIMER_WHEEL_SLOT_MASK);
+            Cascade(ucLevel, ucUpper);
+            if (ucUpper != 0)
+               break;
+         }
+      }
+
+      // Timers taken off the wheel for this tick, so a callback can
+      // still remove one that has not run yet.
+      pstExpired = apstSlots[0][ucSlot];
+      apstSlots[0][ucSlot] = (DSI_TIMER_WHEEL_ENTRY*)NULL;
+      if (pstExpired != NULL)
+         pstExpired->ppstPrev = &pstExpired;
+      ullWheelMs++;
+
+      while ((pstEntry = pstExpired) != NULL)
+      {
+         Unlink(pstEntry);
+         pstEntry->bFired = TRUE;
+         pstRunning = pstEntry;
+         bRunningRemoved = FALSE;
+
+         DSIThread_MutexUnlock(&stMutexCriticalSection);
+         pstEntry->fnCallback(pstEntry->pvParameter);
+         DSIThread_MutexLock(&stMutexCriticalSection);
+
+         if (bRunningRemoved)
+         {
+            // The owner may have freed it already
+         }
+         else if (pstEntry->bRecurring)
+         {
+            ULLONG ullInterval = pstEntry->ulIntervalMs ? pstEntry->ulIntervalMs : 1;
+            ULLONG ullNow = GetTimeMs();
+
+            pstEntry->ullExpiresMs += ullInterval;
+            if (pstEntry->ullExpiresMs <= ullNow)
+               pstEntry->ullExpiresMs += ((ullNow - pstEntry->ullExpiresMs) / ullInterval + 1) * ullInterval;
+            Insert(pstEntry);
+         }
+         else
+         {
+            ulTimers--;
+         }
+
+         pstRunning = (DSI_TIMER_WHEEL_ENTRY*)NULL;
+         DSIThread_CondBroadcast(&stCondCallbackDone);
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////
+// The tick the thread next has work at: the next level 0 slot with a
+// timer in it, or the next time a slot with timers moves down,
+// whichever comes first.  NO_TICK if the wheel is empty.
+///////////////////////////////////////////////////////////////////////
+ULLONG DSITimerWheel::NextTickMs(void)
+{
+   ULLONG ullNext = NO_TICK;
+   ULLONG ullTick;
+   UCHAR ucLevel;
+   UCHAR ucStep;
+
+   if (ulTimers == 0)
+      return NO_TICK;
+
+   for (ucStep = 0; ucStep < DSI_TIMER_WHEEL_SLOTS; ucStep++)
+   {
+      ullTick = ullWheelMs + ucStep;
+      if (apstSlots[0][ullTick & DSI_TIMER_WHEEL_SLOT_MASK] != NULL)
+      {
+         ullNext = ullTick;
+         break;
+      }
+   }
+
+   for (ucLevel = 1; ucLevel < DSI_TIMER_WHEEL_LEVELS; ucLevel++)
+   {
+      UCHAR ucShift = (UCHAR)(DSI_TIMER_WHEEL_SLOT_BITS * ucLevel);
+      ULLONG ullTurn = (ullWheelMs + (1ULL << ucShift) - 1) >> ucShift;   // First turn of this level not moved down yet.
+
+      for (ucStep = 0; ucStep < DSI_TIMER_WHEEL_SLOTS; ucStep++)
+      {
+         if (apstSlots[ucLevel][(ullTurn + ucStep) & DSI_TIMER_WHEEL_SLOT_MASK] != NULL)
+         {
+            ullTick = (ullTurn + ucStep) << ucShift;
+            if (ullTick < ullNext)
+               ullNext = ullTick;
+            break;
+         }
+      }
+   }
+
+   return ullNext;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSITimerWheel::Wake(void)
+{
+   ULLONG ullOne = 1;
+
+   if (write(iWakeFd, &ullOne, sizeof(ullOne)) < 0)
+   {
+      // Already signalled, the counter is saturated
+   }
+}
+
+///////////////////////////////////////////////////////////////////////
+DSI_THREAD_RETURN DSITimerWheel::WheelThreadStart(void *pvParameter_)
+{
+   DSITimerWheel *This = (DSITimerWheel *) pvParameter_;
+
+   This->WheelThread();
+
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSITimerWheel::WheelThread(void)
+{
+   struct pollfd astFds[2];
+   struct itimerspec stTimerSpec;
+   ULLONG ullCount;
+   ULLONG ullNext;
+
+   astFds[0].fd = iTimerFd;
+   astFds[0].events = POLLIN;
+   astFds[1].fd = iWakeFd;
+   astFds[1].events = POLLIN;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+   hWheelThreadIDNum = DSIThread_GetCurrentThreadIDNum();
+
+   while (1)
+   {
+      Advance(GetTimeMs());
+
+      // Absolute, so the time spent getting here does not add up
+      ullNext = NextTickMs();
+      stTimerSpec.it_interval.tv_sec = 0;
+      stTimerSpec.it_interval.tv_nsec = 0;
+      stTimerSpec.it_value.tv_sec = (ullNext == NO_TICK) ? 0 : (time_t)(ullNext / 1000);
+      stTimerSpec.it_value.tv_nsec = (ullNext == NO_TICK) ? 0 : (long)(ullNext % 1000) * 1000000;
+      timerfd_settime(iTimerFd, TFD_TIMER_ABSTIME, &stTimerSpec, (struct itimerspec*)NULL);
+
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+      if (poll(astFds, 2, -1) < 0 && errno != EINTR)
+         DSIThread_Sleep(1);
+
+      if (read(iTimerFd, &ullCount, sizeof(ullCount)) < 0)
+      {
+         // Not expired, woken up to rearm
+      }
+      if (read(iWakeFd, &ullCount, sizeof(ullCount)) < 0)
+      {
+         // Not woken up, the timer expired
+      }
+
+      DSIThread_MutexLock(&stMutexCriticalSection);
+   }
+}
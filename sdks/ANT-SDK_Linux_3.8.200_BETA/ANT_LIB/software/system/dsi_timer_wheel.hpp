@@ -0,0 +1,129 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+
+Copyright (c) Dynastream Innovations Inc. 2016
+All rights reserved.
+*/
+#if !defined(DSI_TIMER_WHEEL_HPP)
+#define DSI_TIMER_WHEEL_HPP
+
+#include "types.h"
+#include "dsi_thread.h"
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Definitions
+//////////////////////////////////////////////////////////////////////////////////
+
+#define DSI_TIMER_WHEEL_LEVELS         4                    // Level 0 ticks every millisecond, each level above 64 times slower.
+#define DSI_TIMER_WHEEL_SLOT_BITS      6
+#define DSI_TIMER_WHEEL_SLOTS          (1 << DSI_TIMER_WHEEL_SLOT_BITS)
+#define DSI_TIMER_WHEEL_SLOT_MASK      (DSI_TIMER_WHEEL_SLOTS - 1)
+
+// A timer on the wheel.  The owner fills in the first four fields and keeps
+// the entry alive until DSITimerWheel::Remove() returns; the rest belongs to
+// the wheel.
+typedef struct DSI_TIMER_WHEEL_ENTRY_
+{
+   DSI_THREAD_RETURN (*fnCallback)(void *);
+   void *pvParameter;
+   ULONG ulIntervalMs;
+   BOOL bRecurring;
+
+   ULLONG ullExpiresMs;                                     // Deadline in milliseconds on CLOCK_MONOTONIC.
+   BOOL bFired;                                             // Called at least once.
+   struct DSI_TIMER_WHEEL_ENTRY_ *pstNext;
+   struct DSI_TIMER_WHEEL_ENTRY_ **ppstPrev;                // Link pointing at this entry, NULL while not on the wheel.
+} DSI_TIMER_WHEEL_ENTRY;
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Class Prototypes
+//////////////////////////////////////////////////////////////////////////////////
+
+// One thread that runs the callbacks of every timer in the process.
+//
+// Timers sit in a hierarchical wheel of DSI_TIMER_WHEEL_LEVELS levels with
+// DSI_TIMER_WHEEL_SLOTS slots each: 64 ms in 1 ms slots, 4 s in 64 ms slots,
+// 4.4 min and 4.7 h above that.  Adding and removing a timer is O(1); a
+// timer moves down a level each time the level below wraps, so it is
+// touched at most once per level.  Deadlines further out than the top level
+// are parked in it and moved on until they fit.
+// The thread sleeps on a timerfd armed for the next slot with a timer in it,
+// on CLOCK_MONOTONIC, so changes to the wall clock do not move deadlines.
+// Recurring deadlines are the previous deadline plus the interval, not the
+// time the callback ran plus the interval, so they do not drift; periods
+// missed by a late callback are skipped rather than run back to back.
+class DSITimerWheel
+{
+   private:
+
+      DSI_TIMER_WHEEL_ENTRY *apstSlots[DSI_TIMER_WHEEL_LEVELS][DSI_TIMER_WHEEL_SLOTS];
+      DSI_TIMER_WHEEL_ENTRY *pstExpired;                    // Timers due this tick, waiting for their callback.
+      DSI_TIMER_WHEEL_ENTRY *pstRunning;                    // Timer whose callback runs right now.
+      BOOL bRunningRemoved;                                 // pstRunning was removed from within a callback.
+      ULLONG ullWheelMs;                                    // Next tick to process.
+      ULONG ulTimers;
+
+      DSI_THREAD_ID hWheelThread;
+      DSI_THREAD_IDNUM hWheelThreadIDNum;
+      DSI_MUTEX stMutexCriticalSection;
+      DSI_CONDITION_VAR stCondCallbackDone;
+      int iTimerFd;
+      int iWakeFd;                                          // eventfd that makes the thread rearm its timerfd.
+      BOOL bInitialized;
+
+      DSITimerWheel();
+
+      BOOL Start(void);
+      void Insert(DSI_TIMER_WHEEL_ENTRY *pstEntry_);
+      void Unlink(DSI_TIMER_WHEEL_ENTRY *pstEntry_);
+      void Cascade(UCHAR ucLevel_, UCHAR ucSlot_);
+      void Advance(ULLONG ullNowMs_);
+      ULLONG NextTickMs(void);
+      void Wake(void);
+
+      void WheelThread(void);
+      static DSI_THREAD_RETURN WheelThreadStart(void *pvParameter_);
+
+   public:
+
+      static DSITimerWheel* GetInstance(void);
+      /////////////////////////////////////////////////////////////////
+      // Returns the wheel of the process, created on first use.  Its
+      // thread starts with the first timer and then stays.
+      /////////////////////////////////////////////////////////////////
+
+      static ULLONG GetTimeMs(void);
+      /////////////////////////////////////////////////////////////////
+      // Returns milliseconds on CLOCK_MONOTONIC, the clock deadlines
+      // are on.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL Add(DSI_TIMER_WHEEL_ENTRY *pstEntry_);
+      /////////////////////////////////////////////////////////////////
+      // Starts a timer that first fires ulIntervalMs from now.
+      // Parameters:
+      //    *pstEntry_:       The timer, with its callback, parameter,
+      //                      interval and recurrence filled in.
+      // Returns TRUE if successful.  Otherwise, it returns FALSE.
+      /////////////////////////////////////////////////////////////////
+
+      void Remove(DSI_TIMER_WHEEL_ENTRY *pstEntry_);
+      /////////////////////////////////////////////////////////////////
+      // Stops a timer.  If its callback is running on the wheel thread
+      // this waits for it to return, unless called from within a
+      // callback, so the entry can be freed as soon as this returns.
+      // Parameters:
+      //    *pstEntry_:       The timer passed to Add().
+      /////////////////////////////////////////////////////////////////
+
+      ULONG GetTimerCount(void);
+      /////////////////////////////////////////////////////////////////
+      // Returns the number of timers on the wheel.
+      /////////////////////////////////////////////////////////////////
+};
+
+#endif // !defined(DSI_TIMER_WHEEL_HPP)
@@ -12,6 +12,18 @@ All rights reserved.
 #include <list>
 #include <queue>
 #include <deque>
+#include <atomic>
+#include <string.h>
+
+#if defined(DSI_TYPES_LINUX)
+   #include <errno.h>
+   #include <time.h>
+   #include <unistd.h>
+   #include <sys/syscall.h>
+   #include <linux/futex.h>
+#endif
+
+#define DSI_CACHE_LINE_SIZE            64
 
 
 //NOTE: Make sure nobody is still using this queue when it is being destroyed!
@@ -145,5 +157,260 @@ class TSQueue  //thread-safe queue
 };
 
 
+//Single-producer/single-consumer lock-free ring.  Exactly one thread may call
+//the producer methods (Reserve/Commit/PushArray) and exactly one thread may call
+//the consumer methods (Front/Pop/PopArray) at any time.  Neither side blocks;
+//callers that need to wait must provide their own signalling.
+//NOTE: T must be safe to copy with memcpy.
+template < class T >
+class SPSCQueue
+{
+  public:
+
+   SPSCQueue(ULONG ulCapacity_)
+   {
+      //Round up to a power of two so indices can be masked instead of divided.
+      ulCapacity = 1;
+      while(ulCapacity < ulCapacity_ && ulCapacity < 0x80000000UL)
+         ulCapacity <<= 1;
+      ulMask = ulCapacity - 1;
+
+      ptBuffer = new T[ulCapacity];
+      ulHead.store(0, std::memory_order_relaxed);
+      ulTail.store(0, std::memory_order_relaxed);
+   }
+
+   ~SPSCQueue()
+   {
+      delete[] ptBuffer;
+   }
+
+   ULONG GetCapacity() const { return ulCapacity; }
+
+   ULONG GetSize() const
+   {
+      return ulHead.load(std::memory_order_acquire) - ulTail.load(std::memory_order_acquire);
+   }
+
+   BOOL IsEmpty() const { return GetSize() == 0; }
+
+   //Only call when neither the producer nor the consumer is active.
+   void Clear()
+   {
+      ulHead.store(0, std::memory_order_relaxed);
+      ulTail.store(0, std::memory_order_relaxed);
+   }
+
+   //Producer: returns the next free slot, or NULL if the ring is full.
+   //The slot is not visible to the consumer until Commit() is called.
+   T* Reserve()
+   {
+      ULONG ulHeadNow = ulHead.load(std::memory_order_relaxed);
+      if(ulHeadNow - ulTail.load(std::memory_order_acquire) >= ulCapacity)
+         return (T*)NULL;
+
+      return &ptBuffer[ulHeadNow & ulMask];
+   }
+
+   void Commit()
+   {
+      ulHead.store(ulHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   }
+
+   //Producer: copies up to ulSize_ elements in, returns the number copied.
+   ULONG PushArray(const T* ptElementArray_, ULONG ulSize_)
+   {
+      ULONG ulHeadNow = ulHead.load(std::memory_order_relaxed);
+      ULONG ulFree = ulCapacity - (ulHeadNow - ulTail.load(std::memory_order_acquire));
+      ULONG ulCount = (ulSize_ < ulFree) ? ulSize_ : ulFree;
+      ULONG ulStart = ulHeadNow & ulMask;
+      ULONG ulFirst = (ulCount < ulCapacity - ulStart) ? ulCount : ulCapacity - ulStart;
+
+      memcpy(&ptBuffer[ulStart], ptElementArray_, ulFirst * sizeof(T));
+      memcpy(&ptBuffer[0], ptElementArray_ + ulFirst, (ulCount - ulFirst) * sizeof(T));
+
+      ulHead.store(ulHeadNow + ulCount, std::memory_order_release);
+      return ulCount;
+   }
+
+   //Consumer: returns the oldest element, or NULL if the ring is empty.
+   //The element stays valid until Pop() is called.
+   T* Front()
+   {
+      ULONG ulTailNow = ulTail.load(std::memory_order_relaxed);
+      if(ulHead.load(std::memory_order_acquire) == ulTailNow)
+         return (T*)NULL;
+
+      return &ptBuffer[ulTailNow & ulMask];
+   }
+
+   void Pop()
+   {
+      ulTail.store(ulTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   }
+
+   //Consumer: copies up to ulMaxSize_ elements out, returns the number copied.
+   ULONG PopArray(T* const ptElementArray_, ULONG ulMaxSize_)
+   {
+      ULONG ulTailNow = ulTail.load(std::memory_order_relaxed);
+      ULONG ulAvailable = ulHead.load(std::memory_order_acquire) - ulTailNow;
+      ULONG ulCount = (ulMaxSize_ < ulAvailable) ? ulMaxSize_ : ulAvailable;
+      ULONG ulStart = ulTailNow & ulMask;
+      ULONG ulFirst = (ulCount < ulCapacity - ulStart) ? ulCount : ulCapacity - ulStart;
+
+      memcpy(ptElementArray_, &ptBuffer[ulStart], ulFirst * sizeof(T));
+      memcpy(ptElementArray_ + ulFirst, &ptBuffer[0], (ulCount - ulFirst) * sizeof(T));
+
+      ulTail.store(ulTailNow + ulCount, std::memory_order_release);
+      return ulCount;
+   }
+
+  private:
+   SPSCQueue(const SPSCQueue&);
+   SPSCQueue& operator=(const SPSCQueue&);
+
+   T* ptBuffer;
+   ULONG ulCapacity;
+   ULONG ulMask;
+
+   //Head and tail live on separate cache lines so the producer and consumer
+   //do not invalidate each other's line on every update.
+   UCHAR aucPad0[DSI_CACHE_LINE_SIZE];
+   std::atomic<ULONG> ulHead;                            //Written by the producer only.
+   UCHAR aucPad1[DSI_CACHE_LINE_SIZE - sizeof(std::atomic<ULONG>)];
+   std::atomic<ULONG> ulTail;                            //Written by the consumer only.
+   UCHAR aucPad2[DSI_CACHE_LINE_SIZE - sizeof(std::atomic<ULONG>)];
+};
+
+
+//Thread-safe byte stream between one producer thread and one consumer thread.
+//Bytes are copied in and out of a contiguous ring with memcpy, so a USB packet
+//costs one copy on each side.  The consumer blocks on a futex on Linux and on a
+//condition variable elsewhere; the producer only makes a system call when the
+//consumer is actually waiting.  If the ring is full, the bytes that do not fit
+//are dropped and counted.
+class TSByteQueue
+{
+  public:
+
+   TSByteQueue(ULONG ulCapacity_ = 65536) : clRing(ulCapacity_)
+   {
+      iSequence.store(0);
+      iWaiters.store(0);
+      ulDroppedBytes.store(0);
+
+   #if !defined(DSI_TYPES_LINUX)
+      UCHAR ret;
+      ret = DSIThread_CondInit(&stEventPush);
+      if(ret != DSI_THREAD_ENONE)
+         throw; //!!Need to throw something!
+
+      ret = DSIThread_MutexInit(&stMutex);
+      if(ret != DSI_THREAD_ENONE)
+      {
+         DSIThread_CondDestroy(&stEventPush);
+         throw; //!!Need to throw something!
+      }
+   #endif
+   }
+
+   ~TSByteQueue()
+   {
+   #if !defined(DSI_TYPES_LINUX)
+      DSIThread_MutexDestroy(&stMutex);
+      DSIThread_CondDestroy(&stEventPush);
+   #endif
+   }
+
+   //Producer: returns the number of bytes queued.
+   ULONG PushArray(const UCHAR* pucData_, ULONG ulSize_)
+   {
+      ULONG ulPushed = clRing.PushArray(pucData_, ulSize_);
+      if(ulPushed < ulSize_)
+         ulDroppedBytes.fetch_add(ulSize_ - ulPushed);
+
+      //Bump the sequence after the data is visible.
+      Notify();
+      return ulPushed;
+   }
+
+   //Producer: wakes a consumer parked in PopArray() without queuing any data,
+   //so it can notice a state change such as the device going away.
+   void Notify()
+   {
+      iSequence.fetch_add(1);
+      if(iWaiters.load() != 0)   //Only make the syscall if the consumer is parked.
+         Wake();
+   }
+
+   //Consumer: waits up to ulWaitTime_ ms (DSI_THREAD_INFINITE to wait forever)
+   //for data, then copies out as much as is available up to ulMaxSize_.
+   ULONG PopArray(UCHAR* const pucData_, ULONG ulMaxSize_, ULONG ulWaitTime_ = 0)
+   {
+      if(clRing.IsEmpty() && ulWaitTime_ != 0)
+      {
+         iWaiters.fetch_add(1);
+         int iSeen = iSequence.load();
+         if(clRing.IsEmpty())
+            Wait(iSeen, ulWaitTime_);
+         iWaiters.fetch_sub(1);
+      }
+
+      return clRing.PopArray(pucData_, ulMaxSize_);
+   }
+
+   ULONG GetDroppedBytes() const { return ulDroppedBytes.load(); }
+
+  private:
+   TSByteQueue(const TSByteQueue&);
+   TSByteQueue& operator=(const TSByteQueue&);
+
+#if defined(DSI_TYPES_LINUX)
+   void Wait(int iSeen_, ULONG ulWaitTime_)
+   {
+      struct timespec stTimeout;
+      struct timespec* pstTimeout = (struct timespec*)NULL;
+
+      if(ulWaitTime_ != DSI_THREAD_INFINITE)
+      {
+         stTimeout.tv_sec = (time_t)(ulWaitTime_ / 1000);
+         stTimeout.tv_nsec = (long)(ulWaitTime_ % 1000) * 1000000;
+         pstTimeout = &stTimeout;
+      }
+
+      //Returns immediately if the producer has pushed since iSeen_ was read.
+      syscall(SYS_futex, reinterpret_cast<int*>(&iSequence), FUTEX_WAIT_PRIVATE, iSeen_, pstTimeout, NULL, 0);
+   }
+
+   void Wake()
+   {
+      syscall(SYS_futex, reinterpret_cast<int*>(&iSequence), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+   }
+#else
+   void Wait(int iSeen_, ULONG ulWaitTime_)
+   {
+      DSIThread_MutexLock(&stMutex);
+      if(iSequence.load() == iSeen_)
+         DSIThread_CondTimedWait(&stEventPush, &stMutex, ulWaitTime_);
+      DSIThread_MutexUnlock(&stMutex);
+   }
+
+   void Wake()
+   {
+      DSIThread_MutexLock(&stMutex);
+      DSIThread_CondSignal(&stEventPush);
+      DSIThread_MutexUnlock(&stMutex);
+   }
+
+   DSI_CONDITION_VAR stEventPush;
+   DSI_MUTEX stMutex;
+#endif
+
+   SPSCQueue<UCHAR> clRing;
+   std::atomic<int> iSequence;                           //Futex word, bumped on every push.
+   std::atomic<int> iWaiters;
+   std::atomic<ULONG> ulDroppedBytes;
+};
+
 
 #endif //DSI_TS_QUEUE_HPP
\ No newline at end of file
@@ -0,0 +1,122 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+
+Copyright (c) Dynastream Innovations Inc. 2016
+All rights reserved.
+*/
+#if !defined(ANTFS_DOWNLOAD_SINK_HPP)
+#define ANTFS_DOWNLOAD_SINK_HPP
+
+#include "types.h"
+
+#include <stdio.h>
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Class Prototypes
+//////////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////
+// Receives the data of ANTFSHostChannel::DownloadToSink() as it
+// arrives, so a download never has to fit in memory.
+//
+// Data is written in order from the offset the download resumed
+// at.  A block that fails its CRC check is taken back with
+// Truncate() and downloaded again, so a sink that cannot rewind,
+// such as a pipe, may fail Truncate() to fail the download instead.
+// All calls are made from the ANT-FS thread.
+/////////////////////////////////////////////////////////////////
+class ANTFSDownloadSink
+{
+   public:
+      virtual ~ANTFSDownloadSink() {}
+
+      virtual ULONG GetSize(void) = 0;
+      /////////////////////////////////////////////////////////////////
+      // Returns the number of bytes the sink already holds from an
+      // earlier, interrupted download.  The download resumes there.
+      /////////////////////////////////////////////////////////////////
+
+      virtual ULONG Read(ULONG ulOffset_, UCHAR *pucData_, ULONG ulSize_) = 0;
+      /////////////////////////////////////////////////////////////////
+      // Reads back data held by the sink, to seed the CRC of a
+      // resumed download.
+      // Parameters:
+      //    ulOffset_:        Offset to read from.
+      //    *pucData_:        Buffer to read into.
+      //    ulSize_:          Number of bytes to read.
+      // Returns the number of bytes read.
+      /////////////////////////////////////////////////////////////////
+
+      virtual BOOL Write(ULONG ulOffset_, const UCHAR *pucData_, ULONG ulSize_) = 0;
+      /////////////////////////////////////////////////////////////////
+      // Appends downloaded data.
+      // Parameters:
+      //    ulOffset_:        Offset of the data in the file, always
+      //                      the current size of the sink.
+      //    *pucData_:        The data.
+      //    ulSize_:          Number of bytes.
+      // Returns TRUE if successful.  Otherwise, it returns FALSE and
+      // the download fails.
+      /////////////////////////////////////////////////////////////////
+
+      virtual BOOL Truncate(ULONG ulSize_) = 0;
+      /////////////////////////////////////////////////////////////////
+      // Drops the data past the last offset that passed a CRC check.
+      // Parameters:
+      //    ulSize_:          Number of bytes to keep.
+      // Returns TRUE if successful.  Otherwise, it returns FALSE and
+      // the download fails.
+      /////////////////////////////////////////////////////////////////
+
+      virtual BOOL Flush(void) = 0;
+      /////////////////////////////////////////////////////////////////
+      // Called after each block that passed its CRC check, and at the
+      // end of the download.
+      // Returns TRUE if successful.  Otherwise, it returns FALSE.
+      /////////////////////////////////////////////////////////////////
+};
+
+/////////////////////////////////////////////////////////////////
+// Writes a download to a file.  Opened for resuming, a partial
+// file from an earlier attempt is kept and the download continues
+// from its end.
+/////////////////////////////////////////////////////////////////
+class ANTFSFileSink : public ANTFSDownloadSink
+{
+   private:
+
+      FILE *pfFile;
+      ULONG ulSize;
+
+   public:
+
+      ANTFSFileSink();
+      ~ANTFSFileSink();
+
+      BOOL Open(const char *pcFilename_, BOOL bResume_ = TRUE);
+      /////////////////////////////////////////////////////////////////
+      // Opens the file to download into.
+      // Parameters:
+      //    *pcFilename_:     Path of the file.
+      //    bResume_:         Keep the contents of an existing file and
+      //                      resume from its end, or start over.
+      // Returns TRUE if successful.  Otherwise, it returns FALSE.
+      /////////////////////////////////////////////////////////////////
+
+      void Close(void);
+      /////////////////////////////////////////////////////////////////
+      // Closes the file.
+      /////////////////////////////////////////////////////////////////
+
+      // Methods inherited from the base class:
+      ULONG GetSize(void);
+      ULONG Read(ULONG ulOffset_, UCHAR *pucData_, ULONG ulSize_);
+      BOOL Write(ULONG ulOffset_, const UCHAR *pucData_, ULONG ulSize_);
+      BOOL Truncate(ULONG ulSize_);
+      BOOL Flush(void);
+};
+
+#endif // !defined(ANTFS_DOWNLOAD_SINK_HPP)
@@ -603,6 +603,14 @@ class ANTFSHost
       // will be available in the transfer buffer.  See GetTransferData().
       /////////////////////////////////////////////////////////////////
 
+      ANTFS_RETURN DownloadToSink(USHORT usFileIndex_, ANTFSDownloadSink *pclSink_, ULONG ulMaxDataLength_ = 0, ULONG ulMaxBlockSize_ = 0);
+      /////////////////////////////////////////////////////////////////
+      // Request a download of a file from the authenticated device,
+      // written to a sink as it is received.  A sink that already
+      // holds part of the file resumes the download from its end.
+      // See ANTFSHostChannel::DownloadToSink().
+      /////////////////////////////////////////////////////////////////
+
       ANTFS_RETURN Upload(USHORT usFileIndex_, ULONG ulDataOffset_, ULONG ulDataLength_, void *pvData_, BOOL bForceOffset_ = TRUE, ULONG ulMaxBlockSize_ = 0);
       /////////////////////////////////////////////////////////////////
       // Request an upload of a file to the authenticated device.
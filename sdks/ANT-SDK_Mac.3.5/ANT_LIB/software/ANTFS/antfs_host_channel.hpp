@@ -9,6 +9,8 @@ All rights reserved.
 #if !defined(ANTFS_HOST_CHANNEL_HPP)
 #define ANTFS_HOST_CHANNEL_HPP
 
+#include <atomic>
+
 #include "types.h"
 #include "dsi_thread.h"
 #include "dsi_timer.hpp"
@@ -20,6 +22,7 @@ All rights reserved.
 #include "antfsmessage.h"
 
 #include "antfs_host_interface.hpp"
+#include "antfs_download_sink.hpp"
 
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -31,6 +34,7 @@ All rights reserved.
 UCHAR const aucTransportFrequencyList[16] = {3 ,7 ,15,20,25,29,34,40,45,49,54,60,65,70,75,80};
 #define TRANSPORT_FREQUENCY_LIST_SIZE  ((UCHAR)sizeof(aucTransportFrequencyList))
 #define SEARCH_DEVICE_LIST_MAX_SIZE    512
+#define STREAM_WINDOW_SIZE             ((ULONG)0x10000)     // Data received by DownloadToSink() but not yet in the sink.
 
 typedef struct
 {
@@ -177,6 +181,15 @@ class ANTFSHostChannel : public ANTFSHostInterface, public DSIANTMessageProcesso
 
       ULONG ulHostBlockSize;
 
+      // Streaming download, see DownloadToSink()
+      ANTFSDownloadSink *pclDownloadSink;                   // NULL to download into the transfer buffer.
+      std::atomic<ULONG> ulStreamWritten;                   // Data bytes handed to the sink, released by the ANTFS thread.
+      std::atomic<ULONG> ulStreamReceived;                  // Data bytes stored in the window, released by the ANT thread.
+      std::atomic<ULONG> ulStreamBlockEnd;                  // End of the data in the block being received, released by the ANT thread.
+      ULONG ulStreamBlockStart;                             // Last offset that passed a CRC check, or where the download resumed.
+      USHORT usStreamCRC;                                   // CRC of the data handed to the sink.
+      USHORT usStreamBlockCRC;                              // CRC at ulStreamBlockStart.
+
       DSI_THREAD_ID hANTFSThread;                           // Handle for the ANTFS thread.
       DSI_MUTEX stMutexResponseQueue;                       // Mutex used with the response queue
       DSI_MUTEX stMutexCriticalSection;                     // Mutex used with the wait condition
@@ -247,6 +260,12 @@ class ANTFSHostChannel : public ANTFSHostInterface, public DSIANTMessageProcesso
       // Private Function Prototypes
       //////////////////////////////////////////////////////////////////////////////////
       BOOL ReportDownloadProgress(void);
+      void StoreTransferPacket(ULONG ulIndex_, const UCHAR *pucPacket_);
+      UCHAR GetTransferByte(ULONG ulIndex_);
+      BOOL StartStream(void);
+      BOOL WriteStream(ULONG ulEnd_);
+      BOOL RewindStream(void);
+      void EndStream(void);
       BOOL ReInitDevice(void);
       void ResetHostState(void);
 
@@ -741,6 +760,39 @@ public:
       // will be available in the transfer buffer.  See GetTransferData().
       /////////////////////////////////////////////////////////////////
 
+      ANTFS_RETURN DownloadToSink(USHORT usFileIndex_, ANTFSDownloadSink *pclSink_, ULONG ulMaxDataLength_ = 0, ULONG ulMaxBlockSize_ = 0);
+      /////////////////////////////////////////////////////////////////
+      // Request a download of a file from the authenticated device,
+      // written to a sink as it is received instead of collected in
+      // the transfer buffer.  Only STREAM_WINDOW_SIZE bytes are held
+      // in memory, whatever the size of the file.
+      // The download resumes from the end of what the sink already
+      // holds, with the CRC of that data as the seed, so the device
+      // rejects the resume with DOWNLOAD_RESPONSE_CRC_FAILED if the
+      // data does not match its file.  A sink that already holds the
+      // whole file passes, whether the device answers the resume with
+      // an empty block or rejects the offset as invalid.  A block that fails its CRC
+      // check is downloaded again from the last good offset.
+      // Parameters:
+      //    usFileIndex_:     The file number to be downloaded.
+      //    *pclSink_:        Where the data goes.  It must stay valid
+      //                      until the download response, the library
+      //                      lets go of it then, whatever the result.
+      //    ulMaxDataLength_: Maximum number of bytes of the file to
+      //                      download, 0 for all of it.
+      //    ulMaxBlockSize_:  Maximum number of bytes that the host
+      //                      wishes to download in a single block.
+      //                      Set to zero to disable.
+      // Returns ANTFS_RETURN_PASS if successful.  Otherwise, it returns
+      // ANTFS_RETURN_FAIL if the library is in the wrong state or the
+      // device does not support large downloads, or
+      // ANTFS_RETURN_BUSY if the library is busy with another request.
+      // Operation:
+      // The responses are those of Download().  GetTransferData() and
+      // RecoverTransferData() return FALSE for a streamed download;
+      // GetDownloadStatus() reports its progress.
+      /////////////////////////////////////////////////////////////////
+
       ANTFS_RETURN Upload(USHORT usFileIndex_, ULONG ulDataOffset_, ULONG ulDataLength_, void *pvData_, BOOL bForceOffset_ = TRUE, ULONG ulMaxBlockSize_ = 0);
       /////////////////////////////////////////////////////////////////
       // Request an upload of a file to the authenticated device.
@@ -32,6 +32,26 @@ struct USBError
 
 typedef USBDeviceList<const USBDevice*> ANTDeviceList;
 
+typedef struct
+{
+   ULONG ulTransfersCompleted;                           // Bulk IN transfers that completed with data.
+   ULONG ulTransferErrors;                               // Bulk IN transfers that completed with an error.
+   ULONG ulTurnaroundAvgUs;                              // Mean time from a transfer completing to it being resubmitted, as seen by the USB event loop.
+   ULONG ulTurnaroundMaxUs;                              // Worst time from a transfer completing to it being resubmitted, as seen by the USB event loop.
+   ULONG ulIdleCount;                                    // Number of times no transfer was in flight, i.e. the endpoint sat idle.
+   ULONG ulIdleTotalUs;                                  // Total time no transfer was in flight.
+} USB_RX_STATS;
+
+typedef struct
+{
+   ULONG ulWrites;                                       // Write() calls queued for the writer thread.
+   ULONG ulTransfers;                                    // Bulk OUT transfers they went out in.
+   ULONG ulTransferErrors;                               // Bulk OUT transfers that failed; their writes were lost.
+   ULONG ulQueueFullWaits;                               // Times Write() waited for the writer to free a slot.
+} USB_TX_STATS;
+
+typedef void (*USBWriteErrorCallback)(void* pvParameter_);  // Called when bytes a handle accepted in Write() could not be sent.
+
 //typedef void (*DeviceCallback)(UCHAR);  //!!Should we make this an error enum?
 
 //NOTE: We assume that there are no devices plugged/unplugged between getting the list and opening a device.
@@ -54,6 +74,12 @@ class USBDeviceHandle
    static BOOL Open(const USBDevice& clDevice_, USBDeviceHandle*& pclDeviceHandle_, ULONG ulBaudRate_);
    static BOOL Close(USBDeviceHandle*& pclDeviceHandle_, BOOL bReset_ = FALSE);
 
+   static void SetRxTransferCount(UCHAR ucCount_);
+   /////////////////////////////////////////////////////////////////
+   // Sets how many bulk IN transfers are kept in flight by handles
+   // opened after this call, on platforms that queue several.
+   /////////////////////////////////////////////////////////////////
+
 
    virtual USBError::Enum Write(void* pvData_, ULONG ulSize_, ULONG& ulBytesWritten_) = 0;  //!!Need timeout?
    /////////////////////////////////////////////////////////////////
@@ -71,6 +97,27 @@ class USBDeviceHandle
 
    virtual const USBDevice& GetDevice() = 0;
 
+   virtual void SetWriteErrorCallback(USBWriteErrorCallback /*pfCallback_*/, void* /*pvParameter_*/) {}
+   /////////////////////////////////////////////////////////////////
+   // Handles that send from a thread of their own, after Write()
+   // returned, report a failed send by calling pfCallback_ on that
+   // thread.  Handles that send within Write() report it there and
+   // ignore this.  Pass NULL to stop the calls.
+   /////////////////////////////////////////////////////////////////
+
+   virtual BOOL GetRxStats(USB_RX_STATS& /*stStats_*/) const { return FALSE; }
+   /////////////////////////////////////////////////////////////////
+   // Copies the receive pipeline counters for this handle.
+   // Returns FALSE if the handle does not keep them.
+   /////////////////////////////////////////////////////////////////
+
+   virtual BOOL GetTxStats(USB_TX_STATS& /*stStats_*/) const { return FALSE; }
+   /////////////////////////////////////////////////////////////////
+   // Copies the transmit counters for this handle.  Writes per
+   // transfer is how well commands were coalesced.
+   // Returns FALSE if the handle does not keep them.
+   /////////////////////////////////////////////////////////////////
+
   protected:
    USBDeviceHandle() {}
    virtual ~USBDeviceHandle() {}
@@ -281,5 +281,10 @@ BOOL USBDeviceHandle::Close(USBDeviceHandle*& pclDeviceHandle_, BOOL bReset_)
    return bSuccess;
 }
 
+void USBDeviceHandle::SetRxTransferCount(UCHAR /*ucCount_*/)
+{
+   //One read is kept in flight on this platform
+}
+
 
 #endif //defined(DSI_TYPES_MACINTOSH)
@@ -0,0 +1,251 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+*/
+
+#include "types.h"
+#include "antmessage.h"
+#include "dsi_thread.h"
+#include "dsi_capture_ant.hpp"
+#include "dsi_serial_frames.hpp"
+
+#include <string.h>
+#include <chrono>
+
+#include "dsi_debug.hpp"
+
+static_assert(sizeof(ANT_CAPTURE_FILE_HEADER) == 64, "Capture file header layout changed");
+static_assert(sizeof(ANT_CAPTURE_CHANNEL) == 16, "Capture channel layout changed");
+static_assert(sizeof(ANT_CAPTURE_RECORD) == 16, "Capture record layout changed");
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Methods
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////
+DSICaptureANT::DSICaptureANT(ULONG ulBufferSize_)
+{
+   pfFile = (FILE*)NULL;
+   ulBufferSize = (ulBufferSize_ < ANT_CAPTURE_RECORD_SIZE(MESG_MAX_SIZE_VALUE)) ? ANT_CAPTURE_RECORD_SIZE(MESG_MAX_SIZE_VALUE) : ulBufferSize_;
+   pucBuffer = new UCHAR[ulBufferSize];
+   ulBufferUsed = 0;
+   ulSequence = 0;
+   ulDroppedRecords = 0;
+
+   DSIThread_MutexInit(&stMutexCriticalSection);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Destructor
+///////////////////////////////////////////////////////////////////////
+DSICaptureANT::~DSICaptureANT()
+{
+   Close();
+
+   DSIThread_MutexDestroy(&stMutexCriticalSection);
+   delete[] pucBuffer;
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSICaptureANT::Open(const char *pcFileName_, ULONG ulSerialNumber_, const UCHAR *pucCapabilities_, UCHAR ucCapabilitiesSize_, const ANT_CHANNEL_CONFIG *pastChannels_, UCHAR ucChannelCount_)
+{
+   ANT_CAPTURE_FILE_HEADER stHeader;
+
+   Close();
+
+   if (pastChannels_ == NULL)
+      ucChannelCount_ = 0;
+   if ((pucCapabilities_ == NULL) || (ucCapabilitiesSize_ > MESG_CAPABILITIES_SIZE))
+      ucCapabilitiesSize_ = (pucCapabilities_ == NULL) ? 0 : MESG_CAPABILITIES_SIZE;
+
+   memset(&stHeader, 0, sizeof(stHeader));
+   memcpy(stHeader.aucMagic, ANT_CAPTURE_MAGIC, sizeof(stHeader.aucMagic));
+   stHeader.usVersion = ANT_CAPTURE_VERSION;
+   stHeader.usHeaderSize = (USHORT)(sizeof(ANT_CAPTURE_FILE_HEADER) + ucChannelCount_ * sizeof(ANT_CAPTURE_CHANNEL));
+   stHeader.ulSerialNumber = ulSerialNumber_;
+   stHeader.ullStartTimeNs = GetTimestamp();
+   stHeader.ullWallClockUs = (ULLONG)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+   if (ucCapabilitiesSize_ > 0)
+      memcpy(stHeader.aucCapabilities, pucCapabilities_, ucCapabilitiesSize_);
+   stHeader.ucCapabilitiesSize = ucCapabilitiesSize_;
+   stHeader.ucChannelCount = ucChannelCount_;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   pfFile = fopen(pcFileName_, "wb");
+   if (pfFile == NULL)
+   {
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("Capture->Open(): Failed to create capture file.");
+      #endif
+      return FALSE;
+   }
+
+   // The header goes through the buffer too, so the file is only touched on flush.
+   memcpy(pucBuffer, &stHeader, sizeof(stHeader));
+   ulBufferUsed = sizeof(stHeader);
+
+   for (UCHAR i = 0; i < ucChannelCount_; i++)
+   {
+      ANT_CAPTURE_CHANNEL stChannel;
+
+      memset(&stChannel, 0, sizeof(stChannel));
+      stChannel.ucANTChannel = pastChannels_[i].ucANTChannel;
+      stChannel.ucChannelType = pastChannels_[i].ucChannelType;
+      stChannel.ucNetworkNumber = pastChannels_[i].ucNetworkNumber;
+      stChannel.ucDeviceType = pastChannels_[i].ucDeviceType;
+      stChannel.usDeviceNumber = pastChannels_[i].usDeviceNumber;
+      stChannel.ucTransmitType = pastChannels_[i].ucTransmitType;
+      stChannel.ucRFFrequency = pastChannels_[i].ucRFFrequency;
+      stChannel.usMessagePeriod = pastChannels_[i].usMessagePeriod;
+      stChannel.ucSearchTimeout = pastChannels_[i].ucSearchTimeout;
+      stChannel.ucOpen = pastChannels_[i].bOpen ? 1 : 0;
+
+      if (ulBufferUsed + sizeof(stChannel) > ulBufferSize)
+         FlushBuffer();
+      memcpy(&pucBuffer[ulBufferUsed], &stChannel, sizeof(stChannel));
+      ulBufferUsed += sizeof(stChannel);
+   }
+
+   if (!FlushBuffer())
+   {
+      fclose(pfFile);
+      pfFile = (FILE*)NULL;
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
+      return FALSE;
+   }
+
+   ulSequence = 0;
+   ulDroppedRecords = 0;
+
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+   return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSICaptureANT::Close(void)
+{
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   if (pfFile != NULL)
+   {
+      FlushBuffer();
+      fclose(pfFile);
+      pfFile = (FILE*)NULL;
+   }
+   ulBufferUsed = 0;
+
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSICaptureANT::IsOpen(void)
+{
+   return (pfFile != NULL);
+}
+
+///////////////////////////////////////////////////////////////////////
+void DSICaptureANT::Record(UCHAR ucDirection_, UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_)
+{
+   ANT_CAPTURE_RECORD *pstRecord;
+   ULONG ulRecordSize = ANT_CAPTURE_RECORD_SIZE(ucLength_);
+   ULLONG ullTimestamp = GetTimestamp();                    // Taken before the lock so waiting doesn't skew it.
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+
+   if (pfFile == NULL)
+   {
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
+      return;
+   }
+
+   if ((ulBufferUsed + ulRecordSize > ulBufferSize) && !FlushBuffer())
+   {
+      ulDroppedRecords++;
+      DSIThread_MutexUnlock(&stMutexCriticalSection);
+      return;
+   }
+
+   pstRecord = (ANT_CAPTURE_RECORD*)&pucBuffer[ulBufferUsed];
+   pstRecord->ullTimestampNs = ullTimestamp;
+   pstRecord->ucDirection = ucDirection_;
+   pstRecord->ucMessageID = ucMessageID_;
+   pstRecord->ucLength = ucLength_;
+   pstRecord->ucReserved = 0;
+   pstRecord->ulSequence = ulSequence++;
+
+   memcpy(&pucBuffer[ulBufferUsed + sizeof(ANT_CAPTURE_RECORD)], pucData_, ucLength_);
+   memset(&pucBuffer[ulBufferUsed + sizeof(ANT_CAPTURE_RECORD) + ucLength_], 0, ulRecordSize - sizeof(ANT_CAPTURE_RECORD) - ucLength_);
+   ulBufferUsed += ulRecordSize;
+
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSICaptureANT::Flush(void)
+{
+   BOOL bReturn;
+
+   DSIThread_MutexLock(&stMutexCriticalSection);
+   bReturn = (pfFile != NULL) ? FlushBuffer() : FALSE;
+   DSIThread_MutexUnlock(&stMutexCriticalSection);
+
+   return bReturn;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSICaptureANT::GetRecordCount(void)
+{
+   return ulSequence;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULONG DSICaptureANT::GetDroppedRecords(void)
+{
+   return ulDroppedRecords;
+}
+
+///////////////////////////////////////////////////////////////////////
+ULLONG DSICaptureANT::GetTimestamp(void)
+{
+   return SerialFrames_GetTimestamp();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Private Methods
+//////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////
+// Must be called with stMutexCriticalSection held.
+///////////////////////////////////////////////////////////////////////
+BOOL DSICaptureANT::FlushBuffer(void)
+{
+   if (ulBufferUsed == 0)
+      return TRUE;
+
+   if ((fwrite(pucBuffer, 1, ulBufferUsed, pfFile) != ulBufferUsed) || (fflush(pfFile) != 0))
+   {
+      #if defined(DEBUG_FILE)
+         DSIDebug::ThreadWrite("Capture->FlushBuffer(): Write failed, buffered records dropped.");
+      #endif
+      // Records are variable length, so count what was lost by walking the buffer.
+      for (ULONG ulOffset = 0; ulOffset + sizeof(ANT_CAPTURE_RECORD) <= ulBufferUsed; )
+      {
+         ANT_CAPTURE_RECORD *pstRecord = (ANT_CAPTURE_RECORD*)&pucBuffer[ulOffset];
+         ulOffset += ANT_CAPTURE_RECORD_SIZE(pstRecord->ucLength);
+         ulDroppedRecords++;
+      }
+      ulBufferUsed = 0;
+      return FALSE;
+   }
+
+   ulBufferUsed = 0;
+   return TRUE;
+}
@@ -14,6 +14,7 @@ All rights reserved.
 #include "antdefines.h"
 #include "dsi_framer.hpp"
 #include "dsi_thread.h"
+#include "dsi_ts_queue.hpp"
 
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -30,6 +31,16 @@ All rights reserved.
 
 #define RX_FIFO_SIZE                   ((USHORT) 256)
 
+#define DSI_FRAMER_ANT_MESSAGE_QUEUE_SIZE ((ULONG) 1024)  // Default number of received data messages that can be queued.
+#define DSI_FRAMER_ANT_CONTROL_QUEUE_SIZE ((ULONG) 256)   // Received control messages that can be queued.
+
+#define DSI_FRAMER_ANT_RESPONSE_BUCKETS   ((UCHAR) 64)    // Pending-response table size, must be a power of two.
+#define DSI_FRAMER_ANT_RESPONSE_POOL_SIZE ((UCHAR) 64)    // Response waiters kept for reuse; more are allocated on demand.
+#define DSI_FRAMER_ANT_RESPONSE_ANY       ((UCHAR) 0xFF)  // Table key for waiters that match on message ID only.
+
+#define DSI_FRAMER_ANT_COMMAND_EWRITE   ((UCHAR) 0xFD)  // Result of a pipelined command that could not be written.
+#define DSI_FRAMER_ANT_COMMAND_ETIMEOUT ((UCHAR) 0xFE)  // Result of a pipelined command that got no response in time.
+
 typedef struct ANT_MESSAGE
 {
    UCHAR ucMessageID;
@@ -42,6 +53,12 @@ typedef struct
    ANT_MESSAGE stANTMessage;
 } ANT_MESSAGE_ITEM;
 
+typedef struct
+{
+   ANT_MESSAGE_ITEM stItem;
+   ULLONG ullQueuedUs;                                   // When the message was framed, in microseconds on std::chrono::steady_clock.
+} ANT_QUEUED_MESSAGE;
+
 typedef enum
 {
    ANTFRAMER_FAIL = 0,
@@ -65,6 +82,23 @@ typedef struct
 } FS_MESSAGE;
 
 class ANTMessageResponse;
+class DSICaptureANT;
+
+typedef ANTMessageResponse * ANT_COMMAND_HANDLE;         // Completion handle for a pipelined command, NULL if the write failed.
+
+typedef struct
+{
+   UCHAR ucANTChannel;
+   UCHAR ucChannelType;
+   UCHAR ucNetworkNumber;
+   USHORT usDeviceNumber;
+   UCHAR ucDeviceType;
+   UCHAR ucTransmitType;
+   USHORT usMessagePeriod;
+   UCHAR ucRFFrequency;
+   UCHAR ucSearchTimeout;
+   BOOL bOpen;                                           // Send OpenChannel once the channel is configured.
+} ANT_CHANNEL_CONFIG;
 
 //////////////////////////////////////////////////////////////////////////////////
 // Public Class Prototypes
@@ -81,10 +115,16 @@ class DSIFramerANT : public DSIFramer
       UCHAR aucRxFifo[RX_FIFO_SIZE];
       UCHAR ucCheckSum;
       UCHAR ucRxSize;
-      USHORT usMessageHead;
-      USHORT usMessageTail;
-      ANT_MESSAGE_ITEM astMessageBuffer[65536];
-      UCHAR ucError;
+      // Received messages can be split into two lanes, each written by
+      // the receive thread and read by the application thread.  The
+      // control lane holds command responses and requested messages,
+      // and is drained first, so the application sees them ahead of
+      // any backlog of broadcasts.
+      SPSCQueue<ANT_QUEUED_MESSAGE> clControlQueue;
+      SPSCQueue<ANT_QUEUED_MESSAGE> clMessageQueue;      // Data lane: channel data and channel events.
+      BOOL bPriorityLanes;                               // FALSE to queue every message on the data lane, in arrival order.
+      std::atomic<ULONG> ulDroppedData;
+      std::atomic<UCHAR> ucError;
       UCHAR ucSerialError;
 
       BOOL bInitOkay;
@@ -97,12 +137,32 @@ class DSIFramerANT : public DSIFramer
       DSI_CONDITION_VAR stCondMessageReady;
       DSI_CONDITION_VAR stCondResponseReady;
 
-      ANTMessageResponse *pclResponseListStart;
+      // Pending responses, hashed by (message ID, first data byte) so the receive
+      // thread only looks at waiters that could match.  The pending counts let it
+      // skip the lock entirely when nothing is waiting, e.g. for broadcast data.
+      ANTMessageResponse *apclResponseTable[DSI_FRAMER_ANT_RESPONSE_BUCKETS];
+      std::atomic<USHORT> ausResponsesPending[DSI_FRAMER_ANT_RESPONSE_BUCKETS];
+      ANTMessageResponse *pclResponsePool;
+      ANTMessageResponse *pclResponseFreeList;
+
+      int iEventFd;                                      // Readable while messages or errors are pending, -1 if unsupported.
+
+      std::atomic<DSICaptureANT*> pclCapture;            // Optional tap that records every framed message.
 
       USHORT GetMessageSize(void);
+      SPSCQueue<ANT_QUEUED_MESSAGE>& GetLane(UCHAR ucMessageID_, UCHAR ucEventID_);
+      void QueueOverflow(UCHAR ucMessageID_);
+      ANT_QUEUED_MESSAGE* FrontMessage(BOOL &bControl_);
+      void PopMessage(BOOL bControl_);
+      void WaitForQueue(ULONG ulMilliseconds_);
       void ProcessMessage(void);
       void CheckResponseList(void);
+      void InitResponseTable(void);
+      static UCHAR GetResponseBucket(UCHAR ucMessageID_, UCHAR ucChannel_);
+      ANTMessageResponse* AcquireResponse(void);
+      void ReleaseResponse(ANTMessageResponse *pclResponse_);
       BOOL SendCommand(ANT_MESSAGE *pstANTMessage_, USHORT usMessageSize_, ULONG ulResponseTime_ = 0);
+      ANT_COMMAND_HANDLE SendCommandAsync(ANT_MESSAGE *pstANTMessage_, USHORT usMessageSize_);
       BOOL SendFSCommand(FS_MESSAGE *pstFSMessage_, USHORT usMessageSize_, UCHAR* pucFSResponse, ULONG ulResponseTime_ = 0);
       ANTFRAMER_RETURN SetupAckDataTransfer(UCHAR ucMessageID_, UCHAR ucANTChannel_, UCHAR *pucData_, UCHAR ucMaxDataSize_, ULONG ulResponseTime_  = 0);
       ANTFRAMER_RETURN SetupBurstDataTransfer(UCHAR ucMessageID_, UCHAR ucANTChannel_, UCHAR * pucData_, ULONG ulSize_,UCHAR ucMaxDataSize_, ULONG ulResponseTime_ = 0);
@@ -113,7 +173,16 @@ class DSIFramerANT : public DSIFramer
 
       // Constuctor and Destructor
       DSIFramerANT();
-      DSIFramerANT(DSISerial *pclSerial_);
+      DSIFramerANT(DSISerial *pclSerial_, ULONG ulMessageQueueSize_ = DSI_FRAMER_ANT_MESSAGE_QUEUE_SIZE);
+      /////////////////////////////////////////////////////////////////
+      // Parameters:
+      //    ulMessageQueueSize_: The number of received messages that
+      //                      can be queued on the data lane before
+      //                      newer broadcasts are dropped, or
+      //                      DSI_FRAMER_ANT_EQUEUE_OVERFLOW is
+      //                      reported.  Rounded up to a power of two.
+      /////////////////////////////////////////////////////////////////
+
       ~DSIFramerANT();
 
       void SetCancelParameter(volatile BOOL *pbCancel_);
@@ -128,6 +197,8 @@ class DSIFramerANT : public DSIFramer
 
       // Inherited methods.
       void ProcessByte(UCHAR ucByte_);
+      void ProcessBytes(const UCHAR *pucBytes_, ULONG ulSize_);
+      ULONG GetBacklog(void);
       void Error(UCHAR ucError_);
 
       BOOL WriteMessage(void *pstANTMessage_, USHORT usMessageSize_);
@@ -166,6 +237,81 @@ class DSIFramerANT : public DSIFramer
       //          data[0] = DSI_SERIAL_EWRITE - the serial class reported an error writing a message, could be from a parameter error or device connection lost (if device connection lost a read error or device lost error will occur as well)
       //          data[0] = DSI_SERIAL_EREAD - the serial class reported a read failure (the read thread is aborted, device connection is lost)
       //          data[0] = DSI_SERIAL_DEVICE_GONE - the serial library reported the device connection is lost
+      //          data[0] = DSI_SERIAL_DEVICE_ARRIVED - a device was plugged in after the connection was lost; reopen the serial to resume
+      /////////////////////////////////////////////////////////////////
+
+      USHORT GetMessages(ANT_MESSAGE_ITEM *pastMessages_, USHORT usMaxMessages_, ULONG ulMilliseconds_, ULLONG *paullQueuedUs_ = (ULLONG*)NULL);
+      /////////////////////////////////////////////////////////////////
+      // Drains every queued message, up to usMaxMessages_, in one
+      // call, the control lane before the data lane.  Waits up to
+      // ulMilliseconds_ if both are empty.
+      // Parameters:
+      //    *pastMessages_:   An array of at least usMaxMessages_
+      //                      ANT_MESSAGE_ITEM structures.  The ucSize
+      //                      member of each holds the message size.
+      //    usMaxMessages_:   The maximum number of messages to copy.
+      //    ulMilliseconds_:  As per WaitForMessage().
+      //    *paullQueuedUs_:  Optional array of usMaxMessages_ that
+      //                      receives when each message was framed,
+      //                      in microseconds on
+      //                      std::chrono::steady_clock.
+      // Return:
+      //    The number of messages copied, 0 if none arrived in time.
+      //    DSI_FRAMER_ERROR if an error occured, in which case
+      //       pastMessages_[0].stANTMessage holds the error as per
+      //       GetMessage().
+      /////////////////////////////////////////////////////////////////
+
+      int GetEventFd() const;
+      /////////////////////////////////////////////////////////////////
+      // Returns a file descriptor that polls readable whenever the
+      // receive thread has queued messages or an error, so the
+      // framer can be waited on with select/poll/epoll together with
+      // other descriptors.  Returns -1 on platforms without eventfd.
+      // Call ClearEvent() before draining with GetMessages() so that
+      // messages queued during the drain re-arm the descriptor.
+      /////////////////////////////////////////////////////////////////
+
+      void ClearEvent();
+      /////////////////////////////////////////////////////////////////
+      // Resets the descriptor returned by GetEventFd().
+      /////////////////////////////////////////////////////////////////
+
+      void SetCapture(DSICaptureANT *pclCapture_);
+      /////////////////////////////////////////////////////////////////
+      // Records every message written to, and every valid message
+      // received from, the device.  The capture must outlive the
+      // framer or be detached with SetCapture(NULL) first.
+      // Parameters:
+      //    *pclCapture_:     An open capture, or NULL to stop.
+      /////////////////////////////////////////////////////////////////
+
+      void SetPriorityLanes(BOOL bEnable_);
+      /////////////////////////////////////////////////////////////////
+      // Turns the control lane on or off (the default).  With it off
+      // every message is queued in arrival order as before.  Call
+      // before messages arrive.
+      /////////////////////////////////////////////////////////////////
+
+      ULONG GetDroppedDataMessages(void);
+      /////////////////////////////////////////////////////////////////
+      // Number of broadcasts dropped because the data lane was full.
+      // Broadcasts repeat every channel period, so with the lanes on
+      // a full data lane drops the newest ones instead of reporting
+      // DSI_FRAMER_ANT_EQUEUE_OVERFLOW.  Acknowledged and burst data,
+      // channel events and a full control lane still report it.
+      /////////////////////////////////////////////////////////////////
+
+      static BOOL IsControlMessage(UCHAR ucMessageID_, UCHAR ucEventID_);
+      /////////////////////////////////////////////////////////////////
+      // Returns TRUE for the messages queued on the control lane:
+      // responses to commands and requested messages.  Channel data
+      // and channel events stay on the data lane, in order.
+      // Parameters:
+      //    ucMessageID_:     The received message ID.
+      //    ucEventID_:       Its second data byte, which for a
+      //                      response or event is the message ID it
+      //                      answers, or MESG_EVENT_ID.
       /////////////////////////////////////////////////////////////////
 
 
@@ -301,6 +447,85 @@ class DSIFramerANT : public DSIFramer
       BOOL SetRSSISearchThreshold(UCHAR ucANTChannel_, UCHAR ucSearchThreshold_, ULONG ulResponseTime_ = 0);
       BOOL EncryptedChannelEnable(UCHAR ucANTChannel_, UCHAR ucMode_, UCHAR ucVolatileKeyIndex_, UCHAR ucDecimationRate_, ULONG ulResponseTime_ = 0);
 
+      /////////////////////////////////////////////////////////////////
+      // Pipelined commands
+      // Each of these writes the command and returns without waiting
+      // for the response, so several commands can be in flight at
+      // once.  The handle must be passed to WaitForCommand() or
+      // WaitForCommands(), which release it.  Do not pipeline the same
+      // command twice for one channel, the responses are identical.
+      /////////////////////////////////////////////////////////////////
+      ANT_COMMAND_HANDLE SetNetworkKeyAsync(UCHAR ucNetworkNumber_, UCHAR *pucKey_);
+      ANT_COMMAND_HANDLE UnAssignChannelAsync(UCHAR ucANTChannel_);
+      ANT_COMMAND_HANDLE AssignChannelAsync(UCHAR ucANTChannel_, UCHAR ucChannelType_, UCHAR ucNetworkNumber_);
+      ANT_COMMAND_HANDLE SetChannelIDAsync(UCHAR ucANTChannel_, USHORT usDeviceNumber_, UCHAR ucDeviceType_, UCHAR ucTransmitType_);
+      ANT_COMMAND_HANDLE SetChannelPeriodAsync(UCHAR ucANTChannel_, USHORT usMessagePeriod_);
+      ANT_COMMAND_HANDLE SetChannelSearchTimeoutAsync(UCHAR ucANTChannel_, UCHAR ucSearchTimeout_);
+      ANT_COMMAND_HANDLE SetLowPriorityChannelSearchTimeoutAsync(UCHAR ucANTChannel_, UCHAR ucSearchTimeout_);
+      ANT_COMMAND_HANDLE SetChannelRFFrequencyAsync(UCHAR ucANTChannel_, UCHAR ucRFFrequency_);
+      ANT_COMMAND_HANDLE SetProximitySearchAsync(UCHAR ucANTChannel_, UCHAR ucSearchThreshold_);
+      ANT_COMMAND_HANDLE OpenChannelAsync(UCHAR ucANTChannel_);
+      ANT_COMMAND_HANDLE CloseChannelAsync(UCHAR ucANTChannel_);
+      /////////////////////////////////////////////////////////////////
+      // The handle completes with the response to the close command.
+      // The channel is only closed once the EVENT_CHANNEL_CLOSED event
+      // for it comes in with the other messages.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL IsCommandComplete(ANT_COMMAND_HANDLE hCommand_);
+      /////////////////////////////////////////////////////////////////
+      // Returns TRUE once the response to a pipelined command has
+      // arrived, or if the command was never written.  Does not
+      // release the handle.
+      /////////////////////////////////////////////////////////////////
+
+      UCHAR WaitForCommand(ANT_COMMAND_HANDLE hCommand_, ULONG ulResponseTime_);
+      /////////////////////////////////////////////////////////////////
+      // Waits for the response to a pipelined command and releases
+      // the handle.
+      // Parameters:
+      //    hCommand_:        Handle returned by one of the *Async()
+      //                      functions.
+      //    ulResponseTime_:  Time to wait for the response, in ms.
+      // Returns the response code (RESPONSE_NO_ERROR on success),
+      // DSI_FRAMER_ANT_COMMAND_EWRITE if the command was never sent or
+      // DSI_FRAMER_ANT_COMMAND_ETIMEOUT if no response arrived.
+      /////////////////////////////////////////////////////////////////
+
+      UCHAR WaitForCommands(ANT_COMMAND_HANDLE *pahCommands_, USHORT usCount_, ULONG ulResponseTime_, USHORT *pusFailedIndex_ = (USHORT*)NULL);
+      /////////////////////////////////////////////////////////////////
+      // Waits for a batch of pipelined commands and releases every
+      // handle in it.
+      // Parameters:
+      //    *pahCommands_:    Array of handles, in the order the
+      //                      commands were issued.
+      //    usCount_:         Number of handles in the array.
+      //    ulResponseTime_:  Time to wait for the whole batch, in ms.
+      //    *pusFailedIndex_: Set to the index of the first command
+      //                      that failed, MAX_USHORT if none did.
+      // Returns the result of the first failed command, in issue
+      // order, or RESPONSE_NO_ERROR if every command succeeded.
+      /////////////////////////////////////////////////////////////////
+
+      UCHAR ConfigureChannels(const ANT_CHANNEL_CONFIG *pastConfigs_, UCHAR ucCount_, ULONG ulResponseTime_, UCHAR *paucResults_ = (UCHAR*)NULL, UCHAR *paucFailedMesgIDs_ = (UCHAR*)NULL);
+      /////////////////////////////////////////////////////////////////
+      // Assigns, configures and optionally opens a set of channels
+      // with every command pipelined, so the batch costs about one
+      // round trip to the device instead of one per command.
+      // Parameters:
+      //    *pastConfigs_:    Channel configurations.
+      //    ucCount_:         Number of configurations.
+      //    ulResponseTime_:  Time to wait for the whole batch, in ms.
+      //    *paucResults_:    Optional array of ucCount_ entries, set
+      //                      to the result of each configuration.
+      //    *paucFailedMesgIDs_: Optional array of ucCount_ entries,
+      //                      set to the message ID of the first
+      //                      command that failed for each
+      //                      configuration, MAX_UCHAR if none did.
+      // Returns the result of the first failed command (see
+      // WaitForCommand()), or RESPONSE_NO_ERROR on success.
+      /////////////////////////////////////////////////////////////////
+
       /////////////////////////////////////////////////////////////////
       // The following are the synchronous RF event functions used to
       // update the synchronous data sent over a channel
@@ -426,7 +651,10 @@ class ANTMessageResponse
       // Variables
       ///////////////////////////////////////////////////////////////
       DSIFramerANT * pclFramer;
-      ANTMessageResponse * pclNext;
+      ANTMessageResponse * pclNext;                     // Next in the table bucket, or in the free list while pooled.
+      BOOL bAttached;
+      BOOL bPooled;
+      UCHAR ucBucket;
       UCHAR ucBytesToMatch;
       ANT_MESSAGE_ITEM stMessageItem;
       DSI_CONDITION_VAR stCondResponseReady;
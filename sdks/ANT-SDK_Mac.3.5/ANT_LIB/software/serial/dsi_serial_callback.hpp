@@ -28,6 +28,27 @@ class DSISerialCallback
       //    ucByte_:          The byte to process.
       /////////////////////////////////////////////////////////////////
 
+      virtual void ProcessBytes(const UCHAR *pucBytes_, ULONG ulSize_)
+      {
+         for (ULONG i = 0; i < ulSize_; i++)
+            ProcessByte(pucBytes_[i]);
+      }
+      /////////////////////////////////////////////////////////////////
+      // Processes a chunk of received bytes.  The default
+      // implementation hands each byte to ProcessByte(); callbacks
+      // that can frame a whole chunk at once should override it.
+      // Parameters:
+      //    *pucBytes_:       A pointer to the received bytes.
+      //    ulSize_:          The number of bytes to process.
+      /////////////////////////////////////////////////////////////////
+
+      virtual ULONG GetBacklog(void) { return 0; }
+      /////////////////////////////////////////////////////////////////
+      // Returns the number of received messages the callback has
+      // framed but not yet handed on.  Serial implementations that
+      // can outrun the application use this to hold back.
+      /////////////////////////////////////////////////////////////////
+
       virtual void Error(UCHAR ucError_) = 0;
       /////////////////////////////////////////////////////////////////
       // Signals an error.
@@ -0,0 +1,152 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+*/
+
+#if !defined(DSI_SERIAL_EMULATOR_HPP)
+#define DSI_SERIAL_EMULATOR_HPP
+
+#include "types.h"
+#include "dsi_thread.h"
+#include "dsi_serial.hpp"
+
+#include <atomic>
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Definitions
+//////////////////////////////////////////////////////////////////////////////////
+
+#define DSI_SERIAL_EMULATOR_MAX_CHANNELS      ((UCHAR) 32)  // Channel numbers are 5 bits on the wire.
+#define DSI_SERIAL_EMULATOR_MAX_ASSETS        ((UCHAR) 32)  // Asset indexes are 5 bits in the tracker pages.
+#define DSI_SERIAL_EMULATOR_CHUNK_SIZE        ((ULONG) 4096)  // Bytes handed to the callback at once, one USB transfer's worth.
+
+typedef struct
+{
+   USHORT usTrackers;                                       // Asset Tracker masters (device type 0x29, 16 Hz).
+   UCHAR ucAssetsPerTracker;                                // Assets reported by each tracker, 0 to DSI_SERIAL_EMULATOR_MAX_ASSETS.
+   USHORT usHeartRateMonitors;                              // Heart rate monitors (device type 0x78, 4 Hz).
+   USHORT usCollisions;                                     // Extra devices that reuse the channel ID of another device.
+   UCHAR ucMaxChannels;                                     // Channels reported in the capabilities, up to DSI_SERIAL_EMULATOR_MAX_CHANNELS.
+   SCHAR scRssiMin;                                         // Base RSSI of each device is drawn from this range, in dBm.
+   SCHAR scRssiMax;
+   UCHAR ucExtFlags;                                        // Extended data reported once RxExtMesgsEnable is on, unless set with the lib config message.
+   BOOL bSelectiveDataUpdates;                              // Report and support the Selective Data Update capability.
+   BOOL bEventBuffering;                                    // Report and support the Event Buffering capability.
+   ULONG ulDropoutMs;                                       // Time each device spends out of range per interval, 0 for never.
+   ULONG ulDropoutIntervalMs;
+   ULONG ulSerialNumber;                                    // Reported stick serial number.
+   ULONG ulSeed;                                            // Seed for device numbers, phases, positions and RSSI.
+   ULONG ulRssiSeed;                                        // Seed for the RSSI alone, 0 to draw it from ulSeed. Emulators with the same
+                                                            // ulSeed but different RSSI seeds act as sticks in different places.
+   ULONG ulUnplugAfterMs;                                   // Time after each Open() until the stick is pulled out, 0 for never.
+   ULONG ulReplugAfterMs;                                   // Time it then stays out before it is plugged back in, 0 for never.
+} DSI_SERIAL_EMULATOR_FLEET;
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Public Class Prototypes
+//////////////////////////////////////////////////////////////////////////////////
+
+// Emulates a USB stick and a fleet of ANT+ devices around it.
+//
+// The channel configuration commands, RxExtMesgsEnable, the lib config,
+// requests and acknowledged data are answered the way a stick would.
+// Open slave channels receive broadcasts in real time from every device
+// that matches their channel ID on the same RF frequency; a wildcard
+// channel locks on to the first matching device it hears, narrowed down by
+// its inclusion or exclusion list and any proximity threshold, while
+// channel 0 in continuous scan mode hears them all.  With dropouts
+// configured, devices go out of range in turn; a channel that misses a
+// few broadcasts drops back to search, within the high and low priority
+// search timeouts.  Channels configured for Selective Data Updates only
+// receive pages whose masked bytes changed.
+// Once event buffering is configured, broadcasts are held until the size
+// or time threshold is reached, or a response goes out, and then delivered
+// in one transfer.
+// Trackers answer page 70 requests over acknowledged data.
+// With an unplug time set, the stick goes quiet that long after each
+// Open(), reports DSI_SERIAL_DEVICE_GONE and fails writes and Open()
+// until it is plugged back in, which it reports with
+// DSI_SERIAL_DEVICE_ARRIVED.
+// Emulators with the same seed hear the same devices broadcast at the
+// same instants, like several sticks in one area.
+class DSISerialEmulator : public DSISerial
+{
+   private:
+
+      struct EMULATOR_STATE;
+
+      DSI_THREAD_ID hEmulatorThread;
+      DSI_MUTEX stMutexCriticalSection;
+      DSI_CONDITION_VAR stCondEmulator;                     // Wakes the emulator thread for responses or shutdown.
+      DSI_CONDITION_VAR stEventEmulatorThreadExit;
+      BOOL bStopEmulatorThread;
+
+      DSI_SERIAL_EMULATOR_FLEET stFleet;
+      UCHAR ucDeviceNumber;
+
+      // The containers live in the .cpp so the layout of this class does
+      // not depend on the standard library debug mode the SDK is built with.
+      EMULATOR_STATE *pstState;
+
+      std::atomic<ULONG> ulGeneratedMessages;
+
+      void CreateFleet(void);
+      void ResetChannels(void);
+      void HandleCommand(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_);
+      void HandleRequest(UCHAR ucChannel_, UCHAR ucRequestedID_);
+      void HandleAcknowledged(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_);
+      void QueueResponse(UCHAR ucChannel_, UCHAR ucMessageID_, UCHAR ucCode_);
+      void QueueMessage(UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_);
+      ULLONG Transmit(ULONG ulDevice_, ULLONG ullNow_);
+      ULLONG CheckSearchTimeouts(ULLONG ullNow_);
+      BOOL HoldBroadcasts(ULLONG ullNow_, ULLONG *pullFlushNs_);
+      BOOL IsUnplugged(ULLONG ullNow_);
+
+      void EmulatorThread(void);
+      static DSI_THREAD_RETURN ProcessThread(void *pvParameter_);
+
+   public:
+
+      DSISerialEmulator();
+      ~DSISerialEmulator();
+
+      static void InitFleet(DSI_SERIAL_EMULATOR_FLEET *pstFleet_);
+      /////////////////////////////////////////////////////////////////
+      // Fills in a default fleet: a handful of trackers and heart
+      // rate monitors, no collisions, 8 channels, RSSI reported.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL Init(const DSI_SERIAL_EMULATOR_FLEET *pstFleet_);
+      /////////////////////////////////////////////////////////////////
+      // Creates the emulated devices.
+      // Parameters:
+      //    *pstFleet_:       The fleet to emulate, NULL for the
+      //                      defaults from InitFleet().
+      // Returns TRUE if successful.
+      /////////////////////////////////////////////////////////////////
+
+      ULONG GetFleetSize(void);
+      /////////////////////////////////////////////////////////////////
+      // Number of emulated devices, collisions included.
+      /////////////////////////////////////////////////////////////////
+
+      ULONG GetGeneratedMessages(void);
+      /////////////////////////////////////////////////////////////////
+      // Number of broadcasts delivered on open channels so far.
+      /////////////////////////////////////////////////////////////////
+
+      // Methods inherited from the base class:
+      BOOL AutoInit();
+      BOOL Init(ULONG ulBaud_, UCHAR ucDeviceNumber_);
+      ULONG GetDeviceSerialNumber();
+
+      BOOL Open();
+      void Close(BOOL bReset = FALSE);
+      BOOL WriteBytes(void *pvData_, USHORT usSize_);
+      UCHAR GetDeviceNumber();
+};
+
+#endif // !defined(DSI_SERIAL_EMULATOR_HPP)
@@ -0,0 +1,30 @@
+/*
+This software is subject to the license described in the License.txt file
+included with this software distribution. You may not use this file except
+in compliance with this license.
+*/
+#if !defined(DSI_SERIAL_FRAMES_HPP)
+#define DSI_SERIAL_FRAMES_HPP
+
+#include "types.h"
+
+#include <vector>
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Internal helpers of the capture, replay and emulator serials.
+//////////////////////////////////////////////////////////////////////////////////
+
+void SerialFrames_Append(std::vector<UCHAR> &clBytes_, UCHAR ucMessageID_, const UCHAR *pucData_, UCHAR ucLength_);
+/////////////////////////////////////////////////////////////////
+// Appends an ANT message to clBytes_ framed as the stick sends
+// it, with sync byte, length, ID and checksum.
+/////////////////////////////////////////////////////////////////
+
+ULLONG SerialFrames_GetTimestamp(void);
+/////////////////////////////////////////////////////////////////
+// Returns the monotonic time in nanoseconds that captured,
+// replayed and emulated traffic is timed against.
+/////////////////////////////////////////////////////////////////
+
+#endif // !defined(DSI_SERIAL_FRAMES_HPP)
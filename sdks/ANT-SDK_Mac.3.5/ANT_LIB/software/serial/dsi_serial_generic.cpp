@@ -259,6 +259,8 @@ BOOL DSISerialGeneric::Open(void)
       return FALSE;
    }
 
+   pclDeviceHandle->SetWriteErrorCallback(&DSISerialGeneric::WriteFailed, this);
+
 
    if(DSIThread_MutexInit(&stMutexCriticalSection) != DSI_THREAD_ENONE)
    {
@@ -354,6 +356,30 @@ UCHAR DSISerialGeneric::GetDeviceNumber()
    return ucDeviceNumber;
 }
 
+///////////////////////////////////////////////////////////////////////
+void DSISerialGeneric::SetRxTransferCount(UCHAR ucCount_)
+{
+   USBDeviceHandle::SetRxTransferCount(ucCount_);
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialGeneric::GetRxStats(USB_RX_STATS& stStats_)
+{
+   if(pclDeviceHandle == NULL)
+      return FALSE;
+
+   return pclDeviceHandle->GetRxStats(stStats_);
+}
+
+///////////////////////////////////////////////////////////////////////
+BOOL DSISerialGeneric::GetTxStats(USB_TX_STATS& stStats_)
+{
+   if(pclDeviceHandle == NULL)
+      return FALSE;
+
+   return pclDeviceHandle->GetTxStats(stStats_);
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Private Methods
 //////////////////////////////////////////////////////////////////////////////////
@@ -371,8 +397,7 @@ void DSISerialGeneric::ReceiveThread(void)
       switch(eStatus)
       {
          case USBError::NONE:
-            for(ULONG i=0; i<ulRxBytesRead; i++)
-               pclCallback->ProcessByte(aucData[i]);
+            pclCallback->ProcessBytes(aucData, ulRxBytesRead);
             break;
 
          case USBError::DEVICE_GONE:
@@ -404,6 +429,17 @@ DSI_THREAD_RETURN DSISerialGeneric::ProcessThread(void* pvParameter_)
    return 0;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Called on the handle's writer thread when bytes an earlier
+// WriteBytes() queued could not be sent.
+///////////////////////////////////////////////////////////////////////
+void DSISerialGeneric::WriteFailed(void* pvParameter_)
+{
+   DSISerialGeneric* This = (DSISerialGeneric*)pvParameter_;
+   if(This->pclCallback != NULL)
+      This->pclCallback->Error(DSI_SERIAL_EWRITE);
+}
+
 
 //NOTE: The USBReset was originally added due to issues in the USB1 (two processor) usb stick that would occasionally have synch issues requiring a reset
 // to remedy. It appears this reset is of no use for USB2s, and in fact is documented in device_handle_libusb PClose() as potentially causing errors with usb2s.
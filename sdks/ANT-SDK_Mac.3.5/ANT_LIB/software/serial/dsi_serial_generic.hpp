@@ -43,6 +43,7 @@ class DSISerialGeneric : public DSISerial
       // Private Member Functions
       void ReceiveThread();
       static DSI_THREAD_RETURN ProcessThread(void *pvParameter_);
+      static void WriteFailed(void *pvParameter_);
 
    public:
       DSISerialGeneric();
@@ -54,6 +55,24 @@ class DSISerialGeneric : public DSISerial
       void USBReset();
       UCHAR GetNumberOfDevices();
 
+      static void SetRxTransferCount(UCHAR ucCount_);
+      /////////////////////////////////////////////////////////////////
+      // As per USBDeviceHandle::SetRxTransferCount().  Applies to
+      // sticks opened after the call.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL GetRxStats(USB_RX_STATS& stStats_);
+      /////////////////////////////////////////////////////////////////
+      // Copies the receive pipeline counters of the open stick.
+      // Returns FALSE if no stick is open or its handle keeps none.
+      /////////////////////////////////////////////////////////////////
+
+      BOOL GetTxStats(USB_TX_STATS& stStats_);
+      /////////////////////////////////////////////////////////////////
+      // Copies the transmit counters of the open stick.
+      // Returns FALSE if no stick is open or its handle keeps none.
+      /////////////////////////////////////////////////////////////////
+
       // Methods inherited from the base class:
       BOOL AutoInit();
       ULONG GetDeviceSerialNumber();
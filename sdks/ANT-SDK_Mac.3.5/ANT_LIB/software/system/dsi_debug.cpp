@@ -19,11 +19,11 @@ All rights reserved.
 #include <string.h>
 #include <stdarg.h>
 
+#include <atomic>
 
 #define NEW_SESSION_MESG         "New Session.\n"
 
-#define OVERFLOW_ERROR           "\n*** ERROR: BUFFER OVERFLOW! ***\n"
-#define OVERFLOW_ERROR_LENGTH    33
+#define DROPPED_ERROR            "\n*** ERROR: %lu RECORD(S) DROPPED, LOG RING FULL! ***\n"
 
 #define TRUNCATE_ERROR           " *** TRUNCATED! ***"
 #define WRITE_ERROR              "\n*** WRITE ERROR ***\n"
@@ -32,73 +32,52 @@ All rights reserved.
 #define MAX_PORTS                ((UCHAR)255)
 #define MAX_THREADS              ((UCHAR)10)
 
-#define THREAD_EXIT_TIMEOUT      ((ULONG)30)
+#define THREAD_EXIT_TIMEOUT      ((ULONG)3000)
 #define MUTEX_UNLOCK_DELAY       ((UCHAR)10) //milliseconds to wait for other threads to unlock mutexs
 
-//Buffer class defines//
+//Log ring defines//
 
-#define BUFFER_SIZE_NO_CAST      (0xFFFF)   //Must be >= DSI_DEBUG_MAX_STRLEN  && < MAX_ULONG - OVERFLOW_ERROR_LENGTH - 1
-#define BUFFER_SIZE              ((ULONG)BUFFER_SIZE_NO_CAST)
-#if BUFFER_SIZE_NO_CAST == 0
-   #error
-#endif
+#define MAX_RINGS                ((UCHAR)32)      //Threads that can log at once; a ring is handed on when its thread exits
+#define RING_SIZE                ((ULONG)0x10000) //Bytes per ring
+#define RING_ALIGN               ((ULONG)8)       //Keeps every record header aligned
+#define MAX_HEADER_LENGTH        ((UCHAR)63)      //Longest SerialWrite() header kept
+#define WRITE_PERIOD             ((ULONG)50)      //Milliseconds between passes of the writer thread
 
-#define ACTUAL_BUFFER_SIZE       ((ULONG)(BUFFER_SIZE + OVERFLOW_ERROR_LENGTH + 1))
-      //Buffer size including room for the error message and plus one so we know the buffer is empty if the pointers equal each other
-#define FLUSH_PERCENT            ((UCHAR)50)
-#define FLUSH_CHECK_PERIOD       ((ULONG)5000)
+#define RECORD_PAD               ((UCHAR)0)       //Skips to the start of the ring
+#define RECORD_SERIAL            ((UCHAR)1)
+#define RECORD_THREAD            ((UCHAR)2)
+
+static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "RING_SIZE must be a power of two");
 
 
 BOOL DSIDebug::bInitialized = FALSE;
 
 //////////////////////////////////////////////////////////
-// Buffer Class Declaration
+// Log File Class Declaration
 //////////////////////////////////////////////////////////
 
-class Buffer
+//A file the writer thread appends formatted records to.
+//Only the writer thread writes to it, apart from Close().
+class LogFile
 {
  public:
-   Buffer(UCHAR* pucFilename_, UCHAR* pucDirectory_);
-   ~Buffer();
-   BOOL Add(UCHAR* pucString_, ULONG ulSize_);
+   LogFile(UCHAR* pucFilename_, UCHAR* pucDirectory_);
+   ~LogFile();
+   BOOL Write(const char* pcString_, ULONG ulSize_);
+   void Flush();
 
    void SetEnable(BOOL bEnable_);
+   BOOL IsEnabled();
    BOOL SetDirectory(const UCHAR* pucDirectory_);
 
  private:
 
-   BOOL bEnable;
-
-   BOOL Flush();
-   ULONG GetBufferCount();
-   UCHAR GetPercentFull();
-   void WriteThread();
-   static DSI_THREAD_RETURN StartWriteThread(void* pvParam_);
-
-   //Helper functions
-   void SignalFlush();
-
-   ULONG ulInput;
-   ULONG ulOutput;
-
-   DSI_MUTEX stInputMutex;
-   DSI_MUTEX stFilenameMutex;
-   DSI_MUTEX stFlushMutex;
-   DSI_CONDITION_VAR stFlushCond;
+   volatile BOOL bEnable;
+   BOOL bDirty;
 
+   FILE* pfFile;
    UCHAR aucFilename[MAX_NAME_LENGTH];
    UCHAR aucFullPath[MAX_NAME_LENGTH];
-   UCHAR aucData[ACTUAL_BUFFER_SIZE];
-
-   //Thread variables
-   BOOL bWriteThreadExit;
-   DSI_THREAD_ID hWriteThreadID;
-   DSI_MUTEX stWriteThreadMutex;
-   DSI_CONDITION_VAR stWriteThreadCond;
-
-   BOOL bBufferOverflow;
-   volatile BOOL bForceFlush;
-
 };
 
 
@@ -111,7 +90,7 @@ typedef struct _TASK_PROP
    _TASK_PROP(DSI_THREAD_IDNUM hThreadIDNum_, UCHAR* pucFilename_, UCHAR* pucDirectory_)
    {
       hThreadIDNum = hThreadIDNum_;
-      pclBuffer = new Buffer(pucFilename_, pucDirectory_);
+      pclBuffer = new LogFile(pucFilename_, pucDirectory_);
    }
 
    ~_TASK_PROP()
@@ -121,17 +100,59 @@ typedef struct _TASK_PROP
    }
 
    DSI_THREAD_IDNUM hThreadIDNum;
-   Buffer* pclBuffer;
+   LogFile* pclBuffer;
 } THREAD_PROP;
 
+//A record as it sits in a ring, followed by its payload: the header string
+//and data bytes of a SerialWrite(), or the message of a ThreadWrite().
+typedef struct
+{
+   USHORT usSize;                //Payload bytes
+   UCHAR ucKind;
+   UCHAR ucIndex;                //Port or thread number
+   UCHAR ucHeaderLength;         //Serial records: header bytes at the start of the payload
+   ULONG ulTime;
+   ULONG ulStartTime;
+   ULONG ulDropped;              //Records the ring dropped before this one
+} RECORD;
+
+//Single producer, single consumer ring of records.  The thread that owns it
+//moves ulHead, the writer thread moves ulTail; neither ever waits for the other.
+typedef struct
+{
+   std::atomic<ULONG> ulHead;
+   std::atomic<ULONG> ulTail;
+   std::atomic<ULONG> ulDropped;
+   std::atomic<BOOL> bOwned;
+   ULONG ulDroppedReported;      //Drops already noted in a file, writer thread only
+   UCHAR aucData[RING_SIZE];
+} LOG_RING;
+
+//Gives the ring of a thread back when the thread exits
+class RingOwner
+{
+ public:
+   LOG_RING* pstRing;
+   RingOwner() { pstRing = (LOG_RING*)NULL; }
+   ~RingOwner() { if(pstRing) pstRing->bOwned.store(FALSE, std::memory_order_release); }
+};
+
 //Private Function Declarations
 BOOL FindThreadNum(UCHAR* pucNum_);
+static LOG_RING* GetThreadRing();
+static BOOL PushRecord(UCHAR ucKind_, UCHAR ucIndex_, const char* pcHeader_, UCHAR ucHeaderLength_, const UCHAR* pucData_, USHORT usSize_);
+static BOOL DrainRing(LOG_RING* pstRing_);
+static void WriteDropped(LOG_RING* pstRing_, LogFile* pclFile_, ULONG ulDropped_);
+static void FormatRecord(const RECORD* pstRecord_, const UCHAR* pucPayload_);
+static LogFile* GetRecordFile(const RECORD* pstRecord_);
+static void WriteThread();
+static DSI_THREAD_RETURN StartWriteThread(void* pvParam_);
 
 
 //Private Variables
 ULONG ulStartTime;
 BOOL bWriteEnable;
-Buffer* apclSerialBuffer[MAX_PORTS];
+LogFile* apclSerialBuffer[MAX_PORTS];
 THREAD_PROP* apstThread[MAX_THREADS];
 
 UCHAR aucLogDirectory[MAX_NAME_LENGTH];
@@ -140,6 +161,19 @@ UCHAR aucExecutablePath[MAX_NAME_LENGTH];
 DSI_MUTEX stThreadBufferMutex;
 DSI_MUTEX stSerialBufferMutex;
 
+//Rings are never freed, as a thread may still hold one while another closes
+//the debug output; they are reused instead.
+static LOG_RING* apstRings[MAX_RINGS];
+static DSI_MUTEX stRingMutex;
+static thread_local RingOwner clRingOwner;
+static std::atomic<ULONG> ulDroppedRecords(0);
+
+static DSI_THREAD_ID hWriteThreadID;
+static DSI_MUTEX stWriteThreadMutex;
+static DSI_CONDITION_VAR stWriteThreadCond;
+static DSI_CONDITION_VAR stWriteThreadExitCond;
+static volatile BOOL bWriteThreadExit;
+
 
 //////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////
@@ -155,6 +189,8 @@ DSI_MUTEX stSerialBufferMutex;
 //Warning: Not thread safe!
 BOOL DSIDebug::Init()
 {
+   static BOOL bRingsInitialized = FALSE;
+
    if(bInitialized)
       return TRUE;
 
@@ -166,7 +202,7 @@ BOOL DSIDebug::Init()
    STRNCPY((char*)aucLogDirectory, (char*)aucExecutablePath, MAX_NAME_LENGTH);
 
    for(UCHAR i=0; i<MAX_PORTS; i++)
-      apclSerialBuffer[i] = (Buffer*)NULL;
+      apclSerialBuffer[i] = (LogFile*)NULL;
 
    for(UCHAR i=0; i<MAX_THREADS; i++)
       apstThread[i] = (THREAD_PROP*)NULL;
@@ -174,6 +210,29 @@ BOOL DSIDebug::Init()
    DSIThread_MutexInit(&stThreadBufferMutex);
    DSIThread_MutexInit(&stSerialBufferMutex);
 
+   if(!bRingsInitialized)
+   {
+      for(UCHAR i=0; i<MAX_RINGS; i++)
+         apstRings[i] = (LOG_RING*)NULL;
+      DSIThread_MutexInit(&stRingMutex);
+      bRingsInitialized = TRUE;
+   }
+
+   DSIThread_MutexInit(&stWriteThreadMutex);
+   DSIThread_CondInit(&stWriteThreadCond);
+   DSIThread_CondInit(&stWriteThreadExitCond);
+   bWriteThreadExit = FALSE;
+   hWriteThreadID = DSIThread_CreateThread(&StartWriteThread, NULL);
+   if(!hWriteThreadID)
+   {
+      DSIThread_MutexDestroy(&stThreadBufferMutex);
+      DSIThread_MutexDestroy(&stSerialBufferMutex);
+      DSIThread_MutexDestroy(&stWriteThreadMutex);
+      DSIThread_CondDestroy(&stWriteThreadCond);
+      DSIThread_CondDestroy(&stWriteThreadExitCond);
+      return FALSE;
+   }
+
    bInitialized = TRUE;
    return TRUE;
 }
@@ -185,15 +244,46 @@ void DSIDebug::Close()
       return;
 
    bWriteEnable = FALSE;
+   DSIThread_Sleep(MUTEX_UNLOCK_DELAY);  //Let any records being written land in their rings.
+
+   //Stop the writer thread, which writes out what is still in the rings
+   DSIThread_MutexLock(&stWriteThreadMutex);
+   if(hWriteThreadID)
+   {
+      bWriteThreadExit = TRUE;
+      DSIThread_CondSignal(&stWriteThreadCond);
+
+      if(DSIThread_CondTimedWait(&stWriteThreadExitCond, &stWriteThreadMutex, THREAD_EXIT_TIMEOUT) != DSI_THREAD_ENONE)
+      {
+         DSIThread_DestroyThread(hWriteThreadID);
+      }
+      DSIThread_ReleaseThreadID(hWriteThreadID);
+      hWriteThreadID = (DSI_THREAD_ID)NULL;
+   }
+   DSIThread_MutexUnlock(&stWriteThreadMutex);
+
+   DSIThread_MutexDestroy(&stWriteThreadMutex);
+   DSIThread_CondDestroy(&stWriteThreadCond);
+   DSIThread_CondDestroy(&stWriteThreadExitCond);
 
-   //Clean up all the buffers
+   //Forget anything the writer thread did not get to, so a later Init() does not write it to the new files
+   for(UCHAR i=0; i<MAX_RINGS; i++)
+   {
+      if(apstRings[i] != NULL)
+      {
+         apstRings[i]->ulTail.store(apstRings[i]->ulHead.load(std::memory_order_acquire), std::memory_order_release);
+         apstRings[i]->ulDroppedReported = apstRings[i]->ulDropped.load(std::memory_order_relaxed);
+      }
+   }
+
+   //Clean up all the files
    DSIThread_MutexLock(&stSerialBufferMutex);
    for(UCHAR i=0; i<MAX_PORTS; i++)
    {
       if(apclSerialBuffer[i] != NULL)
       {
          delete apclSerialBuffer[i];
-         apclSerialBuffer[i] = (Buffer*)NULL;
+         apclSerialBuffer[i] = (LogFile*)NULL;
       }
    }
    DSIThread_MutexUnlock(&stSerialBufferMutex);
@@ -229,15 +319,16 @@ BOOL DSIDebug::ResetTime()
    if(!bWriteEnable)
       return FALSE;
 
+   //Each file gets the message when the writer thread gets to it
    for(UCHAR i=0; i<MAX_THREADS; i++)
    {
       if(apstThread[i] != NULL)
-        apstThread[i]->pclBuffer->Add((UCHAR*)NEW_SESSION_MESG, sizeof(NEW_SESSION_MESG)-1);
+         PushRecord(RECORD_THREAD, i, (const char*)NULL, 0, (const UCHAR*)NEW_SESSION_MESG, sizeof(NEW_SESSION_MESG)-1);
    }
    for(UCHAR i=0; i<MAX_PORTS; i++)
    {
       if(apclSerialBuffer[i] != NULL)
-        apclSerialBuffer[i]->Add((UCHAR*)NEW_SESSION_MESG, sizeof(NEW_SESSION_MESG)-1);
+         PushRecord(RECORD_SERIAL, i, NEW_SESSION_MESG, sizeof(NEW_SESSION_MESG)-1, (const UCHAR*)NULL, 0);
    }
 
    return TRUE;
@@ -254,6 +345,8 @@ BOOL DSIDebug::SetDirectory(const char* pcDirectory_)
    else
       SNPRINTF((char*)aucLogDirectory, MAX_NAME_LENGTH, "%s", pcDirectory_);
 
+   //The writer thread must not be between records while the files move
+   DSIThread_MutexLock(&stWriteThreadMutex);
    for(UCHAR i=0; i<MAX_THREADS; i++)
    {
       if(apstThread[i] != NULL)
@@ -264,6 +357,7 @@ BOOL DSIDebug::SetDirectory(const char* pcDirectory_)
       if(apclSerialBuffer[i] != NULL)
          apclSerialBuffer[i]->SetDirectory(aucLogDirectory);
    }
+   DSIThread_MutexUnlock(&stWriteThreadMutex);
 
    return TRUE;
 }
@@ -330,21 +424,15 @@ BOOL DSIDebug::ThreadWrite(const char* pcMessage_)
    if(!FindThreadNum(&ucThreadNum))
       return FALSE;
 
-   if(apstThread[ucThreadNum] == NULL)
+   if(apstThread[ucThreadNum] == NULL || !apstThread[ucThreadNum]->pclBuffer->IsEnabled())
       return FALSE;
 
+   //The writer thread adds the timestamps and the truncation error
+   size_t uLength = strlen(pcMessage_);
+   if(uLength > DSI_DEBUG_MAX_STRLEN)
+      uLength = DSI_DEBUG_MAX_STRLEN;
 
-   char acString[DSI_DEBUG_MAX_STRLEN];
-   ULONG ulCurrentTime = DSIThread_GetSystemTime();
-
-   SNPRINTF(acString, DSI_DEBUG_MAX_STRLEN, "%10.3f {%10lu}: %s\n", (ulCurrentTime-ulStartTime)/1000.0, ulCurrentTime, pcMessage_);
-   ULONG totalLen = strlen(acString);
-
-   //If we are too long, than overwrite the truncate error to the end
-   if(totalLen >= DSI_DEBUG_MAX_STRLEN-1)
-      SNPRINTF(acString + DSI_DEBUG_MAX_STRLEN - 2 - strlen(TRUNCATE_ERROR), strlen(TRUNCATE_ERROR)+2, "%s\n", TRUNCATE_ERROR);
-
-   return apstThread[ucThreadNum]->pclBuffer->Add((UCHAR*)acString, totalLen);
+   return PushRecord(RECORD_THREAD, ucThreadNum, (const char*)NULL, 0, (const UCHAR*)pcMessage_, (USHORT)uLength);
 }
 
 BOOL DSIDebug::ThreadPrintf(const char* pcMessage_, ...)
@@ -388,10 +476,10 @@ BOOL DSIDebug::SerialWrite(UCHAR ucPortNum_, const char* pcHeader_, UCHAR* pucDa
    if(!bWriteEnable)
       return FALSE;
 
-   //Check if the serial buffer has been created yet
+   //Check if the serial file has been created yet
    if(apclSerialBuffer[ucPortNum_] == NULL)  //is just here so you don't lock the mutex every time you write.
    {
-      DSIThread_MutexLock(&stSerialBufferMutex);   //Note: remember this mutex is shared among every thread that writes to any serial buffer!
+      DSIThread_MutexLock(&stSerialBufferMutex);   //Note: remember this mutex is shared among every thread that writes to any serial file!
       if(apclSerialBuffer[ucPortNum_] == NULL && bWriteEnable)
       {
          UCHAR aucString[MAX_NAME_LENGTH];
@@ -400,44 +488,25 @@ BOOL DSIDebug::SerialWrite(UCHAR ucPortNum_, const char* pcHeader_, UCHAR* pucDa
          #else
             SNPRINTF((char*)aucString, MAX_NAME_LENGTH, "Device%u.txt", ucPortNum_);
          #endif
-         apclSerialBuffer[ucPortNum_] = new Buffer(aucString, aucLogDirectory);
+         apclSerialBuffer[ucPortNum_] = new LogFile(aucString, aucLogDirectory);
       }
       DSIThread_MutexUnlock(&stSerialBufferMutex);
    }
 
-   if(apclSerialBuffer[ucPortNum_] == NULL || !bWriteEnable)
+   if(apclSerialBuffer[ucPortNum_] == NULL || !bWriteEnable || !apclSerialBuffer[ucPortNum_]->IsEnabled())
       return FALSE;
 
-   //Get the current time
-   ULONG ulCurrentTime = DSIThread_GetSystemTime();
+   if(pcHeader_ == NULL)
+      pcHeader_ = "NULL";
+   if(pucData_ == NULL)
+      usSize_ = 0;
 
-   //Compose the string
-   char acString[DSI_DEBUG_MAX_STRLEN];
-   SNPRINTF(acString, DSI_DEBUG_MAX_STRLEN, "%10.3f {%10lu} %s - %s", (ulCurrentTime-ulStartTime)/1000.0, ulCurrentTime, pcHeader_ != NULL ? (char*)pcHeader_ : "NULL", usSize_ == 0 ? "NO DATA\n" : "");
-   ULONG ulStringLength = strlen(acString);
+   //Copied as is; the writer thread formats the bytes
+   size_t uHeaderLength = strlen(pcHeader_);
+   if(uHeaderLength > MAX_HEADER_LENGTH)
+      uHeaderLength = MAX_HEADER_LENGTH;
 
-   if(usSize_ != 0 && ulStringLength < (DSI_DEBUG_MAX_STRLEN - 6))   //6 is room to display at least one byte
-   {
-      //Write all the bytes we can and put '\n' on the last one
-      char* currentPos = acString + ulStringLength;
-      USHORT usMaxDataCount = (USHORT)MIN(usSize_, (DSI_DEBUG_MAX_STRLEN-2-ulStringLength)/4); //2 is room for the closing "\n\0"
-      for(USHORT i=0; i < usMaxDataCount-1; ++i)
-      {
-         SNPRINTF(currentPos, 5, "[%02X]", pucData_[i]);
-         currentPos += 4;
-      }
-      SNPRINTF(currentPos, 6, "[%02X]\n", pucData_[usMaxDataCount-1]);
-
-      //Update our string length
-      ulStringLength += ((ULONG)usMaxDataCount*4) + 1; //4*bytes + '\n'
-   }
-
-   //If we are too long, than overwrite the truncate error to the end
-   if(ulStringLength >= DSI_DEBUG_MAX_STRLEN-1)
-      SNPRINTF(acString + DSI_DEBUG_MAX_STRLEN - 2 - strlen(TRUNCATE_ERROR), strlen(TRUNCATE_ERROR)+2, "%s\n", TRUNCATE_ERROR);
-
-   //Add the string to the buffer
-   return apclSerialBuffer[ucPortNum_]->Add((UCHAR*)acString, ulStringLength);
+   return PushRecord(RECORD_SERIAL, ucPortNum_, pcHeader_, (UCHAR)uHeaderLength, pucData_, usSize_);
 }
 
 BOOL DSIDebug::SerialEnable(UCHAR ucPortNum_, BOOL bEnable_)
@@ -457,6 +526,11 @@ void DSIDebug::SetDebug(BOOL bDebugOn_)
    bWriteEnable = bDebugOn_;
 }
 
+ULONG DSIDebug::GetDroppedRecords()
+{
+   return ulDroppedRecords.load(std::memory_order_relaxed);
+}
+
 
 //////////////////////////////////////////////////////////
 // Private Definitions
@@ -493,337 +567,361 @@ BOOL FindThreadNum(UCHAR* pucNum_)
    return bNotFull;
 }
 
+//Returns the ring of the calling thread, taking a free one the first time.
+//The lock is only taken then; after that logging never waits.
+static LOG_RING* GetThreadRing()
+{
+   if(clRingOwner.pstRing != NULL)
+      return clRingOwner.pstRing;
 
+   DSIThread_MutexLock(&stRingMutex);
+   for(UCHAR i=0; i<MAX_RINGS && clRingOwner.pstRing == NULL; i++)
+   {
+      if(apstRings[i] == NULL)
+      {
+         apstRings[i] = new LOG_RING;
+         apstRings[i]->ulHead.store(0);
+         apstRings[i]->ulTail.store(0);
+         apstRings[i]->ulDropped.store(0);
+         apstRings[i]->ulDroppedReported = 0;
+         apstRings[i]->bOwned.store(TRUE);
+         clRingOwner.pstRing = apstRings[i];
+      }
+      else if(!apstRings[i]->bOwned.load(std::memory_order_acquire))
+      {
+         //Left by a thread that exited; the writer thread still drains what it left
+         apstRings[i]->bOwned.store(TRUE);
+         clRingOwner.pstRing = apstRings[i];
+      }
+   }
+   DSIThread_MutexUnlock(&stRingMutex);
 
-//////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////
-////////                   Buffer Class                           ////////
-//////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////
-
-//////////////////////////////////////////////////////////
-// Public Definitions
-//////////////////////////////////////////////////////////
+   return clRingOwner.pstRing;
+}
 
-Buffer::Buffer(UCHAR* pucFilename_, UCHAR* pucDirectory_)
+//Copies a record into the ring of the calling thread.  Returns FALSE, and
+//counts the record as dropped, if there is no room; it never waits.
+static BOOL PushRecord(UCHAR ucKind_, UCHAR ucIndex_, const char* pcHeader_, UCHAR ucHeaderLength_, const UCHAR* pucData_, USHORT usSize_)
 {
-   if(pucFilename_ == NULL || pucDirectory_ == NULL)
+   LOG_RING* pstRing = GetThreadRing();
+   if(pstRing == NULL)
    {
-      bEnable = FALSE;
-      return;
+      ulDroppedRecords++;
+      return FALSE;
    }
 
-   STRNCPY((char*)aucFilename, (char*)pucFilename_, MAX_NAME_LENGTH);
-   SNPRINTF((char*)aucFullPath, MAX_NAME_LENGTH, "%s%s", pucDirectory_, aucFilename);
-
-   DSIThread_MutexInit(&stInputMutex);
-
-   bEnable = TRUE;
-   ulInput = 0;
-   ulOutput = 0;
+   ULONG ulPayload = (ULONG)ucHeaderLength_ + usSize_;
+   ULONG ulNeeded = (sizeof(RECORD) + ulPayload + RING_ALIGN - 1) & ~(RING_ALIGN - 1);
+   ULONG ulHead = pstRing->ulHead.load(std::memory_order_relaxed);
+   ULONG ulTail = pstRing->ulTail.load(std::memory_order_acquire);
+   ULONG ulOffset = ulHead & (RING_SIZE - 1);
+   ULONG ulPad = (RING_SIZE - ulOffset < ulNeeded) ? RING_SIZE - ulOffset : 0;   //Records do not wrap
 
-   //Filename Mutex
-   DSIThread_MutexInit(&stFilenameMutex);
-
-   //Thread variables
-   DSIThread_MutexInit(&stFlushMutex);
-   DSIThread_CondInit(&stFlushCond);
-   bForceFlush = FALSE;
-   bBufferOverflow = FALSE;
+   if(ulPayload > 0xFFFF || RING_SIZE - (ulHead - ulTail) < ulPad + ulNeeded)
+   {
+      pstRing->ulDropped++;
+      ulDroppedRecords++;
+      return FALSE;
+   }
 
-   DSIThread_MutexInit(&stWriteThreadMutex);
-   DSIThread_CondInit(&stWriteThreadCond);
-   bWriteThreadExit = FALSE;
+   if(ulPad)
+   {
+      RECORD* pstPad = (RECORD*)&pstRing->aucData[ulOffset];
+      pstPad->ucKind = RECORD_PAD;
+      ulOffset = 0;
+   }
 
-   hWriteThreadID = DSIThread_CreateThread(&Buffer::StartWriteThread, this);
+   RECORD* pstRecord = (RECORD*)&pstRing->aucData[ulOffset];
+   pstRecord->usSize = (USHORT)ulPayload;
+   pstRecord->ucKind = ucKind_;
+   pstRecord->ucIndex = ucIndex_;
+   pstRecord->ucHeaderLength = ucHeaderLength_;
+   pstRecord->ulTime = DSIThread_GetSystemTime();
+   pstRecord->ulStartTime = ulStartTime;
+   pstRecord->ulDropped = pstRing->ulDropped.load(std::memory_order_relaxed);
+
+   UCHAR* pucPayload = (UCHAR*)(pstRecord + 1);
+   if(ucHeaderLength_)
+      memcpy(pucPayload, pcHeader_, ucHeaderLength_);
+   if(usSize_)
+      memcpy(pucPayload + ucHeaderLength_, pucData_, usSize_);
+
+   pstRing->ulHead.store(ulHead + ulPad + ulNeeded, std::memory_order_release);
+
+   //Wake the writer thread early once the ring is half full.  Signalling
+   //does not need the lock; if the writer is not waiting it is draining.
+   if(ulHead - ulTail < RING_SIZE/2 && ulHead + ulPad + ulNeeded - ulTail >= RING_SIZE/2)
+      DSIThread_CondSignal(&stWriteThreadCond);
 
+   return TRUE;
 }
 
-Buffer::~Buffer()
+//Formats and writes out every record in a ring.  Returns TRUE if there were any.
+static BOOL DrainRing(LOG_RING* pstRing_)
 {
-   //Handle output - Exit write thread
-   DSIThread_MutexLock(&stWriteThreadMutex);
-   if(hWriteThreadID)
-   {
+   ULONG ulTail = pstRing_->ulTail.load(std::memory_order_relaxed);
+   ULONG ulHead = pstRing_->ulHead.load(std::memory_order_acquire);
+   LogFile* pclLastFile = (LogFile*)NULL;
 
-      bWriteThreadExit = TRUE;
+   if(ulTail == ulHead)
+      return FALSE;
 
-      //Signal thread to exit.
-      SignalFlush();
+   while(ulTail != ulHead)
+   {
+      ULONG ulOffset = ulTail & (RING_SIZE - 1);
+      const RECORD* pstRecord = (const RECORD*)&pstRing_->aucData[ulOffset];
 
-      //Wait for thread to exit.
-      if(DSIThread_CondTimedWait(&stWriteThreadCond, &stWriteThreadMutex, THREAD_EXIT_TIMEOUT) != DSI_THREAD_ENONE)
+      if(pstRecord->ucKind == RECORD_PAD)
       {
-         DSIThread_DestroyThread(hWriteThreadID);
+         ulTail += RING_SIZE - ulOffset;
+         continue;
       }
-      DSIThread_ReleaseThreadID(hWriteThreadID);
-      hWriteThreadID = (DSI_THREAD_ID)NULL;
-   }
-   DSIThread_MutexUnlock(&stWriteThreadMutex);
-
-   DSIThread_MutexDestroy(&stWriteThreadMutex);
-   DSIThread_CondDestroy(&stWriteThreadCond);
-
 
+      //Drops are noted in the file of the next record that made it
+      pclLastFile = GetRecordFile(pstRecord);
+      WriteDropped(pstRing_, pclLastFile, pstRecord->ulDropped);
 
-   //Handle input
-   DSIThread_MutexLock(&stInputMutex);
-      bEnable = FALSE;
-   DSIThread_MutexUnlock(&stInputMutex);
-   DSIThread_Sleep(MUTEX_UNLOCK_DELAY*4);  //wait for any remaining threads to unlock mutex
-
-   //Destroy input mutex
-   DSIThread_MutexDestroy(&stInputMutex);
-
-   //Destroy flush mutex/cond
-   DSIThread_MutexDestroy(&stFlushMutex);
-   DSIThread_CondDestroy(&stFlushCond);
+      FormatRecord(pstRecord, (const UCHAR*)(pstRecord + 1));
+      ulTail += (sizeof(RECORD) + pstRecord->usSize + RING_ALIGN - 1) & ~(RING_ALIGN - 1);
+   }
 
-   //Flush the buffer to make sure it is completely empty.
-   Flush();
+   pstRing_->ulTail.store(ulTail, std::memory_order_release);
 
-   //Destroy filename mutex
-   DSIThread_MutexDestroy(&stFilenameMutex);
+   //Or after the last one, if the ring filled up behind it
+   WriteDropped(pstRing_, pclLastFile, pstRing_->ulDropped.load(std::memory_order_relaxed));
+   return TRUE;
 }
 
-void Buffer::SetEnable(BOOL bEnable_)
+static void WriteDropped(LOG_RING* pstRing_, LogFile* pclFile_, ULONG ulDropped_)
 {
-   //Variable doesn't change
-   if(bEnable == bEnable_)
-      return;
-
-   //Enabling buffer
-   if(!bEnable)
-   {
-      bEnable = TRUE;
+   if((LONG)(ulDropped_ - pstRing_->ulDroppedReported) <= 0)
       return;
-   }
 
-   //Disabling buffer
-   if(bEnable)
+   if(pclFile_)
    {
-      //Set the enable variable
-      bEnable = FALSE;
-
-      //Force a flush
-      SignalFlush();
+      char acString[80];
+      SNPRINTF(acString, sizeof(acString), DROPPED_ERROR, (unsigned long)(ulDropped_ - pstRing_->ulDroppedReported));
+      pclFile_->Write(acString, (ULONG)strlen(acString));
    }
+   pstRing_->ulDroppedReported = ulDropped_;
 }
 
-BOOL Buffer::SetDirectory(const UCHAR* pucDirectory_)
+static LogFile* GetRecordFile(const RECORD* pstRecord_)
 {
-   if(pucDirectory_ == NULL)
-      return FALSE;
+   if(pstRecord_->ucKind == RECORD_SERIAL)
+      return apclSerialBuffer[pstRecord_->ucIndex];
 
-   //Check if the buffer is enabled
-   if(!bEnable)
-      return FALSE;
+   if(pstRecord_->ucIndex < MAX_THREADS && apstThread[pstRecord_->ucIndex] != NULL)
+      return apstThread[pstRecord_->ucIndex]->pclBuffer;
 
-   SignalFlush();
-   DSIThread_Sleep(MUTEX_UNLOCK_DELAY);  //wait for flush to finish
-
-   DSIThread_MutexLock(&stFilenameMutex);
-   SNPRINTF((char*)aucFullPath, MAX_NAME_LENGTH, "%s%s", pucDirectory_, aucFilename);
-   DSIThread_MutexUnlock(&stFilenameMutex);
-   return TRUE;
+   return (LogFile*)NULL;
 }
 
-//Called by program threads
-//Note: Thread could be in this function when class is destroyed and code is deallocated.
-BOOL Buffer::Add(UCHAR* pucString_, ULONG ulSize_)
+//Writes a record out in the format the debug files always had
+static void FormatRecord(const RECORD* pstRecord_, const UCHAR* pucPayload_)
 {
-   if(pucString_ == NULL || ulSize_ > BUFFER_SIZE)
-      return FALSE;
-
-   //Check if the buffer is enabled
-   if(!bEnable)
-      return FALSE;
+   LogFile* pclFile = GetRecordFile(pstRecord_);
+   if(pclFile == NULL)
+      return;
 
-   DSIThread_MutexLock(&stInputMutex);
+   char acString[DSI_DEBUG_MAX_STRLEN];
+   ULONG ulStringLength;
+   double dElapsed = (pstRecord_->ulTime - pstRecord_->ulStartTime)/1000.0;
 
-   //Check if the buffer is enabled
-   if(!bEnable)
+   if(pstRecord_->ucKind == RECORD_THREAD)
    {
-      DSIThread_MutexUnlock(&stInputMutex);
-      return FALSE;
-   }
+      if(pstRecord_->usSize == sizeof(NEW_SESSION_MESG)-1 && memcmp(pucPayload_, NEW_SESSION_MESG, pstRecord_->usSize) == 0)
+      {
+         pclFile->Write(NEW_SESSION_MESG, sizeof(NEW_SESSION_MESG)-1);
+         return;
+      }
 
-   //Check if buffer has enough room for the message
-   if(GetBufferCount() + ulSize_ > BUFFER_SIZE)  //Note: possible railing if GetBufferCount()+ulSize_ > MAX_ULONG
+      SNPRINTF(acString, DSI_DEBUG_MAX_STRLEN, "%10.3f {%10lu}: %.*s\n", dElapsed, (unsigned long)pstRecord_->ulTime, (int)pstRecord_->usSize, (const char*)pucPayload_);
+      ulStringLength = (ULONG)strlen(acString);
+   }
+   else
    {
+      const char* pcHeader = (const char*)pucPayload_;
+      const UCHAR* pucData = pucPayload_ + pstRecord_->ucHeaderLength;
+      USHORT usSize = (USHORT)(pstRecord_->usSize - pstRecord_->ucHeaderLength);
 
-      if(!bBufferOverflow)
+      if(usSize == 0 && pstRecord_->ucHeaderLength == sizeof(NEW_SESSION_MESG)-1 && memcmp(pcHeader, NEW_SESSION_MESG, pstRecord_->ucHeaderLength) == 0)
       {
-         //Set up error message
-         UCHAR aucErrorMesg[OVERFLOW_ERROR_LENGTH+1];
-         STRNCPY((char*)aucErrorMesg, OVERFLOW_ERROR, OVERFLOW_ERROR_LENGTH+1);
+         pclFile->Write(NEW_SESSION_MESG, sizeof(NEW_SESSION_MESG)-1);
+         return;
+      }
 
-         //Add the error message to the buffer
-         ULONG ulNewInput = ulInput;
-         for(ULONG i=0; i<OVERFLOW_ERROR_LENGTH; i++)
+      SNPRINTF(acString, DSI_DEBUG_MAX_STRLEN, "%10.3f {%10lu} %.*s - %s", dElapsed, (unsigned long)pstRecord_->ulTime, (int)pstRecord_->ucHeaderLength, pcHeader, usSize == 0 ? "NO DATA\n" : "");
+      ulStringLength = (ULONG)strlen(acString);
+
+      if(usSize != 0 && ulStringLength < (DSI_DEBUG_MAX_STRLEN - 6))   //6 is room to display at least one byte
+      {
+         //Write all the bytes we can and put '\n' on the last one
+         static const char acHex[] = "0123456789ABCDEF";
+         char* currentPos = acString + ulStringLength;
+         USHORT usMaxDataCount = (USHORT)MIN(usSize, (DSI_DEBUG_MAX_STRLEN-2-ulStringLength)/4); //2 is room for the closing "\n\0"
+         for(USHORT i=0; i < usMaxDataCount; ++i)
          {
-            aucData[ulNewInput] = aucErrorMesg[i];
-            ulNewInput++;
-            ulNewInput %= ACTUAL_BUFFER_SIZE;
+            *currentPos++ = '[';
+            *currentPos++ = acHex[pucData[i] >> 4];
+            *currentPos++ = acHex[pucData[i] & 0x0F];
+            *currentPos++ = ']';
          }
+         *currentPos++ = '\n';
+         *currentPos = '\0';
 
-         //Update the input pointer
-         ulInput = ulNewInput;
-
-         bBufferOverflow = TRUE;
+         //Update our string length
+         ulStringLength += ((ULONG)usMaxDataCount*4) + 1; //4*bytes + '\n'
       }
+   }
 
-      //Signal WriteThread to flush
-      SignalFlush();
+   //If we are too long, than overwrite the truncate error to the end
+   if(ulStringLength >= DSI_DEBUG_MAX_STRLEN-1)
+      SNPRINTF(acString + DSI_DEBUG_MAX_STRLEN - 2 - strlen(TRUNCATE_ERROR), strlen(TRUNCATE_ERROR)+2, "%s\n", TRUNCATE_ERROR);
 
-      DSIThread_MutexUnlock(&stInputMutex);
-      return FALSE;
-   }
+   pclFile->Write(acString, ulStringLength);
+}
+
+
+//////////////////
+// Write Thread //
+//////////////////
 
-   //We don't have a buffer error anymore
-   bBufferOverflow = FALSE;
+//Drains every ring each WRITE_PERIOD, then flushes the files it wrote to
+//in one go, so a slow card only ever holds up this thread.
+static void WriteThread()
+{
+   BOOL bExit = FALSE;
 
-   //Add the message to the buffer
-   ULONG ulNewInput = ulInput;
-   for(ULONG i=0; i<ulSize_; i++)
+   DSIThread_MutexLock(&stWriteThreadMutex);
+   while(!bExit)
    {
-      aucData[ulNewInput] = pucString_[i];
-      ulNewInput++;
-      ulNewInput %= ACTUAL_BUFFER_SIZE;
-   }
+      if(!bWriteThreadExit)
+         DSIThread_CondTimedWait(&stWriteThreadCond, &stWriteThreadMutex, WRITE_PERIOD);
+      bExit = bWriteThreadExit;  //One more pass to write out what is left
 
-   //Update the input pointer
-   ulInput = ulNewInput;
+      for(UCHAR i=0; i<MAX_RINGS; i++)
+      {
+         if(apstRings[i] != NULL)
+            DrainRing(apstRings[i]);
+      }
 
-   //Send a flush signal if the buffer is getting full
-   if(GetPercentFull() >= FLUSH_PERCENT)
-      SignalFlush();
+      for(UCHAR i=0; i<MAX_PORTS; i++)
+      {
+         if(apclSerialBuffer[i] != NULL)
+            apclSerialBuffer[i]->Flush();
+      }
+      for(UCHAR i=0; i<MAX_THREADS; i++)
+      {
+         if(apstThread[i] != NULL)
+            apstThread[i]->pclBuffer->Flush();
+      }
+   }
 
-   DSIThread_MutexUnlock(&stInputMutex);
+   //Exit thread
+   DSIThread_CondSignal(&stWriteThreadExitCond);
+   DSIThread_MutexUnlock(&stWriteThreadMutex);
 
-   return TRUE;
+   return;
 }
 
 
-//////////////////////////////////////////////////////////
-// Private Definitions
-//////////////////////////////////////////////////////////
-
-//Called by WriteThread
-BOOL Buffer::Flush()
+static DSI_THREAD_RETURN StartWriteThread(void* /*pvParam_*/)
 {
-   bForceFlush = FALSE;
+   WriteThread();
+   return 0;
+}
 
-   //Get size of array we are going to write
-   ULONG ulFixedCount = GetBufferCount();
 
-   if (ulFixedCount == 0)
-      return TRUE;
 
-   //Open the file
-   DSIThread_MutexLock(&stFilenameMutex);
-   FILE* pfFile = FOPEN((char*)aucFullPath, "a");
-   DSIThread_MutexUnlock(&stFilenameMutex);
-   if(pfFile == NULL)
-      return FALSE;
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+////////                   Log File Class                         ////////
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
 
+//////////////////////////////////////////////////////////
+// Public Definitions
+//////////////////////////////////////////////////////////
 
-   //Write data to file
-   if(ulFixedCount + ulOutput <= ACTUAL_BUFFER_SIZE)
-   {
-      //We don't go off the edge of the array, so we can write it all at once
-      if(fwrite(&aucData[ulOutput], sizeof(UCHAR), ulFixedCount, pfFile) != ulFixedCount)
-         fwrite(WRITE_ERROR, sizeof(UCHAR), strlen(WRITE_ERROR), pfFile);
+LogFile::LogFile(UCHAR* pucFilename_, UCHAR* pucDirectory_)
+{
+   pfFile = (FILE*)NULL;
+   bDirty = FALSE;
 
-   }
-   else
+   if(pucFilename_ == NULL || pucDirectory_ == NULL)
    {
-      //Write to end of array
-      if(fwrite(&aucData[ulOutput], sizeof(UCHAR), ACTUAL_BUFFER_SIZE-ulOutput, pfFile) != ACTUAL_BUFFER_SIZE-ulOutput)
-         fwrite(WRITE_ERROR, sizeof(UCHAR), strlen(WRITE_ERROR), pfFile);
-
-      ULONG ulLeft = ulFixedCount - (ACTUAL_BUFFER_SIZE-ulOutput);
-
-      //Write from beginning of array
-      if(fwrite(&aucData[0], sizeof(UCHAR), ulLeft, pfFile) != ulLeft)
-         fwrite(WRITE_ERROR, sizeof(UCHAR), strlen(WRITE_ERROR), pfFile);
+      bEnable = FALSE;
+      return;
    }
 
-   //Close file
-   fclose(pfFile);
-
-   //Update the output pointer
-   ULONG ulNewOutput = (ulOutput + ulFixedCount)%ACTUAL_BUFFER_SIZE;
-   ulOutput = ulNewOutput;
+   STRNCPY((char*)aucFilename, (char*)pucFilename_, MAX_NAME_LENGTH);
+   SNPRINTF((char*)aucFullPath, MAX_NAME_LENGTH, "%s%s", pucDirectory_, aucFilename);
 
-   return TRUE;
+   bEnable = TRUE;
 }
 
-ULONG Buffer::GetBufferCount()
+LogFile::~LogFile()
 {
-   //Lock values of input and output pointers
-   ULONG ulFixedInput = ulInput;
-   ULONG ulFixedOutput = ulOutput;
+   bEnable = FALSE;
 
-   ULONG ulFixedCount;
-   if(ulFixedInput >= ulFixedOutput)
-      ulFixedCount = ulFixedInput - ulFixedOutput;
-   else
-      ulFixedCount = ACTUAL_BUFFER_SIZE - (ulFixedOutput - ulFixedInput);
-
-   return ulFixedCount;
+   if(pfFile)
+      fclose(pfFile);
+   pfFile = (FILE*)NULL;
 }
 
-UCHAR Buffer::GetPercentFull()
+void LogFile::SetEnable(BOOL bEnable_)
 {
-   return (UCHAR)((double)GetBufferCount()/BUFFER_SIZE * 100);
+   bEnable = bEnable_;
 }
 
-void Buffer::SignalFlush()
+BOOL LogFile::IsEnabled()
 {
-   DSIThread_MutexLock(&stFlushMutex);
-      bForceFlush = TRUE;
-      DSIThread_CondSignal(&stFlushCond);
-   DSIThread_MutexUnlock(&stFlushMutex);
+   return bEnable;
 }
 
-//////////////////
-// Write Thread //
-//////////////////
-
-void Buffer::WriteThread()
+//Called with the writer thread lock held
+BOOL LogFile::SetDirectory(const UCHAR* pucDirectory_)
 {
+   if(pucDirectory_ == NULL)
+      return FALSE;
 
-   while(!bWriteThreadExit)
-   {
-      if(bEnable || bForceFlush)
-         this->Flush();
+   //Check if the file is enabled
+   if(!bEnable)
+      return FALSE;
 
-      DSIThread_MutexLock(&stFlushMutex);
-      if(!bForceFlush && !bWriteThreadExit)
-         DSIThread_CondTimedWait(&stFlushCond, &stFlushMutex, FLUSH_CHECK_PERIOD);
-      DSIThread_MutexUnlock(&stFlushMutex);
-   }
+   if(pfFile)
+      fclose(pfFile);
+   pfFile = (FILE*)NULL;
+   bDirty = FALSE;
+
+   SNPRINTF((char*)aucFullPath, MAX_NAME_LENGTH, "%s%s", pucDirectory_, aucFilename);
+   return TRUE;
+}
 
+//Called by the writer thread.  The file stays open between writes.
+BOOL LogFile::Write(const char* pcString_, ULONG ulSize_)
+{
+   if(pfFile == NULL)
+   {
+      pfFile = FOPEN((char*)aucFullPath, "a");
+      if(pfFile == NULL)
+         return FALSE;
+   }
 
-   //Exit thread
-   DSIThread_MutexLock(&stWriteThreadMutex);
-      DSIThread_CondSignal(&stWriteThreadCond);
-      bWriteThreadExit = TRUE;
-   DSIThread_MutexUnlock(&stWriteThreadMutex);
+   if(fwrite(pcString_, sizeof(char), ulSize_, pfFile) != ulSize_)
+      fwrite(WRITE_ERROR, sizeof(UCHAR), strlen(WRITE_ERROR), pfFile);
 
-   return;
+   bDirty = TRUE;
+   return TRUE;
 }
 
-
-DSI_THREAD_RETURN Buffer::StartWriteThread(void* pvParam_)
+//Called by the writer thread after each pass
+void LogFile::Flush()
 {
-   if(pvParam_ == NULL)
-      return 0;
-
-   Buffer* pclBuffer = (Buffer*)pvParam_;
-   pclBuffer->WriteThread();
-   return 0;
+   if(pfFile && bDirty)
+      fflush(pfFile);
+   bDirty = FALSE;
 }
 
 